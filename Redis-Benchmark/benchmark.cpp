@@ -0,0 +1,536 @@
+#include "histogram.h"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+/*
+redis-lite-benchmark: a load generator for redis-lite, after redis-benchmark.
+
+    ./redis-lite-benchmark [-h host] [-p port] [-c clients] [--threads n] [-n requests]
+                           [-P pipeline] [-r keyspace] [-d bytes] [-t set,get,...]
+                           [--mix get=80,set=20] [-q] [--csv | --json]
+
+The -c connections are opened once and shared out between the threads; each thread
+drives its connections from one epoll loop. A connection sends -P commands in one
+write, waits for their replies and sends the next batch, until the -n requests of the
+test are used up. The latency of a command runs from the write of its batch to the
+arrival of its reply, and goes into an HDR-style histogram (see histogram.h).
+
+Each test of -t runs on its own, one after the other. --mix runs a single test whose
+commands are drawn at random with the given weights. Keys are key:<n> (hashes
+hash:<n>) with n random below -r, or always 0 without -r; lists use one key, mylist.
+*/
+
+using Clock = std::chrono::steady_clock;
+
+static const char* ALL_TESTS[] = {"PING", "SET", "GET", "LPUSH", "RPUSH", "LPOP", "RPOP", "HSET", "HGET", "HGETALL"};
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 6379;
+    int clients = 50;
+    int threads = 1;
+    long long requests = 100000;
+    int pipeline = 1;
+    long long keyspace = 0;
+    size_t dataSize = 3;
+    std::vector<std::string> tests;
+    std::vector<std::pair<std::string, int>> mix; // command, weight
+    bool quiet = false;
+    bool csv = false;
+    bool json = false;
+};
+
+struct Connection {
+    int fd = -1;
+    std::string out;       // the batch being written...
+    size_t outPos = 0;     // ...from here on
+    bool watchingWrites = false;
+    std::string in;        // replies received, not parsed yet from inPos on
+    size_t inPos = 0;
+    int inflight = 0;      // commands of the batch still waiting for a reply
+    Clock::time_point sent;
+    std::mt19937_64 rng;
+};
+
+struct Result {
+    std::string name;
+    long long requests = 0;
+    long long errors = 0;
+    double seconds = 0;
+    bool failed = false;
+    LatencyHistogram latency;
+};
+
+static void appendArgs(std::string& out, const std::vector<std::string>& args) {
+    out += "*" + std::to_string(args.size()) + "\r\n";
+    for (const auto& arg : args) {
+        out += "$" + std::to_string(arg.size()) + "\r\n";
+        out += arg;
+        out += "\r\n";
+    }
+}
+
+static std::string randomIndex(Connection& conn, long long keyspace) {
+    char digits[24];
+    snprintf(digits, sizeof(digits), "%012lld", keyspace > 0 ? (long long)(conn.rng() % keyspace) : 0LL);
+    return digits;
+}
+
+static void appendCommand(std::string& out, const std::string& test, Connection& conn,
+                          const Options& opts, const std::string& value) {
+    if (test == "PING") {
+        appendArgs(out, {"PING"});
+        return;
+    }
+    if (test == "LPUSH" || test == "RPUSH") {
+        appendArgs(out, {test, "mylist", value});
+        return;
+    }
+    if (test == "LPOP" || test == "RPOP") {
+        appendArgs(out, {test, "mylist"});
+        return;
+    }
+    std::string index = randomIndex(conn, opts.keyspace);
+    if (test == "SET") appendArgs(out, {"SET", "key:" + index, value});
+    else if (test == "GET") appendArgs(out, {"GET", "key:" + index});
+    else if (test == "HSET") appendArgs(out, {"HSET", "hash:" + index, "field", value});
+    else if (test == "HGET") appendArgs(out, {"HGET", "hash:" + index, "field"});
+    else appendArgs(out, {"HGETALL", "hash:" + index});
+}
+
+// Bytes taken by the complete reply at p, 0 if it has not fully arrived, -1 if it is not RESP
+static long replyLength(const char* p, size_t n) {
+    if (n == 0) return 0;
+    const char* eol = (const char*)memchr(p, '\n', n);
+    if (!eol) return 0;
+    size_t line = eol - p + 1;
+    switch (p[0]) {
+    case '+': case '-': case ':': case '_':
+        return line;
+    case '$': {
+        long len = atol(p + 1);
+        if (len < 0) return line;
+        size_t total = line + len + 2;
+        return total <= n ? (long)total : 0;
+    }
+    case '*': case '>': {
+        long count = atol(p + 1);
+        size_t used = line;
+        for (long i = 0; i < count; i++) {
+            long element = replyLength(p + used, n - used);
+            if (element <= 0) return element;
+            used += element;
+        }
+        return used;
+    }
+    default:
+        return -1;
+    }
+}
+
+static int connectTo(const Options& opts) {
+    struct addrinfo hints, *res = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(opts.host.c_str(), std::to_string(opts.port).c_str(), &hints, &res) != 0) return -1;
+    int fd = -1;
+    for (auto p = res; p != nullptr; p = p->ai_next) {
+        fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (fd == -1) continue;
+        if (connect(fd, p->ai_addr, p->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) return -1;
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+// What one test sends: a single command, or commands drawn by weight
+struct Workload {
+    std::vector<std::string> commands;
+    std::vector<int> cumulative; // running sum of the weights
+    std::string value;
+
+    const std::string& pick(Connection& conn) const {
+        if (commands.size() == 1) return commands[0];
+        int r = conn.rng() % cumulative.back();
+        size_t i = std::upper_bound(cumulative.begin(), cumulative.end(), r) - cumulative.begin();
+        return commands[i];
+    }
+};
+
+class Driver {
+public:
+    Driver(const Options& opts, const Workload& work, std::atomic<long long>& remaining, Result& result)
+        : opts(opts), work(work), remaining(remaining), result(result) {}
+
+    void run(std::vector<Connection*>& conns) {
+        epfd = epoll_create1(0);
+        for (auto conn : conns) {
+            struct epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.ptr = conn;
+            conn->watchingWrites = false;
+            epoll_ctl(epfd, EPOLL_CTL_ADD, conn->fd, &ev);
+        }
+        int active = 0;
+        for (auto conn : conns) {
+            if (startBatch(*conn)) active++;
+        }
+        struct epoll_event events[64];
+        while (active > 0 && !result.failed) {
+            int n = epoll_wait(epfd, events, 64, 1000);
+            if (n < 0 && errno != EINTR) break;
+            for (int i = 0; i < n; i++) {
+                Connection& conn = *(Connection*)events[i].data.ptr;
+                if ((events[i].events & EPOLLOUT) && !flush(conn)) {
+                    fail("write failed");
+                    break;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    int done = receive(conn);
+                    if (done < 0) break;
+                    if (done > 0 && !startBatch(conn)) active--;
+                }
+            }
+        }
+        for (auto conn : conns) epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        close(epfd);
+    }
+
+private:
+    void fail(const std::string& why) {
+        if (!result.failed) std::cerr << "Error: " << why << "\n";
+        result.failed = true;
+    }
+
+    void watchWrites(Connection& conn, bool enable) {
+        if (conn.watchingWrites == enable) return;
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | (enable ? EPOLLOUT : 0);
+        ev.data.ptr = &conn;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, conn.fd, &ev);
+        conn.watchingWrites = enable;
+    }
+
+    bool flush(Connection& conn) {
+        while (conn.outPos < conn.out.size()) {
+            ssize_t n = send(conn.fd, conn.out.data() + conn.outPos, conn.out.size() - conn.outPos, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (n <= 0) return false;
+            conn.outPos += n;
+        }
+        watchWrites(conn, conn.outPos < conn.out.size());
+        return true;
+    }
+
+    // claims up to a pipeline's worth of the remaining requests and writes them
+    bool startBatch(Connection& conn) {
+        long long left = remaining.fetch_sub(opts.pipeline);
+        if (left <= 0) return false;
+        int batch = (int)std::min<long long>(left, opts.pipeline);
+        conn.out.clear();
+        conn.outPos = 0;
+        for (int i = 0; i < batch; i++) appendCommand(conn.out, work.pick(conn), conn, opts, work.value);
+        conn.inflight = batch;
+        conn.sent = Clock::now();
+        if (!flush(conn)) {
+            fail("write failed");
+            return false;
+        }
+        return true;
+    }
+
+    // 1 when the batch is complete, 0 when replies are still due, -1 on failure
+    int receive(Connection& conn) {
+        char chunk[64 * 1024];
+        while (true) {
+            ssize_t n = recv(conn.fd, chunk, sizeof(chunk), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (n <= 0) {
+                fail("connection closed by the server");
+                return -1;
+            }
+            conn.in.append(chunk, n);
+        }
+        uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - conn.sent).count();
+        while (conn.inflight > 0) {
+            long len = replyLength(conn.in.data() + conn.inPos, conn.in.size() - conn.inPos);
+            if (len < 0) {
+                fail("unexpected reply from the server");
+                return -1;
+            }
+            if (len == 0) break;
+            if (conn.in[conn.inPos] == '-') {
+                if (result.errors++ == 0) {
+                    std::cerr << "First error reply: " << conn.in.substr(conn.inPos, len - 2) << "\n";
+                }
+            }
+            conn.inPos += len;
+            conn.inflight--;
+            result.requests++;
+            result.latency.record(latency);
+        }
+        if (conn.inPos == conn.in.size()) {
+            conn.in.clear();
+            conn.inPos = 0;
+        }
+        return conn.inflight == 0 ? 1 : 0;
+    }
+
+    const Options& opts;
+    const Workload& work;
+    std::atomic<long long>& remaining;
+    Result& result;
+    int epfd = -1;
+};
+
+static Result runTest(const std::string& name, const Workload& work, std::vector<Connection>& conns, const Options& opts) {
+    int threads = std::max(1, std::min(opts.threads, (int)conns.size()));
+    std::vector<std::vector<Connection*>> shares(threads);
+    for (size_t i = 0; i < conns.size(); i++) shares[i % threads].push_back(&conns[i]);
+
+    std::atomic<long long> remaining(opts.requests);
+    std::vector<Result> partial(threads);
+    std::vector<std::thread> workers;
+    Clock::time_point start = Clock::now();
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            Driver driver(opts, work, remaining, partial[t]);
+            driver.run(shares[t]);
+        });
+    }
+    for (auto& worker : workers) worker.join();
+
+    Result result;
+    result.name = name;
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    for (auto& part : partial) {
+        result.requests += part.requests;
+        result.errors += part.errors;
+        result.failed = result.failed || part.failed;
+        result.latency.merge(part.latency);
+    }
+    return result;
+}
+
+static double ms(uint64_t ns) { return ns / 1e6; }
+
+static void printResult(const Result& r, const Options& opts) {
+    double rps = r.seconds > 0 ? r.requests / r.seconds : 0;
+    const LatencyHistogram& h = r.latency;
+    std::cout << std::fixed << std::setprecision(3);
+    if (opts.quiet) {
+        std::cout << r.name << ": " << std::setprecision(2) << rps << " requests per second, p50="
+                  << std::setprecision(3) << ms(h.percentile(50)) << " msec\n";
+        return;
+    }
+    std::cout << "====== " << r.name << " ======\n"
+              << "  " << r.requests << " requests completed in " << std::setprecision(2) << r.seconds << " seconds\n"
+              << "  " << opts.clients << " parallel clients, " << opts.dataSize << " bytes payload, pipeline "
+              << opts.pipeline << ", " << opts.threads << " threads, keyspace " << opts.keyspace << "\n";
+    if (r.errors) std::cout << "  " << r.errors << " error replies\n";
+    std::cout << "\n  throughput summary: " << rps << " requests per second\n"
+              << "  latency summary (msec):\n"
+              << std::setprecision(3)
+              << "          avg       min       p50       p99     p99.9       max\n"
+              << "    " << std::setw(9) << h.mean() / 1e6 << " " << std::setw(9) << ms(h.min())
+              << " " << std::setw(9) << ms(h.percentile(50)) << " " << std::setw(9) << ms(h.percentile(99))
+              << " " << std::setw(9) << ms(h.percentile(99.9)) << " " << std::setw(9) << ms(h.max()) << "\n\n";
+}
+
+static void printCsv(const std::vector<Result>& results) {
+    std::cout << "\"test\",\"rps\",\"avg_latency_ms\",\"min_latency_ms\",\"p50_latency_ms\",\"p99_latency_ms\","
+                 "\"p99_9_latency_ms\",\"max_latency_ms\",\"errors\"\n";
+    std::cout << std::fixed << std::setprecision(3);
+    for (const auto& r : results) {
+        const LatencyHistogram& h = r.latency;
+        std::cout << "\"" << r.name << "\",\"" << std::setprecision(2) << (r.seconds > 0 ? r.requests / r.seconds : 0)
+                  << std::setprecision(3) << "\",\"" << h.mean() / 1e6 << "\",\"" << ms(h.min()) << "\",\""
+                  << ms(h.percentile(50)) << "\",\"" << ms(h.percentile(99)) << "\",\"" << ms(h.percentile(99.9))
+                  << "\",\"" << ms(h.max()) << "\",\"" << r.errors << "\"\n";
+    }
+}
+
+static void printJson(const std::vector<Result>& results, const Options& opts) {
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "{\"clients\": " << opts.clients << ", \"threads\": " << opts.threads << ", \"pipeline\": "
+              << opts.pipeline << ", \"data_size\": " << opts.dataSize << ", \"keyspace\": " << opts.keyspace
+              << ", \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        const LatencyHistogram& h = r.latency;
+        std::cout << (i ? ",\n  " : "\n  ") << "{\"test\": \"" << r.name << "\", \"requests\": " << r.requests
+                  << ", \"errors\": " << r.errors << ", \"seconds\": " << r.seconds
+                  << ", \"rps\": " << (r.seconds > 0 ? r.requests / r.seconds : 0)
+                  << ", \"latency_ms\": {\"avg\": " << h.mean() / 1e6 << ", \"min\": " << ms(h.min())
+                  << ", \"p50\": " << ms(h.percentile(50)) << ", \"p99\": " << ms(h.percentile(99))
+                  << ", \"p99_9\": " << ms(h.percentile(99.9)) << ", \"max\": " << ms(h.max()) << "}}";
+    }
+    std::cout << "\n]}\n";
+}
+
+static void usage() {
+    std::cerr << "Usage: redis-lite-benchmark [options]\n"
+              << "  -h <host>          server host (127.0.0.1)\n"
+              << "  -p <port>          server port (6379)\n"
+              << "  -c <clients>       parallel connections (50)\n"
+              << "  --threads <n>      threads driving the connections (1)\n"
+              << "  -n <requests>      requests per test (100000)\n"
+              << "  -P <pipeline>      commands per write (1, no pipelining)\n"
+              << "  -r <keyspace>      random keys key:0..keyspace-1 (0: one key)\n"
+              << "  -d <bytes>         value size of SET, LPUSH, RPUSH, HSET (3)\n"
+              << "  -t <tests>         comma separated, of: ping,set,get,lpush,rpush,lpop,rpop,hset,hget,hgetall\n"
+              << "  --mix <spec>       one test mixing commands by weight, e.g. get=80,set=20\n"
+              << "  -q                 one line per test\n"
+              << "  --csv              CSV output\n"
+              << "  --json             JSON output\n";
+}
+
+static std::string upper(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), ::toupper);
+    return s;
+}
+
+static bool knownTest(const std::string& name) {
+    for (const char* test : ALL_TESTS) {
+        if (name == test) return true;
+    }
+    return false;
+}
+
+static std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) items.push_back(upper(item));
+    }
+    return items;
+}
+
+static bool parseArgs(int argc, char* argv[], Options& opts) {
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "-q") opts.quiet = true;
+            else if (arg == "--csv") opts.csv = true;
+            else if (arg == "--json") opts.json = true;
+            else if (!hasValue) return false;
+            else if (arg == "-h") opts.host = argv[++i];
+            else if (arg == "-p") opts.port = std::stoi(argv[++i]);
+            else if (arg == "-c") opts.clients = std::stoi(argv[++i]);
+            else if (arg == "--threads") opts.threads = std::stoi(argv[++i]);
+            else if (arg == "-n") opts.requests = std::stoll(argv[++i]);
+            else if (arg == "-P") opts.pipeline = std::stoi(argv[++i]);
+            else if (arg == "-r") opts.keyspace = std::stoll(argv[++i]);
+            else if (arg == "-d") opts.dataSize = std::stoul(argv[++i]);
+            else if (arg == "-t") opts.tests = splitList(argv[++i]);
+            else if (arg == "--mix") {
+                for (const auto& item : splitList(argv[++i])) {
+                    size_t eq = item.find('=');
+                    if (eq == std::string::npos) return false;
+                    int weight = std::stoi(item.substr(eq + 1));
+                    if (weight <= 0) return false;
+                    opts.mix.push_back({item.substr(0, eq), weight});
+                }
+            }
+            else return false;
+        }
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+    if (opts.clients < 1 || opts.threads < 1 || opts.pipeline < 1 || opts.requests < 1 || opts.keyspace < 0)
+        return false;
+    for (const auto& test : opts.tests) {
+        if (!knownTest(test)) return false;
+    }
+    for (const auto& entry : opts.mix) {
+        if (!knownTest(entry.first)) return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parseArgs(argc, argv, opts)) {
+        usage();
+        return 1;
+    }
+    if (opts.tests.empty() && opts.mix.empty()) opts.tests.assign(std::begin(ALL_TESTS), std::end(ALL_TESTS));
+
+    std::vector<Connection> conns(opts.clients);
+    std::random_device seed;
+    for (auto& conn : conns) {
+        conn.fd = connectTo(opts);
+        if (conn.fd < 0) {
+            std::cerr << "Could not connect to " << opts.host << ":" << opts.port << "\n";
+            return 1;
+        }
+        conn.rng.seed(((uint64_t)seed() << 32) | seed());
+    }
+
+    std::vector<std::pair<std::string, Workload>> runs;
+    std::string value(opts.dataSize, 'x');
+    for (const auto& test : opts.tests) {
+        Workload work;
+        work.commands.push_back(test);
+        work.cumulative.push_back(1);
+        work.value = value;
+        runs.push_back({test, work});
+    }
+    if (!opts.mix.empty()) {
+        Workload work;
+        std::string name = "MIX";
+        int sum = 0;
+        for (const auto& entry : opts.mix) {
+            work.commands.push_back(entry.first);
+            work.cumulative.push_back(sum += entry.second);
+            name += (work.commands.size() == 1 ? " " : ",") + entry.first + "=" + std::to_string(entry.second);
+        }
+        work.value = value;
+        runs.push_back({name, work});
+    }
+
+    std::vector<Result> results;
+    bool failed = false;
+    for (const auto& run : runs) {
+        Result result = runTest(run.first, run.second, conns, opts);
+        if (!opts.csv && !opts.json) printResult(result, opts);
+        failed = failed || result.failed;
+        results.push_back(std::move(result));
+        if (failed) break;
+    }
+    if (opts.csv) printCsv(results);
+    else if (opts.json) printJson(results, opts);
+
+    for (auto& conn : conns) close(conn.fd);
+    return failed ? 1 : 0;
+}
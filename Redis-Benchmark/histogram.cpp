@@ -0,0 +1,49 @@
+#include "histogram.h"
+#include <algorithm>
+
+LatencyHistogram::LatencyHistogram()
+    : counts(BUCKETS, 0), total(0), sum(0), minValue(UINT64_MAX), maxValue(0) {}
+
+size_t LatencyHistogram::bucketOf(uint64_t value) {
+    if (value < LINEAR) return value;
+    int top = 63 - __builtin_clzll(value);     // >= SUB_BUCKET_BITS + 1
+    int shift = top - SUB_BUCKET_BITS;         // keeps the top SUB_BUCKET_BITS + 1 bits
+    uint64_t sub = value >> shift;             // 64..127
+    return LINEAR + (shift - 1) * (size_t(1) << SUB_BUCKET_BITS) + (sub - (uint64_t(1) << SUB_BUCKET_BITS));
+}
+
+uint64_t LatencyHistogram::highestIn(size_t bucket) {
+    if (bucket < LINEAR) return bucket;
+    size_t offset = bucket - LINEAR;
+    int shift = offset / (size_t(1) << SUB_BUCKET_BITS) + 1;
+    uint64_t sub = offset % (size_t(1) << SUB_BUCKET_BITS) + (uint64_t(1) << SUB_BUCKET_BITS);
+    return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value) {
+    counts[bucketOf(value)]++;
+    total++;
+    sum += value;
+    minValue = std::min(minValue, value);
+    maxValue = std::max(maxValue, value);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < counts.size(); i++) counts[i] += other.counts[i];
+    total += other.total;
+    sum += other.sum;
+    minValue = std::min(minValue, other.minValue);
+    maxValue = std::max(maxValue, other.maxValue);
+}
+
+uint64_t LatencyHistogram::percentile(double percentile) const {
+    if (!total) return 0;
+    uint64_t wanted = (uint64_t)(percentile / 100.0 * total + 0.5);
+    wanted = std::max<uint64_t>(1, std::min(wanted, total));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+        seen += counts[i];
+        if (seen >= wanted) return std::min(highestIn(i), maxValue);
+    }
+    return maxValue;
+}
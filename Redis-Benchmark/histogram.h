@@ -0,0 +1,47 @@
+#ifndef REDIS_BENCHMARK_HISTOGRAM_H
+#define REDIS_BENCHMARK_HISTOGRAM_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/*
+Latency histogram in the style of HdrHistogram: values below 128 get a bucket each, above
+that every power of two is split into 64 buckets, so any value is known to within 1/64
+(1.6%) while the whole range of uint64 fits in a few thousand counters. Recording is a
+couple of shifts and an increment; percentiles walk the buckets once.
+
+Values are nanoseconds here, but the histogram does not care about the unit.
+*/
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    void record(uint64_t value);
+    void merge(const LatencyHistogram& other);
+
+    uint64_t count() const { return total; }
+    uint64_t min() const { return total ? minValue : 0; }
+    uint64_t max() const { return maxValue; }
+    double mean() const { return total ? (double)sum / total : 0; }
+    // the smallest value that at least percentile% of the recorded values do not exceed
+    // (the top of its bucket, so never below the exact answer)
+    uint64_t percentile(double percentile) const;
+
+private:
+    static constexpr int SUB_BUCKET_BITS = 6; // 64 buckets per power of two
+    // below 2^(SUB_BUCKET_BITS+1) every value is its own bucket; each power of two above
+    // that adds 2^SUB_BUCKET_BITS buckets, for the 64 - SUB_BUCKET_BITS - 1 of them in uint64
+    static constexpr size_t LINEAR = size_t(1) << (SUB_BUCKET_BITS + 1);
+    static constexpr size_t BUCKETS = LINEAR + (64 - SUB_BUCKET_BITS - 1) * (size_t(1) << SUB_BUCKET_BITS);
+    static size_t bucketOf(uint64_t value);
+    static uint64_t highestIn(size_t bucket);
+
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t sum;
+    uint64_t minValue;
+    uint64_t maxValue;
+};
+
+#endif
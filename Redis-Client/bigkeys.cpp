@@ -0,0 +1,107 @@
+#include "my_redis_cli.h"
+#include <iomanip>
+
+/*
+Keyspace scan (--bigkeys, --memkeys), after redis-cli:
+
+    ./redis-cli --bigkeys      # STRLEN / LLEN / HLEN of every key
+    ./redis-cli --memkeys      # MEMORY USAGE of every key
+
+SCAN walks the keyspace 100 keys at a time, so the server is never blocked for long. For
+each batch the TYPE of every key and then its size are asked for in one pipelined write
+each. The biggest key of each type is printed whenever it changes, then the totals.
+*/
+
+struct KeyTypeStats {
+    const char *name;
+    const char *plural;
+    const char *sizeCommand;   // --bigkeys
+    const char *unit;
+    long long keys = 0;
+    long long total = 0;
+    long long biggest = -1;
+    string biggestKey;
+};
+
+int Client::runKeyScan(int sockfd, bool memory) {
+    KeyTypeStats types[] = {{"string", "strings", "STRLEN", "bytes"}, {"list", "lists", "LLEN", "items"},
+                             {"hash", "hashes", "HLEN", "fields"}};
+    cout << "\n# Scanning the entire keyspace to find biggest keys as well as\n"
+         << "# average sizes per key type.\n\n";
+
+    string cursor = "0";
+    long long sampled = 0, keyBytes = 0;
+    char type;
+    do {
+        vector<string> scanned;
+        string request = buildRESPCommand({"SCAN", cursor, "COUNT", "100"});
+        if (!Utils::sendAll(sockfd, request.data(), request.size()) || !readValues(sockfd, type, scanned)) return 1;
+        if (type == '-') {
+            cerr << "(Error) " << scanned[0] << "\n";
+            return 1;
+        }
+        cursor = scanned[0];
+        vector<string> keys(scanned.begin() + 1, scanned.end());
+
+        request.clear();
+        for (const auto &key : keys) request += buildRESPCommand({"TYPE", key});
+        if (!Utils::sendAll(sockfd, request.data(), request.size())) return 1;
+        vector<KeyTypeStats *> keyTypes;
+        for (size_t i = 0; i < keys.size(); i++) {
+            string value;
+            if (!readReply(sockfd, false, type, value)) return 1;
+            KeyTypeStats *found = nullptr;
+            for (auto &t : types) {
+                if (value == t.name) found = &t;
+            }
+            keyTypes.push_back(found); // null: gone since the SCAN
+        }
+
+        request.clear();
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (!keyTypes[i]) continue;
+            if (memory) request += buildRESPCommand({"MEMORY", "USAGE", keys[i]});
+            else request += buildRESPCommand({keyTypes[i]->sizeCommand, keys[i]});
+        }
+        if (!Utils::sendAll(sockfd, request.data(), request.size())) return 1;
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (!keyTypes[i]) continue;
+            string value;
+            if (!readReply(sockfd, false, type, value)) return 1;
+            if (type == '-') {
+                cerr << "(Error) " << value << "\n";
+                return 1;
+            }
+            if (type != ':') continue;
+            long long size = stoll(value);
+            KeyTypeStats &t = *keyTypes[i];
+            t.keys++;
+            t.total += size;
+            sampled++;
+            keyBytes += keys[i].size();
+            if (size > t.biggest) {
+                t.biggest = size;
+                t.biggestKey = keys[i];
+                cout << "Biggest " << setw(6) << t.name << " found so far '\"" << keys[i] << "\"' with " << size
+                     << " " << (memory ? "bytes" : t.unit) << "\n";
+            }
+        }
+    } while (cursor != "0");
+
+    cout << "\n-------- summary -------\n\n"
+         << "Sampled " << sampled << " keys in the keyspace!\n"
+         << "Total key length in bytes is " << keyBytes << " (avg len " << fixed << setprecision(2)
+         << (sampled ? double(keyBytes) / sampled : 0.0) << ")\n\n";
+    for (const auto &t : types) {
+        if (t.keys)
+            cout << "Biggest " << setw(6) << t.name << " found '\"" << t.biggestKey << "\"' has " << t.biggest << " "
+                 << (memory ? "bytes" : t.unit) << "\n";
+    }
+    cout << "\n";
+    for (const auto &t : types) {
+        cout << t.keys << " " << t.plural << " with " << t.total << " " << (memory ? "bytes" : t.unit) << " ("
+             << (sampled ? 100.0 * t.keys / sampled : 0.0) << "% of keys, avg size "
+             << (t.keys ? double(t.total) / t.keys : 0.0) << ")\n";
+    }
+    return 0;
+}
@@ -11,6 +11,8 @@
        Sends commands formatted in RESP
        Parses responses according to RESP
    4) Minimal error handling and forward-thinking design
+   5) --pipe mass insertion: commands from stdin, streamed (see pipe.cpp)
+   6) --bigkeys / --memkeys: the biggest key of each type, found with SCAN (see bigkeys.cpp)
 */
 
 /*
@@ -20,8 +22,11 @@ int main(int argc, char *argv[]) {
     // Defaults
     std::string host = "127.0.0.1";
     int port = 6379;
+    bool pipeMode = false;
+    int pipeTimeout = 30;
+    bool bigKeys = false, memKeys = false;
 
-    // Check for -h host and -p port
+    // Check for -h host, -p port, --pipe, --pipe-timeout seconds (0: wait forever), --bigkeys and --memkeys
     int i = 1;
     while (i < argc) {
         std::string arg = argv[i];
@@ -29,6 +34,14 @@ int main(int argc, char *argv[]) {
             host = argv[++i];
         } else if (arg == "-p" && i + 1 < argc) {
             port = std::stoi(argv[++i]);
+        } else if (arg == "--pipe") {
+            pipeMode = true;
+        } else if (arg == "--pipe-timeout" && i + 1 < argc) {
+            pipeTimeout = std::stoi(argv[++i]);
+        } else if (arg == "--bigkeys") {
+            bigKeys = true;
+        } else if (arg == "--memkeys") {
+            memKeys = true;
         } else {
             // A single Redis command
             break;
@@ -42,6 +55,17 @@ int main(int argc, char *argv[]) {
     int sockfd = myClient.connectToServer();
     if (sockfd < 0) { return 1; }
 
+    if (pipeMode) {
+        int status = myClient.runPipe(sockfd, pipeTimeout);
+        close(sockfd);
+        return status;
+    }
+    if (bigKeys || memKeys) {
+        int status = myClient.runKeyScan(sockfd, memKeys);
+        close(sockfd);
+        return status;
+    }
+
     // If i < argc, we have some leftover arguments => single command mode
     if (i < argc) {
         // Print prompt
@@ -109,6 +109,58 @@ For example, if args = ["SET", "ath","44"]:
 
 
 
+/*
+Buffered socket reads: one recv() takes whatever the server has sent so far (up to
+64KB), the parser then works out of inbuf. Everything before inpos is consumed.
+*/
+bool Client::fillBuffer(int sockfd) {
+    if (inpos == inbuf.size()) {
+        inbuf.clear();
+        inpos = 0;
+    }
+    else if (inpos > 64 * 1024) {
+        inbuf.erase(0, inpos);
+        inpos = 0;
+    }
+    char chunk[64 * 1024];
+    ssize_t n = recv(sockfd, chunk, sizeof(chunk), 0);
+    if (n <= 0) return false;
+    inbuf.append(chunk, n);
+    return true;
+}
+
+bool Client::readByte(int sockfd, char &c) {
+    if (inpos == inbuf.size() && !fillBuffer(sockfd)) return false;
+    c = inbuf[inpos++];
+    return true;
+}
+
+bool Client::readLine(int sockfd,    string &line) {
+    size_t searched = inpos;
+    while (true) {
+        size_t cr = inbuf.find("\r\n", searched);
+        if (cr !=    string::npos) {
+            line.assign(inbuf, inpos, cr - inpos);
+            inpos = cr + 2;
+            return true;
+        }
+        // a \r at the very end may be followed by the \n of the next chunk
+        searched = inbuf.size() > inpos ? inbuf.size() - 1 : inpos;
+        size_t offset = searched - inpos;
+        if (!fillBuffer(sockfd)) return false;
+        searched = inpos + offset;
+    }
+}
+
+bool Client::readBytes(int sockfd, size_t n,    string &out) {
+    while (inbuf.size() - inpos < n) {
+        if (!fillBuffer(sockfd)) return false;
+    }
+    out.assign(inbuf, inpos, n);
+    inpos += n;
+    return true;
+}
+
 /*
 Parse and print a Redis response from the server (RESP protocol).
 This function reads from the socket until it has parsed a complete reply.
@@ -116,153 +168,106 @@ This function reads from the socket until it has parsed a complete reply.
 Returns true if the response was parsed successfully, false otherwise.
 */
 bool Client::parseAndPrintRedisReply(int sockfd) {
-    // We read from the socket line by line (and more if needed for bulk/arrays).
-    // A robust approach might store partial data in a buffer; this is simplified.
+    char type;
+       string value;
+    return readReply(sockfd, true, type, value);
+}
 
+bool Client::readReply(int sockfd, bool print, char &type,    string &value) {
     // Read the first byte to determine the type of Redis reply.
-    char firstByte;
-    ssize_t bytesRead = recv(sockfd, &firstByte, 1, 0);
-    if (bytesRead <= 0) {
+    value.clear();
+    if (!readByte(sockfd, type)) {
            cerr << "(Error) No response or connection closed.\n";
         return false;
     }
 
-    switch (firstByte) {
-    case '+': {
-        // Simple string; read up to CRLF
-           string line;
-        // Read until we hit \r\n
-        char c;
-        while (true) {
-            ssize_t r = recv(sockfd, &c, 1, 0);
-            if (r <= 0) {
-                   cerr << "(Error) Incomplete simple string.\n";
-                return false;
-            }
-            if (c == '\r') {
-                // Next should be '\n'
-                recv(sockfd, &c, 1, 0);
-                break;
-            }
-            line.push_back(c);
-        }
-           cout << line << "\n";
-        return true;
-    }
-    case '-': {
-        // Error message
-           string line;
-        char c;
-        while (true) {
-            ssize_t r = recv(sockfd, &c, 1, 0);
-            if (r <= 0) {
-                   cerr << "(Error) Incomplete error string.\n";
-                return false;
-            }
-            if (c == '\r') {
-                recv(sockfd, &c, 1, 0);
-                break;
-            }
-            line.push_back(c);
-        }
-           cerr << "(Error) " << line << "\n";
-        return true;
-    }
+    switch (type) {
+    case '+':
+    case '-':
     case ':': {
-        // Integer
-           string line;
-        char c;
-        while (true) {
-            ssize_t r = recv(sockfd, &c, 1, 0);
-            if (r <= 0) {
-                   cerr << "(Error) Incomplete integer.\n";
-                return false;
-            }
-            if (c == '\r') {
-                recv(sockfd, &c, 1, 0);
-                break;
-            }
-            line.push_back(c);
+        // Simple string, error message or integer: the rest of the line
+        if (!readLine(sockfd, value)) {
+               cerr << "(Error) Incomplete reply line.\n";
+            return false;
+        }
+        if (print) {
+            if (type == '-')    cerr << "(Error) " << value << "\n";
+            else    cout << value << "\n";
         }
-           cout << line << "\n";
         return true;
     }
     case '$': {
-        // Bulk string
-        // First read the length (until CRLF)
+        // Bulk string: the length line, then that many bytes and a CRLF
            string lengthStr;
-        char c;
-        while (true) {
-            ssize_t r = recv(sockfd, &c, 1, 0);
-            if (r <= 0) {
-                   cerr << "(Error) Incomplete bulk length.\n";
-                return false;
-            }
-            if (c == '\r') {
-                // Next should be '\n'
-                recv(sockfd, &c, 1, 0);
-                break;
-            }
-            lengthStr.push_back(c);
+        if (!readLine(sockfd, lengthStr)) {
+               cerr << "(Error) Incomplete bulk length.\n";
+            return false;
         }
         int length =    stoi(lengthStr);
 
         if (length == -1) {
             // Null bulk string
-               cout << "(nil)\n";
+            if (print)    cout << "(nil)\n";
             return true;
         }
 
-        // Read 'length' bytes + CRLF
-           string bulk;
-        bulk.resize(length);
-        ssize_t totalRead = 0;
-        while (totalRead < length) {
-            bytesRead = recv(sockfd, &bulk[totalRead], length - totalRead, 0);
-            if (bytesRead <= 0) {
-                   cerr << "(Error) Incomplete bulk data.\n";
-                return false;
-            }
-            totalRead += bytesRead;
+           string crlf;
+        if (!readBytes(sockfd, length, value) || !readBytes(sockfd, 2, crlf)) {
+               cerr << "(Error) Incomplete bulk data.\n";
+            return false;
         }
-        // consume the trailing \r\n
-        recv(sockfd, &c, 1, 0);
-        recv(sockfd, &c, 1, 0);
-
-           cout << bulk << "\n";
+        if (print)    cout << value << "\n";
         return true;
     }
     case '*': {
         // Array
            string arrayCountStr;
-        char c;
-        while (true) {
-            ssize_t r = recv(sockfd, &c, 1, 0);
-            if (r <= 0) {
-                   cerr << "(Error) Incomplete array length.\n";
-                return false;
-            }
-            if (c == '\r') {
-                recv(sockfd, &c, 1, 0);
-                break;
-            }
-            arrayCountStr.push_back(c);
+        if (!readLine(sockfd, arrayCountStr)) {
+               cerr << "(Error) Incomplete array length.\n";
+            return false;
         }
         int arrayCount =    stoi(arrayCountStr);
         if (arrayCount == -1) {
-               cout << "(nil)\n";
+            if (print)    cout << "(nil)\n";
             return true;
         }
+        char elementType;
+           string element;
         for (int i = 0; i < arrayCount; ++i) {
-            if (!parseAndPrintRedisReply(sockfd)) {
+            if (!readReply(sockfd, print, elementType, element)) {
                 return false;
             }
         }
         return true;
     }
     default: {
-           cerr << "(Error) Unknown reply type: " << firstByte << "\n";
+           cerr << "(Error) Unknown reply type: " << type << "\n";
         return false;
     }
     }
-}
\ No newline at end of file
+}
+
+bool Client::readValues(int sockfd, char &type,    vector<   string> &values) {
+    if (inpos == inbuf.size() && !fillBuffer(sockfd)) {
+           cerr << "(Error) No response or connection closed.\n";
+        return false;
+    }
+    if (inbuf[inpos] != '*') {
+           string value;
+        if (!readReply(sockfd, false, type, value)) return false;
+        values.push_back(value);
+        return true;
+    }
+    type = inbuf[inpos++];
+       string countStr;
+    if (!readLine(sockfd, countStr)) {
+           cerr << "(Error) Incomplete array length.\n";
+        return false;
+    }
+    int count =    stoi(countStr);
+    char elementType;
+    for (int i = 0; i < count; ++i) {
+        if (!readValues(sockfd, elementType, values)) return false;
+    }
+    return true;
+}
@@ -24,6 +24,21 @@ private:
 
     int port;
 
+    // replies are read from the socket in large chunks and parsed out of this buffer,
+    // instead of one recv() per byte
+       string inbuf;
+    size_t inpos = 0;
+
+    bool fillBuffer(int sockfd);
+    bool readByte(int sockfd, char &c);
+    bool readLine(int sockfd,  string &line);          // up to CRLF, which is consumed
+    bool readBytes(int sockfd, size_t n,  string &out);
+
+    // one complete reply: type is its first byte, value the line or bulk (empty for arrays)
+    bool readReply(int sockfd, bool print, char &type,  string &value);
+    // one reply with any nested arrays flattened into values; type is the outer reply's
+    bool readValues(int sockfd, char &type,  vector< string> &values);
+
 
 public:
     // Constructor
@@ -50,6 +65,13 @@ int getPort() const;
 
     bool parseAndPrintRedisReply(int sockfd);
 
+    // --pipe: streams stdin (RESP or inline commands) to the server while a reader thread
+    // counts the replies; returns the exit status (1 if any command failed)
+    int runPipe(int sockfd, int timeoutSec);
+
+    // --bigkeys / --memkeys: SCANs the keyspace for the biggest key of each type
+    int runKeyScan(int sockfd, bool memory);
+
     //my_redis_cli.cpp : How resp actually works
 };
 
@@ -57,6 +79,7 @@ int getPort() const;
 namespace Utils {
     void printHelp();
      string trim(const  string &s);
+    bool sendAll(int sockfd, const char *data, size_t len);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,88 @@
+#include "my_redis_cli.h"
+#include <thread>
+#include <chrono>
+#include <random>
+#include <cerrno>
+#include <sys/time.h>
+
+/*
+Mass insertion (--pipe), after redis-cli:
+
+    ./redis-cli --pipe < commands.txt
+
+stdin goes to the server as it is, RESP (*3\r\n$3\r\nSET\r\n...) or inline commands one
+per line (SET key value), in 64KB writes and without waiting for any reply. A second
+thread reads and counts the replies meanwhile, so the server never stalls on a full
+socket and neither side waits for the other. When the input ends, an ECHO of a random
+marker is sent: its reply comes after the reply to every command of the input.
+*/
+
+static string randomMarker() {
+    static const char hex[] = "0123456789abcdef";
+    random_device seed;
+    mt19937 gen(seed());
+    string marker;
+    for (int i = 0; i < 20; i++) marker.push_back(hex[gen() % 16]);
+    return marker;
+}
+
+int Client::runPipe(int sockfd, int timeoutSec) {
+    // no reply for this long: the server is stuck, or the input ended inside a command
+    if (timeoutSec > 0) {
+        struct timeval tv = {timeoutSec, 0};
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+    string marker = randomMarker();
+    long long replies = 0, errors = 0;
+    bool finished = false, timedOut = false;
+    auto start = chrono::steady_clock::now();
+
+    thread reader([&]() {
+        char type;
+        string value;
+        while (readReply(sockfd, false, type, value)) {
+            if ((type == '+' || type == '$') && value == marker) { // ECHO replies with a status line here
+                finished = true;
+                return;
+            }
+            replies++;
+            if (type == '-' && ++errors <= 10) cerr << "(Error) " << value << "\n";
+        }
+        timedOut = errno == EAGAIN || errno == EWOULDBLOCK;
+        shutdown(sockfd, SHUT_RDWR); // a writer blocked on a full socket gives up too
+    });
+
+    char chunk[64 * 1024];
+    long long bytes = 0;
+    char last = '\n';
+    bool ok = true;
+    while (ok) {
+        ssize_t n = read(STDIN_FILENO, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        ok = Utils::sendAll(sockfd, chunk, n);
+        bytes += n;
+        last = chunk[n - 1];
+    }
+    if (ok) {
+        cerr << "All data transferred. Waiting for the last reply...\n";
+        string tail = last == '\n' ? "" : "\r\n"; // an inline last line without its newline
+        tail += buildRESPCommand({"ECHO", marker});
+        ok = Utils::sendAll(sockfd, tail.data(), tail.size());
+    }
+    if (!ok) shutdown(sockfd, SHUT_RDWR);
+    reader.join();
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (finished) cout << "Last reply received from server.\n";
+    else if (timedOut) cerr << "(Error) No reply for " << timeoutSec << " seconds, giving up.\n";
+    else cerr << "(Error) Connection lost before the last reply.\n";
+    if (errors > 10) cerr << "(" << errors - 10 << " more errors not shown)\n";
+    cout << "errors: " << errors << ", replies: " << replies << "\n";
+    if (seconds > 0) {
+        cout << replies << " replies in " << seconds << "s: "
+             << (long long)(replies / seconds) << " replies/s, "
+             << bytes / seconds / (1024 * 1024) << " MB/s sent\n";
+    }
+    return finished && errors == 0 ? 0 : 1;
+}
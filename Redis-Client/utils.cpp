@@ -1,4 +1,5 @@
 #include "my_redis_cli.h"
+#include <cerrno>
 
 namespace Utils {
     // Print help
@@ -8,6 +9,8 @@ namespace Utils {
                 << "      With arguments:            ./client -h <host> -p <port>\n"
                 << "      Default Host (127.0.0.1):  ./client -p <port>\n"
                 << "      Default Port (6379):       ./client -h <host>\n"
+                << "      Mass insertion:            ./client --pipe [--pipe-timeout <sec>] < commands.txt\n"
+                << "      Biggest keys per type:     ./client --bigkeys | --memkeys\n"
                 << "To get help about Redis commands type:\n"
                 << "      \"help @<group>\" to get a list of commands in <group>\n"
                 << "      \"help <command>\" for help on <command>\n"
@@ -20,6 +23,18 @@ namespace Utils {
                 << std::endl;
     }
 
+    // every byte of data, or false once the connection is gone
+    bool sendAll(int sockfd, const char *data, size_t len) {
+        size_t sent = 0;
+        while (sent < len) {
+            ssize_t n = send(sockfd, data + sent, len - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            sent += n;
+        }
+        return true;
+    }
+
     // Trim leading/trailing whitespace
     std::string trim(const std::string &s) {
         auto start = s.find_first_not_of(" \t\n\r\f\v");
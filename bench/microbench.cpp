@@ -0,0 +1,346 @@
+#include "../include/RedisDatabase.h"
+#include "../include/RedisCommandHandler.h"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include <unistd.h>
+
+/*
+In-process microbenchmarks (make bench): RedisDatabase operations, the RESP parsers,
+every command handler (through RedisCommandHandler::executeCommand, the way a
+connection calls them) and snapshot dump()/load(), with no sockets in the way.
+
+Each benchmark is warmed up and calibrated (the operation count doubles until one
+repetition takes --time ms), then timed over --reps repetitions. Reported per
+operation: the median time, its median absolute deviation (MAD, as a share of the
+median: the noise), operations per second at the median, and heap allocations and
+bytes, counted by the operator new below.
+
+    ./redis-lite-microbench [--filter substring] [--reps n] [--time ms] [--csv]
+*/
+
+// counting allocator: every operator new of this process goes through here, including
+// those of the threads the snapshot loader starts
+static std::atomic<uint64_t> allocations{0};
+static std::atomic<uint64_t> allocatedBytes{0};
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+using Clock = std::chrono::steady_clock;
+
+struct Benchmark {
+    std::string name;
+    std::function<void()> setup;          // runs once before warmup; may be empty
+    std::function<void(size_t)> run;      // performs n operations
+};
+
+struct Measurement {
+    double medianNs = 0;
+    double madNs = 0;
+    double allocsPerOp = 0;
+    double bytesPerOp = 0;
+    size_t opsPerRep = 0;
+};
+
+struct Settings {
+    std::string filter;
+    int reps = 10;
+    double repMs = 20;
+    bool csv = false;
+};
+
+static double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    size_t n = values.size();
+    return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+static double timeRun(const Benchmark& bench, size_t n) {
+    Clock::time_point start = Clock::now();
+    bench.run(n);
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+static Measurement measure(const Benchmark& bench, const Settings& settings) {
+    if (bench.setup) bench.setup();
+    // warmup and calibration: double n until one repetition takes long enough
+    size_t n = 1;
+    double targetNs = settings.repMs * 1e6;
+    while (true) {
+        double ns = timeRun(bench, n);
+        if (ns >= targetNs || n >= (size_t(1) << 30)) break;
+        n = ns < targetNs / 16 ? n * 8 : n * 2;
+    }
+    timeRun(bench, n); // one more at the final size, not counted
+
+    Measurement m;
+    m.opsPerRep = n;
+    std::vector<double> perOp;
+    uint64_t allocsBefore = allocations, bytesBefore = allocatedBytes;
+    for (int rep = 0; rep < settings.reps; rep++) perOp.push_back(timeRun(bench, n) / n);
+    double ops = (double)n * settings.reps;
+    m.allocsPerOp = (allocations - allocsBefore) / ops;
+    m.bytesPerOp = (allocatedBytes - bytesBefore) / ops;
+    m.medianNs = median(perOp);
+    std::vector<double> deviations;
+    for (double x : perOp) deviations.push_back(std::fabs(x - m.medianNs));
+    m.madNs = median(deviations);
+    return m;
+}
+
+static std::string key(const char* prefix, size_t i) {
+    return prefix + std::to_string(i);
+}
+
+static const size_t KEYS = 10000;        // keyspace the benchmarks cycle over
+static const std::string VALUE(32, 'v');
+
+// a handler benchmark: executeCommand over a ring of prebuilt commands
+static Benchmark command(const std::string& name, std::function<void()> setup,
+                         std::function<std::vector<std::string>(size_t)> make, size_t distinct = KEYS) {
+    auto commands = std::make_shared<std::vector<std::vector<std::string>>>();
+    for (size_t i = 0; i < distinct; i++) commands->push_back(make(i));
+    return {name, setup, [commands](size_t n) {
+        static RedisCommandHandler handler;
+        size_t size = commands->size();
+        for (size_t i = 0; i < n; i++) handler.executeCommand((*commands)[i % size]);
+    }};
+}
+
+static void populate() {
+    RedisDatabase& db = RedisDatabase::getInstance();
+    db.flushAll();
+    for (size_t i = 0; i < KEYS; i++) {
+        db.set(key("key:", i), VALUE);
+        for (int f = 0; f < 10; f++) db.hset(key("hash:", i), key("field:", f), VALUE);
+    }
+    for (size_t i = 0; i < 100; i++) {
+        for (int e = 0; e < 100; e++) db.rpush(key("list:", i), VALUE);
+    }
+}
+
+static std::vector<Benchmark> benchmarks(const std::string& snapshot) {
+    RedisDatabase& db = RedisDatabase::getInstance();
+    std::vector<Benchmark> all;
+
+    // RedisDatabase, called directly
+    all.push_back({"db.set", populate, [&db](size_t n) {
+        for (size_t i = 0; i < n; i++) db.set(key("key:", i % KEYS), VALUE);
+    }});
+    all.push_back({"db.get", populate, [&db](size_t n) {
+        std::string value;
+        for (size_t i = 0; i < n; i++) db.get(key("key:", i % KEYS), value);
+    }});
+    all.push_back({"db.hset", populate, [&db](size_t n) {
+        for (size_t i = 0; i < n; i++) db.hset(key("hash:", i % KEYS), "field:0", VALUE);
+    }});
+    all.push_back({"db.hget", populate, [&db](size_t n) {
+        std::string value;
+        for (size_t i = 0; i < n; i++) db.hget(key("hash:", i % KEYS), "field:0", value);
+    }});
+    all.push_back({"db.hgetall (10 fields)", populate, [&db](size_t n) {
+        for (size_t i = 0; i < n; i++) db.hgetall(key("hash:", i % KEYS));
+    }});
+    all.push_back({"db.lpush+lpop (100 items)", populate, [&db](size_t n) {
+        std::string value;
+        for (size_t i = 0; i < n; i++) {
+            db.lpush(key("list:", i % 100), VALUE);
+            db.lpop(key("list:", i % 100), value);
+        }
+    }});
+    all.push_back({"db.rpush+rpop (100 items)", populate, [&db](size_t n) {
+        std::string value;
+        for (size_t i = 0; i < n; i++) {
+            db.rpush(key("list:", i % 100), VALUE);
+            db.rpop(key("list:", i % 100), value);
+        }
+    }});
+    all.push_back({"db.keys (10000 strings, 10100 keys)", populate, [&db](size_t n) {
+        for (size_t i = 0; i < n; i++) db.keys();
+    }});
+
+    // a table node's allocation (a string key and value), the slab allocator against operator new
+    all.push_back({"SlabArena alloc+free x1000 (80 B)", nullptr, [](size_t n) {
+        std::vector<void*> nodes(1000);
+        for (size_t i = 0; i < n; i++) {
+            for (auto& node : nodes) node = SlabArena::allocate(80);
+            for (auto node : nodes) SlabArena::deallocate(node, 80);
+        }
+    }});
+    all.push_back({"operator new alloc+free x1000 (80 B)", nullptr, [](size_t n) {
+        std::vector<void*> nodes(1000);
+        for (size_t i = 0; i < n; i++) {
+            for (auto& node : nodes) node = ::operator new(80);
+            for (auto node : nodes) ::operator delete(node);
+        }
+    }});
+
+    // the parsers
+    const std::string set = "*3\r\n$3\r\nSET\r\n$10\r\nkey:000042\r\n$32\r\n" + VALUE + "\r\n";
+    std::string hmset = "*22\r\n$5\r\nHMSET\r\n$7\r\nhash:42\r\n";
+    for (int f = 0; f < 10; f++) hmset += "$7\r\nfield:" + std::to_string(f) + "\r\n$32\r\n" + VALUE + "\r\n";
+    all.push_back({"parseRespCommand SET", nullptr, [set](size_t n) {
+        for (size_t i = 0; i < n; i++) parseRespCommand(set);
+    }});
+    all.push_back({"parseRespCommand HMSET (10 fields)", nullptr, [hmset](size_t n) {
+        for (size_t i = 0; i < n; i++) parseRespCommand(hmset);
+    }});
+    all.push_back({"parseRespFrame SET", nullptr, [set](size_t n) {
+        std::vector<std::string> tokens;
+        for (size_t i = 0; i < n; i++) parseRespFrame(set.data(), set.size(), tokens);
+    }});
+    all.push_back({"parseRespFrame HMSET (10 fields)", nullptr, [hmset](size_t n) {
+        std::vector<std::string> tokens;
+        for (size_t i = 0; i < n; i++) parseRespFrame(hmset.data(), hmset.size(), tokens);
+    }});
+
+    // every handler, through executeCommand
+    all.push_back(command("PING", populate, [](size_t) { return std::vector<std::string>{"PING"}; }, 1));
+    all.push_back(command("ECHO", populate, [](size_t) { return std::vector<std::string>{"ECHO", VALUE}; }, 1));
+    all.push_back(command("SET", populate, [](size_t i) { return std::vector<std::string>{"SET", key("key:", i), VALUE}; }));
+    all.push_back(command("GET", populate, [](size_t i) { return std::vector<std::string>{"GET", key("key:", i)}; }));
+    all.push_back(command("GET (miss)", populate, [](size_t i) { return std::vector<std::string>{"GET", key("nokey:", i)}; }));
+    all.push_back(command("TYPE", populate, [](size_t i) { return std::vector<std::string>{"TYPE", key("hash:", i)}; }));
+    all.push_back(command("EXPIRE", populate, [](size_t i) { return std::vector<std::string>{"EXPIRE", key("key:", i), "3600"}; }));
+    // pairs that leave the keyspace as they found it
+    all.push_back(command("DEL+SET", populate, [](size_t i) {
+        return i % 2 ? std::vector<std::string>{"SET", key("key:", i / 2), VALUE}
+                     : std::vector<std::string>{"DEL", key("key:", i / 2)};
+    }, 2 * KEYS));
+    all.push_back(command("RENAME (pairs)", populate, [](size_t i) {
+        return i % 2 ? std::vector<std::string>{"RENAME", key("moved:", i / 2), key("key:", i / 2)}
+                     : std::vector<std::string>{"RENAME", key("key:", i / 2), key("moved:", i / 2)};
+    }, 2 * KEYS));
+    all.push_back(command("LPUSH+LPOP (100 items)", populate, [](size_t i) {
+        return i % 2 ? std::vector<std::string>{"LPOP", key("list:", i / 2 % 100)}
+                     : std::vector<std::string>{"LPUSH", key("list:", i / 2 % 100), VALUE};
+    }, 200));
+    all.push_back(command("RPUSH+RPOP (100 items)", populate, [](size_t i) {
+        return i % 2 ? std::vector<std::string>{"RPOP", key("list:", i / 2 % 100)}
+                     : std::vector<std::string>{"RPUSH", key("list:", i / 2 % 100), VALUE};
+    }, 200));
+    all.push_back(command("RPUSH+LREM (100 items)", populate, [](size_t i) {
+        return i % 2 ? std::vector<std::string>{"LREM", key("list:", i / 2 % 100), "1", "x"}
+                     : std::vector<std::string>{"RPUSH", key("list:", i / 2 % 100), "x"};
+    }, 200));
+    all.push_back(command("LSET", populate, [](size_t i) { return std::vector<std::string>{"LSET", key("list:", i % 100), "50", VALUE}; }, 100));
+    all.push_back(command("LLEN", populate, [](size_t i) { return std::vector<std::string>{"LLEN", key("list:", i % 100)}; }, 100));
+    all.push_back(command("LINDEX", populate, [](size_t i) { return std::vector<std::string>{"LINDEX", key("list:", i % 100), "50"}; }, 100));
+    all.push_back(command("LGET (100 items)", populate, [](size_t i) { return std::vector<std::string>{"LGET", key("list:", i % 100)}; }, 100));
+    all.push_back(command("HSET", populate, [](size_t i) { return std::vector<std::string>{"HSET", key("hash:", i), "field:0", VALUE}; }));
+    all.push_back(command("HGET", populate, [](size_t i) { return std::vector<std::string>{"HGET", key("hash:", i), "field:0"}; }));
+    all.push_back(command("HEXISTS", populate, [](size_t i) { return std::vector<std::string>{"HEXISTS", key("hash:", i), "field:0"}; }));
+    all.push_back(command("HDEL+HSET", populate, [](size_t i) {
+        return i % 2 ? std::vector<std::string>{"HSET", key("hash:", i / 2), "field:0", VALUE}
+                     : std::vector<std::string>{"HDEL", key("hash:", i / 2), "field:0"};
+    }, 2 * KEYS));
+    all.push_back(command("HMSET (10 fields)", populate, [](size_t i) {
+        std::vector<std::string> args = {"HMSET", key("hash:", i)};
+        for (int f = 0; f < 10; f++) {
+            args.push_back(key("field:", f));
+            args.push_back(VALUE);
+        }
+        return args;
+    }));
+    all.push_back(command("HGETALL (10 fields)", populate, [](size_t i) { return std::vector<std::string>{"HGETALL", key("hash:", i)}; }));
+    all.push_back(command("HKEYS (10 fields)", populate, [](size_t i) { return std::vector<std::string>{"HKEYS", key("hash:", i)}; }));
+    all.push_back(command("HVALS (10 fields)", populate, [](size_t i) { return std::vector<std::string>{"HVALS", key("hash:", i)}; }));
+    all.push_back(command("HLEN", populate, [](size_t i) { return std::vector<std::string>{"HLEN", key("hash:", i)}; }));
+    all.push_back(command("KEYS * (10100 keys)", populate, [](size_t) { return std::vector<std::string>{"KEYS", "*"}; }, 1));
+    all.push_back(command("INFO", populate, [](size_t) { return std::vector<std::string>{"INFO"}; }, 1));
+
+    // snapshots of the populated keyspace
+    all.push_back({"dump (10100 keys)", populate, [&db, snapshot](size_t n) {
+        for (size_t i = 0; i < n; i++) db.dump(snapshot);
+    }});
+    all.push_back({"load (10100 keys)", [&db, snapshot]() {
+        populate();
+        db.dump(snapshot);
+    }, [&db, snapshot](size_t n) {
+        for (size_t i = 0; i < n; i++) db.load(snapshot);
+    }});
+    return all;
+}
+
+static std::string humanRate(double perSecond) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2);
+    if (perSecond >= 1e6) out << perSecond / 1e6 << "M";
+    else if (perSecond >= 1e3) out << perSecond / 1e3 << "k";
+    else out << perSecond;
+    return out.str();
+}
+
+static bool parseArgs(int argc, char* argv[], Settings& settings) {
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--csv") settings.csv = true;
+            else if (arg == "--filter" && i + 1 < argc) settings.filter = argv[++i];
+            else if (arg == "--reps" && i + 1 < argc) settings.reps = std::stoi(argv[++i]);
+            else if (arg == "--time" && i + 1 < argc) settings.repMs = std::stod(argv[++i]);
+            else return false;
+        }
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+    return settings.reps > 0 && settings.repMs > 0;
+}
+
+int main(int argc, char* argv[]) {
+    Settings settings;
+    if (!parseArgs(argc, argv, settings)) {
+        std::cerr << "Usage: redis-lite-microbench [--filter substring] [--reps n] [--time ms] [--csv]\n";
+        return 1;
+    }
+    std::string snapshot = "/tmp/redis-lite-microbench-" + std::to_string(getpid()) + ".rdb";
+
+    if (settings.csv) std::cout << "\"benchmark\",\"ns_per_op\",\"mad_ns\",\"ops_per_sec\",\"allocs_per_op\",\"bytes_per_op\"\n";
+    else {
+        std::cout << std::left << std::setw(40) << "benchmark" << std::right << std::setw(12) << "ns/op"
+                  << std::setw(9) << "MAD" << std::setw(11) << "ops/s" << std::setw(11) << "allocs/op"
+                  << std::setw(11) << "bytes/op" << "\n";
+    }
+    for (const auto& bench : benchmarks(snapshot)) {
+        if (!settings.filter.empty() && bench.name.find(settings.filter) == std::string::npos) continue;
+        Measurement m = measure(bench, settings);
+        double rate = m.medianNs > 0 ? 1e9 / m.medianNs : 0;
+        if (settings.csv) {
+            std::cout << std::fixed << std::setprecision(2) << "\"" << bench.name << "\",\"" << m.medianNs << "\",\""
+                      << m.madNs << "\",\"" << rate << "\",\"" << m.allocsPerOp << "\",\"" << m.bytesPerOp << "\"\n";
+        }
+        else {
+            std::cout << std::left << std::setw(40) << bench.name << std::right << std::fixed
+                      << std::setprecision(1) << std::setw(12) << m.medianNs
+                      << std::setw(8) << (m.medianNs > 0 ? 100 * m.madNs / m.medianNs : 0) << "%"
+                      << std::setw(11) << humanRate(rate)
+                      << std::setprecision(2) << std::setw(11) << m.allocsPerOp
+                      << std::setprecision(0) << std::setw(11) << m.bytesPerOp << "\n";
+        }
+        std::cout.flush();
+    }
+    unlink(snapshot.c_str());
+    return 0;
+}
@@ -0,0 +1,119 @@
+#ifndef APPEND_ONLY_FILE_H
+#define APPEND_ONLY_FILE_H
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include "RedisDatabase.h"
+using namespace std;
+
+struct AofStats {
+    bool enabled = false;
+    uint64_t currentSize = 0;     // base + incremental files, including what is still buffered
+    uint64_t baseSize = 0;        // size of the base after the last rewrite
+    uint64_t pendingBytes = 0;    // fed but not yet written
+    uint64_t fsyncs = 0;
+    long long lastFsyncUsec = 0;
+    bool lastWriteOk = true;
+    bool rewriteInProgress = false;
+    bool rewriteScheduled = false;
+    uint64_t rewrites = 0;
+    bool lastRewriteOk = true;
+    long long lastRewriteSeconds = -1;
+    long long lastSwitchUsec = 0; // how long writers were held back to start the rewrite
+};
+
+/*
+Append-only log of executed write commands, stored as RESP.
+
+Command threads only append to an in-memory buffer (feed). A dedicated writer
+thread swaps the buffer out and issues one write() for everything queued since its
+last round, then fsyncs according to appendfsync:
+  always   --fsync every round; writers block in waitSynced() until their command is
+             on disk, so concurrent writers share one fsync (group commit)
+  everysec --fsync at most once per second
+  no       --never fsync, the kernel flushes when it wants
+
+On disk the log lives in appenddirname as a base snapshot plus incremental files,
+tied together by a manifest (same layout as Redis 7):
+  appendonly.aof.manifest
+  appendonly.aof.3.base.rdb    --dump.my_rdb format, the keyspace at the last rewrite
+  appendonly.aof.3.incr.aof    --RESP commands since then
+
+BGREWRITEAOF forks a snapshot child (RedisDatabase::bgsave) and, in the same instant,
+points the writer at a fresh incr file, so new writes are buffered into the new tail
+while the child writes the new base. When the child is done the manifest is switched
+atomically and the old base/incr files are deleted.
+*/
+class AppendOnlyFile {
+public:
+    static AppendOnlyFile& getInstance();
+
+    // true when the directory holds a manifest or an old single-file appendonly.aof
+    bool exists();
+    // base + incr files into the database; commands counts the replayed incr commands
+    bool load(RedisDatabase& db, uint64_t& commands);
+    // start logging; without a manifest the current keyspace becomes the first base
+    bool open();
+    void close(); // writes and fsyncs whatever is pending, stops the writer thread
+    bool isOpen() const { return running; }
+
+    // write commands execute and get fed while holding this, so the log order is the
+    // order the keyspace saw them in, and a rewrite can fork between two commands
+    mutex& orderLock() { return order_mutex; }
+    // queue one command (already executed) and return its sequence number
+    uint64_t feed(const vector<string>& tokens);
+    void waitSynced(uint64_t seq);
+
+    bool rewrite(); // BGREWRITEAOF; false if a fork is already running
+    void scheduleRewrite(); // run rewrite() as soon as the running fork is done
+    // auto-aof-rewrite-percentage / auto-aof-rewrite-min-size check, called once a second
+    void rewriteIfNeeded();
+
+    // applies every command of a log straight to the database, skipping the reply
+    // formatting of processCommand(). A truncated last command is cut off the file.
+    static bool replay(const string& filename, RedisDatabase& db, uint64_t& commands);
+
+    AofStats stats();
+
+private:
+    AppendOnlyFile() = default;
+    AppendOnlyFile(const AppendOnlyFile&) = delete;
+    AppendOnlyFile& operator=(const AppendOnlyFile&) = delete;
+    void writerLoop();
+    string path(const string& file) const;
+    bool readManifest();
+    bool writeManifest(); // caller holds manifest_mutex
+    int openIncr(uint64_t seq);
+
+    mutex order_mutex;
+
+    // manifest state
+    mutex manifest_mutex;
+    string dir;
+    string baseName;
+    uint64_t currentSeq = 0;
+    string baseFile;
+    vector<string> incrFiles;
+
+    int fd = -1;
+    atomic<bool> running{false};
+    bool stopping = false;
+    thread writer;
+
+    mutex aof_mutex;
+    condition_variable work_cv;   // writer waits for pending data
+    condition_variable synced_cv; // appendfsync always waiters
+    string pending;               // fed, not yet handed to the writer
+    string writing;               // batch the writer is writing (keeps its capacity)
+    string retiredTail;           // fed before a rewrite started, still owed to the old incr
+    int nextFd = -1;              // incr file the writer switches to after retiredTail
+    uint64_t fedSeq = 0;
+    uint64_t syncedSeq = 0;
+    AofStats counters;
+};
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <shared_mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+using namespace std;
+
+#define CLUSTER_SLOTS 16384
+#define CLUSTER_FORGET_TTL 60 //seconds a forgotten node is not learned again from the others
+
+/*
+Cluster mode (--cluster-enabled yes), same model and replies as Redis Cluster.
+
+The keyspace is split into 16384 hash slots, slot = CRC16(key) % 16384. When the key
+holds a non-empty {...}, only the part between the braces is hashed, so task:{42}
+and result:{42} always live on the same node.
+
+Every node owns some of the slots. A command for a key in a slot owned elsewhere gets
+  -MOVED <slot> <ip>:<port>   the slot lives there, the client should update its map
+  -ASK <slot> <ip>:<port>     the slot is being migrated and this key already moved:
+                              send ASKING and then the command to that node, once
+Commands whose keys hash to different slots get -CROSSSLOT.
+
+Nodes learn about each other with CLUSTER MEET (in both directions: the met node is
+introduced to us when we first connect); after that, once a second, every node
+asks every node it knows for CLUSTER NODES on its normal port (there is no separate
+bus port). A node's own line is the only one trusted about its slots. Each node has a
+config epoch that is bumped when it takes slots, and the higher epoch wins a conflict,
+so the cluster converges on the latest owner of every slot. The view is saved to
+cluster-config-file, so a restarted node keeps its id and its slots.
+
+Moving a slot from A to B (what redis-cli --cluster reshard does):
+  B: CLUSTER SETSLOT <slot> IMPORTING <A-id>
+  A: CLUSTER SETSLOT <slot> MIGRATING <B-id>
+  A: CLUSTER GETKEYSINSLOT <slot> 100, MIGRATE <B-ip> <B-port> "" 0 5000 KEYS ... until none are left
+  B, then A: CLUSTER SETSLOT <slot> NODE <B-id>
+While migrating, A serves the keys it still has and answers -ASK for the rest, and B
+serves the slot's keys to clients that sent ASKING.
+*/
+
+struct ClusterNode {
+    string id;   // 40 hex chars
+    string host;
+    int port = 0;
+    uint64_t configEpoch = 0;
+    bool myself = false;
+    bool fail = false; // did not answer for cluster-node-timeout
+    chrono::steady_clock::time_point lastPong = chrono::steady_clock::now();
+};
+
+class Cluster {
+public:
+    static Cluster& getInstance();
+    static unsigned int keySlot(const string& key);
+    // key arguments of a command, empty for commands that do not take keys
+    static vector<string> commandKeys(const string& cmd, const vector<string>& tokens);
+
+    bool enabled() const { return clusterEnabled; }
+    // loads cluster-config-file (or creates this node) and starts the gossip thread
+    bool init(int port);
+    // shared by every command that touches keys, exclusive for MIGRATE, so no write
+    // lands on a key between its DUMP and its deletion
+    shared_mutex& keyspaceLock() { return keyspace_mutex; }
+    // "" when this node serves keys, otherwise the redirect or error reply
+    string route(const vector<string>& keys, bool asking);
+    string command(const vector<string>& tokens); // CLUSTER <subcommand> ...
+    // sends the RESTORE commands (each after an ASKING) to host:port; "" or the error text,
+    // restored tells which ones the target accepted
+    string migrate(const string& host, int port, const vector<vector<string>>& restores, int timeoutMs,
+                   vector<bool>& restored);
+    string info(); // INFO cluster
+    void shutdown();
+
+private:
+    Cluster() = default;
+    Cluster(const Cluster&) = delete;
+    Cluster& operator=(const Cluster&) = delete;
+
+    void busLoop();
+    // CLUSTER NODES reply of the node reached at host:port (id is "" after a MEET)
+    void merge(const string& id, const string& host, int port, const string& nodesReply);
+    void nodeUnreachable(const string& id);
+    void dropNode(const string& id);          // caller holds state_mutex
+    ClusterNode* findNode(const string& id);  // caller holds state_mutex
+    void bumpEpoch();                         // caller holds state_mutex
+    string nodesText();                       // caller holds state_mutex
+    bool saveConfig();                        // caller holds state_mutex
+    bool loadConfig(const string& filename);
+
+    atomic<bool> clusterEnabled{false};
+    shared_mutex keyspace_mutex;
+    shared_mutex state_mutex;
+    unordered_map<string, ClusterNode> nodes; // by id, element addresses are stable
+    ClusterNode* myself = nullptr;
+    vector<ClusterNode*> slots;     // owner of every slot, nullptr if unassigned
+    vector<ClusterNode*> migrating; // slots of ours moving to that node
+    vector<ClusterNode*> importing; // slots moving here from that node
+    uint64_t currentEpoch = 0;
+    vector<pair<string, int>> meets; // MEET addresses that have not answered yet
+    unordered_map<string, chrono::steady_clock::time_point> forgotten;
+    thread bus;
+    atomic<bool> busStop{false};
+};
+
+#endif
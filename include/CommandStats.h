@@ -0,0 +1,158 @@
+#ifndef COMMAND_STATS_H
+#define COMMAND_STATS_H
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include "ServerConfig.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+using namespace std;
+
+// log-linear buckets of nanoseconds: 0..15 one each, then 8 per power of two up to 2^36ns (~69s)
+const int LATENCY_SUB_BUCKET_BITS = 3;
+const int LATENCY_LINEAR = 2 << LATENCY_SUB_BUCKET_BITS;
+const int LATENCY_MAX_BITS = 36;
+const int LATENCY_BUCKETS = LATENCY_LINEAR + (LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS - 1) * (1 << LATENCY_SUB_BUCKET_BITS);
+
+inline size_t latencyBucketOf(uint64_t nanos) {
+    if (nanos >= (uint64_t(1) << LATENCY_MAX_BITS)) nanos = (uint64_t(1) << LATENCY_MAX_BITS) - 1;
+    if (nanos < LATENCY_LINEAR) return nanos;
+    int top = 63 - __builtin_clzll(nanos);
+    int shift = top - LATENCY_SUB_BUCKET_BITS;
+    uint64_t sub = nanos >> shift;
+    return LATENCY_LINEAR + (shift - 1) * (1 << LATENCY_SUB_BUCKET_BITS) + (sub - (1 << LATENCY_SUB_BUCKET_BITS));
+}
+
+// the largest value that falls in a bucket
+inline uint64_t latencyBucketHighest(size_t bucket) {
+    if (bucket < LATENCY_LINEAR) return bucket;
+    size_t offset = bucket - LATENCY_LINEAR;
+    int shift = offset / (1 << LATENCY_SUB_BUCKET_BITS) + 1;
+    uint64_t sub = offset % (1 << LATENCY_SUB_BUCKET_BITS) + (1 << LATENCY_SUB_BUCKET_BITS);
+    return ((sub + 1) << shift) - 1;
+}
+
+// one command as seen by one thread; written by that thread only
+struct CommandCounters {
+    atomic<uint64_t> calls{0};      // executed, failed ones included
+    atomic<uint64_t> nanos{0};
+    atomic<uint64_t> rejected{0};   // refused before executing: redirects, READONLY
+    atomic<uint64_t> failed{0};     // executed and replied with an error
+    atomic<uint64_t> buckets[LATENCY_BUCKETS] = {};
+};
+
+// when a command started, and on which clock
+struct CommandTimer {
+    LatencyClock clock;
+    uint64_t start;
+};
+
+/*
+Per command call counts and latency histograms, for INFO commandstats, INFO
+latencystats and LATENCY HISTOGRAM.
+
+Every dispatched command is timed with a cheap clock (latency-tracking-clock): the TSC
+(rdtsc, calibrated against CLOCK_MONOTONIC at startup; CLOCK_MONOTONIC where there is no
+invariant TSC) or CLOCK_MONOTONIC_COARSE, which is cheaper still but only ticks every
+few ms. Counters live in per thread slots, like ServerStats: a command's counters are
+allocated the first time a thread runs it and bumped with relaxed load/store, and the
+readers sum the slots. latency-tracking no keeps the counts but skips the histograms.
+
+Inside a CommandBatch (the commands of one read from a connection, run back to back)
+a command starts when the one before it ended, so a pipelined command costs one clock
+read instead of two; the parsing in between is counted with the next command. Anything
+else run between two commands (cluster routing, tracking, eviction, the AOF order lock
+and fsync wait, invalidation pushes) calls CommandBatch::interrupt(), and the next
+command reads the clock afresh.
+*/
+class CommandStats {
+public:
+    static CommandStats& getInstance();
+
+    // position of an (uppercase) command in the table, -1 when it is not a command
+    static int indexOf(const string& cmd);
+
+    CommandTimer start() {
+        LatencyClock clock = ServerConfig::getInstance().latencyClock.load(memory_order_relaxed);
+        if (chained && chainClock == clock) return {clock, chainTicks};
+        return {clock, readClock(clock)};
+    }
+    uint64_t record(int command, const CommandTimer& timer, bool failed); // the command's nanoseconds
+    void rejected(const string& cmd);
+
+    string info();          // # Commandstats
+    string latencyInfo();   // # Latencystats
+    string histogram(const vector<string>& tokens); // LATENCY HISTOGRAM [command ...]
+
+    // one command summed over the slots
+    struct Totals {
+        uint64_t calls = 0, nanos = 0, rejected = 0, failed = 0;
+        vector<uint64_t> buckets = vector<uint64_t>(LATENCY_BUCKETS, 0);
+    };
+    // every command's totals, indexed like the table; into is reused, its size kept
+    void totals(vector<Totals>& into);
+    static const string& name(int command);
+
+private:
+    CommandStats();
+    CommandStats(const CommandStats&) = delete;
+    CommandStats& operator=(const CommandStats&) = delete;
+
+    uint64_t readClock(LatencyClock clock) {
+#if defined(__x86_64__) || defined(__i386__)
+        if (clock == LatencyClock::Tsc && tscUsable) return __rdtsc();
+#endif
+        timespec ts;
+        clock_gettime(clock == LatencyClock::Coarse ? CLOCK_MONOTONIC_COARSE : CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+    uint64_t elapsedNanos(const CommandTimer& timer, uint64_t end);
+
+    friend class CommandBatch;
+    static inline thread_local bool batching = false;
+    static inline thread_local bool chained = false; // chainTicks is when the last command ended
+    static inline thread_local LatencyClock chainClock = LatencyClock::Tsc;
+    static inline thread_local uint64_t chainTicks = 0;
+
+    struct CommandSlot {
+        vector<atomic<CommandCounters*>> commands;
+        CommandSlot();
+        ~CommandSlot();
+    };
+    struct SlotHandle {
+        CommandSlot* slot;
+        SlotHandle();
+        ~SlotHandle();
+    };
+    static CommandSlot& local() {
+        thread_local SlotHandle handle;
+        return *handle.slot;
+    }
+    CommandCounters& counters(int command);
+
+    vector<Totals> totals();
+    static uint64_t percentile(const Totals& t, double p);
+
+    mutex slots_mutex;
+    vector<unique_ptr<CommandSlot>> slots;
+    vector<CommandSlot*> freeSlots;
+
+    bool tscUsable = false;
+    uint64_t nanosPerTick32 = 0; // ns per TSC tick, fixed point with 32 fraction bits
+};
+
+// commands run back to back on this thread while one is alive; see CommandStats
+class CommandBatch {
+public:
+    CommandBatch() { CommandStats::batching = true; }
+    ~CommandBatch() { CommandStats::batching = CommandStats::chained = false; }
+    // work outside any command's timing ran since the last one ended
+    static void interrupt() { CommandStats::chained = false; }
+};
+
+#endif
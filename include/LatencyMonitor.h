@@ -0,0 +1,86 @@
+#ifndef LATENCY_MONITOR_H
+#define LATENCY_MONITOR_H
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include "ServerConfig.h"
+using namespace std;
+
+const int LATENCY_HISTORY_LEN = 160; // samples kept per event, at most one per second
+
+struct LatencyPoint {
+    int64_t time;   // unix seconds
+    uint64_t ms;
+};
+
+// one event's spikes: the newest LATENCY_HISTORY_LEN seconds that had one, and the worst
+struct LatencySeries {
+    LatencyPoint points[LATENCY_HISTORY_LEN];
+    int count = 0;          // points filled
+    int next = 0;           // where the next second goes
+    uint64_t maxMs = 0;     // the worst sample since the last reset
+};
+
+/*
+Latency monitor, after Redis: LATENCY LATEST | HISTORY event | RESET [event ...].
+
+Internal events that took latency-monitor-threshold ms or more (0: monitor off) are
+recorded per event, at most one sample per second (the worst of that second):
+  command         a command, measured by dispatchCommand
+  expire-cycle    purgeExpired removing expired keys
+  rehash          an insert that grew one of the keyspace tables
+  large-free      DEL and FLUSHALL freeing values
+  dump            SAVE, or dump() for an AOF rewrite: the keyspace written out under db_mutex
+  fork            fork() of a background save, under db_mutex
+  delta-checkpoint  copying the dirty keys for a delta under db_mutex
+  aof-write       the AOF writer's write() of a batch
+  aof-fsync       its fdatasync()
+  eviction-cycle  freeMemory evicting keys before a write, over maxmemory
+  eviction-del    one of those evictions: the key removed (and freed unless lazyfree-lazy-eviction)
+Samples are rare (only spikes), so one mutex guards the series; with the monitor off an
+event costs one relaxed load.
+*/
+class LatencyMonitor {
+public:
+    static LatencyMonitor& getInstance();
+
+    static bool enabled() {
+        return ServerConfig::getInstance().latencyMonitorThreshold.load(memory_order_relaxed) > 0;
+    }
+    void add(const char* event, uint64_t ms);
+    string command(const vector<string>& tokens); // LATEST, HISTORY, RESET
+
+private:
+    LatencyMonitor() = default;
+    LatencyMonitor(const LatencyMonitor&) = delete;
+    LatencyMonitor& operator=(const LatencyMonitor&) = delete;
+
+    mutex latency_mutex;
+    map<string, LatencySeries> events;
+};
+
+// times the scope it lives in as event, when the monitor is on
+class LatencySample {
+public:
+    explicit LatencySample(const char* event) : LatencySample(event, true) {}
+    // only when the scope may be slow, e.g. an insert that rehashes
+    LatencySample(const char* event, bool when) : event(event), on(when && LatencyMonitor::enabled()) {
+        if (on) start = chrono::steady_clock::now();
+    }
+    ~LatencySample() {
+        if (!on) return;
+        auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+        LatencyMonitor::getInstance().add(event, ms);
+    }
+    LatencySample(const LatencySample&) = delete;
+    LatencySample& operator=(const LatencySample&) = delete;
+private:
+    const char* event;
+    bool on;
+    chrono::steady_clock::time_point start;
+};
+
+#endif
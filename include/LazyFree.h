@@ -0,0 +1,72 @@
+#ifndef LAZY_FREE_H
+#define LAZY_FREE_H
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <cstdint>
+#include <utility>
+using namespace std;
+
+// allocations a value takes to free above which it is freed in the background, as in Redis
+const size_t LAZYFREE_THRESHOLD = 64;
+
+// a value handed to the lazy free thread; deleting it runs the value's destructor
+struct LazyObject {
+    virtual ~LazyObject() = default;
+};
+template<class T>
+struct LazyValue : LazyObject {
+    T value;
+    function<void(const T&)> beforeFree; // last look at the value, on the lazy free thread
+    ~LazyValue() override {
+        if (beforeFree) beforeFree(value);
+    }
+};
+
+/*
+UNLINK, FLUSHALL ASYNC and the overwrites, expiries and evictions of big values detach
+the value under db_mutex (a swap, O(1)) and queue it here; one thread runs the
+destructors, so the nodes and buffers of a 10M element list are given back to the
+allocator without holding up any client. lazy_mutex is taken under db_mutex and
+nothing is taken under it; beforeFree runs with no lock held, so it may take db_mutex.
+*/
+class LazyFree {
+public:
+    static LazyFree& getInstance();
+
+    // takes value's contents, leaving it empty, and frees them in the background
+    template<class T>
+    void release(T& value, function<void(const T&)> beforeFree = nullptr) {
+        unique_ptr<LazyValue<T>> object(new LazyValue<T>());
+        swap(object->value, value);
+        object->beforeFree = move(beforeFree);
+        queue(move(object));
+    }
+
+    size_t pending() const { return pendingObjects; } // INFO lazyfree_pending_objects
+    uint64_t freed() const { return freedObjects; }   // INFO lazyfreed_objects
+    void shutdown(); // stops the thread, what is still queued is left to the exiting process
+
+private:
+    LazyFree();
+    ~LazyFree() { shutdown(); }
+    LazyFree(const LazyFree&) = delete;
+    LazyFree& operator=(const LazyFree&) = delete;
+
+    void queue(unique_ptr<LazyObject> object);
+    void loop();
+
+    mutex lazy_mutex;
+    condition_variable work_cv;
+    vector<unique_ptr<LazyObject>> objects;
+    thread freer;
+    bool stopping = false;
+    atomic<size_t> pendingObjects{0}; // queued or being freed
+    atomic<uint64_t> freedObjects{0};
+};
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef LOCK_STATS_H
+#define LOCK_STATS_H
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include "CommandStats.h"
+using namespace std;
+
+/*
+Lock contention profiling, compiled in with make LOCKSTATS=1 (-DREDIS_LOCKSTATS).
+
+db_mutex, and any other lock worth watching, is a ProfiledMutex. Without the flag that
+is a std::mutex under another name. With it every acquisition records, per lock and per
+holder, in counters and log-linear histograms:
+  wait      asking for the lock until getting it, charged to the one that waited
+  hold      getting it until releasing it
+  blocked   what others waited while this holder had the lock
+A holder is what the thread said it is doing: the command (dispatchCommand sets it), or
+a background job (LockHolder holder("saveDelta")). A LockSection is a stretch of a hold
+recorded under its own name as well (purgeExpired inside every command), and others
+waiting during it count as blocked by the section.
+
+The counters are written while the profiled lock is still held, so they need no lock of
+their own; DEBUG LOCKSTATS [RESET] and INFO lockstats read them.
+*/
+#ifdef REDIS_LOCKSTATS
+
+const int LOCKSTATS_HOLDERS = 64;     // distinct holders per lock, later ones share "other"
+const int LOCKSTATS_NAME_LEN = 24;
+
+struct LockHolderRow {
+    char name[LOCKSTATS_NAME_LEN] = {};
+    bool section = false;               // a LockSection, its time is inside some hold
+    atomic<uint64_t> acquisitions{0};
+    atomic<uint64_t> contended{0};      // acquisitions that had to wait
+    atomic<uint64_t> waitNanos{0};
+    atomic<uint64_t> holdNanos{0};
+    atomic<uint64_t> maxHoldNanos{0};
+    atomic<uint64_t> blockedNanos{0};   // others' waits while this holder had the lock
+    atomic<uint64_t> waitBuckets[LATENCY_BUCKETS] = {};
+    atomic<uint64_t> holdBuckets[LATENCY_BUCKETS] = {};
+};
+
+class ProfiledMutex {
+public:
+    explicit ProfiledMutex(const char* name);
+    ~ProfiledMutex();
+    ProfiledMutex(const ProfiledMutex&) = delete;
+    ProfiledMutex& operator=(const ProfiledMutex&) = delete;
+
+    void lock();
+    bool try_lock();
+    void unlock();
+
+    const char* name() const { return lockName; }
+    string report(bool summary); // DEBUG LOCKSTATS lines, or the INFO ones
+    void reset();
+
+private:
+    friend class LockSection;
+    void acquired(uint64_t asked, bool waited, int blocker); // caller holds m
+    int rowOf(const char* holder);                         // caller holds m
+
+    mutex m;
+    const char* lockName;
+    LockHolderRow rows[LOCKSTATS_HOLDERS];
+    atomic<int> rowCount{0};
+    atomic<int> owner{-1};      // row of the current holder, or of the section it is in
+    uint64_t acquiredAt = 0;
+    int holderRow = -1;
+};
+
+class LockStats {
+public:
+    static constexpr bool compiledIn = true;
+    static LockStats& getInstance();
+    static uint64_t now();
+    static const char* holder() { return currentHolder; }
+
+    string report(bool summary);
+    void reset();
+
+private:
+    friend class ProfiledMutex;
+    friend class LockHolder;
+    LockStats() = default;
+    mutex registry_mutex;
+    vector<ProfiledMutex*> locks;
+    static inline thread_local const char* currentHolder = "other";
+};
+
+// what this thread holds locks for until it goes out of scope
+class LockHolder {
+public:
+    explicit LockHolder(const char* name) : previous(LockStats::currentHolder) { LockStats::currentHolder = name; }
+    explicit LockHolder(const string& name) : LockHolder(name.c_str()) {}
+    ~LockHolder() { LockStats::currentHolder = previous; }
+private:
+    const char* previous;
+};
+
+// a named stretch of a hold on lock, caller holds it
+class LockSection {
+public:
+    LockSection(ProfiledMutex& lock, const char* name);
+    ~LockSection();
+private:
+    ProfiledMutex& lock;
+    int row;
+    int previousOwner;
+    uint64_t start;
+};
+
+#else
+
+class ProfiledMutex : public mutex {
+public:
+    explicit ProfiledMutex(const char* /*name*/) {}
+};
+
+class LockStats {
+public:
+    static constexpr bool compiledIn = false;
+    static LockStats& getInstance() {
+        static LockStats instance;
+        return instance;
+    }
+    string report(bool /*summary*/) { return ""; }
+    void reset() {}
+};
+
+class LockHolder {
+public:
+    explicit LockHolder(const char* /*name*/) {}
+    explicit LockHolder(const string& /*name*/) {}
+};
+
+class LockSection {
+public:
+    LockSection(ProfiledMutex& /*lock*/, const char* /*name*/) {}
+};
+
+#endif
+
+#endif
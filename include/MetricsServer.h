@@ -0,0 +1,65 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include "CommandStats.h"
+using namespace std;
+
+const int METRICS_MAX_CONNECTIONS = 16;
+const int METRICS_REQUEST_BYTES = 4096; // request line and headers; bigger requests are refused
+
+// one scraper's connection; the slots and their buffers outlive the connections
+struct MetricsConnection {
+    int fd = -1;
+    char request[METRICS_REQUEST_BYTES];
+    size_t received = 0;
+    string reply;           // header and page, sent from `sent` on
+    size_t sent = 0;
+    bool keepAlive = true;
+};
+
+/*
+GET /metrics on metrics-port, in the Prometheus text format (version 0.0.4): the INFO
+stats and memory counters, the keyspace, persistence, and per command calls, errors and
+latency histograms from CommandStats.
+
+One thread runs a poll() loop over the listening socket and at most
+METRICS_MAX_CONNECTIONS scrapers, reading requests and writing replies without
+blocking; keep-alive connections are kept. A page is rendered into buffers that live as
+long as the server (the page, the command totals, each connection's reply), so after
+the first scrapes rendering allocates nothing. The command threads are not involved:
+the counters are read the way INFO reads them.
+*/
+class MetricsServer {
+public:
+    static MetricsServer& getInstance();
+
+    bool start(int port); // false (and says why) when the port cannot be listened on
+    void shutdown();
+
+private:
+    MetricsServer() = default;
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    void loop();
+    bool readRequest(MetricsConnection& c);   // false: close the connection
+    bool serveRequest(MetricsConnection& c);  // answers a complete request, if one was read
+    bool writeReply(MetricsConnection& c);    // false: close the connection
+    void respond(MetricsConnection& c, const char* status, bool metrics);
+    void render();                            // the page into `page`
+    void closeConnection(MetricsConnection& c);
+
+    int listenFd = -1;
+    thread poller;
+    atomic<bool> stopping{false};
+    MetricsConnection connections[METRICS_MAX_CONNECTIONS];
+
+    string page;
+    vector<CommandStats::Totals> commandTotals;
+};
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef RDB_FORMAT_H
+#define RDB_FORMAT_H
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+using namespace std;
+
+/*
+Binary snapshot format (dump.my_rdb), version 2
+
+  "MYRDB" + 4 ascii digits of version
+  RESIZEDB  varint kv/list/hash key counts --lets load() reserve() the maps up front
+  AUX key value ...                        --optional metadata (checkpoint ids)
+  section 0 | section 1 | ...              --records, each section decodes on its own
+  EOF
+  index: per section 8 byte offset, length, key count, CRC64 of the section bytes
+  8 byte section count
+  8 byte CRC64 (Jones polynomial) of every byte outside the sections
+
+A record is
+  [EXPIRETIME_MS  8 byte unix time in ms]  --optional, applies to the next key
+  <type opcode> key value
+
+Delta checkpoints (dump.my_rdb.delta.<n>) use the same layout and only hold the
+keys changed since the previous checkpoint; a key that was deleted is written as
+  DELETE key
+
+Every string is a varint length followed by the raw bytes, so keys and values
+can hold spaces, ':' or newlines. Lists and hashes are a varint element count
+followed by their strings. Fixed width integers are little endian.
+
+The index footer lets load() hand sections to several threads, each verifying and
+decoding its own slice. Version 1 files have no sections or index and a single
+CRC64 over the whole file.
+*/
+
+#define RDB_MAGIC "MYRDB"
+#define RDB_VERSION 2
+#define RDB_SECTION_KEYS 65536 //start a new section after this many keys...
+#define RDB_SECTION_BYTES (8 * 1024 * 1024) //...or this many bytes
+
+struct RdbSection {
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    uint64_t keys = 0;
+    uint64_t crc = 0;
+};
+
+enum RdbOpcode : uint8_t {
+    RDB_TYPE_STRING = 0,
+    RDB_TYPE_LIST = 1,
+    RDB_TYPE_HASH = 4,
+    RDB_OPCODE_DELETE = 0xF0,
+    RDB_OPCODE_AUX = 0xFA,
+    RDB_OPCODE_RESIZEDB = 0xFB,
+    RDB_OPCODE_EXPIRETIME_MS = 0xFC,
+    RDB_OPCODE_EOF = 0xFF
+};
+
+//table driven CRC64 (slicing-by-8), same polynomial and output as Redis' crc64
+uint64_t crc64(uint64_t crc, const void* data, size_t len);
+
+//Buffered writer: fields are appended to an in-memory chunk which is written out
+//(and folded into the running checksum) every 64 KB. Bytes written between
+//beginSection() and endSection() go into that section's checksum instead.
+//The string constructor collects the bytes in memory instead (DUMP payloads).
+class RdbWriter {
+public:
+    explicit RdbWriter(int fd);
+    explicit RdbWriter(string* out);
+    void writeHeader();
+    void writeByte(uint8_t b);
+    void writeLength(uint64_t len);
+    void writeString(string_view s);
+    void writeUint64(uint64_t v);
+    void beginSection();
+    RdbSection endSection(uint64_t keys);
+    bool inSection() const { return sectionOpen; }
+    //bytes written so far, including the pending chunk
+    uint64_t size() const { return offset + buf.size(); }
+    //EOF opcode, section index and checksum trailer, then flush; false if any write failed
+    bool finish(const vector<RdbSection>& sections);
+    //string writers: version and checksum trailer of a DUMP payload
+    void finishPayload();
+private:
+    bool flush();
+    int fd;
+    string* out;
+    string buf;
+    uint64_t offset;
+    uint64_t crc;
+    uint64_t sectionCrc;
+    uint64_t sectionStart;
+    bool sectionOpen;
+    bool ok;
+};
+
+//Reader over a snapshot that is already in memory. Every read is bounds checked
+//and returns false on truncated input.
+class RdbReader {
+public:
+    RdbReader(const char* data, size_t size);
+    bool readHeader(int& version);
+    bool readByte(uint8_t& b);
+    bool readLength(uint64_t& len);
+    bool readString(string& s);
+    bool readUint64(uint64_t& v);
+    size_t offset() const { return pos; }
+    size_t remaining() const { return size - pos; }
+    bool atEnd() const { return pos >= size; }
+private:
+    const char* data;
+    size_t size;
+    size_t pos;
+};
+
+//DUMP/RESTORE payload: one value as the record encodes it (type opcode and value, no key),
+//then the 2 byte RDB_VERSION and a CRC64 of everything before it, like Redis' DUMP
+bool rdbVerifyPayload(const string& payload);
+
+//version 1: true when data ends with a CRC64 trailer matching the bytes before it
+bool rdbVerifyChecksum(const char* data, size_t size);
+
+//version 2: checks the trailer over the non-section bytes and fills the index.
+//Section checksums are left to the caller (rdbVerifySection), so they can be
+//verified in parallel.
+bool rdbReadIndex(const char* data, size_t size, size_t headerLen, vector<RdbSection>& sections);
+bool rdbVerifySection(const char* data, const RdbSection& section);
+
+#endif
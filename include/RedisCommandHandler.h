@@ -1,10 +1,20 @@
 #ifndef REDIS_COMMAND_HANDLER_H
 #define REDIS_COMMAND_HANDLER_H
 #include <string>
+#include <vector>
+#include <cstddef>
 class RedisCommandHandler {
 public:
     RedisCommandHandler();
     //we will need to process a command from the client and return a RESP formatted response
     std::string processCommand(const std::string& commandLine);
+    //same, for a command that is already split into arguments
+    std::string executeCommand(const std::vector<std::string>& tokens);
 };
-#endif    
\ No newline at end of file
+
+//parses one complete command (RESP array or inline line) from the front of data into
+//tokens; returns the bytes consumed, 0 when more data is needed, npos when malformed
+size_t parseRespFrame(const char* data, size_t len, std::vector<std::string>& tokens);
+//one whole command line (RESP array or inline) into its arguments, for processCommand
+std::vector<std::string> parseRespCommand(const std::string& input);
+#endif
@@ -3,15 +3,115 @@
 #include <string>
 #include <mutex>//thread safety --prevent race conditions
 #include <unordered_map>
+#include <unordered_set>
 #include<chrono>
 #include <vector>
+#include <istream>
+#include <functional>
+#include <cstdint>
+#include <atomic>
+#include <random>
+#include "LockStats.h"
+#include "SlabAllocator.h"
+#include "StoredString.h"
+#include <ctime>
 using namespace std;
 
+// Snapshot bookkeeping reported by LASTSAVE and INFO persistence
+struct PersistenceStats {
+    time_t lastSaveTime = 0;       // unix time of the last successful SAVE/BGSAVE
+    bool bgsaveInProgress = false;
+    bool lastBgsaveOk = true;
+    long long lastBgsaveSeconds = -1;
+    long long lastForkUsec = 0;    // time the parent spent inside fork() (and the lock)
+    size_t lastCowBytes = 0;       // private dirty memory of the last child
+    double loadSeconds = 0;        // startup load of the snapshot
+    uint64_t loadKeys = 0;
+    size_t loadThreads = 0;
+    uint64_t loadDeltas = 0;       // delta checkpoints applied on top of the base
+    uint64_t changesSinceSave = 0; // writes not yet in any checkpoint
+    uint64_t deltasSinceBase = 0;
+    uint64_t deltaBytes = 0;       // all deltas of the current base together
+    uint64_t baseBytes = 0;
+    uint64_t lastDeltaKeys = 0;
+    uint64_t lastDeltaBytes = 0;
+    uint64_t lastSaveUsec = 0;     // wall time of the last successful snapshot (base or delta)
+};
+
+/*
+The keyspace's tables: StoredString keys, nodes and small bucket arrays from the slab
+allocator. find, count, erase, try_emplace and [] also take any string_view (a
+std::string, a StoredString) and look it up as a borrowed key, so a command's key is
+not copied unless it is inserted.
+*/
+template<class V>
+class KeyTable : public unordered_map<StoredString,V,StoredStringHash,equal_to<StoredString>,SlabAllocator<pair<const StoredString,V>>> {
+    using Table=unordered_map<StoredString,V,StoredStringHash,equal_to<StoredString>,SlabAllocator<pair<const StoredString,V>>>;
+public:
+    using Table::Table;
+    using Table::find;
+    using Table::count;
+    using Table::erase;
+    using Table::try_emplace;
+    using Table::operator[];
+    typename Table::iterator find(string_view key){ return Table::find(StoredString::borrow(key)); }
+    typename Table::const_iterator find(string_view key) const{ return Table::find(StoredString::borrow(key)); }
+    size_t count(string_view key) const{ return Table::count(StoredString::borrow(key)); }
+    size_t erase(string_view key){ return Table::erase(StoredString::borrow(key)); }
+    pair<typename Table::iterator,bool> try_emplace(string_view key){
+        StoredString borrowed=StoredString::borrow(key);
+        return Table::try_emplace(borrowed); //copied into the node only when inserted
+    }
+    V& operator[](string_view key){
+        StoredString borrowed=StoredString::borrow(key);
+        return Table::operator[](borrowed);
+    }
+};
+using HashValue=KeyTable<StoredString>; // a hash's fields
+
+// key counts of INFO keyspace
+struct KeyspaceCounts {
+    uint64_t strings = 0;
+    uint64_t lists = 0;
+    uint64_t hashes = 0;
+    uint64_t expires = 0;
+};
+
+// MEMORY STATS rows: a type and how its values are held
+enum MemoryClass {
+    MEM_STRING_EMBSTR,  // short string kept inside its StoredString word (7 bytes or less)
+    MEM_STRING_RAW,     // string in a block of its own
+    MEM_LIST_VECTOR,
+    MEM_HASH_HASHTABLE,
+    MEM_EXPIRES,        // expiry_map entries
+    MEM_CLASSES
+};
+
+/*
+Approximate bytes of the keyspace, for MEMORY USAGE and MEMORY STATS: a key's table
+entry (node, key string, value object), the value's payload and container overhead, and
+its expiry entry. Table nodes and StoredString blocks are priced at their slab class
+(see SlabArena), list elements after glibc's malloc (8 byte header, 16 byte chunks).
+Every write adjusts the totals by what it adds or drops, so MEMORY STATS is O(1).
+*/
+struct MemoryCounts {
+    uint64_t keys[MEM_CLASSES] = {};
+    uint64_t bytes[MEM_CLASSES] = {};
+    uint64_t bucketBytes = 0;   // bucket arrays of the four tables
+    uint64_t accessBytes = 0;   // key_access, the LRU/LFU clocks: its nodes and buckets
+};
+
+// a key the eviction pool holds on to, until a better one is sampled or it is evicted
+struct EvictionCandidate {
+    uint64_t idle;  // higher goes first: LRU idle time, 255 - LFU counter, or how soon it expires
+    string key;
+};
+
 class RedisDatabase {
 public:
     // get the singleton instance
     static RedisDatabase& getInstance();
-    bool flushAll();
+    bool flushAll(bool async=false);   //async: the old keyspace is freed by LazyFree
 
     //KEY- value ops
     void set(const string& key,const string& value);
@@ -19,8 +119,10 @@ public:
     vector<string> keys();
     string type(const string& key);
     bool del(const string& key);
+    bool unlinkKey(const string& key); //UNLINK: DEL, but a big value is always freed by LazyFree
 
     bool expire(const string& key,const int seconds);
+    bool pexpireat(const string& key,uint64_t unixMs);
     void purgeExpired();
     //rename
     bool rename(const string oldKey,const string newKey);
@@ -47,19 +149,105 @@ public:
     bool hmset(const string& key, const vector<pair<string, string>>& fieldValues);
 
 
-    bool dump(const string& filename);
+    bool dump(const string& filename);   //serializes under db_mutex
+    //copy-on-write snapshot in a forked child, done(ok) runs when the child exits
+    bool bgsave(const string& filename,function<void(bool)> done);
+    bool forkInProgress() const { return bgsave_running; }
     bool load(const string& filename);
+
+    //dbfilename checkpoints: a base snapshot plus deltas holding only the keys written since
+    bool save();            //SAVE: new base under db_mutex
+    bool bgsaveBase();      //BGSAVE: new base from a forked child
+    bool saveDelta();       //dirty keys only, copied under db_mutex and written without it
+    void checkpointCron();  //once a second: a save point is due -> delta, or merge into a base
+    bool loadCheckpoint();  //base + the deltas written against it
+    PersistenceStats persistenceStats();
+    KeyspaceCounts keyspaceCounts();
+
+    //MEMORY USAGE key [SAMPLES n], MEMORY STATS, SCAN, STRLEN
+    bool memoryUsage(const string& key,size_t samples,uint64_t& bytes); //false: no such key; samples 0: every element
+    MemoryCounts memoryCounts();
+    //up to about count keys from cursor on (0: the start), returns the next cursor, 0 when done
+    uint64_t scan(uint64_t cursor,size_t count,const string& pattern,const string& type,vector<string>& keys);
+    ssize_t strlen(const string& key);
+
+    //maxmemory: evicts keys by maxmemory-policy until the keyspace fits or usec are up,
+    //appending them to evicted; false while it is still over the limit
+    bool freeMemory(uint64_t usec,vector<string>& evicted);
+
+    //cluster mode
+    void enableSlotIndex(); //index every key by hash slot from now on
+    vector<string> keysInSlot(unsigned int slot,size_t count);
+    size_t countKeysInSlot(unsigned int slot);
+    //DUMP/RESTORE payloads, what MIGRATE moves between nodes
+    bool dumpKey(const string& key,string& payload,uint64_t& expireUnixMs);
+    bool restoreKey(const string& key,const string& payload,uint64_t expireUnixMs,bool replace,string& error);
 private:
     RedisDatabase() = default;
     ~RedisDatabase() = default;
     RedisDatabase(const RedisDatabase&) = delete;
     RedisDatabase& operator=(const RedisDatabase&) = delete;
-    mutex db_mutex;
-    unordered_map<string,string>kv_Store;
-    unordered_map<string,vector<string>>list_store;
-    unordered_map<string,unordered_map<string,string>>hash_Store;
+    ProfiledMutex db_mutex{"db_mutex"};
+    KeyTable<StoredString>kv_Store;
+    KeyTable<vector<string>>list_store;
+    KeyTable<HashValue>hash_Store;
+
+    KeyTable<chrono::steady_clock::time_point> expiry_map;
+
+    //approximate bytes per MemoryClass, caller holds db_mutex
+    MemoryCounts memory;
+    void account(MemoryClass c,int64_t keys,int64_t bytes){
+        memory.keys[c]+=keys;
+        memory.bytes[c]+=bytes;
+    }
+    void accountKey(string_view key,int sign);      //whatever key holds in the three stores
+    void accountExpire(string_view key,int sign);   //its expiry_map entry, if there is one
+    void setField(HashValue& hash,const string& field,const string& value);
+    void recountMemory();                           //from scratch, after a load
+    void countOverhead(MemoryCounts& counts);       //bucketBytes and accessBytes
+    uint64_t datasetBytes();                        //what maxmemory is compared with
+
+    /*
+    maxmemory-policy bookkeeping, caller holds db_mutex. The values have no object
+    header to keep an LRU clock or LFU counter in, so every key's lives in key_access
+    under the key's hash, 32 bits like Redis' robj lru field; two keys sharing a hash
+    share one. Only kept while a *-lru or *-lfu policy is in force.
+    */
+    unordered_map<size_t,uint32_t,hash<size_t>,equal_to<size_t>,SlabAllocator<pair<const size_t,uint32_t>>> key_access;
+    vector<EvictionCandidate> eviction_pool;        //best candidates sampled so far, ascending idle
+    mt19937_64 eviction_rng;
+    bool lookup(const string& key,bool found);      //keyspace hits/misses of INFO, and an access
+    void accessed(const string& key);
+    bool nextEviction(string& key);
+    void evictKey(const string& key);
+    //key out of the three stores and expiry_map, big values to LazyFree when lazy; caller holds db_mutex
+    bool removeKey(const string& key,bool lazy);
+    template<class V>
+    bool dropValue(KeyTable<V>& table,string_view key,bool lazy);
+    uint64_t memory_epoch=0;                        //bumped when the counts start over, see dropValue
 
-    unordered_map<string,chrono::steady_clock::time_point> expiry_map;
+    //writes the stores to filename via a temp file + rename, caller provides consistency
+    bool writeSnapshot(const string& filename,uint64_t baseId=0,uint64_t* bytes=nullptr);
+    bool forkSnapshot(const string& filename,uint64_t baseId,function<void(bool)> done);
+    bool loadFile(const string& filename,bool delta,uint64_t& baseId);
+    //change tracking for delta checkpoints, caller holds db_mutex
+    void touch(const string& key);
+    void baseWritten(const string& filename,uint64_t firstDelta); //drops the deltas of older bases
+    unordered_set<string> dirty_keys;  //written or deleted since the last checkpoint
+    bool dirty_all=true;               //FLUSHALL, a failed save or no base yet: next one is a base
+    uint64_t dirty_changes=0;          //writes since the last checkpoint, for the save points
+    chrono::steady_clock::time_point last_checkpoint=chrono::steady_clock::now();
+    uint64_t base_id=0;                //AUX base-id of the current base, deltas name it
+    uint64_t pending_base_id=0;        //a base child is writing this one, deltas name it too
+    bool pending_chain_kept=false;     //...false: base_id had no complete chain, deltas wait
+    uint64_t next_delta=1;
+    vector<unordered_set<string>> slot_keys; //keys per hash slot, empty unless cluster mode
+    void rebuildSlotIndex();                 //caller holds db_mutex
+    bool loadText(istream& in); //pre-binary dumps, caller holds db_mutex
+    mutex stats_mutex;
+    PersistenceStats stats;
+    atomic<bool> bgsave_running{false}; //one forked child at a time
+    atomic<bool> rdb_child{false};      //...and it is writing the dbfilename base
 };    
 
 #endif
\ No newline at end of file
@@ -0,0 +1,110 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+using namespace std;
+
+#define REPL_OUTPUT_LIMIT (256 * 1024 * 1024) //replica that falls this far behind is dropped
+#define REPL_PING_PERIOD 10                   //seconds between PINGs on an idle stream
+
+/*
+Primary-replica replication, same protocol as Redis:
+
+  replica                                    master
+  PING                                  ->   +PONG
+  REPLCONF listening-port <port>        ->   +OK
+  PSYNC <replid> <offset+1> | PSYNC ? -1 ->  +CONTINUE <replid>, then the stream from offset+1
+                                             +FULLRESYNC <replid> <offset>,
+                                             $<len> + snapshot (dump.my_rdb format), then the stream
+  REPLCONF ACK <offset>  (every second) ->
+
+The stream is the RESP encoding of every write command, fed from the same point as
+the append-only file (under AppendOnlyFile::orderLock), so its order is the order the
+keyspace saw. The offset counts stream bytes; the last repl-backlog-size bytes are kept
+in a circular backlog so a replica that was briefly disconnected continues from its
+offset instead of taking a new snapshot.
+
+A full sync forks a snapshot (RedisDatabase::bgsave) while holding the order lock, so
+the snapshot and the start of that replica's stream meet exactly at <offset>.
+
+A replica applies the stream through the normal command path and appends the same
+bytes to its own backlog, so replicas of a replica see the master's replid/offsets.
+*/
+
+struct ReplicaLink; // master side view of one connected replica
+
+class Replication {
+public:
+    static Replication& getInstance();
+    void setListeningPort(int port) { listeningPort = port; }
+
+    // master side
+    // true once a replica has connected; write commands are then fed to the stream
+    bool active() const { return backlogActive; }
+    // appends one executed write command to the stream, caller holds the order lock
+    void feed(const vector<string>& tokens);
+    // PSYNC arrived on a client connection: this thread now serves that replica until it goes away
+    void serveReplica(int fd, const vector<string>& psync, int replicaPort, const string& pending);
+
+    // replica side
+    void replicaOf(const string& host, int port); // REPLICAOF host port
+    void promote();                               // REPLICAOF NO ONE
+    bool isReplica() const { return replica; }
+    // writes from regular clients are refused on a read-only replica
+    bool rejectsWrites() const;
+    // true on the thread applying the master's stream (it already holds the order lock)
+    static bool fromMaster();
+
+    void cron(); // once a second: PINGs the replicas so their links do not time out
+    void shutdown(); // closes the master link and every replica connection
+    string info(); // INFO replication
+
+private:
+    Replication();
+    Replication(const Replication&) = delete;
+    Replication& operator=(const Replication&) = delete;
+
+    void appendStream(const char* data, size_t len); // caller holds repl_mutex
+    void createBacklog();                            // caller holds repl_mutex
+    string backlogFrom(uint64_t start);              // bytes from stream position start on
+    void disconnectReplicas();                       // caller holds repl_mutex
+    void masterLoop();                               // replica side link thread
+    bool syncWithMaster(int fd);
+    void stopLink();
+
+    mutex repl_mutex;
+    condition_variable out_cv;    // replica senders wait for stream data
+    string replid;                // 40 hex chars, names the history the offsets belong to
+    string replid2;               // previous replid after a promotion...
+    uint64_t secondOffset = 0;    // ...valid for PSYNC up to this position
+    uint64_t offset = 0;          // stream bytes so far
+    string backlog;               // circular, repl-backlog-size bytes
+    size_t backlogIdx = 0;        // where the next byte goes
+    uint64_t histlen = 0;         // valid bytes in the backlog
+    atomic<bool> backlogActive{false};
+    vector<shared_ptr<ReplicaLink>> replicas;
+    int listeningPort = 6379;
+    int pingTicks = 0;
+
+    // replica side
+    atomic<bool> replica{false};
+    string masterHost;
+    int masterPort = 0;
+    thread link;
+    atomic<bool> linkStop{false};
+    atomic<int> linkFd{-1};
+    bool linkUp = false;
+    bool syncInProgress = false;
+    uint64_t syncBytes = 0;
+    chrono::steady_clock::time_point lastIo;
+    chrono::steady_clock::time_point linkDownSince;
+};
+
+#endif
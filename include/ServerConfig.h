@@ -0,0 +1,97 @@
+#ifndef SERVER_CONFIG_H
+#define SERVER_CONFIG_H
+#include <string>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+using namespace std;
+
+/*
+Runtime settings, filled from the command line (./redis-lite 6379 --appendonly yes)
+and changed at runtime with CONFIG SET. Names follow redis.conf. Settings read on the
+hot path are atomics so command threads never take config_mutex.
+*/
+enum class AppendFsync { Always, EverySec, No };
+enum class LatencyClock { Tsc, Coarse };
+// which keys go when the keyspace outgrows maxmemory; volatile-*: only keys with a TTL
+enum class MaxMemoryPolicy {
+    NoEviction, AllKeysLru, AllKeysLfu, AllKeysRandom,
+    VolatileLru, VolatileLfu, VolatileRandom, VolatileTtl
+};
+
+// "save 900 1": checkpoint when at least `changes` writes happened in `seconds`
+struct SavePoint {
+    uint64_t seconds;
+    uint64_t changes;
+};
+
+class ServerConfig {
+public:
+    static ServerConfig& getInstance();
+
+    // --name value pairs after the port; returns false (and prints why) on a bad option
+    bool parseArgs(int argc, char* argv[], int first);
+    bool set(const string& name, const string& value, string& error);
+    // name/value pairs of every setting matching a glob style pattern ("*", "append*")
+    vector<pair<string, string>> get(const string& pattern);
+
+    // persistence
+    string dbFilename = "dump.my_rdb";      // startup only
+    vector<SavePoint> save = {{3600, 1}, {300, 100}, {60, 10000}}; // under config_mutex
+    vector<SavePoint> savePoints(); // copy of save for the checkpoint thread
+    atomic<uint64_t> checkpointMaxDeltas{16}; // deltas before they are merged into a new base
+    atomic<bool> appendOnly{false};         // startup only
+    atomic<AppendFsync> appendFsync{AppendFsync::EverySec};
+    string appendFilename = "appendonly.aof"; // startup only
+    string appendDirname = "appendonlydir";   // startup only
+    atomic<uint64_t> autoAofRewritePercentage{100};
+    atomic<uint64_t> autoAofRewriteMinSize{64 * 1024 * 1024};
+
+    // replication
+    atomic<uint64_t> replBacklogSize{1024 * 1024};
+    atomic<bool> replicaReadOnly{true};
+    atomic<uint64_t> replTimeout{60}; // seconds without traffic before a link is dropped
+
+    // cluster
+    bool clusterEnabled = false;               // startup only
+    string clusterConfigFile = "nodes.conf";   // startup only, written by the server
+    string clusterAnnounceIp = "127.0.0.1";    // startup only, the address peers and clients are given
+    atomic<uint64_t> clusterNodeTimeout{15000}; // ms without a reply before a node is flagged fail
+
+    // client side caching
+    atomic<uint64_t> trackingTableMaxKeys{1000000}; // keys remembered for CLIENT TRACKING, 0: no limit
+
+    // per command latency (INFO latencystats, LATENCY HISTOGRAM)
+    atomic<bool> latencyTracking{true};
+    atomic<LatencyClock> latencyClock{LatencyClock::Tsc};
+    atomic<int64_t> slowlogLogSlowerThan{10000}; // usec, negative: log nothing
+    atomic<uint64_t> slowlogMaxLen{128};
+    atomic<uint64_t> latencyMonitorThreshold{0}; // ms, LATENCY LATEST/HISTORY spikes, 0: off
+
+    // memory limit
+    atomic<uint64_t> maxMemory{0};       // keyspace bytes as MEMORY STATS prices them (dataset.bytes), 0: no limit
+    atomic<MaxMemoryPolicy> maxMemoryPolicy{MaxMemoryPolicy::NoEviction};
+    atomic<uint64_t> maxMemorySamples{5}; // keys sampled per table for each eviction
+    atomic<uint64_t> lfuLogFactor{10};    // hits needed to saturate the LFU counter grow with it
+    atomic<uint64_t> lfuDecayTime{1};     // minutes per unit the LFU counter loses while idle, 0: never
+
+    // lazy free: big values are freed by a background thread (see LazyFree)
+    atomic<bool> lazyfreeLazyUserDel{false};   // DEL frees like UNLINK
+    atomic<bool> lazyfreeLazyUserFlush{false}; // FLUSHALL without SYNC is FLUSHALL ASYNC
+    atomic<bool> lazyfreeLazyServerDel{true};  // values replaced by SET and RESTORE REPLACE
+    atomic<bool> lazyfreeLazyExpire{true};
+    atomic<bool> lazyfreeLazyEviction{true};
+
+    // monitoring
+    int metricsPort = 0; // startup only, HTTP port serving /metrics for Prometheus, 0: none
+
+private:
+    ServerConfig() = default;
+    ServerConfig(const ServerConfig&) = delete;
+    ServerConfig& operator=(const ServerConfig&) = delete;
+    mutex config_mutex;
+    bool started = false; // set once parseArgs is done, startup only settings are frozen after
+};
+
+#endif
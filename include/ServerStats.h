@@ -0,0 +1,107 @@
+#ifndef SERVER_STATS_H
+#define SERVER_STATS_H
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+using namespace std;
+
+// counters of INFO stats, one slot each
+enum Stat {
+    STAT_COMMANDS,          // total_commands_processed
+    STAT_CONNECTIONS,       // total_connections_received
+    STAT_NET_INPUT,         // bytes read from clients
+    STAT_NET_OUTPUT,        // bytes written to clients
+    STAT_KEYSPACE_HITS,     // reads that found their key
+    STAT_KEYSPACE_MISSES,
+    STAT_EXPIRED,           // keys removed because their TTL ran out
+    STAT_EVICTED,           // keys removed to stay under maxmemory
+    STAT_COUNT
+};
+
+// one thread's counters, alone on its cache line(s)
+struct alignas(64) StatSlot {
+    atomic<uint64_t> values[STAT_COUNT] = {};
+};
+
+/*
+Server-wide counters for INFO. The hot ones (commands, bytes, hits...) are counted per
+thread: add() bumps the calling thread's own slot with a relaxed load and store, no
+lock and no cache line shared with another writer, and INFO sums the slots when asked.
+When a thread exits its slot goes back to a free list and is reused, counts included,
+so totals never go backwards and there are never more slots than threads at the peak.
+
+The rates (instantaneous_ops_per_sec, ..._kbps) come from a ring of totals sampled
+every 100ms by the cron.
+*/
+class ServerStats {
+public:
+    static ServerStats& getInstance();
+
+    static void add(Stat stat, uint64_t n = 1) {
+        atomic<uint64_t>& value = local().values[stat];
+        value.store(value.load(memory_order_relaxed) + n, memory_order_relaxed);
+    }
+    uint64_t total(Stat stat);
+    void totals(uint64_t values[STAT_COUNT]); // every counter summed over the slots
+    uint64_t uptimeSeconds() const;
+
+    void setPort(int p) { port = p; }
+    void clientConnected();
+    void clientDisconnected();
+    int connectedClients() const { return connected; }
+
+    void sample(); // cron, every 100ms
+
+    // sections of INFO
+    string serverInfo();
+    string clientsInfo();
+    string memoryInfo();
+    string statsInfo();
+    string cpuInfo();
+
+    size_t usedMemory();        // bytes the allocator handed out and not got back
+    size_t rssMemory();         // resident set size of the process
+
+private:
+    ServerStats();
+    ServerStats(const ServerStats&) = delete;
+    ServerStats& operator=(const ServerStats&) = delete;
+
+    struct SlotHandle {
+        StatSlot* slot;
+        SlotHandle();
+        ~SlotHandle();
+    };
+    static StatSlot& local() {
+        thread_local SlotHandle handle;
+        return *handle.slot;
+    }
+    StatSlot* acquireSlot();
+    void releaseSlot(StatSlot* slot);
+    double rate(Stat stat);                   // per second over the sample ring
+
+    mutex slots_mutex;
+    vector<unique_ptr<StatSlot>> slots;
+    vector<StatSlot*> freeSlots;
+
+    static const int SAMPLES = 16;
+    struct Sample {
+        chrono::steady_clock::time_point at;
+        uint64_t values[STAT_COUNT];
+    };
+    mutex sample_mutex;
+    Sample ring[SAMPLES];
+    int samples = 0;     // taken so far, the newest at (samples - 1) % SAMPLES
+    size_t peakMemory = 0;
+
+    chrono::steady_clock::time_point startedSteady;
+    time_t startedAt;
+    int port = 0;
+    atomic<int> connected{0};
+};
+
+#endif
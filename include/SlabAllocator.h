@@ -0,0 +1,87 @@
+#ifndef SLAB_ALLOCATOR_H
+#define SLAB_ALLOCATOR_H
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+using namespace std;
+
+const size_t SLAB_CLASS_STEP = 8;        // object sizes are rounded up to a multiple of this
+const size_t SLAB_MAX_OBJECT = 256;      // bigger requests go to operator new
+const size_t SLAB_CLASSES = SLAB_MAX_OBJECT / SLAB_CLASS_STEP;
+const size_t SLAB_BYTES = 64 * 1024;     // what a class takes from malloc when it runs dry
+const size_t SLAB_CACHE_OBJECTS = 64;    // per class in a thread's cache; past twice that, half goes back
+
+// INFO memory slab_* fields
+struct SlabStats {
+    uint64_t active = 0;    // bytes of slabs taken from malloc
+    uint64_t allocated = 0; // ...of which not on a central free list (thread caches count as allocated)
+};
+
+/*
+Size-class allocator for the keyspace's small, fixed size allocations: table nodes (a
+key and its value, a hash field and its value, an expiry) and small bucket arrays.
+malloc puts an 8 byte header on each and rounds it to 16, and a freed node sits between
+live ones of other sizes; here an object is its size rounded to 8, and a class's objects
+only share slabs with each other, so a freed node is reused by the next of its kind.
+
+Every thread allocates from and frees to a cache of its own, no lock; a cache that runs
+dry takes SLAB_CACHE_OBJECTS / 2 objects from the class's central free list, one that
+grows past 2 * SLAB_CACHE_OBJECTS gives half back, and a thread's cache goes back when
+it exits. The central lists, one mutex each, are also where objects freed by another
+thread (the lazy free thread, a loader) end up. Slabs are never given back to malloc: a
+keyspace that shrinks keeps them for the next keys, the ratio in INFO shows how much of
+them is unused.
+*/
+class SlabArena {
+public:
+    static void* allocate(size_t bytes);
+    static void deallocate(void* p, size_t bytes);
+    static SlabStats stats();
+
+private:
+    struct FreeObject {
+        FreeObject* next;
+    };
+    struct CentralList {
+        mutex lock;
+        FreeObject* head = nullptr;
+        size_t count = 0;
+        size_t slabs = 0;
+    };
+    // trivially destructible, so it can still be used by frees after the thread's cleanup ran
+    struct ThreadCache {
+        FreeObject* head[SLAB_CLASSES];
+        uint32_t count[SLAB_CLASSES];
+        bool flusherSet; // a CacheFlusher will give the cache back when the thread exits
+        bool exited;
+    };
+    struct CacheFlusher {
+        ~CacheFlusher();
+    };
+
+    static CentralList central[SLAB_CLASSES];
+    static thread_local ThreadCache cache;
+
+    static void setFlusher();
+    static void refill(size_t c);
+    static void giveBack(size_t c, uint32_t objects);
+    static void flushCache();
+};
+
+// std allocator over SlabArena, for the keyspace's unordered_maps
+template<class T>
+struct SlabAllocator {
+    using value_type = T;
+    SlabAllocator() noexcept = default;
+    template<class U>
+    SlabAllocator(const SlabAllocator<U>&) noexcept {}
+    T* allocate(size_t n) { return static_cast<T*>(SlabArena::allocate(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) noexcept { SlabArena::deallocate(p, n * sizeof(T)); }
+};
+template<class T, class U>
+bool operator==(const SlabAllocator<T>&, const SlabAllocator<U>&) { return true; }
+template<class T, class U>
+bool operator!=(const SlabAllocator<T>&, const SlabAllocator<U>&) { return false; }
+
+#endif
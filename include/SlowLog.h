@@ -0,0 +1,68 @@
+#ifndef SLOW_LOG_H
+#define SLOW_LOG_H
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include "ServerConfig.h"
+using namespace std;
+
+const int SLOWLOG_RING = 1024;          // entries the ring holds, slowlog-max-len is capped to it
+const int SLOWLOG_MAX_ARGC = 32;        // arguments kept, the rest is "... (N more arguments)"
+const int SLOWLOG_MAX_ARG_LEN = 128;    // bytes kept of an argument, the rest is "... (N more bytes)"
+const int SLOWLOG_ARG_BYTES = 1024;     // all kept arguments of one entry together
+const int SLOWLOG_CLIENT_LEN = 48;
+
+// one entry, rewritten in place when the ring comes round
+struct SlowLogSlot {
+    atomic<uint64_t> seq{0};    // odd while being written, 2 * (id + 1) once entry id is complete
+    uint64_t id = 0;
+    int64_t time = 0;           // unix seconds when the command finished
+    uint64_t usec = 0;
+    uint32_t argc = 0;          // arguments the command had
+    uint32_t kept = 0;          // of which are in args
+    uint32_t argLens[SLOWLOG_MAX_ARGC] = {};    // their full lengths
+    char args[SLOWLOG_ARG_BYTES];               // the kept bytes of each, one after the other
+    char client[SLOWLOG_CLIENT_LEN];
+};
+
+/*
+SLOWLOG GET [count] | LEN | RESET: commands that ran for slowlog-log-slower-than usec or
+more (negative: none, 0: all), the newest slowlog-max-len of them.
+
+Entries go into a fixed ring of slots. A writer takes the next id with one fetch_add and
+fills the slot under a per slot sequence number (a seqlock): no mutex, so logging a slow
+command never holds up the commands after it, and no allocation. Readers copy a slot and
+keep the copy only if its sequence number was even and unchanged around the copy. Should
+two writers meet on one slot (the ring came round during a write) the later one drops its
+entry. RESET hides the entries logged so far instead of clearing the slots.
+*/
+class SlowLog {
+public:
+    static SlowLog& getInstance();
+
+    // the connection whose commands this thread runs, "ip:port"
+    static void setClient(const string& address);
+
+    void consider(const vector<string>& tokens, uint64_t usec) {
+        int64_t slowerThan = ServerConfig::getInstance().slowlogLogSlowerThan.load(memory_order_relaxed);
+        if (slowerThan >= 0 && usec >= static_cast<uint64_t>(slowerThan)) add(tokens, usec);
+    }
+    string command(const vector<string>& tokens);
+
+private:
+    SlowLog();
+    SlowLog(const SlowLog&) = delete;
+    SlowLog& operator=(const SlowLog&) = delete;
+
+    void add(const vector<string>& tokens, uint64_t usec);
+    bool read(uint64_t id, SlowLogSlot& out); // false when entry id is gone or being written
+    vector<uint64_t> visibleIds(uint64_t limit); // newest first
+
+    unique_ptr<SlowLogSlot[]> ring;
+    atomic<uint64_t> nextId{0};
+    atomic<uint64_t> resetBelow{0};
+};
+
+#endif
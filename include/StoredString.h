@@ -0,0 +1,131 @@
+#ifndef STORED_STRING_H
+#define STORED_STRING_H
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include "SlabAllocator.h"
+using namespace std;
+
+/*
+The keyspace's strings (keys, string values, hash fields and values) in one word instead
+of a 32 byte std::string. The low two bits tell what the word is:
+  INLINE    up to 7 bytes, kept in the word itself: the length in bits 2..4, the bytes
+            in bytes 1..7 (little endian hosts only, like the rdb format)
+  owned     a pointer to a block from SlabArena: the length in one byte (255: eight
+            more bytes follow with the real one), then the bytes, no terminator
+  BORROWED  a pointer to a caller's string_view, for lookups: KeyTable finds a key by a
+            std::string without copying it. Copying a borrowed one makes an owned copy.
+Copies are deep, moves take the word.
+*/
+class StoredString {
+public:
+    StoredString() noexcept : word(INLINE) {}
+    explicit StoredString(string_view s) : word(INLINE) { assign(s); }
+    StoredString(const StoredString& other) : StoredString(other.view()) {}
+    StoredString(StoredString&& other) noexcept : word(other.word) { other.word = INLINE; }
+    ~StoredString() { release(); }
+
+    StoredString& operator=(const StoredString& other) { return *this = other.view(); }
+    StoredString& operator=(StoredString&& other) noexcept {
+        if (this != &other) {
+            release();
+            word = other.word;
+            other.word = INLINE;
+        }
+        return *this;
+    }
+    StoredString& operator=(string_view s) {
+        StoredString copy(s); // s may point into this one
+        return *this = move(copy);
+    }
+
+    // a lookup key for s, valid as long as s is
+    static StoredString borrow(const string_view& s) {
+        StoredString key;
+        key.word = reinterpret_cast<uintptr_t>(&s) | BORROWED;
+        return key;
+    }
+
+    size_t size() const {
+        switch (word & TAG_MASK) {
+        case INLINE: return (word >> 2) & 7;
+        case BORROWED: return reinterpret_cast<const string_view*>(word & ~TAG_MASK)->size();
+        default: return blockLength(block());
+        }
+    }
+    const char* data() const {
+        switch (word & TAG_MASK) {
+        case INLINE: return reinterpret_cast<const char*>(&word) + 1;
+        case BORROWED: return reinterpret_cast<const string_view*>(word & ~TAG_MASK)->data();
+        default: return block() + (static_cast<uint8_t>(*block()) < LONG_LENGTH ? 1 : 9);
+        }
+    }
+    bool empty() const { return size() == 0; }
+    string_view view() const { return string_view(data(), size()); }
+    operator string_view() const { return view(); }
+    string str() const { return string(data(), size()); }
+
+    // what a string of len bytes allocates: 0 when it fits the word
+    static size_t blockBytes(size_t len) {
+        if (len <= INLINE_MAX) return 0;
+        return (len < LONG_LENGTH ? 1 : 9) + len;
+    }
+
+    friend bool operator==(const StoredString& a, const StoredString& b) {
+        size_t n = a.size();
+        return n == b.size() && memcmp(a.data(), b.data(), n) == 0;
+    }
+
+private:
+    static const uintptr_t TAG_MASK = 3;
+    static const uintptr_t INLINE = 1;
+    static const uintptr_t BORROWED = 2;
+    static const size_t INLINE_MAX = 7;
+    static const uint8_t LONG_LENGTH = 255;
+
+    uintptr_t word;
+
+    const char* block() const { return reinterpret_cast<const char*>(word); }
+    static size_t blockLength(const char* block) {
+        uint8_t len = static_cast<uint8_t>(*block);
+        if (len < LONG_LENGTH) return len;
+        uint64_t longLen;
+        memcpy(&longLen, block + 1, 8);
+        return longLen;
+    }
+    void assign(string_view s) {
+        size_t len = s.size();
+        if (len <= INLINE_MAX) {
+            word = INLINE | (len << 2);
+            memcpy(reinterpret_cast<char*>(&word) + 1, s.data(), len);
+            return;
+        }
+        char* block = static_cast<char*>(SlabArena::allocate(blockBytes(len)));
+        if (len < LONG_LENGTH) {
+            block[0] = static_cast<char>(len);
+            memcpy(block + 1, s.data(), len);
+        }
+        else {
+            uint64_t longLen = len;
+            block[0] = static_cast<char>(LONG_LENGTH);
+            memcpy(block + 1, &longLen, 8);
+            memcpy(block + 9, s.data(), len);
+        }
+        word = reinterpret_cast<uintptr_t>(block);
+    }
+    void release() {
+        if (word & TAG_MASK) return;
+        SlabArena::deallocate(reinterpret_cast<void*>(word), blockBytes(blockLength(block())));
+    }
+};
+
+// not noexcept on purpose: libstdc++ then keeps each node's hash, so rehashing and
+// walking a bucket do not have to read the key's block again
+struct StoredStringHash {
+    size_t operator()(const StoredString& s) const { return hash<string_view>()(s.view()); }
+};
+
+#endif
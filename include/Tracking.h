@@ -0,0 +1,103 @@
+#ifndef TRACKING_H
+#define TRACKING_H
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+using namespace std;
+
+/*
+Server assisted client side caching (CLIENT TRACKING), after Redis.
+
+  CLIENT TRACKING ON [NOLOOP]                        remember every key this connection reads
+  CLIENT TRACKING ON BCAST [PREFIX p ...] [NOLOOP]   no remembering: every change to a key
+                                                     starting with one of the prefixes (or any)
+  CLIENT TRACKING OFF
+
+When a remembered key changes (write, expiry, eviction by another client) the
+connection gets, on the same socket and outside of any reply, a RESP3 push frame
+  >2 $10 invalidate *N $key ...       (the keys)
+  >2 $10 invalidate _                 (FLUSHALL or a full resync: drop everything)
+and the key is forgotten until the connection reads it again. NOLOOP skips changes
+the connection made itself.
+
+Keys are remembered before the read executes, so a change can never slip in between
+the read and the remembering. The pushes are written by the connection that made the
+change, right after its command (before its own reply), or by a thread of their own
+for changes no connection made. While a connection has replies in flight its pushes
+are held back and written after those replies, so an invalidation never overtakes the
+read reply it invalidates.
+*/
+
+// one client connection, as far as tracking and writing to it are concerned
+struct TrackingClient {
+    uint64_t id = 0;
+    int fd = -1;
+    mutex io_mutex;     // one writer at a time on fd; guards busy and pending
+    bool busy = false;  // executing commands whose replies are not written yet
+    string pending;     // pushes the socket has not taken yet, maybe half a frame
+    string held;        // pushes that came in while busy, written after those replies
+    // written only by the connection's own thread, under tracking_mutex
+    bool on = false;
+    bool bcast = false;
+    bool noloop = false;
+    vector<string> prefixes;
+};
+
+class Tracking {
+public:
+    static Tracking& getInstance();
+
+    // connection side, on the connection's own thread
+    shared_ptr<TrackingClient> attach(int fd); // also the thread's current client from now on
+    void detach(const shared_ptr<TrackingClient>& client);
+    void beginReplies(TrackingClient& client);
+    // writes the replies of the commands just executed, then any pushes held back
+    bool sendReplies(TrackingClient& client, const string& response);
+
+    // command side
+    string command(const vector<string>& tokens); // CLIENT ...
+    bool active() const { return trackingClients > 0; }
+    void keysRead(const vector<string>& keys);    // the current connection is about to read these
+    void keyModified(const string& key);          // RedisDatabase::touch, under db_mutex
+    void keyspaceReplaced();                      // FLUSHALL, a full resync
+    // writes the invalidations queued so far; the connection loop calls it after every
+    // command, so they are on their way before the writer gets its reply
+    void flushInvalidations();
+    string info();                                // tracking lines of INFO
+    void shutdown();
+
+private:
+    Tracking() = default;
+    Tracking(const Tracking&) = delete;
+    Tracking& operator=(const Tracking&) = delete;
+
+    bool invalidate(uint64_t id, const string& key); // caller holds tracking_mutex
+    void evictKeys();                                // caller holds tracking_mutex
+    void pushLoop();
+    void deliver(unique_lock<mutex>& lock);          // takes the outbox, writes it without the lock
+    bool writePending(TrackingClient& client);       // caller holds client.io_mutex
+
+    mutex tracking_mutex;
+    condition_variable outbox_cv;
+    unordered_map<uint64_t, shared_ptr<TrackingClient>> clients; // every connection, by id
+    unordered_set<uint64_t> bcastClients;                        // tracking on in BCAST mode
+    unordered_map<string, unordered_set<uint64_t>> table;       // key -> ids that read it
+    atomic<int> trackingClients{0};
+    uint64_t nextId = 1;
+    // invalidations waiting for the push thread
+    unordered_map<uint64_t, vector<string>> outbox; // id -> keys
+    unordered_set<uint64_t> flushOutbox;            // ids told to drop everything
+    atomic<bool> queued{false}; // the outbox is not empty
+    bool backlog = false; // some socket did not take all of its pushes
+    thread pusher;
+    bool stopping = false;
+};
+
+#endif
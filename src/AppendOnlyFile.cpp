@@ -0,0 +1,491 @@
+#include "../include/AppendOnlyFile.h"
+#include "../include/RedisCommandHandler.h"
+#include "../include/ServerConfig.h"
+#include "../include/LatencyMonitor.h"
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+AppendOnlyFile& AppendOnlyFile::getInstance() {
+    static AppendOnlyFile instance;
+    return instance;
+}
+
+string AppendOnlyFile::path(const string& file) const {
+    return dir + "/" + file;
+}
+
+static uint64_t fileSize(const string& filename) {
+    struct stat st;
+    return stat(filename.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+static bool endsWith(const string& s, const string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static bool fsyncDir(const string& dirname) {
+    int dfd = ::open(dirname.c_str(), O_RDONLY);
+    if (dfd < 0) return false;
+    bool ok = fsync(dfd) == 0;
+    ::close(dfd);
+    return ok;
+}
+
+/*
+Manifest, one line per file:
+file appendonly.aof.3.base.rdb seq 3 type b
+file appendonly.aof.3.incr.aof seq 3 type i
+*/
+bool AppendOnlyFile::readManifest() {
+    ifstream in(path(baseName + ".manifest"));
+    if (!in) return false;
+    baseFile.clear();
+    incrFiles.clear();
+    currentSeq = 0;
+    string line;
+    while (getline(in, line)) {
+        istringstream iss(line);
+        string word, name, type;
+        uint64_t seq = 0;
+        while (iss >> word) {
+            if (word == "file") iss >> name;
+            else if (word == "seq") iss >> seq;
+            else if (word == "type") iss >> type;
+        }
+        if (name.empty()) continue;
+        if (type == "b") baseFile = name;
+        else if (type == "i") incrFiles.push_back(name);
+        currentSeq = max(currentSeq, seq);
+    }
+    return !baseFile.empty();
+}
+
+static uint64_t seqOf(const string& file) {
+    //appendonly.aof.<seq>.incr.aof
+    size_t end = file.rfind('.', file.rfind('.') - 1);
+    size_t start = file.rfind('.', end - 1);
+    try {
+        return stoull(file.substr(start + 1, end - start - 1));
+    } catch (const exception&) {
+        return 0;
+    }
+}
+
+bool AppendOnlyFile::writeManifest() {
+    string tmpName = path(baseName + ".manifest.tmp");
+    {
+        ofstream out(tmpName, ios::trunc);
+        if (!out) return false;
+        out << "file " << baseFile << " seq " << seqOf(baseFile) << " type b\n";
+        for (const auto& incr : incrFiles)
+            out << "file " << incr << " seq " << seqOf(incr) << " type i\n";
+        out.flush();
+        if (!out) return false;
+    }
+    int tfd = ::open(tmpName.c_str(), O_RDONLY);
+    if (tfd >= 0) {
+        fsync(tfd);
+        ::close(tfd);
+    }
+    if (::rename(tmpName.c_str(), path(baseName + ".manifest").c_str()) != 0) return false;
+    return fsyncDir(dir);
+}
+
+int AppendOnlyFile::openIncr(uint64_t seq) {
+    string name = path(baseName + "." + to_string(seq) + ".incr.aof");
+    return ::open(name.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+}
+
+bool AppendOnlyFile::exists() {
+    ServerConfig& config = ServerConfig::getInstance();
+    dir = config.appendDirname;
+    baseName = config.appendFilename;
+    return access(path(baseName + ".manifest").c_str(), F_OK) == 0 ||
+           access(baseName.c_str(), F_OK) == 0;
+}
+
+bool AppendOnlyFile::load(RedisDatabase& db, uint64_t& commands) {
+    commands = 0;
+    lock_guard<mutex> lock(manifest_mutex);
+    if (access(path(baseName + ".manifest").c_str(), F_OK) != 0) {
+        //single appendonly.aof from before the manifest: it becomes the first base
+        mkdir(dir.c_str(), 0755);
+        baseFile = baseName + ".1.base.aof";
+        if (::rename(baseName.c_str(), path(baseFile).c_str()) != 0) return false;
+        incrFiles.clear();
+        currentSeq = 1;
+        if (!writeManifest()) return false;
+    }
+    if (!readManifest()) return false;
+
+    if (endsWith(baseFile, ".rdb")) {
+        if (!db.load(path(baseFile))) return false;
+    }
+    else {
+        uint64_t baseCommands;
+        if (!replay(path(baseFile), db, baseCommands)) return false;
+        commands += baseCommands;
+    }
+    for (const auto& incr : incrFiles) {
+        uint64_t incrCommands;
+        if (access(path(incr).c_str(), F_OK) != 0) continue; //created but never written to
+        if (!replay(path(incr), db, incrCommands)) return false;
+        commands += incrCommands;
+    }
+    return true;
+}
+
+bool AppendOnlyFile::open() {
+    if (running) return true;
+    {
+        lock_guard<mutex> lock(manifest_mutex);
+        ServerConfig& config = ServerConfig::getInstance();
+        dir = config.appendDirname;
+        baseName = config.appendFilename;
+        mkdir(dir.c_str(), 0755);
+        if (!readManifest()) {
+            //first start with appendonly: whatever dump.my_rdb gave us is the base
+            currentSeq = 1;
+            baseFile = baseName + ".1.base.rdb";
+            incrFiles.clear();
+            if (!RedisDatabase::getInstance().dump(path(baseFile))) {
+                cerr << "Can't write the append-only base " << path(baseFile) << "\n";
+                return false;
+            }
+        }
+        if (incrFiles.empty()) {
+            incrFiles.push_back(baseName + "." + to_string(currentSeq) + ".incr.aof");
+        }
+        if (!writeManifest()) {
+            cerr << "Can't write the append-only manifest in " << dir << "\n";
+            return false;
+        }
+        fd = ::open(path(incrFiles.back()).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) {
+            cerr << "Can't open the append-only file " << path(incrFiles.back()) << "\n";
+            return false;
+        }
+    }
+    pending.reserve(64 * 1024);
+    writing.reserve(64 * 1024);
+    stopping = false;
+    counters = AofStats();
+    running = true;
+    writer = thread(&AppendOnlyFile::writerLoop, this);
+    return true;
+}
+
+void AppendOnlyFile::close() {
+    if (!running) return;
+    {
+        lock_guard<mutex> lock(aof_mutex);
+        stopping = true;
+    }
+    work_cv.notify_one();
+    writer.join();
+    fsync(fd);
+    ::close(fd);
+    fd = -1;
+    running = false;
+}
+
+uint64_t AppendOnlyFile::feed(const vector<string>& tokens) {
+    lock_guard<mutex> lock(aof_mutex);
+    pending += "*" + to_string(tokens.size()) + "\r\n";
+    for (const auto& token : tokens) {
+        pending += "$" + to_string(token.size()) + "\r\n";
+        pending += token;
+        pending += "\r\n";
+    }
+    work_cv.notify_one();
+    return ++fedSeq;
+}
+
+void AppendOnlyFile::waitSynced(uint64_t seq) {
+    unique_lock<mutex> lock(aof_mutex);
+    synced_cv.wait(lock, [&] { return syncedSeq >= seq || stopping; });
+}
+
+static bool writeAll(int fd, const string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n <= 0) return false;
+        written += n;
+    }
+    return true;
+}
+
+/*
+Writer thread. While it is inside write()/fsync() new commands pile up in `pending`,
+so under load each round carries many commands and a single fsync covers them all.
+*/
+void AppendOnlyFile::writerLoop() {
+    auto lastFsync = chrono::steady_clock::now();
+    bool unsynced = false;
+    unique_lock<mutex> lock(aof_mutex);
+    while (true) {
+        work_cv.wait_for(lock, chrono::seconds(1),
+                         [&] { return stopping || !pending.empty() || nextFd >= 0; });
+        if (stopping && pending.empty() && nextFd < 0) break;
+        writing.swap(pending);
+        string tail;
+        tail.swap(retiredTail);
+        int switchTo = nextFd;
+        nextFd = -1;
+        uint64_t batchSeq = fedSeq;
+        AppendFsync policy = ServerConfig::getInstance().appendFsync;
+        lock.unlock();
+
+        bool ok = true;
+        if (switchTo >= 0) {
+            //a rewrite started: finish the old incr file, then continue in the new one
+            ok = writeAll(fd, tail);
+            fdatasync(fd);
+            ::close(fd);
+            fd = switchTo;
+            unsynced = false;
+        }
+        {
+            LatencySample sample("aof-write");
+            ok = writeAll(fd, writing) && ok;
+        }
+        unsynced = unsynced || !writing.empty();
+
+        auto now = chrono::steady_clock::now();
+        bool doSync = unsynced && (policy == AppendFsync::Always ||
+            (policy == AppendFsync::EverySec && now - lastFsync >= chrono::seconds(1)));
+        long long fsyncUsec = 0;
+        if (doSync) {
+            fdatasync(fd);
+            lastFsync = chrono::steady_clock::now();
+            fsyncUsec = chrono::duration_cast<chrono::microseconds>(lastFsync - now).count();
+            LatencyMonitor::getInstance().add("aof-fsync", fsyncUsec / 1000);
+            unsynced = false;
+        }
+
+        lock.lock();
+        writing.clear();
+        counters.lastWriteOk = ok;
+        if (doSync) {
+            counters.fsyncs++;
+            counters.lastFsyncUsec = fsyncUsec;
+        }
+        //with everysec/no a command counts as done once it reached the kernel; a switch
+        //synced the retired tail, which may hold the whole batch when writing is empty
+        if (doSync || switchTo >= 0 || policy != AppendFsync::Always) {
+            syncedSeq = batchSeq;
+            synced_cv.notify_all();
+        }
+    }
+    syncedSeq = fedSeq;
+    synced_cv.notify_all();
+}
+
+/*
+BGREWRITEAOF. Writers are held back (order_mutex) only while the child is forked and
+the writer thread is told to start a new incr file, so every command fed before this
+point is in the child's snapshot and every command after it lands in the new tail.
+*/
+bool AppendOnlyFile::rewrite() {
+    if (!running) return false;
+    RedisDatabase& db = RedisDatabase::getInstance();
+    auto start = chrono::steady_clock::now();
+    lock_guard<mutex> order(order_mutex);
+
+    uint64_t newSeq;
+    string newBase, newIncr;
+    {
+        lock_guard<mutex> lock(manifest_mutex);
+        newSeq = currentSeq + 1;
+        newBase = baseName + "." + to_string(newSeq) + ".base.rdb";
+        newIncr = baseName + "." + to_string(newSeq) + ".incr.aof";
+    }
+    int newFd = openIncr(newSeq);
+    if (newFd < 0) return false;
+    {
+        //list the new tail before anything is written to it, in case we crash mid-rewrite
+        lock_guard<mutex> lock(manifest_mutex);
+        incrFiles.push_back(newIncr);
+        currentSeq = newSeq;
+        writeManifest();
+    }
+
+    bool started = db.bgsave(path(newBase), [this, newBase, newIncr, start](bool ok) {
+        {
+            lock_guard<mutex> lock(manifest_mutex);
+            if (ok) {
+                vector<string> obsolete(incrFiles.begin(), incrFiles.end() - 1);
+                obsolete.push_back(baseFile);
+                baseFile = newBase;
+                incrFiles = {newIncr};
+                ok = writeManifest();
+                if (ok) {
+                    for (const auto& file : obsolete) unlink(path(file).c_str());
+                }
+            }
+        }
+        lock_guard<mutex> lock(aof_mutex);
+        counters.rewriteInProgress = false;
+        counters.lastRewriteOk = ok;
+        counters.lastRewriteSeconds =
+            chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now() - start).count();
+        if (ok) counters.rewrites++;
+    });
+    if (!started) {
+        ::close(newFd);
+        unlink(path(newIncr).c_str());
+        lock_guard<mutex> lock(manifest_mutex);
+        incrFiles.pop_back();
+        writeManifest();
+        return false;
+    }
+
+    {
+        lock_guard<mutex> lock(aof_mutex);
+        retiredTail.append(pending);
+        pending.clear();
+        nextFd = newFd;
+        counters.rewriteInProgress = true;
+        counters.rewriteScheduled = false;
+        counters.lastSwitchUsec =
+            chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    }
+    work_cv.notify_one();
+    return true;
+}
+
+void AppendOnlyFile::scheduleRewrite() {
+    lock_guard<mutex> lock(aof_mutex);
+    counters.rewriteScheduled = true;
+}
+
+void AppendOnlyFile::rewriteIfNeeded() {
+    if (!running || RedisDatabase::getInstance().forkInProgress()) return;
+    AofStats st = stats();
+    if (st.rewriteScheduled) {
+        rewrite();
+        return;
+    }
+    ServerConfig& config = ServerConfig::getInstance();
+    uint64_t percentage = config.autoAofRewritePercentage;
+    if (percentage == 0 || st.currentSize < config.autoAofRewriteMinSize) return;
+    uint64_t base = max<uint64_t>(st.baseSize, 1);
+    uint64_t growth = st.currentSize > base ? (st.currentSize - base) * 100 / base : 0;
+    if (growth >= percentage) {
+        cout << "Starting automatic rewriting of AOF on " << growth << "% growth\n";
+        rewrite();
+    }
+}
+
+AofStats AppendOnlyFile::stats() {
+    uint64_t base = 0, incr = 0;
+    {
+        lock_guard<mutex> lock(manifest_mutex);
+        if (!baseFile.empty()) base = fileSize(path(baseFile));
+        for (const auto& file : incrFiles) incr += fileSize(path(file));
+    }
+    lock_guard<mutex> lock(aof_mutex);
+    AofStats result = counters;
+    result.enabled = running;
+    result.pendingBytes = pending.size() + writing.size() + retiredTail.size();
+    result.baseSize = base;
+    result.currentSize = base + incr + result.pendingBytes;
+    return result;
+}
+
+/*
+Replay fast path: commands go straight to the RedisDatabase calls they stand for.
+Unlike processCommand() nothing is looked up twice and no reply is built.
+*/
+static bool applyWriteCommand(vector<string>& t, RedisDatabase& db) {
+    if (t.empty()) return false;
+    string& cmd = t[0];
+    transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+    string value;
+    if (cmd == "SET" && t.size() >= 3) db.set(t[1], t[2]);
+    else if ((cmd == "DEL" || cmd == "UNLINK") && t.size() >= 2) db.del(t[1]);
+    else if (cmd == "PEXPIREAT" && t.size() >= 3) db.pexpireat(t[1], stoull(t[2]));
+    else if (cmd == "EXPIRE" && t.size() >= 3) db.expire(t[1], stoi(t[2]));
+    else if (cmd == "RENAME" && t.size() >= 3) db.rename(t[1], t[2]);
+    else if (cmd == "FLUSHALL") db.flushAll();
+    else if (cmd == "LPUSH" && t.size() >= 3) { for (size_t i = 2; i < t.size(); i++) db.lpush(t[1], t[i]); }
+    else if (cmd == "RPUSH" && t.size() >= 3) { for (size_t i = 2; i < t.size(); i++) db.rpush(t[1], t[i]); }
+    else if (cmd == "LPOP" && t.size() >= 2) db.lpop(t[1], value);
+    else if (cmd == "RPOP" && t.size() >= 2) db.rpop(t[1], value);
+    else if (cmd == "LREM" && t.size() >= 4) db.lrem(t[1], stoi(t[2]), t[3]);
+    else if (cmd == "LSET" && t.size() >= 4) db.lset(t[1], stoi(t[2]), t[3]);
+    else if (cmd == "HSET" && t.size() >= 4) db.hset(t[1], t[2], t[3]);
+    else if (cmd == "HDEL" && t.size() >= 3) db.hdel(t[1], t[2]);
+    else if (cmd == "HMSET" && t.size() >= 4) {
+        vector<pair<string, string>> fieldValues;
+        for (size_t i = 2; i + 1 < t.size(); i += 2) fieldValues.emplace_back(move(t[i]), move(t[i + 1]));
+        db.hmset(t[1], fieldValues);
+    }
+    //logged as RESTORE key <unix ms deadline> payload REPLACE ABSTTL
+    else if (cmd == "RESTORE" && t.size() >= 4) {
+        string error;
+        return db.restoreKey(t[1], t[3], stoull(t[2]), true, error);
+    }
+    else return false;
+    return true;
+}
+
+bool AppendOnlyFile::replay(const string& filename, RedisDatabase& db, uint64_t& commands) {
+    commands = 0;
+    int fd = ::open(filename.c_str(), O_RDWR);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    if (size == 0) {
+        ::close(fd);
+        return true;
+    }
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        ::close(fd);
+        return false;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    const char* data = static_cast<const char*>(map);
+
+    size_t pos = 0;
+    vector<string> tokens;
+    bool ok = true;
+    while (pos < size) {
+        size_t used = parseRespFrame(data + pos, size - pos, tokens);
+        if (used == 0) break; //truncated tail, e.g. a crash in the middle of a write()
+        if (used == string::npos) {
+            cerr << "Bad command in " << filename << " at offset " << pos << "\n";
+            ok = false;
+            break;
+        }
+        try {
+            if (applyWriteCommand(tokens, db)) commands++;
+        } catch (const exception&) {
+            //a command that failed when it first ran fails the same way now
+        }
+        pos += used;
+    }
+    munmap(map, size);
+    if (ok && pos < size) {
+        cerr << "Truncated append-only file " << filename << ", dropping the last "
+             << size - pos << " bytes\n";
+        if (ftruncate(fd, pos) != 0) ok = false;
+    }
+    ::close(fd);
+    return ok;
+}
@@ -0,0 +1,763 @@
+#include "../include/Cluster.h"
+#include "../include/RedisDatabase.h"
+#include "../include/ServerConfig.h"
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <random>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+Cluster& Cluster::getInstance() {
+    static Cluster instance;
+    return instance;
+}
+
+// CRC16-CCITT (XMODEM): polynomial 0x1021, initial value 0 --the one Redis Cluster uses
+static uint16_t crc16(const char* data, size_t len) {
+    static const vector<uint16_t> table = []() {
+        vector<uint16_t> t(256);
+        for (int i = 0; i < 256; i++) {
+            uint16_t crc = static_cast<uint16_t>(i << 8);
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+            t[i] = crc;
+        }
+        return t;
+    }();
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++)
+        crc = static_cast<uint16_t>((crc << 8) ^ table[((crc >> 8) ^ static_cast<uint8_t>(data[i])) & 0xff]);
+    return crc;
+}
+
+unsigned int Cluster::keySlot(const string& key) {
+    size_t open = key.find('{');
+    if (open != string::npos) {
+        size_t close = key.find('}', open + 1);
+        if (close != string::npos && close > open + 1)
+            return crc16(key.data() + open + 1, close - open - 1) & (CLUSTER_SLOTS - 1);
+    }
+    return crc16(key.data(), key.size()) & (CLUSTER_SLOTS - 1);
+}
+
+// first and last argument holding a key (-1: up to the end)
+vector<string> Cluster::commandKeys(const string& cmd, const vector<string>& tokens) {
+    static const unordered_map<string, pair<int, int>> keySpecs = {
+        {"SET", {1, 1}}, {"GET", {1, 1}}, {"TYPE", {1, 1}}, {"DEL", {1, 1}}, {"UNLINK", {1, 1}},
+        {"EXPIRE", {1, 1}}, {"PEXPIREAT", {1, 1}}, {"RENAME", {1, 2}},
+        {"LGET", {1, 1}}, {"LLEN", {1, 1}}, {"LPUSH", {1, 1}}, {"RPUSH", {1, 1}}, {"LPOP", {1, 1}},
+        {"RPOP", {1, 1}}, {"LREM", {1, 1}}, {"LINDEX", {1, 1}}, {"LSET", {1, 1}},
+        {"HSET", {1, 1}}, {"HGET", {1, 1}}, {"HEXISTS", {1, 1}}, {"HDEL", {1, 1}}, {"HGETALL", {1, 1}},
+        {"HKEYS", {1, 1}}, {"HVALS", {1, 1}}, {"HLEN", {1, 1}}, {"HMSET", {1, 1}},
+        {"DUMP", {1, 1}}, {"RESTORE", {1, 1}}, {"STRLEN", {1, 1}}, {"MEMORY", {2, 2}}
+    };
+    vector<string> keys;
+    auto it = keySpecs.find(cmd);
+    if (it == keySpecs.end()) return keys;
+    int last = it->second.second < 0 ? static_cast<int>(tokens.size()) - 1 : it->second.second;
+    for (int i = it->second.first; i <= last && i < static_cast<int>(tokens.size()); i++)
+        keys.push_back(tokens[i]);
+    return keys;
+}
+
+static string newNodeId() {
+    static const char* hex = "0123456789abcdef";
+    random_device rd;
+    string id;
+    for (int i = 0; i < 40; i++) id += hex[rd() % 16];
+    return id;
+}
+
+static void appendResp(string& out, const vector<string>& tokens) {
+    out += "*" + to_string(tokens.size()) + "\r\n";
+    for (const auto& token : tokens) {
+        out += "$" + to_string(token.size()) + "\r\n";
+        out += token;
+        out += "\r\n";
+    }
+}
+
+static string bulk(const string& s) {
+    return "$" + to_string(s.size()) + "\r\n" + s + "\r\n";
+}
+
+static bool sendAll(int fd, const string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+// bytes of the complete RESP reply at the front of data, 0 while it is incomplete
+static size_t replyLength(const char* data, size_t len) {
+    const char* eol = len ? static_cast<const char*>(memmem(data, len, "\r\n", 2)) : nullptr;
+    if (!eol) return 0;
+    size_t head = eol - data + 2;
+    long long n = atoll(data + 1);
+    if (data[0] == '$') {
+        if (n < 0) return head;
+        return len - head >= static_cast<size_t>(n) + 2 ? head + n + 2 : 0;
+    }
+    if (data[0] == '*') {
+        size_t pos = head;
+        for (long long i = 0; i < n; i++) {
+            size_t used = replyLength(data + pos, len - pos);
+            if (!used) return 0;
+            pos += used;
+        }
+        return pos;
+    }
+    return head;
+}
+
+static bool readReply(int fd, string& buf, string& reply) {
+    char chunk[16 * 1024];
+    while (true) {
+        size_t used = replyLength(buf.data(), buf.size());
+        if (used) {
+            reply = buf.substr(0, used);
+            buf.erase(0, used);
+            return true;
+        }
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        buf.append(chunk, n);
+    }
+}
+
+// blocking connect; connect, sends and receives give up after timeoutMs
+static int connectTo(const string& host, int port, int timeoutMs) {
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    if (getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &res) != 0) return -1;
+    timeval tv{timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+    int fd = -1;
+    for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static bool parseSlot(const string& s, unsigned int& slot) {
+    if (s.empty() || s.size() > 5 || s.find_first_not_of("0123456789") != string::npos) return false;
+    slot = stoul(s);
+    return slot < CLUSTER_SLOTS;
+}
+
+// one line of CLUSTER NODES / cluster-config-file:
+// <id> <ip>:<port>@<bus-port> <flags> <master> <ping-sent> <pong-recv> <epoch> <link> <slot|range|[moving]>...
+struct NodeLine {
+    string id;
+    string host;
+    int port = 0;
+    bool myself = false;
+    uint64_t epoch = 0;
+    vector<pair<unsigned int, unsigned int>> ranges;
+    vector<pair<unsigned int, string>> migrating; // [slot->-id]
+    vector<pair<unsigned int, string>> importing; // [slot-<-id]
+};
+
+static bool parseNodeLine(const string& line, NodeLine& out) {
+    istringstream in(line);
+    vector<string> f{istream_iterator<string>(in), istream_iterator<string>()};
+    if (f.size() < 8) return false;
+    string addr = f[1].substr(0, f[1].find('@'));
+    size_t colon = addr.rfind(':');
+    if (colon == string::npos) return false;
+    out.id = f[0];
+    out.host = addr.substr(0, colon);
+    out.port = atoi(addr.c_str() + colon + 1);
+    out.myself = f[2].find("myself") != string::npos;
+    out.epoch = strtoull(f[6].c_str(), nullptr, 10);
+    for (size_t i = 8; i < f.size(); i++) {
+        const string& s = f[i];
+        if (s[0] == '[') {
+            size_t arrow = s.find("->-");
+            auto* moving = &out.migrating;
+            if (arrow == string::npos) {
+                arrow = s.find("-<-");
+                moving = &out.importing;
+            }
+            if (arrow == string::npos || s.back() != ']') return false;
+            unsigned int slot;
+            if (!parseSlot(s.substr(1, arrow - 1), slot)) return false;
+            moving->emplace_back(slot, s.substr(arrow + 3, s.size() - arrow - 4));
+            continue;
+        }
+        size_t dash = s.find('-');
+        unsigned int first, last;
+        if (!parseSlot(s.substr(0, dash), first)) return false;
+        if (dash == string::npos) last = first;
+        else if (!parseSlot(s.substr(dash + 1), last) || last < first) return false;
+        out.ranges.emplace_back(first, last);
+    }
+    return true;
+}
+
+bool Cluster::init(int port) {
+    ServerConfig& config = ServerConfig::getInstance();
+    unique_lock<shared_mutex> lock(state_mutex);
+    slots.assign(CLUSTER_SLOTS, nullptr);
+    migrating.assign(CLUSTER_SLOTS, nullptr);
+    importing.assign(CLUSTER_SLOTS, nullptr);
+    struct stat st;
+    if (stat(config.clusterConfigFile.c_str(), &st) == 0) {
+        if (!loadConfig(config.clusterConfigFile)) {
+            cerr << "Unrecoverable error: corrupted cluster config file " << config.clusterConfigFile << "\n";
+            return false;
+        }
+        cout << "Node configuration loaded, I'm " << myself->id << "\n";
+    }
+    else {
+        string id = newNodeId();
+        myself = &nodes[id];
+        myself->id = id;
+        myself->myself = true;
+        cout << "No cluster configuration found, I'm " << id << "\n";
+    }
+    myself->host = config.clusterAnnounceIp;
+    myself->port = port;
+    if (!saveConfig()) {
+        cerr << "Error writing the cluster config file " << config.clusterConfigFile << "\n";
+        return false;
+    }
+    clusterEnabled = true;
+    bus = thread(&Cluster::busLoop, this);
+    return true;
+}
+
+void Cluster::shutdown() {
+    busStop = true;
+    if (bus.joinable()) bus.join();
+}
+
+ClusterNode* Cluster::findNode(const string& id) {
+    auto it = nodes.find(id);
+    return it == nodes.end() ? nullptr : &it->second;
+}
+
+void Cluster::bumpEpoch() {
+    myself->configEpoch = ++currentEpoch;
+}
+
+void Cluster::dropNode(const string& id) {
+    ClusterNode* node = findNode(id);
+    if (!node || node == myself) return;
+    for (unsigned int s = 0; s < CLUSTER_SLOTS; s++) {
+        if (slots[s] == node) slots[s] = nullptr;
+        if (migrating[s] == node) migrating[s] = nullptr;
+        if (importing[s] == node) importing[s] = nullptr;
+    }
+    nodes.erase(id);
+}
+
+/*
+Same text as Redis' CLUSTER NODES, this node first. The bus port is the client port,
+since nodes talk over the normal protocol. Only our own line lists the slots being
+migrated ([slot->-id]) or imported ([slot-<-id]).
+*/
+string Cluster::nodesText() {
+    ostringstream oss;
+    auto nowMs = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    auto steadyNow = chrono::steady_clock::now();
+    vector<const ClusterNode*> ordered{myself};
+    for (const auto& entry : nodes)
+        if (&entry.second != myself) ordered.push_back(&entry.second);
+    for (const ClusterNode* node : ordered) {
+        long long pong = node->myself ? 0 : nowMs -
+            chrono::duration_cast<chrono::milliseconds>(steadyNow - node->lastPong).count();
+        oss << node->id << " " << node->host << ":" << node->port << "@" << node->port << " "
+            << (node->myself ? "myself,master" : node->fail ? "master,fail" : "master")
+            << " - 0 " << pong << " " << node->configEpoch << " "
+            << (node->fail ? "disconnected" : "connected");
+        for (unsigned int s = 0; s < CLUSTER_SLOTS; s++) {
+            if (slots[s] != node) continue;
+            unsigned int last = s;
+            while (last + 1 < CLUSTER_SLOTS && slots[last + 1] == node) last++;
+            oss << " " << s;
+            if (last > s) oss << "-" << last;
+            s = last;
+        }
+        if (node->myself) {
+            for (unsigned int s = 0; s < CLUSTER_SLOTS; s++) {
+                if (migrating[s]) oss << " [" << s << "->-" << migrating[s]->id << "]";
+                if (importing[s]) oss << " [" << s << "-<-" << importing[s]->id << "]";
+            }
+        }
+        oss << "\n";
+    }
+    return oss.str();
+}
+
+// written next to the target and renamed, like the snapshots
+bool Cluster::saveConfig() {
+    const string& filename = ServerConfig::getInstance().clusterConfigFile;
+    string tmpName = filename + ".tmp-" + to_string(getpid());
+    {
+        ofstream out(tmpName, ios::trunc);
+        out << nodesText() << "vars currentEpoch " << currentEpoch << " lastVoteEpoch 0\n";
+        out.flush();
+        if (!out) {
+            unlink(tmpName.c_str());
+            return false;
+        }
+    }
+    int fd = open(tmpName.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    if (::rename(tmpName.c_str(), filename.c_str()) != 0) {
+        unlink(tmpName.c_str());
+        return false;
+    }
+    return true;
+}
+
+// caller (init) holds state_mutex
+bool Cluster::loadConfig(const string& filename) {
+    ifstream in(filename);
+    if (!in) return false;
+    vector<NodeLine> lines;
+    string line;
+    while (getline(in, line)) {
+        if (line.empty()) continue;
+        if (line.compare(0, 5, "vars ") == 0) {
+            istringstream vars(line.substr(5));
+            string name;
+            uint64_t value;
+            while (vars >> name >> value)
+                if (name == "currentEpoch") currentEpoch = value;
+            continue;
+        }
+        NodeLine parsed;
+        if (!parseNodeLine(line, parsed)) return false;
+        ClusterNode& node = nodes[parsed.id];
+        node.id = parsed.id;
+        node.host = parsed.host;
+        node.port = parsed.port;
+        node.configEpoch = parsed.epoch;
+        node.myself = parsed.myself;
+        if (parsed.myself) myself = &node;
+        lines.push_back(parsed);
+    }
+    for (const auto& parsed : lines) {
+        ClusterNode* node = findNode(parsed.id);
+        for (const auto& range : parsed.ranges)
+            for (unsigned int s = range.first; s <= range.second; s++) slots[s] = node;
+        for (const auto& moving : parsed.migrating) migrating[moving.first] = findNode(moving.second);
+        for (const auto& moving : parsed.importing) importing[moving.first] = findNode(moving.second);
+    }
+    return myself != nullptr;
+}
+
+// once a second every known node (and every MEET address) is asked for CLUSTER NODES
+void Cluster::busLoop() {
+    unordered_map<string, int> links; // "host:port" -> connection kept between rounds
+    while (!busStop) {
+        for (int i = 0; i < 10 && !busStop; i++)
+            this_thread::sleep_for(chrono::milliseconds(100));
+        if (busStop) break;
+        struct Target {
+            string id;
+            string host;
+            int port;
+        };
+        vector<Target> targets;
+        string hello; //a new link starts with a MEET back to us, so meeting is mutual
+        {
+            shared_lock<shared_mutex> lock(state_mutex);
+            appendResp(hello, {"CLUSTER", "MEET", myself->host, to_string(myself->port)});
+            for (const auto& entry : nodes)
+                if (&entry.second != myself) targets.push_back({entry.first, entry.second.host, entry.second.port});
+            for (const auto& meet : meets) targets.push_back({"", meet.first, meet.second});
+        }
+        unordered_map<string, int> kept;
+        for (const auto& target : targets) {
+            string addr = target.host + ":" + to_string(target.port);
+            if (kept.count(addr)) continue;
+            int fd;
+            string request, buf, reply;
+            bool fresh = false;
+            auto link = links.find(addr);
+            if (link != links.end()) {
+                fd = link->second;
+                links.erase(link);
+            }
+            else {
+                fd = connectTo(target.host, target.port, 1000);
+                request = hello;
+                fresh = true;
+            }
+            appendResp(request, {"CLUSTER", "NODES"});
+            if (fd >= 0 && sendAll(fd, request) && (!fresh || readReply(fd, buf, reply)) &&
+                readReply(fd, buf, reply) && reply[0] == '$') {
+                kept[addr] = fd;
+                size_t body = reply.find("\r\n") + 2;
+                merge(target.id, target.host, target.port, reply.substr(body, reply.size() - body - 2));
+            }
+            else {
+                if (fd >= 0) close(fd);
+                if (!target.id.empty()) nodeUnreachable(target.id);
+            }
+        }
+        for (auto& link : links) close(link.second);
+        links.swap(kept);
+    }
+    for (auto& link : links) close(link.second);
+}
+
+void Cluster::nodeUnreachable(const string& id) {
+    unique_lock<shared_mutex> lock(state_mutex);
+    ClusterNode* node = findNode(id);
+    if (!node || node->fail) return;
+    auto silent = chrono::steady_clock::now() - node->lastPong;
+    if (silent > chrono::milliseconds(ServerConfig::getInstance().clusterNodeTimeout)) {
+        node->fail = true;
+        cout << "Cluster: marking node " << id << " as failing\n";
+    }
+}
+
+/*
+The node at host:port described the cluster. Its own line is the truth about the node
+(id, epoch, slots); it is kept under the address we reached it on. Other lines only
+introduce nodes we did not know yet, which we will ask ourselves from the next round.
+*/
+void Cluster::merge(const string& id, const string& host, int port, const string& nodesReply) {
+    vector<NodeLine> lines;
+    istringstream in(nodesReply);
+    string line;
+    while (getline(in, line)) {
+        NodeLine parsed;
+        if (parseNodeLine(line, parsed)) lines.push_back(parsed);
+    }
+    const NodeLine* self = nullptr;
+    for (const auto& parsed : lines)
+        if (parsed.myself) self = &parsed;
+    if (!self) return;
+
+    unique_lock<shared_mutex> lock(state_mutex);
+    auto now = chrono::steady_clock::now();
+    bool changed = false;
+    if (id.empty())
+        meets.erase(remove(meets.begin(), meets.end(), make_pair(host, port)), meets.end());
+    else if (id != self->id) {
+        //someone else answers on that address now (the node was reset), forget the old one
+        dropNode(id);
+        changed = true;
+    }
+    if (self->id == myself->id) return;
+
+    ClusterNode* peer = findNode(self->id);
+    if (!peer) {
+        peer = &nodes[self->id];
+        peer->id = self->id;
+        forgotten.erase(self->id);
+        changed = true;
+        cout << "Cluster: connected to node " << self->id << " at " << host << ":" << port << "\n";
+    }
+    if (peer->host != host || peer->port != port) {
+        peer->host = host;
+        peer->port = port;
+        changed = true;
+    }
+    if (peer->fail) cout << "Cluster: node " << peer->id << " is reachable again\n";
+    peer->fail = false;
+    peer->lastPong = now;
+    if (peer->configEpoch != self->epoch) {
+        peer->configEpoch = self->epoch;
+        changed = true;
+    }
+    if (self->epoch > currentEpoch) {
+        currentEpoch = self->epoch;
+        changed = true;
+    }
+
+    //its slots: a claim with a newer epoch (ties: the higher id) wins, a slot it stopped listing is released
+    vector<bool> claimed(CLUSTER_SLOTS, false);
+    for (const auto& range : self->ranges)
+        for (unsigned int s = range.first; s <= range.second; s++) claimed[s] = true;
+    for (unsigned int s = 0; s < CLUSTER_SLOTS; s++) {
+        ClusterNode* owner = slots[s];
+        if (owner == peer) {
+            if (!claimed[s]) {
+                slots[s] = nullptr;
+                changed = true;
+            }
+            continue;
+        }
+        if (!claimed[s]) continue;
+        if (owner && (owner->configEpoch > peer->configEpoch ||
+                      (owner->configEpoch == peer->configEpoch && owner->id > peer->id)))
+            continue;
+        if (owner == myself) {
+            cout << "Cluster: slot " << s << " was taken over by " << peer->id << "\n";
+            migrating[s] = nullptr;
+        }
+        if (importing[s] == peer) importing[s] = nullptr;
+        slots[s] = peer;
+        changed = true;
+    }
+
+    for (const auto& other : lines) {
+        if (other.myself || other.id == myself->id || findNode(other.id)) continue;
+        auto ban = forgotten.find(other.id);
+        if (ban != forgotten.end()) {
+            if (now - ban->second < chrono::seconds(CLUSTER_FORGET_TTL)) continue;
+            forgotten.erase(ban);
+        }
+        ClusterNode& node = nodes[other.id];
+        node.id = other.id;
+        node.host = other.host;
+        node.port = other.port;
+        node.configEpoch = other.epoch;
+        changed = true;
+    }
+    if (changed) saveConfig();
+}
+
+string Cluster::route(const vector<string>& keys, bool asking) {
+    unsigned int slot = keySlot(keys[0]);
+    for (size_t i = 1; i < keys.size(); i++)
+        if (keySlot(keys[i]) != slot) return "-CROSSSLOT Keys in request don't hash to the same slot\r\n";
+    string target;
+    {
+        shared_lock<shared_mutex> lock(state_mutex);
+        ClusterNode* owner = slots[slot];
+        if (owner == myself) {
+            if (!migrating[slot]) return "";
+            target = migrating[slot]->host + ":" + to_string(migrating[slot]->port);
+        }
+        else if (importing[slot] && asking) return "";
+        else if (!owner) return "-CLUSTERDOWN Hash slot not served\r\n";
+        else return "-MOVED " + to_string(slot) + " " + owner->host + ":" + to_string(owner->port) + "\r\n";
+    }
+    //migrating: keys that are still here are served here, the ones that left are asked for there
+    RedisDatabase& db = RedisDatabase::getInstance();
+    size_t present = 0;
+    for (const auto& key : keys)
+        if (db.type(key) != "none") present++;
+    if (present == keys.size()) return "";
+    if (present > 0) return "-TRYAGAIN Multiple keys request during rehashing of slot\r\n";
+    return "-ASK " + to_string(slot) + " " + target + "\r\n";
+}
+
+string Cluster::migrate(const string& host, int port, const vector<vector<string>>& restores, int timeoutMs,
+                        vector<bool>& restored) {
+    restored.assign(restores.size(), false);
+    int fd = connectTo(host, port, timeoutMs);
+    if (fd < 0) return "IOERR error or timeout connecting to the client";
+    //ASKING only covers the next command, so every RESTORE gets its own
+    string request, buf, reply, error;
+    for (const auto& restore : restores) {
+        appendResp(request, {"ASKING"});
+        appendResp(request, restore);
+    }
+    if (!sendAll(fd, request)) error = "IOERR error or timeout writing to target instance";
+    for (size_t i = 0; error.empty() && i < restores.size(); i++) {
+        if (!readReply(fd, buf, reply) || !readReply(fd, buf, reply)) {
+            error = "IOERR error or timeout reading to target instance";
+        }
+        else if (reply[0] == '-') {
+            error = "ERR Target instance replied with error: " + reply.substr(1, reply.size() - 3);
+        }
+        else restored[i] = true;
+    }
+    close(fd);
+    return error;
+}
+
+string Cluster::info() {
+    return string("# Cluster\r\ncluster_enabled:") + (clusterEnabled ? "1" : "0") + "\r\n";
+}
+
+string Cluster::command(const vector<string>& tokens) {
+    if (!clusterEnabled) return "-Error: This instance has cluster support disabled\r\n";
+    if (tokens.size() < 2) return "-Error: CLUSTER requires a subcommand\r\n";
+    string sub = tokens[1];
+    transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    RedisDatabase& db = RedisDatabase::getInstance();
+    unsigned int slot;
+
+    if (sub == "KEYSLOT") {
+        if (tokens.size() != 3) return "-Error: CLUSTER KEYSLOT requires a key\r\n";
+        return ":" + to_string(keySlot(tokens[2])) + "\r\n";
+    }
+    if (sub == "MYID") {
+        shared_lock<shared_mutex> lock(state_mutex);
+        return bulk(myself->id);
+    }
+    if (sub == "NODES") {
+        shared_lock<shared_mutex> lock(state_mutex);
+        return bulk(nodesText());
+    }
+    if (sub == "SLOTS") {
+        //[first, last, [ip, port, id]] for every run of slots with the same owner
+        shared_lock<shared_mutex> lock(state_mutex);
+        ostringstream oss;
+        size_t ranges = 0;
+        for (unsigned int s = 0; s < CLUSTER_SLOTS; s++) {
+            ClusterNode* owner = slots[s];
+            if (!owner) continue;
+            unsigned int last = s;
+            while (last + 1 < CLUSTER_SLOTS && slots[last + 1] == owner) last++;
+            oss << "*3\r\n:" << s << "\r\n:" << last << "\r\n*3\r\n" << bulk(owner->host)
+                << ":" << owner->port << "\r\n" << bulk(owner->id);
+            ranges++;
+            s = last;
+        }
+        return "*" + to_string(ranges) + "\r\n" + oss.str();
+    }
+    if (sub == "INFO") {
+        shared_lock<shared_mutex> lock(state_mutex);
+        size_t assigned = 0, failing = 0, sized = 0;
+        for (unsigned int s = 0; s < CLUSTER_SLOTS; s++) {
+            if (!slots[s]) continue;
+            assigned++;
+            if (slots[s]->fail) failing++;
+        }
+        for (const auto& entry : nodes)
+            if (find(slots.begin(), slots.end(), &entry.second) != slots.end()) sized++;
+        ostringstream oss;
+        oss << "cluster_state:" << (assigned == CLUSTER_SLOTS && failing == 0 ? "ok" : "fail") << "\r\n"
+            << "cluster_slots_assigned:" << assigned << "\r\n"
+            << "cluster_slots_ok:" << assigned - failing << "\r\n"
+            << "cluster_slots_pfail:0\r\n"
+            << "cluster_slots_fail:" << failing << "\r\n"
+            << "cluster_known_nodes:" << nodes.size() << "\r\n"
+            << "cluster_size:" << sized << "\r\n"
+            << "cluster_current_epoch:" << currentEpoch << "\r\n"
+            << "cluster_my_epoch:" << myself->configEpoch << "\r\n";
+        return bulk(oss.str());
+    }
+    if (sub == "COUNTKEYSINSLOT") {
+        if (tokens.size() != 3 || !parseSlot(tokens[2], slot)) return "-Error: Invalid or out of range slot\r\n";
+        return ":" + to_string(db.countKeysInSlot(slot)) + "\r\n";
+    }
+    if (sub == "GETKEYSINSLOT") {
+        if (tokens.size() != 4 || !parseSlot(tokens[2], slot)) return "-Error: Invalid or out of range slot\r\n";
+        size_t count;
+        try {
+            count = stoul(tokens[3]);
+        } catch (const exception&) {
+            return "-Error: Invalid number of keys\r\n";
+        }
+        auto keys = db.keysInSlot(slot, count);
+        string reply = "*" + to_string(keys.size()) + "\r\n";
+        for (const auto& key : keys) reply += bulk(key);
+        return reply;
+    }
+    if (sub == "MEET") {
+        if (tokens.size() != 4) return "-Error: CLUSTER MEET requires ip and port\r\n";
+        int port = atoi(tokens[3].c_str());
+        if (port <= 0 || port > 65535) return "-Error: Invalid port\r\n";
+        unique_lock<shared_mutex> lock(state_mutex);
+        for (const auto& entry : nodes)
+            if (entry.second.host == tokens[2] && entry.second.port == port) return "+OK\r\n";
+        if (find(meets.begin(), meets.end(), make_pair(tokens[2], port)) == meets.end())
+            meets.emplace_back(tokens[2], port);
+        return "+OK\r\n";
+    }
+    if (sub == "FORGET") {
+        if (tokens.size() != 3) return "-Error: CLUSTER FORGET requires a node id\r\n";
+        unique_lock<shared_mutex> lock(state_mutex);
+        if (tokens[2] == myself->id) return "-Error: I tried hard but I can't forget myself...\r\n";
+        if (!findNode(tokens[2])) return "-Error: Unknown node " + tokens[2] + "\r\n";
+        dropNode(tokens[2]);
+        forgotten[tokens[2]] = chrono::steady_clock::now();
+        saveConfig();
+        return "+OK\r\n";
+    }
+    if (sub == "ADDSLOTS" || sub == "DELSLOTS" || sub == "ADDSLOTSRANGE" || sub == "DELSLOTSRANGE") {
+        bool add = sub.compare(0, 3, "ADD") == 0;
+        bool range = sub.size() > 8;
+        if (tokens.size() < 3 || (range && tokens.size() % 2 != 0))
+            return "-Error: CLUSTER " + sub + " requires " + (range ? "start and end slots" : "slots") + "\r\n";
+        vector<unsigned int> list;
+        for (size_t i = 2; i < tokens.size(); i += range ? 2 : 1) {
+            unsigned int first, last;
+            if (!parseSlot(tokens[i], first)) return "-Error: Invalid or out of range slot\r\n";
+            last = first;
+            if (range && (!parseSlot(tokens[i + 1], last) || last < first))
+                return "-Error: Invalid or out of range slot\r\n";
+            for (unsigned int s = first; s <= last; s++) list.push_back(s);
+        }
+        unique_lock<shared_mutex> lock(state_mutex);
+        for (unsigned int s : list) {
+            if (add && slots[s]) return "-Error: Slot " + to_string(s) + " is already busy\r\n";
+            if (!add && !slots[s]) return "-Error: Slot " + to_string(s) + " is already unassigned\r\n";
+        }
+        for (unsigned int s : list) {
+            slots[s] = add ? myself : nullptr;
+            migrating[s] = importing[s] = nullptr;
+        }
+        if (add) bumpEpoch();
+        saveConfig();
+        return "+OK\r\n";
+    }
+    if (sub == "SETSLOT") {
+        if (tokens.size() < 4 || !parseSlot(tokens[2], slot)) return "-Error: Invalid or out of range slot\r\n";
+        string action = tokens[3];
+        transform(action.begin(), action.end(), action.begin(), ::toupper);
+        if (action == "STABLE") {
+            unique_lock<shared_mutex> lock(state_mutex);
+            migrating[slot] = importing[slot] = nullptr;
+            saveConfig();
+            return "+OK\r\n";
+        }
+        if (tokens.size() != 5) return "-Error: CLUSTER SETSLOT " + action + " requires a node id\r\n";
+        size_t keysHere = action == "NODE" ? db.countKeysInSlot(slot) : 0;
+        unique_lock<shared_mutex> lock(state_mutex);
+        ClusterNode* node = findNode(tokens[4]);
+        if (!node) return "-Error: I don't know about node " + tokens[4] + "\r\n";
+        if (action == "MIGRATING") {
+            if (slots[slot] != myself) return "-Error: I'm not the owner of hash slot " + to_string(slot) + "\r\n";
+            if (node == myself) return "-Error: I can't migrate a slot to myself\r\n";
+            migrating[slot] = node;
+        }
+        else if (action == "IMPORTING") {
+            if (slots[slot] == myself) return "-Error: I'm already the owner of hash slot " + to_string(slot) + "\r\n";
+            if (node == myself) return "-Error: I can't import a slot from myself\r\n";
+            importing[slot] = node;
+        }
+        else if (action == "NODE") {
+            if (slots[slot] == myself && node != myself && keysHere > 0)
+                return "-Error: Can't assign hashslot " + to_string(slot) +
+                       " to a different node while I still hold keys for this hash slot.\r\n";
+            if (node != myself) migrating[slot] = nullptr;
+            //taking a slot over: a new epoch makes the rest of the cluster accept the claim
+            if (node == myself && slots[slot] != myself) bumpEpoch();
+            if (node == myself) importing[slot] = nullptr;
+            slots[slot] = node;
+        }
+        else return "-Error: Invalid CLUSTER SETSLOT action or number of arguments\r\n";
+        saveConfig();
+        return "+OK\r\n";
+    }
+    if (sub == "SAVECONFIG") {
+        unique_lock<shared_mutex> lock(state_mutex);
+        return saveConfig() ? "+OK\r\n" : "-Error: error saving the cluster node config\r\n";
+    }
+    return "-Error: Unknown CLUSTER subcommand\r\n";
+}
@@ -0,0 +1,274 @@
+#include "../include/CommandStats.h"
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+using namespace std;
+
+//every command dispatchCommand() knows; new commands go here too
+static const vector<string> commandNames = {
+    "PING", "ECHO", "FLUSHALL", "SET", "GET", "KEYS", "TYPE", "DEL", "UNLINK", "EXPIRE",
+    "PEXPIREAT", "RENAME", "LGET", "LLEN", "LPUSH", "RPUSH", "LPOP", "RPOP", "LREM", "LINDEX",
+    "LSET", "HSET", "HGET", "HEXISTS", "HDEL", "HGETALL", "HKEYS", "HVALS", "HLEN", "HMSET",
+    "SAVE", "BGSAVE", "LASTSAVE", "INFO", "BGREWRITEAOF", "CONFIG", "REPLICAOF", "SLAVEOF",
+    "REPLCONF", "CLIENT", "CLUSTER", "ASKING", "DUMP", "RESTORE", "MIGRATE", "LATENCY", "SLOWLOG",
+    "DEBUG", "STRLEN", "SCAN", "MEMORY"
+};
+
+CommandStats& CommandStats::getInstance() {
+    static CommandStats instance;
+    return instance;
+}
+
+CommandStats::CommandStats() {
+#if defined(__x86_64__) || defined(__i386__)
+    //invariant TSC: constant rate through frequency and sleep states, the same on every core
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8))) {
+        auto wallStart = chrono::steady_clock::now();
+        uint64_t tscStart = __rdtsc();
+        this_thread::sleep_for(chrono::milliseconds(10));
+        uint64_t ticks = __rdtsc() - tscStart;
+        uint64_t nanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - wallStart).count();
+        if (ticks > 0) {
+            nanosPerTick32 = (nanos << 32) / ticks;
+            tscUsable = true;
+        }
+    }
+#endif
+}
+
+// FNV-1a; the names are short and the table is small, std::hash would cost more than the rest
+static uint32_t nameHash(const string& name) {
+    uint32_t h = 2166136261u;
+    for (unsigned char c : name) h = (h ^ c) * 16777619u;
+    return h;
+}
+
+int CommandStats::indexOf(const string& cmd) {
+    //open addressing, power of two slots, at most a quarter full
+    static const size_t TABLE = 256;
+    static const vector<int> table = [] {
+        vector<int> t(TABLE, -1);
+        for (size_t i = 0; i < commandNames.size(); i++) {
+            size_t at = nameHash(commandNames[i]) & (TABLE - 1);
+            while (t[at] >= 0) at = (at + 1) & (TABLE - 1);
+            t[at] = i;
+        }
+        return t;
+    }();
+    for (size_t at = nameHash(cmd) & (TABLE - 1); table[at] >= 0; at = (at + 1) & (TABLE - 1)) {
+        if (commandNames[table[at]] == cmd) return table[at];
+    }
+    return -1;
+}
+
+CommandStats::CommandSlot::CommandSlot() : commands(commandNames.size()) {}
+
+CommandStats::CommandSlot::~CommandSlot() {
+    for (auto& command : commands) delete command.load();
+}
+
+CommandStats::SlotHandle::SlotHandle() {
+    CommandStats& stats = CommandStats::getInstance();
+    lock_guard<mutex> lock(stats.slots_mutex);
+    if (!stats.freeSlots.empty()) {
+        slot = stats.freeSlots.back();
+        stats.freeSlots.pop_back();
+        return;
+    }
+    stats.slots.push_back(make_unique<CommandSlot>());
+    slot = stats.slots.back().get();
+}
+
+CommandStats::SlotHandle::~SlotHandle() {
+    CommandStats& stats = CommandStats::getInstance();
+    lock_guard<mutex> lock(stats.slots_mutex);
+    stats.freeSlots.push_back(slot);
+}
+
+CommandCounters& CommandStats::counters(int command) {
+    atomic<CommandCounters*>& entry = local().commands[command];
+    CommandCounters* counters = entry.load(memory_order_relaxed);
+    if (!counters) {
+        counters = new CommandCounters();
+        entry.store(counters, memory_order_release);
+    }
+    return *counters;
+}
+
+uint64_t CommandStats::elapsedNanos(const CommandTimer& timer, uint64_t end) {
+    uint64_t ticks = end - timer.start;
+    if (timer.clock != LatencyClock::Tsc || !tscUsable) return ticks;
+    return (unsigned __int128)ticks * nanosPerTick32 >> 32;
+}
+
+static void bump(atomic<uint64_t>& value, uint64_t n) {
+    value.store(value.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+uint64_t CommandStats::record(int command, const CommandTimer& timer, bool failed) {
+    uint64_t end = readClock(timer.clock);
+    uint64_t nanos = elapsedNanos(timer, end);
+    if (batching) {
+        chained = true;
+        chainClock = timer.clock;
+        chainTicks = end;
+    }
+    CommandCounters& c = counters(command);
+    bump(c.calls, 1);
+    bump(c.nanos, nanos);
+    if (failed) bump(c.failed, 1);
+    if (ServerConfig::getInstance().latencyTracking.load(memory_order_relaxed)) bump(c.buckets[latencyBucketOf(nanos)], 1);
+    return nanos;
+}
+
+void CommandStats::rejected(const string& cmd) {
+    int command = indexOf(cmd);
+    if (command >= 0) bump(counters(command).rejected, 1);
+}
+
+vector<CommandStats::Totals> CommandStats::totals() {
+    vector<Totals> result;
+    totals(result);
+    return result;
+}
+
+const string& CommandStats::name(int command) {
+    return commandNames[command];
+}
+
+void CommandStats::totals(vector<Totals>& result) {
+    result.resize(commandNames.size());
+    for (Totals& t : result) {
+        t.calls = t.nanos = t.rejected = t.failed = 0;
+        fill(t.buckets.begin(), t.buckets.end(), 0);
+    }
+    lock_guard<mutex> lock(slots_mutex);
+    for (const auto& slot : slots) {
+        for (size_t i = 0; i < commandNames.size(); i++) {
+            CommandCounters* c = slot->commands[i].load(memory_order_acquire);
+            if (!c) continue;
+            Totals& t = result[i];
+            t.calls += c->calls.load(memory_order_relaxed);
+            t.nanos += c->nanos.load(memory_order_relaxed);
+            t.rejected += c->rejected.load(memory_order_relaxed);
+            t.failed += c->failed.load(memory_order_relaxed);
+            for (int b = 0; b < LATENCY_BUCKETS; b++) t.buckets[b] += c->buckets[b].load(memory_order_relaxed);
+        }
+    }
+}
+
+static uint64_t recordedIn(const vector<uint64_t>& buckets) {
+    uint64_t recorded = 0;
+    for (uint64_t n : buckets) recorded += n;
+    return recorded;
+}
+
+uint64_t CommandStats::percentile(const Totals& t, double p) {
+    uint64_t recorded = recordedIn(t.buckets);
+    if (!recorded) return 0;
+    uint64_t wanted = max<uint64_t>(1, min<uint64_t>(recorded, (uint64_t)(p / 100.0 * recorded + 0.5)));
+    uint64_t seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += t.buckets[b];
+        if (seen >= wanted) return latencyBucketHighest(b);
+    }
+    return latencyBucketHighest(LATENCY_BUCKETS - 1);
+}
+
+static string lowercase(string s) {
+    transform(s.begin(), s.end(), s.begin(), ::tolower);
+    return s;
+}
+
+string CommandStats::info() {
+    vector<Totals> all = totals();
+    ostringstream oss;
+    oss << "# Commandstats\r\n" << fixed << setprecision(2);
+    for (size_t i = 0; i < all.size(); i++) {
+        const Totals& t = all[i];
+        if (!t.calls && !t.rejected) continue;
+        double usec = t.nanos / 1000.0;
+        oss << "cmdstat_" << lowercase(commandNames[i]) << ":calls=" << t.calls << ",usec=" << t.nanos / 1000
+            << ",usec_per_call=" << (t.calls ? usec / t.calls : 0) << ",rejected_calls=" << t.rejected
+            << ",failed_calls=" << t.failed << "\r\n";
+    }
+    return oss.str();
+}
+
+string CommandStats::latencyInfo() {
+    vector<Totals> all = totals();
+    ostringstream oss;
+    oss << "# Latencystats\r\n" << fixed << setprecision(3);
+    for (size_t i = 0; i < all.size(); i++) {
+        const Totals& t = all[i];
+        if (!recordedIn(t.buckets)) continue;
+        oss << "latency_percentiles_usec_" << lowercase(commandNames[i]) << ":p50=" << percentile(t, 50) / 1000.0
+            << ",p99=" << percentile(t, 99) / 1000.0 << ",p99.9=" << percentile(t, 99.9) / 1000.0 << "\r\n";
+    }
+    return oss.str();
+}
+
+static string bulk(const string& s) {
+    return "$" + to_string(s.size()) + "\r\n" + s + "\r\n";
+}
+
+static string usecText(uint64_t nanos) {
+    ostringstream oss;
+    oss << fixed << setprecision(3) << nanos / 1000.0;
+    return oss.str();
+}
+
+/*
+LATENCY HISTOGRAM [command ...] --every command that ran when none is named:
+  name -> [calls N p50 usec p99 usec p99.9 usec max usec histogram_usec [bound count ...]]
+The histogram has cumulative counts at power of two usec bounds, like Redis' reply.
+*/
+string CommandStats::histogram(const vector<string>& tokens) {
+    vector<Totals> all = totals();
+    vector<int> wanted;
+    for (size_t i = 2; i < tokens.size(); i++) {
+        string cmd = tokens[i];
+        transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+        int command = indexOf(cmd);
+        if (command >= 0 && find(wanted.begin(), wanted.end(), command) == wanted.end()) wanted.push_back(command);
+    }
+    if (tokens.size() <= 2) {
+        for (size_t i = 0; i < all.size(); i++) wanted.push_back(i);
+    }
+
+    ostringstream oss;
+    size_t replied = 0;
+    for (int command : wanted) {
+        const Totals& t = all[command];
+        if (!t.calls) continue;
+        //cumulative counts at 1, 2, 4... usec
+        vector<pair<uint64_t, uint64_t>> bounds;
+        uint64_t seen = 0, maxNanos = 0;
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            if (!t.buckets[b]) continue;
+            seen += t.buckets[b];
+            maxNanos = latencyBucketHighest(b);
+            uint64_t usec = (maxNanos + 999) / 1000, bound = 1;
+            while (bound < usec) bound <<= 1;
+            if (!bounds.empty() && bounds.back().first == bound) bounds.back().second = seen;
+            else bounds.emplace_back(bound, seen);
+        }
+        oss << bulk(lowercase(commandNames[command])) << "*12\r\n"
+            << bulk("calls") << ":" << t.calls << "\r\n"
+            << bulk("p50") << bulk(usecText(percentile(t, 50)))
+            << bulk("p99") << bulk(usecText(percentile(t, 99)))
+            << bulk("p99.9") << bulk(usecText(percentile(t, 99.9)))
+            << bulk("max") << bulk(usecText(maxNanos))
+            << bulk("histogram_usec") << "*" << bounds.size() * 2 << "\r\n";
+        for (const auto& bound : bounds) oss << ":" << bound.first << "\r\n:" << bound.second << "\r\n";
+        replied++;
+    }
+    return "*" + to_string(replied * 2) + "\r\n" + oss.str();
+}
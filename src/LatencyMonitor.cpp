@@ -0,0 +1,75 @@
+#include "../include/LatencyMonitor.h"
+#include <algorithm>
+#include <ctime>
+#include <sstream>
+
+using namespace std;
+
+LatencyMonitor& LatencyMonitor::getInstance() {
+    static LatencyMonitor instance;
+    return instance;
+}
+
+void LatencyMonitor::add(const char* event, uint64_t ms) {
+    uint64_t threshold = ServerConfig::getInstance().latencyMonitorThreshold.load(memory_order_relaxed);
+    if (threshold == 0 || ms < threshold) return;
+    int64_t now = time(nullptr);
+    lock_guard<mutex> lock(latency_mutex);
+    LatencySeries& series = events[event];
+    series.maxMs = max(series.maxMs, ms);
+    //one sample per second, the worst one
+    int newest = (series.next + LATENCY_HISTORY_LEN - 1) % LATENCY_HISTORY_LEN;
+    if (series.count > 0 && series.points[newest].time == now) {
+        series.points[newest].ms = max(series.points[newest].ms, ms);
+        return;
+    }
+    series.points[series.next] = {now, ms};
+    series.next = (series.next + 1) % LATENCY_HISTORY_LEN;
+    series.count = min(series.count + 1, LATENCY_HISTORY_LEN);
+}
+
+/*
+LATENCY LATEST           *N [event, unix time of the newest sample, its ms, max ms]
+LATENCY HISTORY event    *N [unix time, ms], oldest first
+LATENCY RESET [event..]  :number of events cleared, every event without arguments
+*/
+string LatencyMonitor::command(const vector<string>& tokens) {
+    string sub = tokens[1];
+    transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    lock_guard<mutex> lock(latency_mutex);
+    if (sub == "LATEST") {
+        ostringstream oss;
+        oss << "*" << events.size() << "\r\n";
+        for (const auto& entry : events) {
+            const LatencySeries& series = entry.second;
+            const LatencyPoint& newest = series.points[(series.next + LATENCY_HISTORY_LEN - 1) % LATENCY_HISTORY_LEN];
+            oss << "*4\r\n$" << entry.first.size() << "\r\n" << entry.first << "\r\n:" << newest.time << "\r\n:"
+                << newest.ms << "\r\n:" << series.maxMs << "\r\n";
+        }
+        return oss.str();
+    }
+    if (sub == "HISTORY") {
+        if (tokens.size() != 3) return "-Error: LATENCY HISTORY requires an event name\r\n";
+        auto it = events.find(tokens[2]);
+        if (it == events.end()) return "*0\r\n";
+        const LatencySeries& series = it->second;
+        ostringstream oss;
+        oss << "*" << series.count << "\r\n";
+        int first = (series.next + LATENCY_HISTORY_LEN - series.count) % LATENCY_HISTORY_LEN;
+        for (int i = 0; i < series.count; i++) {
+            const LatencyPoint& point = series.points[(first + i) % LATENCY_HISTORY_LEN];
+            oss << "*2\r\n:" << point.time << "\r\n:" << point.ms << "\r\n";
+        }
+        return oss.str();
+    }
+    if (sub == "RESET") {
+        size_t cleared = 0;
+        if (tokens.size() == 2) {
+            cleared = events.size();
+            events.clear();
+        }
+        for (size_t i = 2; i < tokens.size(); i++) cleared += events.erase(tokens[i]);
+        return ":" + to_string(cleared) + "\r\n";
+    }
+    return "-Error: Unknown LATENCY subcommand '" + tokens[1] + "'\r\n";
+}
@@ -0,0 +1,53 @@
+#include "../include/LazyFree.h"
+
+using namespace std;
+
+LazyFree& LazyFree::getInstance() {
+    static LazyFree instance;
+    return instance;
+}
+
+LazyFree::LazyFree() {
+    freer = thread(&LazyFree::loop, this);
+}
+
+void LazyFree::queue(unique_ptr<LazyObject> object) {
+    {
+        lock_guard<mutex> lock(lazy_mutex);
+        objects.push_back(move(object));
+        pendingObjects++;
+    }
+    work_cv.notify_one();
+}
+
+void LazyFree::loop() {
+    vector<unique_ptr<LazyObject>> batch;
+    for (;;) {
+        {
+            unique_lock<mutex> lock(lazy_mutex);
+            work_cv.wait(lock, [this] { return stopping || !objects.empty(); });
+            if (stopping) return;
+            swap(batch, objects);
+        }
+        //one at a time, so pending counts down as the work gets done
+        for (auto& object : batch) {
+            object.reset();
+            pendingObjects--;
+            freedObjects++;
+        }
+        batch.clear();
+    }
+}
+
+void LazyFree::shutdown() {
+    {
+        lock_guard<mutex> lock(lazy_mutex);
+        stopping = true;
+    }
+    work_cv.notify_one();
+    if (freer.joinable()) freer.join();
+    //the process is exiting, giving the pages back is faster than running the destructors
+    lock_guard<mutex> lock(lazy_mutex);
+    for (auto& object : objects) object.release();
+    objects.clear();
+}
@@ -0,0 +1,222 @@
+#include "../include/LockStats.h"
+#ifdef REDIS_LOCKSTATS
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+
+using namespace std;
+
+LockStats& LockStats::getInstance() {
+    static LockStats instance;
+    return instance;
+}
+
+uint64_t LockStats::now() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void bump(atomic<uint64_t>& value, uint64_t n) {
+    value.store(value.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+ProfiledMutex::ProfiledMutex(const char* name) : lockName(name) {
+    strncpy(rows[0].name, "other", LOCKSTATS_NAME_LEN - 1);
+    rowCount = 1;
+    LockStats& stats = LockStats::getInstance();
+    lock_guard<mutex> lock(stats.registry_mutex);
+    stats.locks.push_back(this);
+}
+
+ProfiledMutex::~ProfiledMutex() {
+    LockStats& stats = LockStats::getInstance();
+    lock_guard<mutex> lock(stats.registry_mutex);
+    stats.locks.erase(remove(stats.locks.begin(), stats.locks.end(), this), stats.locks.end());
+}
+
+void ProfiledMutex::lock() {
+    uint64_t asked = LockStats::now();
+    if (m.try_lock()) {
+        acquired(asked, false, -1);
+        return;
+    }
+    int blocker = owner.load(memory_order_relaxed); //who we are about to wait for
+    m.lock();
+    acquired(asked, true, blocker);
+}
+
+bool ProfiledMutex::try_lock() {
+    uint64_t asked = LockStats::now();
+    if (!m.try_lock()) return false;
+    acquired(asked, false, -1);
+    return true;
+}
+
+void ProfiledMutex::acquired(uint64_t asked, bool waited, int blocker) {
+    uint64_t at = LockStats::now();
+    int row = rowOf(LockStats::holder());
+    LockHolderRow& r = rows[row];
+    uint64_t wait = waited ? at - asked : 0;
+    bump(r.acquisitions, 1);
+    bump(r.waitBuckets[latencyBucketOf(wait)], 1);
+    if (waited) {
+        bump(r.contended, 1);
+        bump(r.waitNanos, wait);
+        if (blocker >= 0) bump(rows[blocker].blockedNanos, wait);
+    }
+    acquiredAt = at;
+    holderRow = row;
+    owner.store(row, memory_order_relaxed);
+}
+
+void ProfiledMutex::unlock() {
+    uint64_t held = LockStats::now() - acquiredAt;
+    LockHolderRow& r = rows[holderRow];
+    bump(r.holdNanos, held);
+    bump(r.holdBuckets[latencyBucketOf(held)], 1);
+    if (held > r.maxHoldNanos.load(memory_order_relaxed)) r.maxHoldNanos.store(held, memory_order_relaxed);
+    owner.store(-1, memory_order_relaxed);
+    m.unlock();
+}
+
+int ProfiledMutex::rowOf(const char* holder) {
+    int count = rowCount.load(memory_order_relaxed);
+    for (int i = 0; i < count; i++) {
+        if (strncmp(rows[i].name, holder, LOCKSTATS_NAME_LEN - 1) == 0) return i;
+    }
+    if (count == LOCKSTATS_HOLDERS) return 0;
+    strncpy(rows[count].name, holder, LOCKSTATS_NAME_LEN - 1);
+    rows[count].section = false;
+    rowCount.store(count + 1, memory_order_release); //readers see the name before the row
+    return count;
+}
+
+void ProfiledMutex::reset() {
+    lock_guard<mutex> lock(m);
+    int count = rowCount.load(memory_order_relaxed);
+    for (int i = 0; i < count; i++) {
+        LockHolderRow& r = rows[i];
+        for (auto* counter : {&r.acquisitions, &r.contended, &r.waitNanos, &r.holdNanos, &r.maxHoldNanos, &r.blockedNanos})
+            counter->store(0, memory_order_relaxed);
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            r.waitBuckets[b].store(0, memory_order_relaxed);
+            r.holdBuckets[b].store(0, memory_order_relaxed);
+        }
+    }
+}
+
+LockSection::LockSection(ProfiledMutex& lock, const char* name) : lock(lock) {
+    row = lock.rowOf(name);
+    lock.rows[row].section = true;
+    previousOwner = lock.owner.load(memory_order_relaxed);
+    lock.owner.store(row, memory_order_relaxed); //waits from here on are this section's doing
+    start = LockStats::now();
+}
+
+LockSection::~LockSection() {
+    uint64_t spent = LockStats::now() - start;
+    LockHolderRow& r = lock.rows[row];
+    bump(r.acquisitions, 1);
+    bump(r.holdNanos, spent);
+    bump(r.holdBuckets[latencyBucketOf(spent)], 1);
+    if (spent > r.maxHoldNanos.load(memory_order_relaxed)) r.maxHoldNanos.store(spent, memory_order_relaxed);
+    lock.owner.store(previousOwner, memory_order_relaxed);
+}
+
+// one row, read without the lock: the numbers may be a few acquisitions apart
+struct RowSnapshot {
+    string name;
+    bool section;
+    uint64_t acquisitions, contended, waitNanos, holdNanos, maxHoldNanos, blockedNanos;
+    vector<uint64_t> waitBuckets, holdBuckets;
+};
+
+static uint64_t percentile(const vector<uint64_t>& buckets, double p) {
+    uint64_t recorded = 0;
+    for (uint64_t n : buckets) recorded += n;
+    if (!recorded) return 0;
+    uint64_t wanted = max<uint64_t>(1, min<uint64_t>(recorded, (uint64_t)(p / 100.0 * recorded + 0.5)));
+    uint64_t seen = 0;
+    for (size_t b = 0; b < buckets.size(); b++) {
+        seen += buckets[b];
+        if (seen >= wanted) return latencyBucketHighest(b);
+    }
+    return latencyBucketHighest(buckets.size() - 1);
+}
+
+static string usec(uint64_t nanos) {
+    ostringstream oss;
+    oss << fixed << setprecision(1) << nanos / 1000.0;
+    return oss.str();
+}
+
+/*
+DEBUG LOCKSTATS: one line per holder, the ones that blocked others longest first
+  db_mutex holder=KEYS acquisitions=.. contended=.. wait_usec=.. wait_p99_usec=.. hold_usec=..
+           hold_p50_usec=.. hold_p99_usec=.. hold_max_usec=.. blocked_others_usec=..
+INFO lockstats: a line per lock with the totals and the holder that blocked others longest
+*/
+string ProfiledMutex::report(bool summary) {
+    vector<RowSnapshot> snapshot;
+    int count = rowCount.load(memory_order_acquire);
+    for (int i = 0; i < count; i++) {
+        const LockHolderRow& r = rows[i];
+        RowSnapshot s{r.name, r.section,
+                      r.acquisitions.load(memory_order_relaxed), r.contended.load(memory_order_relaxed),
+                      r.waitNanos.load(memory_order_relaxed), r.holdNanos.load(memory_order_relaxed),
+                      r.maxHoldNanos.load(memory_order_relaxed), r.blockedNanos.load(memory_order_relaxed),
+                      vector<uint64_t>(LATENCY_BUCKETS), vector<uint64_t>(LATENCY_BUCKETS)};
+        if (!s.acquisitions) continue;
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            s.waitBuckets[b] = r.waitBuckets[b].load(memory_order_relaxed);
+            s.holdBuckets[b] = r.holdBuckets[b].load(memory_order_relaxed);
+        }
+        snapshot.push_back(move(s));
+    }
+    sort(snapshot.begin(), snapshot.end(), [](const RowSnapshot& a, const RowSnapshot& b) {
+        return a.blockedNanos != b.blockedNanos ? a.blockedNanos > b.blockedNanos : a.holdNanos > b.holdNanos;
+    });
+
+    ostringstream oss;
+    if (summary) {
+        uint64_t acquisitions = 0, contended = 0, waitNanos = 0, holdNanos = 0;
+        for (const auto& s : snapshot) {
+            if (s.section) continue; //inside some hold, already counted
+            acquisitions += s.acquisitions;
+            contended += s.contended;
+            waitNanos += s.waitNanos;
+            holdNanos += s.holdNanos;
+        }
+        oss << "lock_" << lockName << ":acquisitions=" << acquisitions << ",contended=" << contended
+            << ",wait_usec=" << waitNanos / 1000 << ",hold_usec=" << holdNanos / 1000;
+        if (!snapshot.empty() && snapshot[0].blockedNanos) {
+            oss << ",top_blocker=" << snapshot[0].name << ",top_blocker_usec=" << snapshot[0].blockedNanos / 1000;
+        }
+        oss << "\r\n";
+        return oss.str();
+    }
+    for (const auto& s : snapshot) {
+        oss << lockName << " holder=" << s.name << " acquisitions=" << s.acquisitions << " contended=" << s.contended
+            << " wait_usec=" << usec(s.waitNanos) << " wait_p99_usec=" << usec(percentile(s.waitBuckets, 99))
+            << " hold_usec=" << usec(s.holdNanos) << " hold_p50_usec=" << usec(min(percentile(s.holdBuckets, 50), s.maxHoldNanos))
+            << " hold_p99_usec=" << usec(min(percentile(s.holdBuckets, 99), s.maxHoldNanos))
+            << " hold_max_usec=" << usec(s.maxHoldNanos)
+            << " blocked_others_usec=" << usec(s.blockedNanos) << "\n";
+    }
+    return oss.str();
+}
+
+string LockStats::report(bool summary) {
+    lock_guard<mutex> lock(registry_mutex);
+    string text;
+    for (ProfiledMutex* m : locks) text += m->report(summary);
+    return text;
+}
+
+void LockStats::reset() {
+    lock_guard<mutex> lock(registry_mutex);
+    for (ProfiledMutex* m : locks) m->reset();
+}
+
+#endif
@@ -0,0 +1,344 @@
+#include "../include/MetricsServer.h"
+#include "../include/ServerStats.h"
+#include "../include/RedisDatabase.h"
+#include <iostream>
+#include <charconv>
+#include <string_view>
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+#include <strings.h>
+
+using namespace std;
+
+MetricsServer& MetricsServer::getInstance() {
+    static MetricsServer instance;
+    return instance;
+}
+
+bool MetricsServer::start(int port) {
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) {
+        cerr << "Error creating the metrics socket\n";
+        return false;
+    }
+    int opt = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (::bind(listenFd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenFd, METRICS_MAX_CONNECTIONS) < 0) {
+        cerr << "Error listening for metrics on port " << port << "\n";
+        ::close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    page.reserve(64 * 1024);
+    poller = thread(&MetricsServer::loop, this);
+    cout << "Metrics at http://0.0.0.0:" << port << "/metrics\n";
+    return true;
+}
+
+void MetricsServer::shutdown() {
+    stopping = true;
+    if (poller.joinable()) poller.join();
+    for (auto& c : connections) closeConnection(c);
+    if (listenFd >= 0) ::close(listenFd);
+    listenFd = -1;
+}
+
+void MetricsServer::closeConnection(MetricsConnection& c) {
+    if (c.fd < 0) return;
+    ::close(c.fd);
+    c.fd = -1;
+    c.received = 0;
+    c.reply.clear(); //keeps its capacity for the next scraper
+    c.sent = 0;
+}
+
+void MetricsServer::loop() {
+    pollfd fds[METRICS_MAX_CONNECTIONS + 1];
+    int slotOf[METRICS_MAX_CONNECTIONS + 1];
+    while (!stopping) {
+        int n = 0;
+        fds[n++] = {listenFd, POLLIN, 0};
+        for (int i = 0; i < METRICS_MAX_CONNECTIONS; i++) {
+            MetricsConnection& c = connections[i];
+            if (c.fd < 0) continue;
+            //a connection is either reading its next request or writing a reply
+            fds[n] = {c.fd, short(c.sent < c.reply.size() ? POLLOUT : POLLIN), 0};
+            slotOf[n++] = i;
+        }
+        if (poll(fds, n, 100) <= 0) continue; //the timeout is when stopping is looked at
+
+        for (int k = 1; k < n; k++) {
+            if (!fds[k].revents) continue;
+            MetricsConnection& c = connections[slotOf[k]];
+            bool open = (fds[k].revents & POLLOUT) ? writeReply(c) : readRequest(c);
+            if (!open) closeConnection(c);
+        }
+        if (!(fds[0].revents & POLLIN)) continue;
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) break;
+            MetricsConnection* slot = nullptr;
+            for (auto& c : connections) {
+                if (c.fd < 0) {
+                    slot = &c;
+                    break;
+                }
+            }
+            if (!slot) {
+                ::close(fd); //too many scrapers at once
+                continue;
+            }
+            slot->fd = fd;
+        }
+    }
+}
+
+static const char* findHeaderEnd(const char* data, size_t size) {
+    for (size_t i = 0; i + 3 < size; i++) {
+        if (memcmp(data + i, "\r\n\r\n", 4) == 0) return data + i + 4;
+    }
+    return nullptr;
+}
+
+// a header's value in the request, "" when it is not there
+static string_view headerValue(string_view headers, const char* name) {
+    size_t nameLen = strlen(name);
+    size_t pos = headers.find("\r\n");
+    while (pos != string_view::npos && pos + 2 < headers.size()) {
+        size_t start = pos + 2;
+        size_t end = headers.find("\r\n", start);
+        if (end == string_view::npos) end = headers.size();
+        string_view line = headers.substr(start, end - start);
+        if (line.size() > nameLen && line[nameLen] == ':' && strncasecmp(line.data(), name, nameLen) == 0) {
+            string_view value = line.substr(nameLen + 1);
+            while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+            return value;
+        }
+        pos = end;
+    }
+    return {};
+}
+
+bool MetricsServer::readRequest(MetricsConnection& c) {
+    ssize_t n = recv(c.fd, c.request + c.received, METRICS_REQUEST_BYTES - c.received, 0);
+    if (n == 0) return false;
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    c.received += n;
+    return serveRequest(c);
+}
+
+bool MetricsServer::serveRequest(MetricsConnection& c) {
+    const char* end = findHeaderEnd(c.request, c.received);
+    if (!end) {
+        if (c.received < METRICS_REQUEST_BYTES) return true; //the rest is on its way
+        c.keepAlive = false;
+        respond(c, "431 Request Header Fields Too Large", false);
+        return writeReply(c);
+    }
+
+    //GET /metrics HTTP/1.1
+    string_view request(c.request, end - c.request);
+    string_view line = request.substr(0, request.find("\r\n"));
+    size_t methodEnd = line.find(' ');
+    size_t pathEnd = methodEnd == string_view::npos ? string_view::npos : line.find(' ', methodEnd + 1);
+    if (pathEnd == string_view::npos) {
+        c.keepAlive = false;
+        respond(c, "400 Bad Request", false);
+        return writeReply(c);
+    }
+    string_view method = line.substr(0, methodEnd);
+    string_view path = line.substr(methodEnd + 1, pathEnd - methodEnd - 1);
+    string_view version = line.substr(pathEnd + 1);
+    path = path.substr(0, path.find('?'));
+    string_view connection = headerValue(request, "Connection");
+    c.keepAlive = version == "HTTP/1.1" ? !(connection.size() == 5 && strncasecmp(connection.data(), "close", 5) == 0)
+                                        : connection.size() == 10 && strncasecmp(connection.data(), "keep-alive", 10) == 0;
+    if (method != "GET" && method != "HEAD") respond(c, "405 Method Not Allowed", false);
+    else if (path != "/metrics") respond(c, "404 Not Found", false);
+    else respond(c, "200 OK", true);
+    if (method == "HEAD") c.reply.resize(c.reply.find("\r\n\r\n") + 4);
+
+    //whatever came after this request waits for the reply to go out
+    size_t used = end - c.request;
+    memmove(c.request, end, c.received - used);
+    c.received -= used;
+    return writeReply(c);
+}
+
+bool MetricsServer::writeReply(MetricsConnection& c) {
+    while (c.sent < c.reply.size()) {
+        ssize_t n = send(c.fd, c.reply.data() + c.sent, c.reply.size() - c.sent, MSG_NOSIGNAL);
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        c.sent += n;
+    }
+    if (!c.keepAlive) return false;
+    c.reply.clear();
+    c.sent = 0;
+    //a pipelined request may already be waiting
+    return c.received ? serveRequest(c) : true;
+}
+
+static void appendNumber(string& out, uint64_t value) {
+    char buf[24];
+    auto result = to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, result.ptr - buf);
+}
+
+static void appendNumber(string& out, double value) {
+    char buf[32];
+    auto result = to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, result.ptr - buf);
+}
+
+void MetricsServer::respond(MetricsConnection& c, const char* status, bool metrics) {
+    const char* body = "";
+    size_t bodyLen = 0;
+    if (metrics) {
+        render();
+        body = page.data();
+        bodyLen = page.size();
+    }
+    else {
+        body = status;
+        bodyLen = strlen(status);
+    }
+    c.reply.clear();
+    c.reply.append("HTTP/1.1 ").append(status).append("\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n");
+    c.reply.append("Content-Length: ");
+    appendNumber(c.reply, uint64_t(bodyLen));
+    c.reply.append(c.keepAlive ? "\r\n\r\n" : "\r\nConnection: close\r\n\r\n");
+    c.reply.append(body, bodyLen);
+    c.sent = 0;
+}
+
+// # HELP and # TYPE lines of a metric
+static void family(string& out, const char* name, const char* type, const char* help) {
+    out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+    out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+static void metric(string& out, const char* name, const char* type, const char* help, uint64_t value) {
+    family(out, name, type, help);
+    out.append(name).append(" ");
+    appendNumber(out, value);
+    out.append("\n");
+}
+
+// name{cmd="get"}
+static void commandLabel(string& out, const char* name, int command) {
+    out.append(name).append("{cmd=\"");
+    for (char ch : CommandStats::name(command)) out.push_back(tolower(ch));
+    out.append("\"");
+}
+
+static const struct {
+    Stat stat;
+    const char* name;
+    const char* help;
+} counters[] = {
+    {STAT_COMMANDS, "redis_commands_processed_total", "Commands processed."},
+    {STAT_CONNECTIONS, "redis_connections_received_total", "Client connections accepted."},
+    {STAT_NET_INPUT, "redis_net_input_bytes_total", "Bytes read from clients."},
+    {STAT_NET_OUTPUT, "redis_net_output_bytes_total", "Bytes written to clients."},
+    {STAT_KEYSPACE_HITS, "redis_keyspace_hits_total", "Reads that found their key."},
+    {STAT_KEYSPACE_MISSES, "redis_keyspace_misses_total", "Reads that did not find their key."},
+    {STAT_EXPIRED, "redis_expired_keys_total", "Keys removed because their TTL ran out."},
+    {STAT_EVICTED, "redis_evicted_keys_total", "Keys removed to stay under maxmemory."},
+};
+
+// cumulative buckets at 1, 2, 4 ... 2^25 usec (~34s), as in LATENCY HISTOGRAM, and +Inf
+const int METRICS_LATENCY_BOUNDS = 26;
+
+void MetricsServer::render() {
+    page.clear();
+    ServerStats& stats = ServerStats::getInstance();
+    metric(page, "redis_uptime_seconds", "gauge", "Seconds since the server started.", stats.uptimeSeconds());
+    metric(page, "redis_connected_clients", "gauge", "Client connections open.", stats.connectedClients());
+    uint64_t totals[STAT_COUNT];
+    stats.totals(totals);
+    for (const auto& counter : counters)
+        metric(page, counter.name, "counter", counter.help, totals[counter.stat]);
+    metric(page, "redis_memory_used_bytes", "gauge", "Bytes the allocator handed out.", stats.usedMemory());
+    metric(page, "redis_memory_rss_bytes", "gauge", "Resident set size of the process.", stats.rssMemory());
+
+    RedisDatabase& db = RedisDatabase::getInstance();
+    KeyspaceCounts keyspace = db.keyspaceCounts();
+    family(page, "redis_keys", "gauge", "Keys by type.");
+    const pair<const char*, uint64_t> types[] = {{"string", keyspace.strings}, {"list", keyspace.lists}, {"hash", keyspace.hashes}};
+    for (const auto& type : types) {
+        page.append("redis_keys{type=\"").append(type.first).append("\"} ");
+        appendNumber(page, type.second);
+        page.append("\n");
+    }
+    metric(page, "redis_keys_with_expiry", "gauge", "Keys with a TTL.", keyspace.expires);
+    PersistenceStats persistence = db.persistenceStats();
+    metric(page, "redis_rdb_changes_since_last_save", "gauge", "Writes not yet in any checkpoint.", persistence.changesSinceSave);
+    metric(page, "redis_rdb_last_save_timestamp_seconds", "gauge", "Unix time of the last successful save.", persistence.lastSaveTime);
+    metric(page, "redis_rdb_bgsave_in_progress", "gauge", "1 while a background save runs.", persistence.bgsaveInProgress);
+
+    CommandStats::getInstance().totals(commandTotals);
+    struct {
+        const char* name;
+        const char* help;
+        uint64_t CommandStats::Totals::*field;
+    } perCommand[] = {
+        {"redis_commands_total", "Calls per command, failed ones included.", &CommandStats::Totals::calls},
+        {"redis_commands_failed_total", "Calls that replied with an error.", &CommandStats::Totals::failed},
+        {"redis_commands_rejected_total", "Calls refused before running: redirects, READONLY.", &CommandStats::Totals::rejected},
+    };
+    for (const auto& row : perCommand) {
+        family(page, row.name, "counter", row.help);
+        for (size_t i = 0; i < commandTotals.size(); i++) {
+            const CommandStats::Totals& t = commandTotals[i];
+            if (!t.calls && !t.rejected) continue;
+            commandLabel(page, row.name, i);
+            page.append("} ");
+            appendNumber(page, t.*row.field);
+            page.append("\n");
+        }
+    }
+
+    family(page, "redis_command_duration_seconds", "histogram", "Time spent running each command.");
+    for (size_t i = 0; i < commandTotals.size(); i++) {
+        const CommandStats::Totals& t = commandTotals[i];
+        if (!t.calls) continue;
+        //the fine buckets folded into the power of two bounds
+        uint64_t counts[METRICS_LATENCY_BOUNDS + 1] = {};
+        uint64_t recorded = 0;
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            if (!t.buckets[b]) continue;
+            uint64_t usec = (latencyBucketHighest(b) + 999) / 1000;
+            int bound = usec <= 1 ? 0 : 64 - __builtin_clzll(usec - 1);
+            counts[min(bound, METRICS_LATENCY_BOUNDS)] += t.buckets[b];
+            recorded += t.buckets[b];
+        }
+        uint64_t seen = 0;
+        for (int bound = 0; bound <= METRICS_LATENCY_BOUNDS; bound++) {
+            seen += counts[bound];
+            commandLabel(page, "redis_command_duration_seconds_bucket", i);
+            page.append(",le=\"");
+            if (bound < METRICS_LATENCY_BOUNDS) appendNumber(page, double(uint64_t(1) << bound) / 1e6);
+            else page.append("+Inf");
+            page.append("\"} ");
+            appendNumber(page, seen);
+            page.append("\n");
+        }
+        commandLabel(page, "redis_command_duration_seconds_sum", i);
+        page.append("} ");
+        appendNumber(page, t.nanos / 1e9);
+        page.append("\n");
+        //latency-tracking no keeps counting calls but not the histogram
+        commandLabel(page, "redis_command_duration_seconds_count", i);
+        page.append("} ");
+        appendNumber(page, recorded);
+        page.append("\n");
+    }
+}
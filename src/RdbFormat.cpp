@@ -0,0 +1,263 @@
+#include "../include/RdbFormat.h"
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
+
+using namespace std;
+
+/*
+CRC64 --reflected Jones polynomial (0xad93d23594c935a9, reflected 0x95ac9329ac4bc9b5).
+Slicing-by-8: table[k][b] is the CRC of byte b followed by k zero bytes, so eight
+input bytes are folded in with eight independent lookups instead of eight dependent
+shift/lookup rounds.
+*/
+static const uint64_t CRC64_POLY = 0x95ac9329ac4bc9b5ULL;
+
+struct Crc64Tables {
+    uint64_t t[8][256];
+    Crc64Tables() {
+        for (int n = 0; n < 256; n++) {
+            uint64_t crc = n;
+            for (int k = 0; k < 8; k++)
+                crc = (crc & 1) ? (crc >> 1) ^ CRC64_POLY : crc >> 1;
+            t[0][n] = crc;
+        }
+        for (int n = 0; n < 256; n++) {
+            for (int k = 1; k < 8; k++)
+                t[k][n] = (t[k - 1][n] >> 8) ^ t[0][t[k - 1][n] & 0xff];
+        }
+    }
+};
+
+static const Crc64Tables crcTables;
+
+uint64_t crc64(uint64_t crc, const void* data, size_t len) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const auto& t = crcTables.t;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8); //little endian hosts only, like the rest of the format
+        crc ^= word;
+        crc = t[7][crc & 0xff] ^ t[6][(crc >> 8) & 0xff] ^
+              t[5][(crc >> 16) & 0xff] ^ t[4][(crc >> 24) & 0xff] ^
+              t[3][(crc >> 32) & 0xff] ^ t[2][(crc >> 40) & 0xff] ^
+              t[1][(crc >> 48) & 0xff] ^ t[0][crc >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+//Writer
+static const size_t RDB_WRITE_CHUNK = 64 * 1024;
+
+RdbWriter::RdbWriter(int fd)
+    : fd(fd), out(nullptr), offset(0), crc(0), sectionCrc(0), sectionStart(0), sectionOpen(false), ok(true) {
+    buf.reserve(RDB_WRITE_CHUNK + 1024);
+}
+
+RdbWriter::RdbWriter(string* out)
+    : fd(-1), out(out), offset(0), crc(0), sectionCrc(0), sectionStart(0), sectionOpen(false), ok(true) {}
+
+void RdbWriter::writeHeader() {
+    char header[16];
+    snprintf(header, sizeof(header), "%s%04d", RDB_MAGIC, RDB_VERSION);
+    buf.append(header);
+}
+
+void RdbWriter::writeByte(uint8_t b) {
+    buf.push_back(static_cast<char>(b));
+    if (buf.size() >= RDB_WRITE_CHUNK) flush();
+}
+
+// LEB128 varint --7 bits per byte, high bit set on every byte but the last
+void RdbWriter::writeLength(uint64_t len) {
+    while (len >= 0x80) {
+        buf.push_back(static_cast<char>((len & 0x7f) | 0x80));
+        len >>= 7;
+    }
+    buf.push_back(static_cast<char>(len));
+    if (buf.size() >= RDB_WRITE_CHUNK) flush();
+}
+
+void RdbWriter::writeString(string_view s) {
+    writeLength(s.size());
+    buf.append(s);
+    if (buf.size() >= RDB_WRITE_CHUNK) flush();
+}
+
+void RdbWriter::writeUint64(uint64_t v) {
+    char bytes[8];
+    memcpy(bytes, &v, 8);
+    buf.append(bytes, 8);
+    if (buf.size() >= RDB_WRITE_CHUNK) flush();
+}
+
+bool RdbWriter::flush() {
+    if (buf.empty() || !ok) return ok;
+    if (sectionOpen)
+        sectionCrc = crc64(sectionCrc, buf.data(), buf.size());
+    else
+        crc = crc64(crc, buf.data(), buf.size());
+    size_t written = out ? buf.size() : 0;
+    if (out) out->append(buf);
+    while (written < buf.size()) {
+        ssize_t n = ::write(fd, buf.data() + written, buf.size() - written);
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        written += n;
+    }
+    offset += buf.size();
+    buf.clear();
+    return ok;
+}
+
+//sections start and end on a flush, so each chunk belongs to exactly one checksum
+void RdbWriter::beginSection() {
+    flush();
+    sectionOpen = true;
+    sectionStart = offset;
+    sectionCrc = 0;
+}
+
+RdbSection RdbWriter::endSection(uint64_t keys) {
+    flush();
+    sectionOpen = false;
+    RdbSection section;
+    section.offset = sectionStart;
+    section.length = offset - sectionStart;
+    section.keys = keys;
+    section.crc = sectionCrc;
+    return section;
+}
+
+bool RdbWriter::finish(const vector<RdbSection>& sections) {
+    writeByte(RDB_OPCODE_EOF);
+    for (const auto& section : sections) {
+        writeUint64(section.offset);
+        writeUint64(section.length);
+        writeUint64(section.keys);
+        writeUint64(section.crc);
+    }
+    writeUint64(sections.size());
+    if (!flush()) return false;
+    //the trailer is not part of its own checksum
+    char bytes[8];
+    memcpy(bytes, &crc, 8);
+    return ::write(fd, bytes, 8) == 8;
+}
+
+void RdbWriter::finishPayload() {
+    uint16_t version = RDB_VERSION;
+    buf.append(reinterpret_cast<const char*>(&version), 2);
+    flush();
+    out->append(reinterpret_cast<const char*>(&crc), 8);
+}
+
+//Reader
+RdbReader::RdbReader(const char* data, size_t size) : data(data), size(size), pos(0) {}
+
+bool RdbReader::readHeader(int& version) {
+    size_t magicLen = strlen(RDB_MAGIC);
+    if (size < magicLen + 4 || memcmp(data, RDB_MAGIC, magicLen) != 0) return false;
+    version = 0;
+    for (size_t i = magicLen; i < magicLen + 4; i++) {
+        if (data[i] < '0' || data[i] > '9') return false;
+        version = version * 10 + (data[i] - '0');
+    }
+    pos = magicLen + 4;
+    return true;
+}
+
+bool RdbReader::readByte(uint8_t& b) {
+    if (pos >= size) return false;
+    b = static_cast<uint8_t>(data[pos++]);
+    return true;
+}
+
+bool RdbReader::readLength(uint64_t& len) {
+    len = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (pos >= size) return false;
+        uint8_t b = static_cast<uint8_t>(data[pos++]);
+        len |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+bool RdbReader::readString(string& s) {
+    uint64_t len;
+    if (!readLength(len) || len > size - pos) return false;
+    s.assign(data + pos, len);
+    pos += len;
+    return true;
+}
+
+bool RdbReader::readUint64(uint64_t& v) {
+    if (size - pos < 8) return false;
+    memcpy(&v, data + pos, 8);
+    pos += 8;
+    return true;
+}
+
+bool rdbVerifyPayload(const string& payload) {
+    if (payload.size() < 10) return false;
+    uint16_t version;
+    memcpy(&version, payload.data() + payload.size() - 10, 2);
+    if (version > RDB_VERSION) return false;
+    uint64_t expected;
+    memcpy(&expected, payload.data() + payload.size() - 8, 8);
+    return crc64(0, payload.data(), payload.size() - 8) == expected;
+}
+
+bool rdbVerifyChecksum(const char* data, size_t size) {
+    if (size < 8) return false;
+    uint64_t expected;
+    memcpy(&expected, data + size - 8, 8);
+    return crc64(0, data, size - 8) == expected;
+}
+
+/*
+Everything outside the sections (header, RESIZEDB, AUX, EOF, index) is covered by the
+trailer. The sections themselves must tile the gap between the header and EOF.
+*/
+bool rdbReadIndex(const char* data, size_t size, size_t headerLen, vector<RdbSection>& sections) {
+    if (size < headerLen + 1 + 16) return false;
+    uint64_t count;
+    memcpy(&count, data + size - 16, 8);
+    //the index and the EOF byte before it fit between the header and the trailer
+    if (count > (size - 16 - headerLen - 1) / 32) return false;
+    size_t indexStart = size - 16 - count * 32;
+    sections.resize(count);
+    for (uint64_t i = 0; i < count; i++) {
+        const char* p = data + indexStart + i * 32;
+        memcpy(&sections[i].offset, p, 8);
+        memcpy(&sections[i].length, p + 8, 8);
+        memcpy(&sections[i].keys, p + 16, 8);
+        memcpy(&sections[i].crc, p + 24, 8);
+    }
+    //crc over [0, first section) + [end of last section, trailer)
+    size_t bodyStart = count ? sections[0].offset : indexStart - 1;
+    if (bodyStart < headerLen || bodyStart > indexStart - 1) return false;
+    size_t bodyEnd = bodyStart;
+    for (const auto& section : sections) {
+        if (section.offset != bodyEnd || section.length > indexStart - 1 - bodyEnd) return false;
+        bodyEnd += section.length;
+    }
+    if (bodyEnd != indexStart - 1) return false;
+    uint64_t crc = crc64(0, data, bodyStart);
+    crc = crc64(crc, data + bodyEnd, size - 8 - bodyEnd);
+    uint64_t expected;
+    memcpy(&expected, data + size - 8, 8);
+    return crc == expected && static_cast<uint8_t>(data[bodyEnd]) == RDB_OPCODE_EOF;
+}
+
+bool rdbVerifySection(const char* data, const RdbSection& section) {
+    return crc64(0, data + section.offset, section.length) == section.crc;
+}
@@ -7,6 +7,21 @@
 #include<iostream>
 #include <sstream>
 #include <cstddef>
+#include <cstring>
+#include <cctype>
+#include <chrono>
+#include <mutex>
+#include "../include/AppendOnlyFile.h"
+#include "../include/ServerConfig.h"
+#include "../include/Replication.h"
+#include "../include/Cluster.h"
+#include "../include/Tracking.h"
+#include "../include/ServerStats.h"
+#include "../include/CommandStats.h"
+#include "../include/SlowLog.h"
+#include "../include/LockStats.h"
+#include "../include/LatencyMonitor.h"
+#include <shared_mutex>
 
 
 using namespace std;
@@ -84,6 +99,66 @@ using namespace std;
 
     //SET GET KEY handlers
 }
+// parseRespFrame() is the streaming version: it never copies the input, tells the
+// caller how many bytes one command used and returns 0 when the command is not
+// complete yet, so a buffer holding several (or half a) command can be fed to it.
+static bool parseRespNumber(const char* data, size_t len, size_t& pos, long long& value) {
+    size_t start = pos;
+    bool negative = false;
+    if (pos < len && data[pos] == '-') {
+        negative = true;
+        pos++;
+    }
+    value = 0;
+    while (pos < len && data[pos] >= '0' && data[pos] <= '9') {
+        value = value * 10 + (data[pos] - '0');
+        pos++;
+    }
+    if (negative) value = -value;
+    return pos > start;
+}
+
+size_t parseRespFrame(const char* data, size_t len, vector<string>& tokens) {
+    tokens.clear();
+    if (len == 0) return 0;
+    if (data[0] != '*') {
+        //inline command: one line of space separated words
+        const char* nl = static_cast<const char*>(memchr(data, '\n', len));
+        if (!nl) return 0;
+        size_t lineLen = nl - data;
+        size_t i = 0;
+        while (i < lineLen) {
+            while (i < lineLen && isspace(static_cast<unsigned char>(data[i]))) i++;
+            size_t start = i;
+            while (i < lineLen && !isspace(static_cast<unsigned char>(data[i]))) i++;
+            if (i > start) tokens.emplace_back(data + start, i - start);
+        }
+        return lineLen + 1;
+    }
+    size_t pos = 1;
+    long long count;
+    if (!parseRespNumber(data, len, pos, count)) return pos >= len ? 0 : string::npos;
+    if (pos + 2 > len) return 0;
+    if (data[pos] != '\r' || data[pos + 1] != '\n') return string::npos;
+    pos += 2;
+    if (count < 0 || count > 1024 * 1024) return string::npos;
+    tokens.reserve(count);
+    for (long long i = 0; i < count; i++) {
+        if (pos >= len) return 0;
+        if (data[pos] != '$') return string::npos;
+        pos++;
+        long long bulkLen;
+        if (!parseRespNumber(data, len, pos, bulkLen)) return pos >= len ? 0 : string::npos;
+        if (pos + 2 > len) return 0;
+        if (bulkLen < 0 || data[pos] != '\r' || data[pos + 1] != '\n') return string::npos;
+        pos += 2;
+        if (len - pos < static_cast<size_t>(bulkLen) + 2) return 0;
+        tokens.emplace_back(data + pos, bulkLen);
+        pos += bulkLen + 2;
+    }
+    return pos;
+}
+
 //Common commands
 static    string handlePing(const    vector<   string>& /*tokens*/, RedisDatabase& /*db*/){
     return "+PONG\r\n";
@@ -94,8 +169,19 @@ static    string handleEcho(const    vector<   string>& tokens, RedisDatabase& /
     }
     return "+" + tokens[1] + "\r\n";
 }
-static    string handleFlushAll(const    vector<   string>& /*tokens*/, RedisDatabase& db){
-    db.flushAll();
+// FLUSHALL [ASYNC|SYNC] --ASYNC frees the old keyspace in the background; neither: lazyfree-lazy-user-flush
+static    string handleFlushAll(const    vector<   string>& tokens, RedisDatabase& db){
+    bool async = ServerConfig::getInstance().lazyfreeLazyUserFlush;
+    if (tokens.size() > 2)
+        return "-Error: FLUSHALL accepts ASYNC or SYNC\r\n";
+    if (tokens.size() == 2) {
+           string mode = tokens[1];
+           transform(mode.begin(), mode.end(), mode.begin(), ::toupper);
+        if (mode != "ASYNC" && mode != "SYNC")
+            return "-Error: FLUSHALL accepts ASYNC or SYNC\r\n";
+        async = mode == "ASYNC";
+    }
+    db.flushAll(async);
     return "+OK\r\n";
 }
 //Key-Value operations
@@ -134,6 +220,12 @@ static    string handleGet(const    vector<   string>& tokens, RedisDatabase& db
     return "$-1\r\n";
 }
 
+static    string handleStrlen(const    vector<   string>& tokens, RedisDatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: STRLEN requires key\r\n";
+    return ":" +    to_string(db.strlen(tokens[1])) + "\r\n";
+}
+
      
 
 // KEYS Command - Iterates all three stores
@@ -153,6 +245,41 @@ static    string handleKeys(const    vector<   string>& /*tokens*/, RedisDatabas
     return oss.str();
 }
 
+// SCAN cursor [MATCH pattern] [COUNT n] [TYPE string|list|hash] --KEYS in small steps
+static    string handleScan(const    vector<   string>& tokens, RedisDatabase& db) {
+    if (tokens.size() < 2 || tokens.size() % 2 != 0)
+        return "-Error: SCAN requires a cursor and option value pairs\r\n";
+    uint64_t cursor;
+    size_t count = 10;
+       string pattern, type;
+    try {
+        size_t pos;
+        cursor = stoull(tokens[1], &pos);
+        if (pos != tokens[1].size()) throw invalid_argument("cursor");
+    } catch (const exception&) {
+        return "-Error: invalid cursor\r\n";
+    }
+    for (size_t i = 2; i < tokens.size(); i += 2) {
+           string option = tokens[i];
+           transform(option.begin(), option.end(), option.begin(), ::toupper);
+        if (option == "MATCH") pattern = tokens[i + 1] == "*" ? "" : tokens[i + 1];
+        else if (option == "TYPE") type = tokens[i + 1];
+        else if (option == "COUNT") {
+            long long n = atoll(tokens[i + 1].c_str());
+            if (n < 1) return "-Error: COUNT must be a positive number\r\n";
+            count = n;
+        }
+        else return "-Error: Unknown SCAN option '" + tokens[i] + "'\r\n";
+    }
+       vector<   string> keys;
+    uint64_t next = db.scan(cursor, count, pattern, type, keys);
+       string nextCursor =    to_string(next);
+       ostringstream oss;
+    oss << "*2\r\n$" << nextCursor.size() << "\r\n" << nextCursor << "\r\n*" << keys.size() << "\r\n";
+    for (const auto& key : keys)
+        oss << "$" << key.size() << "\r\n" << key << "\r\n";
+    return oss.str();
+}
 
 //list ops
 
@@ -168,6 +295,13 @@ static    string handleDel(const    vector<   string>& tokens, RedisDatabase& db
     bool res = db.del(tokens[1]);
     return ":" +    to_string(res ? 1 : 0) + "\r\n";
 }
+// UNLINK --DEL that leaves freeing a big value to the lazy free thread
+static    string handleUnlink(const    vector<   string>& tokens, RedisDatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: UNLINK requires key\r\n";
+    bool res = db.unlinkKey(tokens[1]);
+    return ":" +    to_string(res ? 1 : 0) + "\r\n";
+}
 
 static    string handleExpire(const    vector<   string>& tokens, RedisDatabase& db) {
     if (tokens.size() < 3)
@@ -183,6 +317,18 @@ static    string handleExpire(const    vector<   string>& tokens, RedisDatabase&
     }
 }
 
+static    string handlePexpireat(const    vector<   string>& tokens, RedisDatabase& db) {
+    if (tokens.size() < 3)
+        return "-Error: PEXPIREAT requires key and unix time in milliseconds\r\n";
+    try {
+        if (db.pexpireat(tokens[1],    stoull(tokens[2])))
+            return ":1\r\n";
+        return ":0\r\n";
+    } catch (const    exception&) {
+        return "-Error: Invalid expiration time\r\n";
+    }
+}
+
 static    string handleRename(const    vector<   string>& tokens, RedisDatabase& db) {
     if (tokens.size() < 3)
         return "-Error: RENAME requires old key and new key\r\n";
@@ -425,23 +571,582 @@ static    string handleHmset(const    vector<   string>& tokens, RedisDatabase&
     return "+OK\r\n";
 }
 
+//Persistence
+
+// SAVE blocks every client while the base is written, BGSAVE forks a copy-on-write
+// child and returns immediately (see RedisDatabase::forkSnapshot). Both replace the
+// base and the delta checkpoints written against the old one.
+static    string handleSave(const    vector<   string>& /*tokens*/, RedisDatabase& db) {
+    if (db.persistenceStats().bgsaveInProgress)
+        return "-Error: Background save already in progress\r\n";
+    if (db.save())
+        return "+OK\r\n";
+    return "-Error: SAVE failed\r\n";
+}
+
+static    string handleBgsave(const    vector<   string>& /*tokens*/, RedisDatabase& db) {
+    if (db.persistenceStats().bgsaveInProgress)
+        return "-Error: Background save already in progress\r\n";
+    if (db.bgsaveBase())
+        return "+Background saving started\r\n";
+    return "-Error: Background save failed to start\r\n";
+}
+
+static    string handleLastsave(const    vector<   string>& /*tokens*/, RedisDatabase& db) {
+    return ":" +    to_string(db.persistenceStats().lastSaveTime) + "\r\n";
+}
+
+// BGREWRITEAOF --new base snapshot from a forked child, writes continue into a new tail
+static    string handleBgrewriteaof(const    vector<   string>& /*tokens*/, RedisDatabase& db) {
+    AppendOnlyFile& aof = AppendOnlyFile::getInstance();
+    if (!aof.isOpen())
+        return "-Error: Append only file is disabled\r\n";
+    if (aof.stats().rewriteInProgress)
+        return "-Error: Background append only file rewriting already in progress\r\n";
+    if (db.forkInProgress()) {
+        aof.scheduleRewrite();
+        return "+Background append only file rewriting scheduled\r\n";
+    }
+    if (aof.rewrite())
+        return "+Background append only file rewriting started\r\n";
+    return "-Error: Background append only file rewriting failed to start\r\n";
+}
+
+// CONFIG GET <pattern> / CONFIG SET <name> <value>
+static    string handleConfig(const    vector<   string>& tokens, RedisDatabase& /*db*/) {
+    if (tokens.size() < 3)
+        return "-Error: CONFIG requires GET pattern or SET name value\r\n";
+       string sub = tokens[1];
+       transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    ServerConfig& config = ServerConfig::getInstance();
+    if (sub == "GET") {
+        auto values = config.get(tokens[2]);
+           ostringstream oss;
+        oss << "*" << values.size() * 2 << "\r\n";
+        for (const auto& nv : values) {
+            oss << "$" << nv.first.size() << "\r\n" << nv.first << "\r\n";
+            oss << "$" << nv.second.size() << "\r\n" << nv.second << "\r\n";
+        }
+        return oss.str();
+    }
+    if (sub == "SET" && tokens.size() >= 4) {
+           string error;
+        if (config.set(tokens[2], tokens[3], error))
+            return "+OK\r\n";
+        return "-" + error + "\r\n";
+    }
+    return "-Error: Unknown CONFIG subcommand\r\n";
+}
+
+// INFO [section] --every section, or only the named one
+static    string handleInfo(const    vector<   string>& tokens, RedisDatabase& db) {
+       string section = tokens.size() > 1 ? tokens[1] : "default";
+       transform(section.begin(), section.end(), section.begin(), ::tolower);
+    //per command sections are long, only asked for or with all
+    bool everything = section == "all" || section == "everything";
+    bool all = everything || section == "default";
+       ostringstream oss;
+    ServerStats& stats = ServerStats::getInstance();
+    if (all || section == "server") {
+        oss << stats.serverInfo();
+    }
+    if (all || section == "clients") {
+        if (oss.tellp() > 0) oss << "\r\n";
+        oss << stats.clientsInfo() << Tracking::getInstance().info();
+    }
+    if (all || section == "memory") {
+        if (oss.tellp() > 0) oss << "\r\n";
+        oss << stats.memoryInfo();
+    }
+    if (all || section == "persistence") {
+        if (oss.tellp() > 0) oss << "\r\n";
+        PersistenceStats st = db.persistenceStats();
+        AofStats aof = AppendOnlyFile::getInstance().stats();
+        oss << "# Persistence\r\n"
+            << "rdb_changes_since_last_save:" << st.changesSinceSave << "\r\n"
+            << "rdb_bgsave_in_progress:" << (st.bgsaveInProgress ? 1 : 0) << "\r\n"
+            << "rdb_last_save_time:" << st.lastSaveTime << "\r\n"
+            << "rdb_last_bgsave_status:" << (st.lastBgsaveOk ? "ok" : "err") << "\r\n"
+            << "rdb_last_bgsave_time_sec:" << st.lastBgsaveSeconds << "\r\n"
+            << "rdb_last_save_duration_usec:" << st.lastSaveUsec << "\r\n"
+            << "rdb_last_load_keys_loaded:" << st.loadKeys << "\r\n"
+            << "rdb_last_load_time_sec:" << st.loadSeconds << "\r\n"
+            << "rdb_last_fork_usec:" << st.lastForkUsec << "\r\n"
+            << "rdb_last_cow_size:" << st.lastCowBytes << "\r\n"
+            << "rdb_base_size:" << st.baseBytes << "\r\n"
+            << "rdb_deltas_since_base:" << st.deltasSinceBase << "\r\n"
+            << "rdb_deltas_size:" << st.deltaBytes << "\r\n"
+            << "rdb_last_delta_keys:" << st.lastDeltaKeys << "\r\n"
+            << "rdb_last_delta_size:" << st.lastDeltaBytes << "\r\n"
+            << "aof_enabled:" << (aof.enabled ? 1 : 0) << "\r\n"
+            << "aof_rewrite_in_progress:" << (aof.rewriteInProgress ? 1 : 0) << "\r\n"
+            << "aof_rewrite_scheduled:" << (aof.rewriteScheduled ? 1 : 0) << "\r\n"
+            << "aof_rewrites:" << aof.rewrites << "\r\n"
+            << "aof_last_rewrite_time_sec:" << aof.lastRewriteSeconds << "\r\n"
+            << "aof_last_bgrewrite_status:" << (aof.lastRewriteOk ? "ok" : "err") << "\r\n"
+            << "aof_last_rewrite_switch_usec:" << aof.lastSwitchUsec << "\r\n"
+            << "aof_current_size:" << aof.currentSize << "\r\n"
+            << "aof_base_size:" << aof.baseSize << "\r\n"
+            << "aof_buffer_length:" << aof.pendingBytes << "\r\n"
+            << "aof_last_write_status:" << (aof.lastWriteOk ? "ok" : "err") << "\r\n"
+            << "aof_fsyncs:" << aof.fsyncs << "\r\n"
+            << "aof_last_fsync_usec:" << aof.lastFsyncUsec << "\r\n";
+    }
+    if (all || section == "stats") {
+        if (oss.tellp() > 0) oss << "\r\n";
+        oss << stats.statsInfo();
+    }
+    if (all || section == "replication") {
+        if (oss.tellp() > 0) oss << "\r\n";
+        oss << Replication::getInstance().info();
+    }
+    if (all || section == "cpu") {
+        if (oss.tellp() > 0) oss << "\r\n";
+        oss << stats.cpuInfo();
+    }
+    if (everything || section == "commandstats") {
+        if (oss.tellp() > 0) oss << "\r\n";
+        oss << CommandStats::getInstance().info();
+    }
+    if (everything || section == "latencystats") {
+        if (oss.tellp() > 0) oss << "\r\n";
+        oss << CommandStats::getInstance().latencyInfo();
+    }
+    if (LockStats::compiledIn && (everything || section == "lockstats")) {
+        if (oss.tellp() > 0) oss << "\r\n";
+        oss << "# Lockstats\r\n" << LockStats::getInstance().report(true);
+    }
+    if (all || section == "cluster") {
+        if (oss.tellp() > 0) oss << "\r\n";
+        oss << Cluster::getInstance().info();
+    }
+    if (all || section == "keyspace") {
+        if (oss.tellp() > 0) oss << "\r\n";
+        KeyspaceCounts counts = db.keyspaceCounts();
+        uint64_t keys = counts.strings + counts.lists + counts.hashes;
+        oss << "# Keyspace\r\n";
+        if (keys > 0) {
+            oss << "db0:keys=" << keys << ",expires=" << counts.expires << ",strings=" << counts.strings
+                << ",lists=" << counts.lists << ",hashes=" << counts.hashes << "\r\n";
+        }
+    }
+       string body = oss.str();
+    return "$" +    to_string(body.size()) + "\r\n" + body + "\r\n";
+}
+
+// REPLICAOF host port --become a replica; REPLICAOF NO ONE --become a master again
+static    string handleReplicaof(const    vector<   string>& tokens, RedisDatabase& /*db*/) {
+    if (tokens.size() != 3)
+        return "-Error: REPLICAOF requires host and port, or NO ONE\r\n";
+       string host = tokens[1], port = tokens[2];
+       transform(host.begin(), host.end(), host.begin(), ::toupper);
+       transform(port.begin(), port.end(), port.begin(), ::toupper);
+    Replication& repl = Replication::getInstance();
+    if (host == "NO" && port == "ONE") {
+        repl.promote();
+        return "+OK\r\n";
+    }
+    int portNum;
+    try {
+        portNum =    stoi(tokens[2]);
+    } catch (const    exception&) {
+        return "-Error: Invalid port\r\n";
+    }
+    if (portNum <= 0 || portNum > 65535)
+        return "-Error: Invalid port\r\n";
+    repl.replicaOf(tokens[1], portNum);
+    return "+OK\r\n";
+}
+
+// REPLCONF listening-port / capa during the handshake; the connection loop keeps the port
+static    string handleReplconf(const    vector<   string>& /*tokens*/, RedisDatabase& /*db*/) {
+    return "+OK\r\n";
+}
+
+//runs a write and records it in the append-only file and the replication stream
+static    string executeWrite(const    string& cmd, const    vector<   string>& tokens, RedisDatabase& db);
+
+//set by ASKING, good for the next command of the same connection (one thread per connection)
+static thread_local bool askingFlag = false;
+
+// MEMORY USAGE key [SAMPLES n] | MEMORY STATS --approximate, see MemoryCounts
+static    string handleMemory(const    vector<   string>& tokens, RedisDatabase& db) {
+    if (tokens.size() < 2) return "-Error: MEMORY requires a subcommand\r\n";
+       string sub = tokens[1];
+       transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if (sub == "USAGE") {
+        if (tokens.size() != 3 && tokens.size() != 5) return "-Error: MEMORY USAGE requires key [SAMPLES count]\r\n";
+        size_t samples = 5;
+        if (tokens.size() == 5) {
+               string option = tokens[3];
+               transform(option.begin(), option.end(), option.begin(), ::toupper);
+            long long n = atoll(tokens[4].c_str());
+            if (option != "SAMPLES" || n < 0) return "-Error: MEMORY USAGE requires key [SAMPLES count]\r\n";
+            samples = n;
+        }
+        uint64_t bytes;
+        if (!db.memoryUsage(tokens[2], samples, bytes)) return "$-1\r\n";
+        return ":" +    to_string(bytes) + "\r\n";
+    }
+    if (sub != "STATS") return "-Error: Unknown MEMORY subcommand '" + tokens[1] + "'\r\n";
+
+    static const char* classNames[MEM_CLASSES] = {"string.embstr", "string.raw", "list.vector", "hash.hashtable", "expires"};
+    MemoryCounts counts = db.memoryCounts();
+    ServerStats& stats = ServerStats::getInstance();
+    uint64_t keys = 0, dataset = counts.bucketBytes + counts.accessBytes;
+    for (int c = 0; c < MEM_CLASSES; c++) {
+        if (c != MEM_EXPIRES) keys += counts.keys[c];
+        dataset += counts.bytes[c];
+    }
+    size_t used = stats.usedMemory(), rss = stats.rssMemory();
+    vector<pair<string, string>> rows = {
+        {"total.allocated", to_string(used)},
+        {"rss.bytes", to_string(rss)},
+        {"dataset.bytes", to_string(dataset)},
+        {"dataset.percentage", to_string(used ? 100.0 * dataset / used : 0)},
+        {"keys.count", to_string(keys)},
+        {"keys.bytes-per-key", to_string(keys ? (dataset - counts.bytes[MEM_EXPIRES]) / keys : 0)},
+        {"overhead.hashtable.buckets", to_string(counts.bucketBytes)},
+        {"overhead.key-access", to_string(counts.accessBytes)},
+        {"fragmentation", to_string(used ? double(rss) / used : 0)},
+    };
+    for (int c = 0; c < MEM_CLASSES; c++) {
+        rows.push_back({string(classNames[c]) + ".keys", to_string(counts.keys[c])});
+        rows.push_back({string(classNames[c]) + ".bytes", to_string(counts.bytes[c])});
+    }
+       ostringstream oss;
+    oss << "*" << rows.size() * 2 << "\r\n";
+    for (const auto& row : rows) {
+        oss << "$" << row.first.size() << "\r\n" << row.first << "\r\n";
+        //numbers are integer replies, ratios bulk strings, as in Redis
+        if (row.second.find('.') == string::npos) oss << ":" << row.second << "\r\n";
+        else oss << "$" << row.second.size() << "\r\n" << row.second << "\r\n";
+    }
+    return oss.str();
+}
+
+// LATENCY HISTOGRAM [command ...] | LATEST | HISTORY event | RESET [event ...]
+static    string handleLatency(const    vector<   string>& tokens, RedisDatabase& /*db*/) {
+    if (tokens.size() < 2) return "-Error: LATENCY requires a subcommand\r\n";
+       string sub = tokens[1];
+       transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if (sub == "HISTOGRAM") return CommandStats::getInstance().histogram(tokens);
+    return LatencyMonitor::getInstance().command(tokens);
+}
+
+// SLOWLOG GET [count] | LEN | RESET
+static    string handleSlowlog(const    vector<   string>& tokens, RedisDatabase& /*db*/) {
+    return SlowLog::getInstance().command(tokens);
+}
+
+// DEBUG LOCKSTATS [RESET]: lock wait and hold times per holder, LOCKSTATS builds only
+static    string handleDebug(const    vector<   string>& tokens, RedisDatabase& /*db*/) {
+    if (tokens.size() < 2) return "-Error: DEBUG requires a subcommand\r\n";
+       string sub = tokens[1];
+       transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if (sub != "LOCKSTATS") return "-Error: Unknown DEBUG subcommand '" + tokens[1] + "'\r\n";
+    if (!LockStats::compiledIn) return "-Error: lock profiling is not compiled in, build with make LOCKSTATS=1\r\n";
+       string option = tokens.size() > 2 ? tokens[2] : "";
+       transform(option.begin(), option.end(), option.begin(), ::toupper);
+    if (option == "RESET") {
+        LockStats::getInstance().reset();
+        return "+OK\r\n";
+    }
+       string report = LockStats::getInstance().report(false);
+    return "$" +    to_string(report.size()) + "\r\n" + report + "\r\n";
+}
+
+// CLIENT ID | CLIENT TRACKING on|off [BCAST] [PREFIX p ...] [NOLOOP]
+static    string handleClient(const    vector<   string>& tokens, RedisDatabase& /*db*/) {
+    return Tracking::getInstance().command(tokens);
+}
+
+// CLUSTER <subcommand> ...
+static    string handleCluster(const    vector<   string>& tokens, RedisDatabase& /*db*/) {
+    return Cluster::getInstance().command(tokens);
+}
+
+// ASKING --the next command may use a slot this node is importing
+static    string handleAsking(const    vector<   string>& /*tokens*/, RedisDatabase& /*db*/) {
+    askingFlag = true;
+    return "+OK\r\n";
+}
+
+// DUMP key --the value as a payload RESTORE accepts
+static    string handleDump(const    vector<   string>& tokens, RedisDatabase& db) {
+    if (tokens.size() != 2)
+        return "-Error: DUMP requires key\r\n";
+       string payload;
+    uint64_t expireMs;
+    if (!db.dumpKey(tokens[1], payload, expireMs))
+        return "$-1\r\n";
+    return "$" +    to_string(payload.size()) + "\r\n" + payload + "\r\n";
+}
+
+// RESTORE key ttl payload [REPLACE] [ABSTTL] --ttl is ms from now, a unix time in ms with
+// ABSTTL, 0 for no expiry; expireMs comes back as the absolute deadline (0: none)
+static bool restoreOptions(const    vector<   string>& tokens, uint64_t& expireMs, bool& replace) {
+    if (tokens.size() < 4) return false;
+    bool absttl = false;
+    replace = false;
+    for (size_t i = 4; i < tokens.size(); i++) {
+           string opt = tokens[i];
+           transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+        if (opt == "REPLACE") replace = true;
+        else if (opt == "ABSTTL") absttl = true;
+        else return false;
+    }
+    long long ttl;
+    try {
+        ttl =    stoll(tokens[2]);
+    } catch (const    exception&) {
+        return false;
+    }
+    if (ttl < 0) return false;
+    auto nowMs =   chrono::duration_cast<   chrono::milliseconds>(
+           chrono::system_clock::now().time_since_epoch()).count();
+    expireMs = (ttl == 0 || absttl) ? ttl : nowMs + ttl;
+    return true;
+}
+
+static    string handleRestore(const    vector<   string>& tokens, RedisDatabase& db) {
+    uint64_t expireMs;
+    bool replace;
+    if (!restoreOptions(tokens, expireMs, replace))
+        return "-Error: RESTORE requires key, ttl and payload [REPLACE] [ABSTTL]\r\n";
+       string error;
+    if (!db.restoreKey(tokens[1], tokens[3], expireMs, replace, error))
+        return "-" + error + "\r\n";
+    return "+OK\r\n";
+}
+
+// MIGRATE host port key|"" 0 timeout [COPY] [REPLACE] [KEYS key ...]
+// --moves keys to another node with RESTORE and deletes them here
+static    string handleMigrate(const    vector<   string>& tokens, RedisDatabase& db) {
+    if (tokens.size() < 6)
+        return "-Error: MIGRATE requires host, port, key, destination-db and timeout\r\n";
+    int port;
+    long long timeout;
+    try {
+        port =    stoi(tokens[2]);
+        timeout =    stoll(tokens[5]);
+    } catch (const    exception&) {
+        return "-Error: Invalid port or timeout\r\n";
+    }
+    if (tokens[4] != "0")
+        return "-Error: Only database 0 exists\r\n";
+    if (timeout <= 0) timeout = 1000;
+    bool copy = false, replace = false;
+       vector<   string> keys;
+    for (size_t i = 6; i < tokens.size(); i++) {
+           string opt = tokens[i];
+           transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+        if (opt == "COPY") copy = true;
+        else if (opt == "REPLACE") replace = true;
+        else if (opt == "KEYS") {
+            if (!tokens[3].empty())
+                return "-Error: With KEYS the key argument must be the empty string\r\n";
+            keys.assign(tokens.begin() + i + 1, tokens.end());
+            break;
+        }
+        else return "-Error: MIGRATE syntax error\r\n";
+    }
+    if (keys.empty() && !tokens[3].empty()) keys.push_back(tokens[3]);
+    if (!copy && Replication::getInstance().rejectsWrites())
+        return "-READONLY You can't write against a read only replica.\r\n";
+
+    //no command touches a key from its DUMP until it is deleted here, so no write is lost
+    Cluster& cluster = Cluster::getInstance();
+       unique_lock<   shared_mutex> exclusive(cluster.keyspaceLock());
+       vector<   vector<   string>> restores;
+       vector<   string> moved;
+    for (const auto& key : keys) {
+           string payload;
+        uint64_t expireMs;
+        if (!db.dumpKey(key, payload, expireMs)) continue;
+           vector<   string> restore = {"RESTORE", key,    to_string(expireMs), payload, "ABSTTL"};
+        if (replace) restore.push_back("REPLACE");
+        restores.push_back(   move(restore));
+        moved.push_back(key);
+    }
+    if (restores.empty())
+        return "+NOKEY\r\n";
+       vector<bool> restored;
+       string error = cluster.migrate(tokens[1], port, restores, static_cast<int>(timeout), restored);
+    //keys the target took are gone from here even when a later one failed
+    if (!copy) {
+        for (size_t i = 0; i < moved.size(); i++)
+            if (restored[i]) executeWrite("DEL", {"DEL", moved[i]}, db);
+    }
+    if (!error.empty())
+        return "-" + error + "\r\n";
+    return "+OK\r\n";
+}
+
+//commands that change the keyspace; these are the ones the append-only file records
+static bool isWriteCommand(const    string& cmd) {
+    static const    vector<   string> writeCommands = {
+        "SET", "DEL", "UNLINK", "EXPIRE", "PEXPIREAT", "RENAME", "FLUSHALL",
+        "LPUSH", "RPUSH", "LPOP", "RPOP", "LREM", "LSET",
+        "HSET", "HDEL", "HMSET", "RESTORE"
+    };
+    return    find(writeCommands.begin(), writeCommands.end(), cmd) != writeCommands.end();
+}
+
+//writes refused with OOM when maxmemory is reached and nothing can be evicted; the
+//others (DEL, LPOP...) only shrink the keyspace and always run
+static bool growsKeyspace(const    string& cmd) {
+    static const    vector<   string> growing = {
+        "SET", "RENAME", "LPUSH", "RPUSH", "LSET", "HSET", "HMSET", "RESTORE"
+    };
+    return    find(growing.begin(), growing.end(), cmd) != growing.end();
+}
+
+//time one write may spend evicting, the next writes carry on from there
+static const uint64_t EVICTION_SLICE_USEC = 500;
+
+/*
+maxmemory: before a client's write, keys are evicted until the keyspace fits. Their
+DELs go to the append-only file and the replicas in order with the other writes, so
+both stay in step with what is left here. Replicas do not evict, they apply the
+master's DELs. False when over the limit and nothing could be evicted.
+*/
+static bool freeMemoryForWrite(RedisDatabase& db) {
+    if (!ServerConfig::getInstance().maxMemory || Replication::getInstance().isReplica()) return true;
+    CommandBatch::interrupt();
+    AppendOnlyFile& aof = AppendOnlyFile::getInstance();
+    Replication& repl = Replication::getInstance();
+       unique_lock<   mutex> order(aof.orderLock(),    defer_lock);
+    if (aof.isOpen() || repl.active()) order.lock();
+       vector<   string> evicted;
+    bool fits = db.freeMemory(EVICTION_SLICE_USEC, evicted);
+    for (const auto& key : evicted) {
+           vector<   string> del = {"DEL", key};
+        if (aof.isOpen()) aof.feed(del);
+        repl.feed(del);
+    }
+    return fits || !evicted.empty();
+}
+
+static    string dispatchCommand(const    string& cmd, const    vector<   string>& tokens, RedisDatabase& db);
+
 RedisCommandHandler::RedisCommandHandler() {}
    string RedisCommandHandler::processCommand(const    string& commandLine) {
     // Parse the command line into tokens
     auto tokens =parseRespCommand(commandLine);
+    return executeCommand(tokens);
+}
+
+   string RedisCommandHandler::executeCommand(const    vector<   string>& tokens) {
     if(tokens.empty()){
         return "-Error Empty Command\r\n";
     }
+    ServerStats::add(STAT_COMMANDS);
 
     // //    cout<<commandLine<<"\n"; RESP parse debug line
     // for (auto& t : tokens)    cout<<t<<"\n";//debug
        string cmd =tokens[0];
        transform(cmd.begin(),cmd.end(),cmd.begin(),::toupper); //Convert command to uppercase for case-insensitive comparison
-       ostringstream response;
 
-    
     //Connect to the database
     RedisDatabase& db =RedisDatabase::getInstance();
+    bool asking =askingFlag;
+    askingFlag =false;
+    //cluster mode: keys in a slot this node does not serve are redirected (MOVED/ASK);
+    //the master's stream is applied as it comes, the master already routed it
+       shared_lock<   shared_mutex> slotLock;
+    Cluster& cluster =Cluster::getInstance();
+    if(cluster.enabled() && !Replication::fromMaster()){
+           vector<   string> keys =Cluster::commandKeys(cmd,tokens);
+        if(!keys.empty()){
+            CommandBatch::interrupt();
+            slotLock =   shared_lock<   shared_mutex>(cluster.keyspaceLock());
+               string redirect =cluster.route(keys,asking);
+            if(!redirect.empty()){
+                CommandStats::getInstance().rejected(cmd);
+                return redirect;
+            }
+        }
+    }
+    if(!isWriteCommand(cmd)){
+        //client side caching: remembered before the read, so no write can fall in between
+        Tracking& tracking =Tracking::getInstance();
+        if(tracking.active()){
+            CommandBatch::interrupt();
+            tracking.keysRead(Cluster::commandKeys(cmd,tokens));
+        }
+        return dispatchCommand(cmd,tokens,db);
+    }
+    if(Replication::getInstance().rejectsWrites()){
+        CommandStats::getInstance().rejected(cmd);
+        return "-READONLY You can't write against a read only replica.\r\n";
+    }
+    if(!Replication::fromMaster() && !freeMemoryForWrite(db) && growsKeyspace(cmd)){
+        CommandStats::getInstance().rejected(cmd);
+        return "-OOM command not allowed when used memory > 'maxmemory'.\r\n";
+    }
+    return executeWrite(cmd,tokens,db);
+}
+
+static    string executeWrite(const    string& cmd, const    vector<   string>& tokens, RedisDatabase& db) {
+    AppendOnlyFile& aof =AppendOnlyFile::getInstance();
+    Replication& repl =Replication::getInstance();
+    if(!aof.isOpen() && !repl.active()){
+        return dispatchCommand(cmd,tokens,db);
+    }
+
+    uint64_t seq =0;
+       string response;
+    {
+        //the master link applies its stream with the order lock already held
+           unique_lock<   mutex> order(aof.orderLock(),    defer_lock);
+        if(!Replication::fromMaster()) order.lock();
+        CommandBatch::interrupt(); //the wait for the order lock is not this command's time
+        response =dispatchCommand(cmd,tokens,db);
+        if(response[0]=='-') return response;
+        //relative TTLs would restart on replay, log and replicate the absolute deadline
+           vector<   string> logged;
+        if(cmd=="EXPIRE"){
+            auto nowMs =   chrono::duration_cast<   chrono::milliseconds>(
+                   chrono::system_clock::now().time_since_epoch()).count();
+            logged ={"PEXPIREAT",tokens[1],   to_string(nowMs +    stoll(tokens[2])*1000)};
+        }
+        else if(cmd=="RESTORE"){
+            uint64_t expireMs;
+            bool replace;
+            restoreOptions(tokens,expireMs,replace);
+            logged ={"RESTORE",tokens[1],   to_string(expireMs),tokens[3],"REPLACE","ABSTTL"};
+        }
+        const    vector<   string>& command =logged.empty() ? tokens : logged;
+        if(aof.isOpen()) seq =aof.feed(command);
+        repl.feed(command);
+    }
+    if(seq && ServerConfig::getInstance().appendFsync ==AppendFsync::Always){
+        aof.waitSynced(seq); //group commit: one fsync covers every writer waiting here
+    }
+    CommandBatch::interrupt(); //nor are the feeds and the fsync wait the next command's
+    return response;
+}
+
+static    string callCommand(const    string& cmd, const    vector<   string>& tokens, RedisDatabase& db);
+
+//runs the command's handler, timed for INFO commandstats, LATENCY HISTOGRAM, SLOWLOG and the latency monitor
+static    string dispatchCommand(const    string& cmd, const    vector<   string>& tokens, RedisDatabase& db) {
+    int command =CommandStats::indexOf(cmd);
+    if(command <0) return callCommand(cmd,tokens,db);
+    CommandStats& stats =CommandStats::getInstance();
+    CommandTimer timer =stats.start();
+    LockHolder holder(cmd); //what the locks it takes are held for, LOCKSTATS builds
+       string response =callCommand(cmd,tokens,db);
+    uint64_t nanos =stats.record(command,timer,response[0]=='-');
+    SlowLog::getInstance().consider(tokens,nanos/1000);
+    if(LatencyMonitor::enabled()) LatencyMonitor::getInstance().add("command",nanos/1000000);
+    return response;
+}
+
+//new commands also go into CommandStats' table
+static    string callCommand(const    string& cmd, const    vector<   string>& tokens, RedisDatabase& db) {
+       ostringstream response;
     //check commmands
     if(cmd =="PING"){
         return handlePing(tokens,db);
@@ -458,19 +1163,30 @@ RedisCommandHandler::RedisCommandHandler() {}
         return handleSet(tokens,db);
     } else if(cmd == "GET"){
         return handleGet(tokens,db);
+    } else if(cmd == "STRLEN"){
+        return handleStrlen(tokens,db);
     }
         else if (cmd == "KEYS"){
             return handleKeys(tokens,db);
         }
+        else if (cmd == "SCAN"){
+            return handleScan(tokens,db);
+        }
         else if (cmd == "TYPE"){
             return handleType(tokens,db);
         }
-        else if (cmd == "DEL" || cmd == "UNLINK"){
+        else if (cmd == "DEL"){
             return handleDel(tokens,db);
         }
+        else if (cmd == "UNLINK"){
+            return handleUnlink(tokens,db);
+        }
         else if (cmd == "EXPIRE"){
             return handleExpire(tokens,db);
         }
+        else if (cmd == "PEXPIREAT"){
+            return handlePexpireat(tokens,db);
+        }
         else if (cmd == "RENAME"){
             return handleRename(tokens,db);
         }
@@ -511,6 +1227,46 @@ RedisCommandHandler::RedisCommandHandler() {}
         return handleHlen(tokens, db);
     else if (cmd == "HMSET") 
         return handleHmset(tokens, db); 
+    //persistence
+    else if (cmd == "SAVE")
+        return handleSave(tokens, db);
+    else if (cmd == "BGSAVE")
+        return handleBgsave(tokens, db);
+    else if (cmd == "LASTSAVE")
+        return handleLastsave(tokens, db);
+    else if (cmd == "INFO")
+        return handleInfo(tokens, db);
+    else if (cmd == "MEMORY")
+        return handleMemory(tokens, db);
+    else if (cmd == "LATENCY")
+        return handleLatency(tokens, db);
+    else if (cmd == "SLOWLOG")
+        return handleSlowlog(tokens, db);
+    else if (cmd == "DEBUG")
+        return handleDebug(tokens, db);
+    else if (cmd == "BGREWRITEAOF")
+        return handleBgrewriteaof(tokens, db);
+    else if (cmd == "CONFIG")
+        return handleConfig(tokens, db);
+    else if (cmd == "REPLICAOF" || cmd == "SLAVEOF")
+        return handleReplicaof(tokens, db);
+    else if (cmd == "REPLCONF")
+        return handleReplconf(tokens, db);
+    else if (cmd == "CLIENT")
+        return handleClient(tokens, db);
+    //cluster
+    else if (cmd == "CLUSTER")
+        return handleCluster(tokens, db);
+    else if (cmd == "ASKING")
+        return handleAsking(tokens, db);
+    else if (cmd == "DUMP")
+        return handleDump(tokens, db);
+    else if (cmd == "RESTORE")
+        return handleRestore(tokens, db);
+    else if (cmd == "MIGRATE")
+        return handleMigrate(tokens, db);
+    else if (cmd == "PSYNC" || cmd == "SYNC")
+        return "-Error: " + cmd + " is only valid on a client connection\r\n";
     
     else{
         response<<"-Error Unknown Command\r\n";
@@ -1,37 +1,318 @@
 #include "../include/RedisDatabase.h"
+#include "../include/RdbFormat.h"
+#include "../include/ServerConfig.h"
+#include "../include/Cluster.h"
+#include "../include/Tracking.h"
+#include "../include/ServerStats.h"
+#include "../include/LatencyMonitor.h"
+#include "../include/LazyFree.h"
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include<iterator>
 #include<algorithm>
+#include<thread>
+#include<random>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <fnmatch.h>
 
 using namespace std;
 
+//steady_clock deadlines are process local, the dump stores them as unix time in ms
+static uint64_t toUnixMs(chrono::steady_clock::time_point tp){
+    auto remaining=tp-chrono::steady_clock::now();
+    auto unixNow=chrono::system_clock::now().time_since_epoch();
+    return chrono::duration_cast<chrono::milliseconds>(unixNow+remaining).count();
+}
+
+static chrono::steady_clock::time_point fromUnixMs(uint64_t ms){
+    auto unixNow=chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch());
+    return chrono::steady_clock::now()+(chrono::milliseconds(ms)-unixNow);
+}
+
+//MEMORY USAGE prices, see MemoryCounts
+static size_t mallocBytes(size_t n){
+    return max<size_t>(32,(n+8+15)&~size_t(15));
+}
+//the heap part of a list element, nothing when it fits the small string buffer
+static size_t heapBytes(const string& s){
+    return s.size()<16 ? 0 : mallocBytes(s.size()+1);
+}
+//a small allocation of the keyspace's tables, from its slab class
+static size_t slabBytes(size_t n){
+    return n<=SLAB_MAX_OBJECT ? (n+SLAB_CLASS_STEP-1)&~(SLAB_CLASS_STEP-1) : mallocBytes(n);
+}
+//a StoredString's block, nothing when it fits the word
+static size_t storedBytes(string_view s){
+    size_t block=StoredString::blockBytes(s.size());
+    return block ? slabBytes(block) : 0;
+}
+//a table entry holding a V under key: the node, the key's block and a bucket slot
+template<class V>
+static size_t entryBytes(string_view key){
+    return slabBytes(sizeof(void*)+sizeof(pair<const StoredString,V>)+sizeof(size_t))+storedBytes(key)+sizeof(void*);
+}
+static size_t elementBytes(const string& element){
+    return sizeof(string)+heapBytes(element);
+}
+static size_t fieldBytes(string_view field,string_view value){
+    return entryBytes<StoredString>(field)+storedBytes(value);
+}
+static MemoryClass stringClass(string_view value){
+    return storedBytes(value) ? MEM_STRING_RAW : MEM_STRING_EMBSTR;
+}
+//a value's class and bytes besides its table entry
+static MemoryClass memoryClass(const StoredString& value){
+    return stringClass(value);
+}
+static MemoryClass memoryClass(const vector<string>&){
+    return MEM_LIST_VECTOR;
+}
+static MemoryClass memoryClass(const HashValue&){
+    return MEM_HASH_HASHTABLE;
+}
+static size_t valueBytes(const StoredString& value){
+    return storedBytes(value);
+}
+static size_t valueBytes(const vector<string>& list){
+    size_t bytes=0;
+    for(const auto& element:list) bytes+=elementBytes(element);
+    return bytes;
+}
+static size_t valueBytes(const HashValue& hash){
+    size_t bytes=0;
+    for(const auto& field:hash) bytes+=fieldBytes(field.first,field.second);
+    return bytes;
+}
+
+void RedisDatabase::accountKey(string_view key,int sign){
+    auto itkv=kv_Store.find(key);
+    if(itkv!=kv_Store.end())
+        account(memoryClass(itkv->second),sign,sign*int64_t(entryBytes<StoredString>(key)+valueBytes(itkv->second)));
+    auto itlist=list_store.find(key);
+    if(itlist!=list_store.end())
+        account(MEM_LIST_VECTOR,sign,sign*int64_t(entryBytes<vector<string>>(key)+valueBytes(itlist->second)));
+    auto iths=hash_Store.find(key);
+    if(iths!=hash_Store.end())
+        account(MEM_HASH_HASHTABLE,sign,sign*int64_t(entryBytes<HashValue>(key)+valueBytes(iths->second)));
+}
+
+void RedisDatabase::accountExpire(string_view key,int sign){
+    if(expiry_map.count(key))
+        account(MEM_EXPIRES,sign,sign*int64_t(entryBytes<chrono::steady_clock::time_point>(key)));
+}
+
+//HSET/HMSET of one field, the hash's bytes adjusted
+void RedisDatabase::setField(HashValue& hash,const string& field,const string& value){
+    auto [it,added]=hash.try_emplace(field);
+    int64_t bytes=added ? fieldBytes(field,value) : int64_t(storedBytes(value))-int64_t(storedBytes(it->second));
+    it->second=value;
+    account(MEM_HASH_HASHTABLE,0,bytes);
+}
+
+void RedisDatabase::recountMemory(){
+    memory=MemoryCounts();
+    for(const auto& kv:kv_Store) accountKey(kv.first,1);
+    for(const auto& kv:list_store) accountKey(kv.first,1);
+    for(const auto& kv:hash_Store) accountKey(kv.first,1);
+    for(const auto& kv:expiry_map) accountExpire(kv.first,1);
+    memory_epoch++;
+    //a new keyspace, nothing accessed yet
+    key_access.clear();
+    eviction_pool.clear();
+}
+
+//the tables' bucket arrays, and key_access: a node (next, key, clock) per key under an
+//LRU/LFU policy, a third again on top of a small string key
+void RedisDatabase::countOverhead(MemoryCounts& counts){
+    counts.bucketBytes=sizeof(void*)*(kv_Store.bucket_count()+list_store.bucket_count()+
+                                      hash_Store.bucket_count()+expiry_map.bucket_count());
+    counts.accessBytes=key_access.size()*slabBytes(sizeof(void*)+sizeof(decltype(key_access)::value_type))+
+                       key_access.bucket_count()*sizeof(void*);
+}
+
+uint64_t RedisDatabase::datasetBytes(){
+    MemoryCounts overhead;
+    countOverhead(overhead);
+    uint64_t bytes=overhead.bucketBytes+overhead.accessBytes;
+    for(int c=0;c<MEM_CLASSES;c++) bytes+=memory.bytes[c];
+    return bytes;
+}
+
+/*
+maxmemory-policy clocks, after Redis. LRU: the time of the last access in 100ms units,
+a key's idle time is the clock now minus its own. LFU: a Morris counter in the low 8
+bits, incremented with probability 1/((counter-5)*lfu-log-factor+1) so it grows with
+the log of the hits, and the minute of the last access in the 16 bits above; it loses
+one every lfu-decay-time minutes the key sits idle.
+*/
+static const uint64_t LRU_CLOCK_RESOLUTION_MS=100;
+static const uint8_t LFU_INIT_VAL=5; //new keys are not the first to go
+static const size_t EVICTION_POOL_SIZE=16;
+
+//key_access is keyed by this, for a command's std::string and a table's StoredString alike
+static size_t keyHash(string_view key){
+    return hash<string_view>()(key);
+}
+
+static uint32_t lruClock(){
+    auto ms=chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    return static_cast<uint32_t>(ms/LRU_CLOCK_RESOLUTION_MS);
+}
+static uint32_t lfuMinutes(){
+    auto minutes=chrono::duration_cast<chrono::minutes>(chrono::steady_clock::now().time_since_epoch()).count();
+    return static_cast<uint32_t>(minutes)&0xFFFF;
+}
+static uint8_t lfuDecayed(uint32_t word){
+    uint8_t counter=word&0xFF;
+    uint64_t decayTime=ServerConfig::getInstance().lfuDecayTime;
+    if(!decayTime) return counter;
+    uint64_t periods=((lfuMinutes()-(word>>8))&0xFFFF)/decayTime;
+    return periods>counter ? 0 : counter-periods;
+}
+static bool usesLfu(MaxMemoryPolicy policy){
+    return policy==MaxMemoryPolicy::AllKeysLfu || policy==MaxMemoryPolicy::VolatileLfu;
+}
+static bool usesLru(MaxMemoryPolicy policy){
+    return policy==MaxMemoryPolicy::AllKeysLru || policy==MaxMemoryPolicy::VolatileLru;
+}
+//accesses are only recorded while they can decide an eviction
+static bool accessTracked(){
+    ServerConfig& config=ServerConfig::getInstance();
+    MaxMemoryPolicy policy=config.maxMemoryPolicy;
+    return config.maxMemory && (usesLru(policy) || usesLfu(policy));
+}
+
+//keyspace_hits/keyspace_misses of INFO, one per read of a key
+bool RedisDatabase::lookup(const string& key,bool found){
+    ServerStats::add(found?STAT_KEYSPACE_HITS:STAT_KEYSPACE_MISSES);
+    if(found) accessed(key);
+    return found;
+}
+
+void RedisDatabase::accessed(const string& key){
+    if(!accessTracked()) return;
+    auto [it,added]=key_access.try_emplace(keyHash(key));
+    if(usesLru(ServerConfig::getInstance().maxMemoryPolicy)){
+        it->second=lruClock();
+        return;
+    }
+    uint8_t counter=LFU_INIT_VAL;
+    if(!added){
+        counter=lfuDecayed(it->second);
+        double base=counter>LFU_INIT_VAL ? counter-LFU_INIT_VAL : 0;
+        double p=1.0/(base*ServerConfig::getInstance().lfuLogFactor+1);
+        if(counter<255 && (eviction_rng()>>11)*0x1.0p-53<p) counter++;
+    }
+    it->second=(lfuMinutes()<<8)|counter;
+}
+
+//allocations it takes to free a value, against LAZYFREE_THRESHOLD; a string past the
+//mmap threshold is unmapped a page at a time
+static size_t freeEffort(const StoredString& value){
+    return value.size()/4096;
+}
+static size_t freeEffort(const vector<string>& list){
+    return list.size();
+}
+static size_t freeEffort(const HashValue& hash){
+    return hash.size();
+}
+
+//the key's value out of table, accounted for. A big one goes to LazyFree when lazy and
+//is priced there too: walking it here would hold db_mutex as long as freeing it. Its
+//bytes leave the totals once freed, unless the totals started over in between.
+template<class V>
+bool RedisDatabase::dropValue(KeyTable<V>& table,string_view key,bool lazy){
+    auto it=table.find(key);
+    if(it==table.end()) return false;
+    MemoryClass c=memoryClass(it->second);
+    account(c,-1,-int64_t(entryBytes<V>(key)));
+    if(lazy && freeEffort(it->second)>LAZYFREE_THRESHOLD){
+        uint64_t epoch=memory_epoch;
+        LazyFree::getInstance().release<V>(it->second,[this,c,epoch](const V& value){
+            int64_t bytes=valueBytes(value);
+            LockHolder holder("lazyFree");
+            lock_guard<ProfiledMutex> lock(db_mutex);
+            if(memory_epoch==epoch) account(c,0,-bytes);
+        });
+    }
+    else
+        account(c,0,-int64_t(valueBytes(it->second)));
+    table.erase(it);
+    return true;
+}
+
+bool RedisDatabase::removeKey(const string& key,bool lazy){
+    accountExpire(key,-1);
+    bool erased=dropValue(kv_Store,key,lazy);
+    erased|=dropValue(list_store,key,lazy);
+    erased|=dropValue(hash_Store,key,lazy);
+    expiry_map.erase(key);
+    return erased;
+}
+
 RedisDatabase& RedisDatabase::getInstance() {
     static RedisDatabase instance;
     return instance;
 }
 
-bool RedisDatabase::flushAll(){
+bool RedisDatabase::flushAll(bool async){
     //Resetting a cache or starting fresh -It clears all the stored keys.
-    std::lock_guard<std::mutex>lock(db_mutex);
+    std::lock_guard<ProfiledMutex>lock(db_mutex);
+    LatencySample sample("large-free");
+    if(async){
+        LazyFree& lazy=LazyFree::getInstance();
+        lazy.release(kv_Store);
+        lazy.release(list_store);
+        lazy.release(hash_Store);
+        lazy.release(key_access);
+    }
     kv_Store.clear();
     list_store.clear();
     hash_Store.clear();
+    for(int c=0;c<MEM_EXPIRES;c++) memory.keys[c]=memory.bytes[c]=0;
+    memory_epoch++;
+    key_access.clear();
+    eviction_pool.clear();
+    dirty_changes++;
+    dirty_all=true;
+    dirty_keys.clear();
+    for(auto& keys:slot_keys) keys.clear();
+    Tracking::getInstance().keyspaceReplaced();
     return true;
 }
 
+//an insert into table that grows its buckets, every key is rehashed under db_mutex
+template<class Table>
+static bool growsOnInsert(const Table& table){
+    return table.size()+1 > table.bucket_count()*table.max_load_factor();
+}
+
 //KEY- value ops
 void RedisDatabase::set(const std::string& key,const std::string& value){
-    std::lock_guard<std::mutex>lock(db_mutex);
-    kv_Store[key]=value;
-
+    std::lock_guard<ProfiledMutex>lock(db_mutex);
+    LatencySample sample("rehash",growsOnInsert(kv_Store));
+    auto [it,inserted]=kv_Store.try_emplace(key);
+    if(!inserted){
+        account(stringClass(it->second),-1,-int64_t(entryBytes<StoredString>(key)+storedBytes(it->second)));
+        if(ServerConfig::getInstance().lazyfreeLazyServerDel && freeEffort(it->second)>LAZYFREE_THRESHOLD)
+            LazyFree::getInstance().release(it->second);
+    }
+    it->second=value;
+    account(stringClass(value),1,entryBytes<StoredString>(key)+storedBytes(value));
+    touch(key);
 }
 bool RedisDatabase::get(const std::string& key, std::string& value){
-    std::lock_guard<std::mutex>lock(db_mutex);
+    std::lock_guard<ProfiledMutex>lock(db_mutex);
     purgeExpired();
     auto it=kv_Store.find(key);
-    if(it!=kv_Store.end()){
+    if(lookup(key,it!=kv_Store.end())){
         value = it->second;
         return true;
     }
@@ -41,24 +322,24 @@ bool RedisDatabase::get(const std::string& key, std::string& value){
 
 }
 std::vector<std::string> RedisDatabase::keys(){
-    std::lock_guard<std::mutex>lock(db_mutex);
+    std::lock_guard<ProfiledMutex>lock(db_mutex);
     purgeExpired();
     std:: vector<std::string> result;
 
     for(const  auto& pair:kv_Store){
-        result.push_back(pair.first);
+        result.push_back(pair.first.str());
     }
     for(const  auto& pair:list_store){
-        result.push_back(pair.first);
+        result.push_back(pair.first.str());
     }
     for(const  auto& pair:hash_Store){
-        result.push_back(pair.first);
+        result.push_back(pair.first.str());
     }
     return result;
 
 }
 std::string RedisDatabase::type(const std::string& key){
-    std::lock_guard<std::mutex>lock(db_mutex);
+    std::lock_guard<ProfiledMutex>lock(db_mutex);
     purgeExpired();
     if(kv_Store.find(key) !=kv_Store.end())
         return "string";
@@ -70,35 +351,98 @@ std::string RedisDatabase::type(const std::string& key){
     
 }
 bool RedisDatabase::del(const std::string& key){
-    std::lock_guard<std::mutex>lock(db_mutex);
+    std::lock_guard<ProfiledMutex>lock(db_mutex);
     purgeExpired();
-    bool erased=false;
-    erased |=kv_Store.erase(key)>0;
-    erased |=list_store.erase(key)>0;
-    erased !=hash_Store.erase(key)>0;
-    return false;
+    bool erased;
+    {
+        LatencySample sample("large-free");
+        erased=removeKey(key,ServerConfig::getInstance().lazyfreeLazyUserDel);
+    }
+    touch(key);
+    return erased;
+}
+bool RedisDatabase::unlinkKey(const std::string& key){
+    std::lock_guard<ProfiledMutex>lock(db_mutex);
+    purgeExpired();
+    bool erased=removeKey(key,true);
+    touch(key);
+    return erased;
 }
 //expire
 bool RedisDatabase::expire(const std::string& key,int seconds){
-    std::lock_guard<std::mutex>lock(db_mutex);
+    std::lock_guard<ProfiledMutex>lock(db_mutex);
     purgeExpired();
     bool exist=(kv_Store.find(key)!=kv_Store.end())||
         (list_store.find(key)!=list_store.end())||
         (hash_Store.find(key)!=hash_Store.end());
     if(!exist) return false;
+    accountExpire(key,-1);
     expiry_map[key]=std::chrono::steady_clock::now()+ std::chrono::seconds(seconds);
+    accountExpire(key,1);
     //It stores the exact future time (current time + given seconds) at which the key should expire into the expiry_map
+    touch(key);
 
     return true;
 }
+//PEXPIREAT --absolute deadline, what the append-only file records instead of EXPIRE
+bool RedisDatabase::pexpireat(const std::string& key,uint64_t unixMs){
+    std::lock_guard<ProfiledMutex>lock(db_mutex);
+    purgeExpired();
+    bool exist=(kv_Store.find(key)!=kv_Store.end())||
+        (list_store.find(key)!=list_store.end())||
+        (hash_Store.find(key)!=hash_Store.end());
+    if(!exist) return false;
+    accountExpire(key,-1);
+    expiry_map[key]=fromUnixMs(unixMs);
+    accountExpire(key,1);
+    touch(key);
+    return true;
+}
+//every write calls this under db_mutex; the next delta checkpoint rewrites the key,
+//in cluster mode the key is (un)indexed under its hash slot, and clients caching it
+//are told to drop it
+void RedisDatabase::touch(const std::string& key){
+    dirty_changes++;
+    Tracking::getInstance().keyModified(key);
+    bool tracked=accessTracked();
+    if(!slot_keys.empty() || tracked){
+        bool exists=kv_Store.count(key)||list_store.count(key)||hash_Store.count(key);
+        if(!slot_keys.empty()){
+            auto& keys=slot_keys[Cluster::keySlot(key)];
+            if(exists)
+                keys.insert(key);
+            else
+                keys.erase(key);
+        }
+        if(exists)
+            accessed(key);
+        else if(tracked)
+            key_access.erase(keyHash(key));
+    }
+    if(dirty_all) return;
+    dirty_keys.insert(key);
+    //once most of the keyspace is dirty a delta would be as large as a new base
+    size_t total=kv_Store.size()+list_store.size()+hash_Store.size();
+    if(dirty_keys.size()>1024 && dirty_keys.size()>total/2){
+        dirty_all=true;
+        dirty_keys.clear();
+    }
+}
 void RedisDatabase::purgeExpired() {
+    if(expiry_map.empty()) return;
+    LockSection section(db_mutex,"purgeExpired");
+    LatencySample sample("expire-cycle");
     auto now = std::chrono::steady_clock::now();
+    bool lazy=ServerConfig::getInstance().lazyfreeLazyExpire;
     for (auto it = expiry_map.begin(); it != expiry_map.end(); ) {
         if (now > it->second) {
             // Remove from all stores
-            kv_Store.erase(it->first);
-            list_store.erase(it->first);
-            hash_Store.erase(it->first);
+            accountExpire(it->first,-1);
+            dropValue(kv_Store,it->first,lazy);
+            dropValue(list_store,it->first,lazy);
+            dropValue(hash_Store,it->first,lazy);
+            touch(it->first.str());
+            ServerStats::add(STAT_EXPIRED);
             it = expiry_map.erase(it);
         } else {
             ++it;
@@ -107,87 +451,97 @@ void RedisDatabase::purgeExpired() {
 }
 //rename
 bool RedisDatabase::rename(const std::string oldKey,const std::string newKey){
-    std::lock_guard<std::mutex>lock(db_mutex);
+    std::lock_guard<ProfiledMutex>lock(db_mutex);
     purgeExpired();
-    bool found=false;
+    bool found=kv_Store.count(oldKey)||list_store.count(oldKey)||hash_Store.count(oldKey);
+    //onto itself: nothing moves, the value and its TTL stay as they are
+    if(!found || oldKey==newKey) return found;
+    //whatever newKey held goes first, whatever its type, TTL included
+    removeKey(newKey,ServerConfig::getInstance().lazyfreeLazyServerDel);
+    accountKey(oldKey,-1);
+    accountExpire(oldKey,-1);
 
-    auto itkv = kv_Store.find(oldKey);
-    if(itkv !=kv_Store.end()){
-         kv_Store[newKey]=itkv->second;
-         kv_Store.erase(itkv);
-         found=true;
-    }
-    auto itlist= list_store.find(oldKey);
-    if(itlist !=list_store.end()){
-         list_store[newKey]=itlist->second;
-         list_store.erase(itlist);
-         found=true;
-    }
-    auto iths = hash_Store.find(oldKey);
-    if(iths !=hash_Store.end()){
-         hash_Store[newKey]=iths->second;
-         hash_Store.erase(iths);
-         found=true;
-    }
-    auto itExpire = expiry_map.find(oldKey);
-    if(itExpire !=expiry_map.end()){
-         expiry_map[newKey]=itExpire->second;
-         expiry_map.erase(itExpire);
-         found=true;
-    }
-    return found;
+    //the nodes move under the new name, the values are not copied
+    auto moveNode=[&](auto& table){
+        auto it=table.find(oldKey);
+        if(it==table.end()) return;
+        auto node=table.extract(it);
+        node.key()=newKey;
+        table.insert(std::move(node));
+    };
+    moveNode(kv_Store);
+    moveNode(list_store);
+    moveNode(hash_Store);
+    moveNode(expiry_map);
+    accountKey(newKey,1);
+    accountExpire(newKey,1);
+    touch(oldKey);
+    touch(newKey);
+    return true;
 }
 //list operations
 std::vector<std::string> RedisDatabase::lget(const std::string& key) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+    std::lock_guard<ProfiledMutex> lock(db_mutex);
     auto it = list_store.find(key);
-    if (it != list_store.end()) {
+    if (lookup(key,it != list_store.end())) {
         return it->second; 
     }
     return {}; 
 }
 
 ssize_t RedisDatabase::llen(const std::string& key) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+    std::lock_guard<ProfiledMutex> lock(db_mutex);
     auto it = list_store.find(key);
-    if (it != list_store.end()) 
+    if (lookup(key,it != list_store.end())) 
         return it->second.size();
     return 0;
 }
 
 void RedisDatabase::lpush(const std::string& key, const std::string& value) {
-    std::lock_guard<std::mutex> lock(db_mutex);
-    list_store[key].insert(list_store[key].begin(), value);
+    std::lock_guard<ProfiledMutex> lock(db_mutex);
+    LatencySample sample("rehash",growsOnInsert(list_store));
+    auto [it,created]=list_store.try_emplace(key);
+    it->second.insert(it->second.begin(), value);
+    account(MEM_LIST_VECTOR,created,(created?entryBytes<vector<string>>(key):0)+elementBytes(value));
+    touch(key);
 }
 
 void RedisDatabase::rpush(const std::string& key, const std::string& value) {
-    std::lock_guard<std::mutex> lock(db_mutex);
-    list_store[key].push_back(value);
+    std::lock_guard<ProfiledMutex> lock(db_mutex);
+    LatencySample sample("rehash",growsOnInsert(list_store));
+    auto [it,created]=list_store.try_emplace(key);
+    it->second.push_back(value);
+    account(MEM_LIST_VECTOR,created,(created?entryBytes<vector<string>>(key):0)+elementBytes(value));
+    touch(key);
 }
 
 bool RedisDatabase::lpop(const std::string& key, std::string& value) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+    std::lock_guard<ProfiledMutex> lock(db_mutex);
     auto it = list_store.find(key);
     if (it != list_store.end() && !it->second.empty()) {
         value = it->second.front();
         it->second.erase(it->second.begin());
+        account(MEM_LIST_VECTOR,0,-int64_t(elementBytes(value)));
+        touch(key);
         return true;
     }
     return false;
 }
 bool RedisDatabase::rpop(const std::string& key, std::string& value) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+    std::lock_guard<ProfiledMutex> lock(db_mutex);
     auto it = list_store.find(key);
     if (it != list_store.end() && !it->second.empty()) {
         value = it->second.back();
         it->second.pop_back();
+        account(MEM_LIST_VECTOR,0,-int64_t(elementBytes(value)));
+        touch(key);
         return true;
     }
     return false;
 }
 
 int RedisDatabase::lrem(const std::string& key, int count, const std::string& value) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+    std::lock_guard<ProfiledMutex> lock(db_mutex);
     int removed = 0;
     auto it = list_store.find(key);
     if (it == list_store.end()) 
@@ -224,13 +578,17 @@ int RedisDatabase::lrem(const std::string& key, int count, const std::string& va
             }
         }
     }
+    if(removed>0){
+        account(MEM_LIST_VECTOR,0,-int64_t(removed*elementBytes(value)));
+        touch(key);
+    }
     return removed;
 }
 
 bool RedisDatabase::lindex(const std::string& key, int index, std::string& value) {
-    std::lock_guard<std::mutex>lock(db_mutex);
+    std::lock_guard<ProfiledMutex>lock(db_mutex);
     auto it = list_store.find(key);
-    if (it == list_store.end()) 
+    if (!lookup(key,it != list_store.end())) 
         return false;
 
     const auto& lst =it->second;
@@ -246,7 +604,7 @@ bool RedisDatabase::lindex(const std::string& key, int index, std::string& value
 }
 
 bool RedisDatabase::lset(const std::string& key, int index, const std::string& value) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+    std::lock_guard<ProfiledMutex> lock(db_mutex);
     auto it = list_store.find(key);
     if (it == list_store.end()) 
         return false;
@@ -257,20 +615,26 @@ bool RedisDatabase::lset(const std::string& key, int index, const std::string& v
     if (index < 0 || index >= static_cast<int>(lst.size()))
         return false;
     
+    account(MEM_LIST_VECTOR,0,int64_t(elementBytes(value))-int64_t(elementBytes(lst[index])));
     lst[index] = value;
+    touch(key);
     return true;
 }
 
 //Hash ops
     bool RedisDatabase::hset(const std::string& key, const std::string& field,const std::string& value){
-        std::lock_guard<std::mutex> lock(db_mutex);
-        hash_Store[key][field]=value;
+        std::lock_guard<ProfiledMutex> lock(db_mutex);
+        LatencySample sample("rehash",growsOnInsert(hash_Store));
+        auto [it,created]=hash_Store.try_emplace(key);
+        if(created) account(MEM_HASH_HASHTABLE,1,entryBytes<HashValue>(key));
+        setField(it->second,field,value);
+        touch(key);
         return true;
     }
     bool RedisDatabase::hget(const std::string& key, const std::string& field,std::string& value){
-        std::lock_guard<std::mutex> lock(db_mutex);
+        std::lock_guard<ProfiledMutex> lock(db_mutex);
         auto it =hash_Store.find(key);
-        if(it !=hash_Store.end()){
+        if(lookup(key,it !=hash_Store.end())){
             auto f=it->second.find(field);
             if(f !=it->second.end()){
                 value=f->second;
@@ -280,58 +644,72 @@ bool RedisDatabase::lset(const std::string& key, int index, const std::string& v
         return false;
     }
     bool RedisDatabase::hexists(const std::string& key,const std::string& field){
-        std::lock_guard<std::mutex> lock(db_mutex);
+        std::lock_guard<ProfiledMutex> lock(db_mutex);
         auto it =hash_Store.find(key);
-        if(it !=hash_Store.end()){
+        if(lookup(key,it !=hash_Store.end())){
             return it->second.find(field) != it->second.end();
         }
         return false;
     }
     bool RedisDatabase::hdel(const std::string& key, const std::string& field){
-        std::lock_guard<std::mutex> lock(db_mutex);
+        std::lock_guard<ProfiledMutex> lock(db_mutex);
         
         auto it =hash_Store.find(key);
-        if(it !=hash_Store.end()){
-            return it->second.erase(field)>0;
+        if(it ==hash_Store.end()) return false;
+        auto f=it->second.find(field);
+        if(f !=it->second.end()){
+            account(MEM_HASH_HASHTABLE,0,-int64_t(fieldBytes(f->first,f->second)));
+            it->second.erase(f);
+            touch(key);
+            return true;
         }
         return false;
     }
     std::unordered_map<std::string,std::string> RedisDatabase::hgetall(const std::string& key){
-        std::lock_guard<std::mutex> lock(db_mutex);
-        if(hash_Store.find(key)!=hash_Store.end())
-            return hash_Store[key];
-        return {};
+        std::lock_guard<ProfiledMutex> lock(db_mutex);
+        auto it=hash_Store.find(key);
+        std::unordered_map<std::string,std::string> fields;
+        if(lookup(key,it!=hash_Store.end())){
+            fields.reserve(it->second.size());
+            for(const auto& pair:it->second)
+                fields.emplace(pair.first.str(),pair.second.str());
+        }
+        return fields;
     }
     std::vector<std::string> RedisDatabase::hkeys(const std::string& key){
-        std::lock_guard<std::mutex> lock(db_mutex);
+        std::lock_guard<ProfiledMutex> lock(db_mutex);
         std:: vector<string> fields;
         auto it =hash_Store.find(key);
-        if(it!=hash_Store.end()){
+        if(lookup(key,it!=hash_Store.end())){
             for(const auto& pair:it->second)
-                fields.push_back(pair.first);
+                fields.push_back(pair.first.str());
         }
         return fields;
     }
     std::vector<std::string> RedisDatabase::hvals(const std::string& key){
-        std::lock_guard<std::mutex> lock(db_mutex);
+        std::lock_guard<ProfiledMutex> lock(db_mutex);
         std:: vector<string> values;
         auto it =hash_Store.find(key);
-        if(it!=hash_Store.end()){
+        if(lookup(key,it!=hash_Store.end())){
             for(const auto& pair:it->second)
-                values.push_back(pair.second);
+                values.push_back(pair.second.str());
         }
         return values;
     }
     ssize_t RedisDatabase::hlen(const std::string& key){
-        std::lock_guard<std::mutex> lock(db_mutex);
+        std::lock_guard<ProfiledMutex> lock(db_mutex);
         auto it =hash_Store.find(key);
-        return (it !=hash_Store.end()) ? it->second.size() :0; 
+        return lookup(key,it !=hash_Store.end()) ? it->second.size() :0; 
     }
     bool RedisDatabase::hmset(const std::string& key, const std::vector<std::pair<std::string, std::string>>& fieldValues){
-        std::lock_guard<std::mutex> lock(db_mutex);
+        std::lock_guard<ProfiledMutex> lock(db_mutex);
+        LatencySample sample("rehash",growsOnInsert(hash_Store));
+        auto [it,created]=hash_Store.try_emplace(key);
+        if(created) account(MEM_HASH_HASHTABLE,1,entryBytes<HashValue>(key));
         for(const auto& pair :fieldValues){
-            hash_Store[key][pair.first]=pair.second;
+            setField(it->second,pair.first,pair.second);
         }
+        touch(key);
         return true;
     }
 /*
@@ -345,58 +723,968 @@ H=hash
 
 */
 bool RedisDatabase::dump(const std::string& filename) {
-    lock_guard<mutex> lock(db_mutex);
-    ofstream ofs(filename,ios::binary);//opens the file in binary format
-    if(!ofs) return false;
-    for(const auto& kv:kv_Store){
-        ofs<<"K"<<kv.first<<" "<<kv.second<<"\n";
+    lock_guard<ProfiledMutex> lock(db_mutex);
+    LockSection section(db_mutex,"dump");
+    LatencySample sample("dump");
+    return writeSnapshot(filename);
+}
+
+//value encodings, shared by snapshot records and DUMP payloads
+static void writeList(RdbWriter& w,const vector<string>& list){
+    w.writeLength(list.size());
+    for(const auto& item:list)
+        w.writeString(item);
+}
+
+static void writeHash(RdbWriter& w,const HashValue& hash){
+    w.writeLength(hash.size());
+    for(const auto& field_val:hash){
+        w.writeString(field_val.first);
+        w.writeString(field_val.second);
+    }
+}
+
+//element counts come from the input (a RESTORE payload is the client's): every string
+//takes at least its length byte, so a count the remaining bytes cannot hold is corrupt
+//and is rejected before anything is sized after it
+static bool readList(RdbReader& r,vector<string>& list){
+    uint64_t len;
+    if(!r.readLength(len) || len>r.remaining()) return false;
+    list.resize(len);
+    for(auto& item:list)
+        if(!r.readString(item)) return false;
+    return true;
+}
+
+static bool readHash(RdbReader& r,HashValue& hash){
+    uint64_t len;
+    if(!r.readLength(len) || len>r.remaining()/2) return false;
+    hash.reserve(len);
+    string field,value;
+    for(uint64_t i=0;i<len;i++){
+        if(!r.readString(field)||!r.readString(value)) return false;
+        hash[field]=move(value);
+    }
+    return true;
+}
+
+//what one rdb file holds: a base points at the live stores, a delta at copies of the dirty keys
+struct RdbContents {
+    const KeyTable<StoredString>& kv;
+    const KeyTable<vector<string>>& lists;
+    const KeyTable<HashValue>& hashes;
+    const KeyTable<chrono::steady_clock::time_point>& expiry;
+    const vector<string>& deleted;
+    vector<pair<string,string>> aux;
+};
+
+static bool writeRdbFile(const std::string& filename,const RdbContents& c,uint64_t* bytes) {
+    //write next to the target and rename, so a crash mid-write never leaves a half dump behind
+    string tmpName=filename+".tmp-"+to_string(getpid());
+    int fd=open(tmpName.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+    if(fd<0) return false;
+
+    RdbWriter w(fd);
+    w.writeHeader();
+    w.writeByte(RDB_OPCODE_RESIZEDB);
+    w.writeLength(c.kv.size());
+    w.writeLength(c.lists.size());
+    w.writeLength(c.hashes.size());
+    for(const auto& field:c.aux){
+        w.writeByte(RDB_OPCODE_AUX);
+        w.writeString(field.first);
+        w.writeString(field.second);
     }
-    for(const auto& kv:list_store){
-        ofs<<"L"<<kv.first;
-        for(const auto& item:kv.second){
-            ofs<<" "<<item;
+
+    //records are grouped into sections of RDB_SECTION_KEYS keys / RDB_SECTION_BYTES bytes
+    vector<RdbSection> sections;
+    uint64_t sectionKeys=0;
+    uint64_t sectionStart=0;
+    auto beginRecord=[&](string_view key){
+        if(!w.inSection()){
+            w.beginSection();
+            sectionStart=w.size();
         }
-        ofs<<"\n";
+        auto it=c.expiry.find(key);
+        if(it!=c.expiry.end()){
+            w.writeByte(RDB_OPCODE_EXPIRETIME_MS);
+            w.writeUint64(toUnixMs(it->second));
+        }
+    };
+    auto endRecord=[&](){
+        if(++sectionKeys>=RDB_SECTION_KEYS || w.size()-sectionStart>=RDB_SECTION_BYTES){
+            sections.push_back(w.endSection(sectionKeys));
+            sectionKeys=0;
+        }
+    };
+    for(const auto& kv:c.kv){
+        beginRecord(kv.first);
+        w.writeByte(RDB_TYPE_STRING);
+        w.writeString(kv.first);
+        w.writeString(kv.second);
+        endRecord();
+    }
+    for(const auto& kv:c.lists){
+        beginRecord(kv.first);
+        w.writeByte(RDB_TYPE_LIST);
+        w.writeString(kv.first);
+        writeList(w,kv.second);
+        endRecord();
     }
-    for(const auto& kv:hash_Store){
-        ofs<<"H"<<kv.first;
-        for(const auto&  field_val :kv.second){
-            ofs<<" "<<field_val.first<<":"<<field_val.second;
+    for(const auto& kv:c.hashes){
+        beginRecord(kv.first);
+        w.writeByte(RDB_TYPE_HASH);
+        w.writeString(kv.first);
+        writeHash(w,kv.second);
+        endRecord();
+    }
+    for(const auto& key:c.deleted){
+        beginRecord(key);
+        w.writeByte(RDB_OPCODE_DELETE);
+        w.writeString(key);
+        endRecord();
+    }
+    if(w.inSection())
+        sections.push_back(w.endSection(sectionKeys));
+    bool ok=w.finish(sections) && fsync(fd)==0;
+    struct stat st;
+    if(bytes) *bytes=fstat(fd,&st)==0?st.st_size:0;
+    close(fd);
+    if(!ok || ::rename(tmpName.c_str(),filename.c_str())!=0){
+        unlink(tmpName.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool RedisDatabase::writeSnapshot(const std::string& filename,uint64_t baseId,uint64_t* bytes) {
+    static const vector<string> noDeletes;
+    RdbContents contents{kv_Store,list_store,hash_Store,expiry_map,noDeletes,{}};
+    if(baseId) contents.aux.emplace_back("base-id",to_string(baseId));
+    return writeRdbFile(filename,contents,bytes);
+}
+
+//Private_Dirty of the calling process = pages copied since fork (the COW cost of the child)
+static size_t privateDirtyBytes(){
+    ifstream smaps("/proc/self/smaps_rollup");
+    string line;
+    size_t total=0;
+    while(getline(smaps,line)){
+        if(line.compare(0,14,"Private_Dirty:")==0){
+            total+=stoull(line.substr(14))*1024;
         }
-        ofs<<"\n";
     }
-    return true; 
+    return total;
+}
+
+bool RedisDatabase::bgsave(const std::string& filename,function<void(bool)> done) {
+    return forkSnapshot(filename,0,done);
 }
+
 /*
+fork() while holding db_mutex, so the child starts with a consistent copy of every
+store. The kernel shares pages copy-on-write, so the parent only pays for the fork
+itself (page table copy) and clients continue as soon as the lock is released.
+The child serializes its frozen view and reports its COW size through a pipe; a
+detached reaper thread in the parent waits for it and records the result.
+A non-zero baseId makes this the next dbfilename base. Until the child has renamed it
+into place the old base is the one on disk, so deltas written meanwhile name both: they
+keep the keys dirty at the fork along with the ones written since, which is what the old
+chain is missing and a no-op on top of the new base. If the old base had no complete
+chain (dirty_all at the fork) there is nothing to add to, and deltas wait for the new one.
+*/
+bool RedisDatabase::forkSnapshot(const std::string& filename,uint64_t baseId,function<void(bool)> done) {
+    if(bgsave_running.exchange(true)) return false;
+    rdb_child=baseId!=0;
 
-Each line encodes a record;
-Key-Value (K)
-kv_store["name"] = "Alice";
-kv_store["city"] = "Berlin";
+    int pipefd[2];
+    if(pipe(pipefd)!=0){
+        bgsave_running=false;
+        return false;
+    }
+    auto start=chrono::steady_clock::now();
+    pid_t pid;
+    uint64_t firstDelta=0;
+    uint64_t changes=0;
+    bool chainKept=false;
+    {
+        lock_guard<ProfiledMutex> lock(db_mutex);
+        LockSection section(db_mutex,"fork");
+        LatencySample sample("fork");
+        pid=fork();
+        if(pid>0 && baseId){
+            pending_base_id=baseId;
+            chainKept=!dirty_all;
+            pending_chain_kept=chainKept;
+            firstDelta=next_delta;
+            changes=dirty_changes;
+            if(dirty_all){
+                dirty_all=false;
+                dirty_keys.clear();
+            }
+            dirty_changes=0;
+            last_checkpoint=start;
+        }
+    }
+    if(pid==0){
+        //child: only this thread exists here, never touch db_mutex again
+        close(pipefd[0]);
+        bool ok=writeSnapshot(filename,baseId);
+        size_t cow=privateDirtyBytes();
+        if(write(pipefd[1],&cow,sizeof(cow))<0) ok=false;
+        _exit(ok?0:1);
+    }
+    close(pipefd[1]);
+    long long forkUsec=chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-start).count();
+    if(pid<0){
+        close(pipefd[0]);
+        bgsave_running=false;
+        return false;
+    }
+    {
+        lock_guard<mutex> statsLock(stats_mutex);
+        stats.lastForkUsec=forkUsec;
+        if(baseId){
+            stats.deltasSinceBase=0;
+            stats.deltaBytes=0;
+        }
+    }
+    thread([this,pid,readFd=pipefd[0],start,done,filename,baseId,firstDelta,changes,chainKept](){
+        size_t cow=0;
+        if(read(readFd,&cow,sizeof(cow))!=sizeof(cow)) cow=0;
+        close(readFd);
+        int status=0;
+        waitpid(pid,&status,0);
+        bool ok=WIFEXITED(status)&&WEXITSTATUS(status)==0;
+        if(baseId){
+            lock_guard<ProfiledMutex> lock(db_mutex);
+            pending_base_id=0;
+            if(ok){
+                base_id=baseId;
+                baseWritten(filename,firstDelta);
+            }
+            else if(chainKept){
+                //the old base and its deltas still stand, the next delta carries on from them
+                dirty_changes+=changes;
+            }
+            else{
+                //the keys dirty before the fork are in no file
+                dirty_all=true;
+                dirty_keys.clear();
+                dirty_changes+=changes;
+            }
+        }
+        {
+            lock_guard<mutex> statsLock(stats_mutex);
+            stats.lastCowBytes=cow;
+            if(baseId){
+                stats.lastBgsaveOk=ok;
+                stats.lastBgsaveSeconds=chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now()-start).count();
+                if(ok){
+                    stats.lastSaveTime=time(nullptr);
+                    stats.lastSaveUsec=chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-start).count();
+                }
+            }
+        }
+        //other forks (AOF rewrite) finish their own bookkeeping before the next child may start
+        if(done) done(ok);
+        bgsave_running=false;
+    }).detach();
+    return true;
+}
 
-List (L)
-list_store["fruits"] = {"apple", "banana", "orange"};
-list_store["colors"] = {"red", "green", "blue"};
+//dbfilename.delta.<n> files in the working directory, oldest first
+static vector<pair<uint64_t,string>> listDeltas(const std::string& base){
+    vector<pair<uint64_t,string>> deltas;
+    string prefix=base+".delta.";
+    DIR* dir=opendir(".");
+    if(!dir) return deltas;
+    while(dirent* entry=readdir(dir)){
+        string name=entry->d_name;
+        if(name.compare(0,prefix.size(),prefix)!=0) continue;
+        string seq=name.substr(prefix.size());
+        //skips the .tmp-<pid> files of a save that is still running
+        if(seq.empty() || seq.find_first_not_of("0123456789")!=string::npos) continue;
+        deltas.emplace_back(stoull(seq),name);
+    }
+    closedir(dir);
+    sort(deltas.begin(),deltas.end());
+    return deltas;
+}
 
-Hash (H)
-hash_store["user:100"] = {
-    {"name", "Bob"},
-    {"age", "30"},
-    {"email", "bob@example.com"}
-};
+static uint64_t newBaseId(){
+    random_device rd;
+    uint64_t id=(static_cast<uint64_t>(rd())<<32)|rd();
+    return id?id:1;
+}
+
+//a new base is on disk: only the deltas written since its fork, [firstDelta, next_delta), still apply
+void RedisDatabase::baseWritten(const std::string& filename,uint64_t firstDelta){
+    for(const auto& delta:listDeltas(filename)){
+        if(delta.first<firstDelta || delta.first>=next_delta)
+            ::unlink(delta.second.c_str());
+    }
+    struct stat st;
+    lock_guard<mutex> statsLock(stats_mutex);
+    stats.baseBytes=stat(filename.c_str(),&st)==0?st.st_size:0;
+}
+
+bool RedisDatabase::save() {
+    string filename=ServerConfig::getInstance().dbFilename;
+    //a running base child would later rename its older snapshot over this one
+    while(bgsave_running && rdb_child)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    lock_guard<ProfiledMutex> lock(db_mutex);
+    LatencySample sample("dump");
+    auto start=chrono::steady_clock::now();
+    uint64_t id=newBaseId();
+    if(!writeSnapshot(filename,id)) return false;
+    base_id=id;
+    dirty_all=false;
+    dirty_keys.clear();
+    dirty_changes=0;
+    last_checkpoint=chrono::steady_clock::now();
+    baseWritten(filename,next_delta);
+    lock_guard<mutex> statsLock(stats_mutex);
+    stats.lastSaveTime=time(nullptr);
+    stats.lastSaveUsec=chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-start).count();
+    stats.deltasSinceBase=0;
+    stats.deltaBytes=0;
+    return true;
+}
+
+bool RedisDatabase::bgsaveBase() {
+    return forkSnapshot(ServerConfig::getInstance().dbFilename,newBaseId(),nullptr);
+}
 
-hash_store["user:200"] = {
-    {"name", "Eve"},
-    {"age", "25"},
-    {"email", "eve@example.com"}
+//one loader thread's share of the keyspace, spliced into the real stores at the end
+struct LoadSlice {
+    KeyTable<StoredString> kv;
+    KeyTable<vector<string>> lists;
+    KeyTable<HashValue> hashes;
+    KeyTable<chrono::steady_clock::time_point> expiry;
+    vector<string> deleted; //DELETE records and expired keys, only deltas care
+    uint64_t keys=0;
+    bool ok=true;
 };
+
+/*
+Delta checkpoint --copies the dirty keys (and tombstones for the ones that are gone)
+under db_mutex, then writes them without the lock. Cost is proportional to what was
+written since the last checkpoint, not to the size of the keyspace.
+*/
+bool RedisDatabase::saveDelta() {
+    string base=ServerConfig::getInstance().dbFilename;
+    auto start=chrono::steady_clock::now();
+    LoadSlice delta;
+    uint64_t id,nextId,seq,changes;
+    {
+        lock_guard<ProfiledMutex> lock(db_mutex);
+        if(dirty_all) return false;
+        LatencySample sample("delta-checkpoint");
+        for(const auto& key:dirty_keys){
+            bool found=false;
+            auto itkv=kv_Store.find(key);
+            if(itkv!=kv_Store.end()){
+                delta.kv.emplace(key,itkv->second);
+                found=true;
+            }
+            auto itlist=list_store.find(key);
+            if(itlist!=list_store.end()){
+                delta.lists.emplace(key,itlist->second);
+                found=true;
+            }
+            auto iths=hash_Store.find(key);
+            if(iths!=hash_Store.end()){
+                delta.hashes.emplace(key,iths->second);
+                found=true;
+            }
+            if(!found){
+                delta.deleted.push_back(key);
+                continue;
+            }
+            auto itExpire=expiry_map.find(key);
+            if(itExpire!=expiry_map.end())
+                delta.expiry.emplace(key,itExpire->second);
+        }
+        id=base_id;
+        nextId=pending_base_id;
+        seq=next_delta++;
+        changes=dirty_changes;
+        dirty_keys.clear();
+        dirty_changes=0;
+        last_checkpoint=chrono::steady_clock::now();
+    }
+
+    RdbContents contents{delta.kv,delta.lists,delta.hashes,delta.expiry,delta.deleted,
+        {{"delta-base",to_string(id)},{"delta-seq",to_string(seq)}}};
+    if(nextId) contents.aux.emplace_back("delta-next-base",to_string(nextId));
+    uint64_t bytes=0;
+    if(!writeRdbFile(base+".delta."+to_string(seq),contents,&bytes)){
+        lock_guard<ProfiledMutex> lock(db_mutex);
+        dirty_all=true;
+        dirty_keys.clear();
+        dirty_changes+=changes;
+        return false;
+    }
+    lock_guard<mutex> statsLock(stats_mutex);
+    stats.lastSaveTime=time(nullptr);
+    stats.lastDeltaKeys=delta.kv.size()+delta.lists.size()+delta.hashes.size()+delta.deleted.size();
+    stats.lastDeltaBytes=bytes;
+    stats.lastSaveUsec=chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now()-start).count();
+    stats.deltasSinceBase++;
+    stats.deltaBytes+=bytes;
+    return true;
+}
+
+/*
+Called once a second. A checkpoint is due when any save point is met; it is a delta
+unless there is no usable base yet (startup, FLUSHALL, failed save) or the deltas of
+the current base exceed checkpoint-max-deltas or the size of the base itself, in
+which case they are merged by forking a fresh base.
+*/
+void RedisDatabase::checkpointCron() {
+    ServerConfig& config=ServerConfig::getInstance();
+    vector<SavePoint> points=config.savePoints();
+    bool base;
+    {
+        lock_guard<ProfiledMutex> lock(db_mutex);
+        auto elapsed=chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now()-last_checkpoint).count();
+        bool due=false;
+        for(const auto& point:points){
+            if(dirty_changes>0 && dirty_changes>=point.changes && static_cast<uint64_t>(elapsed)>=point.seconds)
+                due=true;
+        }
+        if(!due) return;
+        base=dirty_all;
+        //a base child started without a complete chain: until it lands a delta applies to nothing
+        if(!base && pending_base_id && !pending_chain_kept) return;
+    }
+    if(!base){
+        lock_guard<mutex> statsLock(stats_mutex);
+        base=stats.deltasSinceBase>=config.checkpointMaxDeltas || stats.deltaBytes>stats.baseBytes;
+    }
+    if(base){
+        if(bgsave_running) return; //tried again on the next tick
+        if(bgsaveBase())
+            cout<<"Background saving started for "<<config.dbFilename<<"\n";
+        else
+            cerr<<"Error starting background save\n";
+        return;
+    }
+    if(!saveDelta())
+        cerr<<"Error writing delta checkpoint for "<<config.dbFilename<<"\n";
+}
+
+KeyspaceCounts RedisDatabase::keyspaceCounts() {
+    lock_guard<ProfiledMutex> lock(db_mutex);
+    KeyspaceCounts counts;
+    counts.strings=kv_Store.size();
+    counts.lists=list_store.size();
+    counts.hashes=hash_Store.size();
+    counts.expires=expiry_map.size();
+    return counts;
+}
+
+//MEMORY USAGE: the key's entry, value and expiry; a container longer than samples is
+//priced from its first samples elements
+bool RedisDatabase::memoryUsage(const std::string& key,size_t samples,uint64_t& bytes){
+    lock_guard<ProfiledMutex> lock(db_mutex);
+    purgeExpired();
+    bytes=0;
+    bool found=false;
+    auto itkv=kv_Store.find(key);
+    if(itkv!=kv_Store.end()){
+        bytes+=entryBytes<StoredString>(key)+storedBytes(itkv->second);
+        found=true;
+    }
+    auto itlist=list_store.find(key);
+    if(itlist!=list_store.end()){
+        const auto& lst=itlist->second;
+        size_t seen=0,elements=0;
+        for(const auto& element:lst){
+            if(samples && seen==samples) break;
+            elements+=elementBytes(element);
+            seen++;
+        }
+        bytes+=entryBytes<vector<string>>(key)+(seen ? elements*lst.size()/seen : 0);
+        found=true;
+    }
+    auto iths=hash_Store.find(key);
+    if(iths!=hash_Store.end()){
+        const auto& hash=iths->second;
+        size_t seen=0,fields=0;
+        for(const auto& field:hash){
+            if(samples && seen==samples) break;
+            fields+=fieldBytes(field.first,field.second);
+            seen++;
+        }
+        bytes+=entryBytes<HashValue>(key)+(seen ? fields*hash.size()/seen : 0);
+        found=true;
+    }
+    if(found && expiry_map.count(key)) bytes+=entryBytes<chrono::steady_clock::time_point>(key);
+    return found;
+}
+
+MemoryCounts RedisDatabase::memoryCounts(){
+    lock_guard<ProfiledMutex> lock(db_mutex);
+    MemoryCounts counts=memory;
+    countOverhead(counts);
+    return counts;
+}
+
+/*
+SCAN walks the buckets of kv_Store, then list_store, then hash_Store; the cursor is the
+table in its top byte and the next bucket below. A key present for the whole scan is
+returned at least once unless a table is resized in between, a key may come twice.
 */
+uint64_t RedisDatabase::scan(uint64_t cursor,size_t count,const std::string& pattern,const std::string& type,std::vector<std::string>& keys){
+    lock_guard<ProfiledMutex> lock(db_mutex);
+    purgeExpired();
+    static const char* tables[]={"string","list","hash"};
+    size_t table=cursor>>56,bucket=cursor&((uint64_t(1)<<56)-1);
+    size_t scanned=0,visited=0;
+    auto walk=[&](const auto& store){
+        for(;bucket<store.bucket_count();bucket++){
+            if(scanned>=count || visited>=count*10) return false;
+            visited++;
+            for(auto it=store.begin(bucket);it!=store.end(bucket);++it){
+                scanned++;
+                std::string key=it->first.str();
+                if(pattern.empty() || fnmatch(pattern.c_str(),key.c_str(),0)==0) keys.push_back(move(key));
+            }
+        }
+        return true;
+    };
+    for(;table<3;table++,bucket=0){
+        if(!type.empty() && type!=tables[table]) continue;
+        bool done=table==0 ? walk(kv_Store) : table==1 ? walk(list_store) : walk(hash_Store);
+        if(!done) return (uint64_t(table)<<56)|bucket;
+    }
+    return 0;
+}
+
+ssize_t RedisDatabase::strlen(const std::string& key){
+    lock_guard<ProfiledMutex> lock(db_mutex);
+    purgeExpired();
+    auto it=kv_Store.find(key);
+    return lookup(key,it!=kv_Store.end()) ? it->second.size() : 0;
+}
+
+//up to count keys from random buckets of table, for the eviction pool
+template<class Table>
+static void sampleKeys(const Table& table,size_t count,mt19937_64& rng,vector<const StoredString*>& keys){
+    if(table.empty()) return;
+    size_t buckets=table.bucket_count(),bucket=rng()%buckets,wanted=keys.size()+count;
+    for(size_t visited=0;keys.size()<wanted && visited<count*10;visited++,bucket=(bucket+1)%buckets){
+        for(auto it=table.begin(bucket);it!=table.end(bucket) && keys.size()<wanted;++it)
+            keys.push_back(&it->first);
+    }
+}
+
+/*
+The next key maxmemory-policy gives up. maxmemory-samples keys are sampled from each
+table (or from expiry_map for volatile-*), the ones idler than the worst of the pool
+replace it, and the idlest key of the pool still in the keyspace is the one. The pool
+carries over between evictions, so every round starts from the best seen so far.
+*/
+bool RedisDatabase::nextEviction(string& key){
+    ServerConfig& config=ServerConfig::getInstance();
+    MaxMemoryPolicy policy=config.maxMemoryPolicy;
+    if(policy==MaxMemoryPolicy::NoEviction) return false;
+    bool volatileOnly=policy>=MaxMemoryPolicy::VolatileLru;
+    size_t samples=config.maxMemorySamples;
+    vector<const StoredString*> sampled;
+    if(policy==MaxMemoryPolicy::AllKeysRandom || policy==MaxMemoryPolicy::VolatileRandom){
+        size_t total=volatileOnly ? expiry_map.size() : kv_Store.size()+list_store.size()+hash_Store.size();
+        if(!total) return false;
+        size_t pick=eviction_rng()%total;
+        if(volatileOnly) sampleKeys(expiry_map,1,eviction_rng,sampled);
+        else if(pick<kv_Store.size()) sampleKeys(kv_Store,1,eviction_rng,sampled);
+        else if(pick<kv_Store.size()+list_store.size()) sampleKeys(list_store,1,eviction_rng,sampled);
+        else sampleKeys(hash_Store,1,eviction_rng,sampled);
+        if(sampled.empty()) return false;
+        key=sampled[0]->str();
+        return true;
+    }
+
+    if(volatileOnly)
+        sampleKeys(expiry_map,samples,eviction_rng,sampled);
+    else{
+        sampleKeys(kv_Store,samples,eviction_rng,sampled);
+        sampleKeys(list_store,samples,eviction_rng,sampled);
+        sampleKeys(hash_Store,samples,eviction_rng,sampled);
+    }
+    uint32_t now=lruClock();
+    for(const StoredString* sample:sampled){
+        uint64_t idle;
+        if(policy==MaxMemoryPolicy::VolatileTtl)
+            idle=UINT64_MAX-static_cast<uint64_t>(expiry_map.at(*sample).time_since_epoch().count());
+        else{
+            auto it=key_access.find(keyHash(*sample));
+            if(usesLru(policy))
+                idle=it==key_access.end() ? UINT32_MAX : uint32_t(now-it->second);
+            else
+                idle=255-(it==key_access.end() ? LFU_INIT_VAL : lfuDecayed(it->second));
+        }
+        if(eviction_pool.size()==EVICTION_POOL_SIZE && idle<=eviction_pool.front().idle) continue;
+        bool pooled=false;
+        for(const auto& candidate:eviction_pool) pooled|=candidate.key==sample->view();
+        if(pooled) continue;
+        auto pos=upper_bound(eviction_pool.begin(),eviction_pool.end(),idle,
+                             [](uint64_t value,const EvictionCandidate& c){ return value<c.idle; });
+        eviction_pool.insert(pos,EvictionCandidate{idle,sample->str()});
+        if(eviction_pool.size()>EVICTION_POOL_SIZE) eviction_pool.erase(eviction_pool.begin());
+    }
+    //the pool's keys may have been deleted, or lost their TTL, since they were sampled
+    while(!eviction_pool.empty()){
+        EvictionCandidate candidate=move(eviction_pool.back());
+        eviction_pool.pop_back();
+        bool present=volatileOnly ? expiry_map.count(candidate.key)>0 :
+            kv_Store.count(candidate.key) || list_store.count(candidate.key) || hash_Store.count(candidate.key);
+        if(present){
+            key=move(candidate.key);
+            return true;
+        }
+    }
+    return false;
+}
+
+void RedisDatabase::evictKey(const string& key){
+    LatencySample sample("eviction-del");
+    removeKey(key,ServerConfig::getInstance().lazyfreeLazyEviction);
+    touch(key);
+    ServerStats::add(STAT_EVICTED);
+}
+
+//runs before writes: a bounded slice of eviction each time, so no one write pays for
+//freeing everything a lowered maxmemory asks for, the writes after it carry on
+bool RedisDatabase::freeMemory(uint64_t usec,std::vector<std::string>& evicted){
+    uint64_t limit=ServerConfig::getInstance().maxMemory;
+    if(!limit) return true;
+    lock_guard<ProfiledMutex> lock(db_mutex);
+    purgeExpired();
+    if(datasetBytes()<=limit) return true;
+    LatencySample sample("eviction-cycle");
+    auto deadline=chrono::steady_clock::now()+chrono::microseconds(usec);
+    std::string key;
+    while(datasetBytes()>limit && chrono::steady_clock::now()<deadline){
+        if(!nextEviction(key)) break;
+        evictKey(key);
+        evicted.push_back(key);
+    }
+    return datasetBytes()<=limit;
+}
+
+PersistenceStats RedisDatabase::persistenceStats() {
+    uint64_t changes;
+    {
+        lock_guard<ProfiledMutex> lock(db_mutex);
+        changes=dirty_changes;
+    }
+    lock_guard<mutex> statsLock(stats_mutex);
+    PersistenceStats result=stats;
+    result.bgsaveInProgress=bgsave_running && rdb_child;
+    result.changesSinceSave=changes;
+    return result;
+}
+
+//decodes records until the reader is exhausted (or hits EOF); expired keys are skipped
+static bool decodeRecords(RdbReader& r, LoadSlice& out, uint64_t nowMs){
+    uint64_t expireMs=0;
+    uint8_t op;
+    string key;
+    while(r.readByte(op)){
+        if(op==RDB_OPCODE_EOF) return true;
+        if(op==RDB_OPCODE_RESIZEDB){
+            uint64_t kvCount,listCount,hashCount;
+            if(!r.readLength(kvCount)||!r.readLength(listCount)||!r.readLength(hashCount)) return false;
+            out.kv.reserve(kvCount);
+            out.lists.reserve(listCount);
+            out.hashes.reserve(hashCount);
+            continue;
+        }
+        if(op==RDB_OPCODE_EXPIRETIME_MS){
+            if(!r.readUint64(expireMs)) return false;
+            continue;
+        }
+        if(op==RDB_OPCODE_AUX){
+            string value;
+            if(!r.readString(key)||!r.readString(value)) return false;
+            continue;
+        }
+        if(!r.readString(key)) return false;
+        if(op==RDB_OPCODE_DELETE){
+            out.deleted.push_back(key);
+            continue;
+        }
+        bool expired=expireMs && expireMs<=nowMs;
+        if(op==RDB_TYPE_STRING){
+            string value;
+            if(!r.readString(value)) return false;
+            if(!expired) out.kv[key]=move(value);
+        }
+        else if(op==RDB_TYPE_LIST){
+            vector<string> list;
+            if(!readList(r,list)) return false;
+            if(!expired) out.lists[key]=move(list);
+        }
+        else if(op==RDB_TYPE_HASH){
+            HashValue hash;
+            if(!readHash(r,hash)) return false;
+            if(!expired) out.hashes[key]=move(hash);
+        }
+        else{
+            return false; //unknown opcode
+        }
+        if(expired)
+            out.deleted.push_back(key);
+        else if(expireMs)
+            out.expiry[key]=fromUnixMs(expireMs);
+        expireMs=0;
+        out.keys++;
+    }
+    return r.atEnd();
+}
+
 bool RedisDatabase::load(const std::string& filename) {
-    lock_guard<mutex> lock(db_mutex);
+    uint64_t baseId;
+    if(!loadFile(filename,false,baseId)) return false;
+    {
+        lock_guard<ProfiledMutex> lock(db_mutex);
+        recountMemory();
+    }
+    Tracking::getInstance().keyspaceReplaced(); //a replica's full resync
+    return true;
+}
+
+/*
+loadFile() --maps the file and checks the header/index checksum, then a pool of threads
+verifies and decodes sections in parallel, each into its own LoadSlice. The slices
+are spliced into the stores with unordered_map::merge (moves nodes, no copies).
+Version 1 dumps decode on one thread, and dumps written by older builds (one text
+line per key) are still accepted.
+A base replaces the keyspace and reports its base-id. A delta is only applied if its
+delta-base, or the delta-next-base of one written while that base was being forked,
+matches baseId (otherwise baseId comes back as 0); each of its keys replaces whatever
+the keyspace held under that name.
+*/
+bool RedisDatabase::loadFile(const std::string& filename,bool delta,uint64_t& baseId) {
+    auto start=chrono::steady_clock::now();
+    int fd=open(filename.c_str(),O_RDONLY);
+    if(fd<0) return false;
+    struct stat st;
+    if(fstat(fd,&st)!=0 || st.st_size==0){
+        close(fd);
+        return false;
+    }
+    size_t size=st.st_size;
+    void* map=mmap(nullptr,size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(map==MAP_FAILED) return false;
+    madvise(map,size,MADV_WILLNEED);
+    const char* data=static_cast<const char*>(map);
+
+    lock_guard<ProfiledMutex> lock(db_mutex);
+    RdbReader header(data,size);
+    int version;
+    if(!header.readHeader(version)){
+        if(delta){
+            munmap(map,size);
+            return false;
+        }
+        istringstream text(string(data,size));
+        munmap(map,size);
+        bool loaded=loadText(text);
+        rebuildSlotIndex();
+        baseId=0;
+        dirty_all=true;
+        dirty_keys.clear();
+        lock_guard<mutex> statsLock(stats_mutex);
+        stats.loadKeys=kv_Store.size()+list_store.size()+hash_Store.size();
+        stats.loadThreads=1;
+        stats.loadSeconds=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+        return loaded;
+    }
 
-    ifstream ifs(filename,ios::binary);
-    if(!ifs)return false;
+    uint64_t nowMs=chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    vector<RdbSection> sections;
+    uint64_t fileBase=0,fileNextBase=0;
+    bool ok=true;
+    if(version==1){
+        ok=rdbVerifyChecksum(data,size);
+        RdbSection whole;
+        whole.offset=header.offset();
+        whole.length=size-8-header.offset();
+        sections.push_back(whole);
+    }
+    else if(version==RDB_VERSION){
+        ok=rdbReadIndex(data,size,header.offset(),sections);
+        //RESIZEDB and the AUX fields sit between the header and the first section
+        uint8_t op;
+        while(ok && header.readByte(op)){
+            if(op==RDB_OPCODE_RESIZEDB){
+                uint64_t kvCount,listCount,hashCount;
+                if(!header.readLength(kvCount) || !header.readLength(listCount) || !header.readLength(hashCount)) break;
+                if(!delta){
+                    kv_Store.reserve(kvCount);
+                    list_store.reserve(listCount);
+                    hash_Store.reserve(hashCount);
+                }
+            }
+            else if(op==RDB_OPCODE_AUX){
+                string name,value;
+                if(!header.readString(name) || !header.readString(value)) break;
+                if(name==(delta?"delta-base":"base-id"))
+                    fileBase=strtoull(value.c_str(),nullptr,10);
+                else if(delta && name=="delta-next-base")
+                    fileNextBase=strtoull(value.c_str(),nullptr,10);
+            }
+            else break;
+        }
+    }
+    else{
+        ok=false;
+    }
+    if(!ok){
+        cerr<<"Snapshot "<<filename<<" is corrupt or from a newer version\n";
+        munmap(map,size);
+        return false;
+    }
+    if(delta && fileBase!=baseId && fileNextBase!=baseId){
+        //written against an older base that has since been replaced
+        munmap(map,size);
+        baseId=0;
+        return true;
+    }
+
+    size_t threadCount=min<size_t>(max(1u,thread::hardware_concurrency()),sections.size());
+    vector<LoadSlice> slices(max<size_t>(threadCount,1));
+    vector<thread> loaders;
+    for(size_t t=0;t<threadCount;t++){
+        loaders.emplace_back([&,t](){
+            LoadSlice& slice=slices[t];
+            for(size_t i=t;i<sections.size() && slice.ok;i+=threadCount){
+                const RdbSection& section=sections[i];
+                if(version!=1 && !rdbVerifySection(data,section)){
+                    slice.ok=false;
+                    break;
+                }
+                RdbReader r(data+section.offset,section.length);
+                slice.ok=decodeRecords(r,slice,nowMs);
+            }
+        });
+    }
+    for(auto& loader:loaders) loader.join();
+    munmap(map,size);
 
+    for(const auto& slice:slices){
+        if(!slice.ok){
+            cerr<<"Snapshot "<<filename<<" has a corrupt section\n";
+            return false;
+        }
+    }
+    if(delta){
+        //every key of the delta replaces the old one, whatever its type was
+        auto forget=[this](string_view key){
+            kv_Store.erase(key);
+            list_store.erase(key);
+            hash_Store.erase(key);
+            expiry_map.erase(key);
+        };
+        for(const auto& slice:slices){
+            for(const auto& kv:slice.kv) forget(kv.first);
+            for(const auto& kv:slice.lists) forget(kv.first);
+            for(const auto& kv:slice.hashes) forget(kv.first);
+            for(const auto& key:slice.deleted) forget(key);
+        }
+        for(auto& slice:slices){
+            kv_Store.merge(slice.kv);
+            list_store.merge(slice.lists);
+            hash_Store.merge(slice.hashes);
+            expiry_map.merge(slice.expiry);
+        }
+        rebuildSlotIndex();
+        return true;
+    }
+    kv_Store.clear();
+    list_store.clear();
+    hash_Store.clear();
+    expiry_map.clear();
+    uint64_t keys=0;
+    for(auto& slice:slices){
+        kv_Store.merge(slice.kv);
+        list_store.merge(slice.lists);
+        hash_Store.merge(slice.hashes);
+        expiry_map.merge(slice.expiry);
+        keys+=slice.keys;
+    }
+    rebuildSlotIndex();
+    baseId=fileBase;
+    //whatever was loaded is not in any base we wrote (loadCheckpoint knows better)
+    dirty_all=true;
+    dirty_keys.clear();
+
+    lock_guard<mutex> statsLock(stats_mutex);
+    stats.loadKeys=keys;
+    stats.loadThreads=threadCount;
+    stats.loadSeconds=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+    return true;
+}
+
+/*
+Startup: the base, then its deltas in order. A delta that fails to load stops the
+chain (later ones would build on a state we do not have) and the next checkpoint
+becomes a new base.
+*/
+bool RedisDatabase::loadCheckpoint() {
+    auto start=chrono::steady_clock::now();
+    string base=ServerConfig::getInstance().dbFilename;
+    auto deltas=listDeltas(base);
+    uint64_t id=0;
+    if(!loadFile(base,false,id)) return false;
+
+    uint64_t applied=0,bytes=0;
+    bool broken=false;
+    for(const auto& delta:deltas){
+        if(!id || broken) break;
+        uint64_t deltaBase=id;
+        if(!loadFile(delta.second,true,deltaBase)){
+            cerr<<"Delta checkpoint "<<delta.second<<" failed to load, later deltas ignored\n";
+            broken=true;
+        }
+        else if(deltaBase==id){
+            struct stat st;
+            if(stat(delta.second.c_str(),&st)==0) bytes+=st.st_size;
+            applied++;
+        }
+    }
+
+    struct stat st;
+    lock_guard<ProfiledMutex> lock(db_mutex);
+    recountMemory();
+    base_id=id;
+    dirty_all=!id || broken;
+    dirty_keys.clear();
+    dirty_changes=0;
+    last_checkpoint=chrono::steady_clock::now();
+    if(!deltas.empty()) next_delta=deltas.back().first+1;
+    lock_guard<mutex> statsLock(stats_mutex);
+    stats.loadDeltas=applied;
+    stats.deltasSinceBase=applied;
+    stats.deltaBytes=bytes;
+    stats.baseBytes=stat(base.c_str(),&st)==0?st.st_size:0;
+    stats.loadSeconds=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+    return true;
+}
+
+/*
+Legacy text dump, one record per line:
+K<key> <value>
+L<key> <item> <item>...
+H<key> <field>:<value>...
+*/
+bool RedisDatabase::loadText(istream& ifs) {
     kv_Store.clear();
     list_store.clear();
     hash_Store.clear();
@@ -405,7 +1693,7 @@ bool RedisDatabase::load(const std::string& filename) {
         istringstream iss(line);
         char type;
         iss >> type;
-        if(type=='k'){
+        if(type=='K'){
             string key ,value;
             iss>>key>>value;
             kv_Store[key]=value;
@@ -423,7 +1711,7 @@ bool RedisDatabase::load(const std::string& filename) {
         else if(type=='H'){
             string key;
             iss>>key;
-            unordered_map<string,string> hash;
+            HashValue hash;
             string pair;
             while(iss>>pair){
                 auto pos=pair.find(':');
@@ -438,4 +1726,115 @@ bool RedisDatabase::load(const std::string& filename) {
     }
 
     return true; 
-}
\ No newline at end of file
+}
+
+/*
+Cluster mode: keys are indexed by hash slot (touch() keeps the index current), so
+CLUSTER COUNTKEYSINSLOT/GETKEYSINSLOT and slot migration do not scan the keyspace.
+*/
+void RedisDatabase::enableSlotIndex(){
+    std::lock_guard<ProfiledMutex> lock(db_mutex);
+    slot_keys.assign(CLUSTER_SLOTS,{});
+    rebuildSlotIndex();
+}
+
+void RedisDatabase::rebuildSlotIndex(){
+    if(slot_keys.empty()) return;
+    for(auto& keys:slot_keys) keys.clear();
+    auto index=[this](const StoredString& stored){
+        string key=stored.str();
+        slot_keys[Cluster::keySlot(key)].insert(move(key));
+    };
+    for(const auto& kv:kv_Store) index(kv.first);
+    for(const auto& kv:list_store) index(kv.first);
+    for(const auto& kv:hash_Store) index(kv.first);
+}
+
+std::vector<std::string> RedisDatabase::keysInSlot(unsigned int slot,size_t count){
+    std::lock_guard<ProfiledMutex> lock(db_mutex);
+    purgeExpired();
+    std::vector<std::string> result;
+    if(slot>=slot_keys.size()) return result;
+    for(const auto& key:slot_keys[slot]){
+        if(result.size()>=count) break;
+        result.push_back(key);
+    }
+    return result;
+}
+
+size_t RedisDatabase::countKeysInSlot(unsigned int slot){
+    std::lock_guard<ProfiledMutex> lock(db_mutex);
+    purgeExpired();
+    return slot<slot_keys.size() ? slot_keys[slot].size() : 0;
+}
+
+/*
+DUMP --one key as a standalone payload (type opcode and value as a snapshot record
+writes them, then version and CRC64). The deadline travels next to it, as RESTORE's
+ttl argument, so expireUnixMs is 0 for a key without one.
+*/
+bool RedisDatabase::dumpKey(const std::string& key,std::string& payload,uint64_t& expireUnixMs){
+    std::lock_guard<ProfiledMutex> lock(db_mutex);
+    purgeExpired();
+    payload.clear();
+    RdbWriter w(&payload);
+    auto itkv=kv_Store.find(key);
+    auto itlist=list_store.find(key);
+    auto iths=hash_Store.find(key);
+    if(itkv!=kv_Store.end()){
+        w.writeByte(RDB_TYPE_STRING);
+        w.writeString(itkv->second);
+    }
+    else if(itlist!=list_store.end()){
+        w.writeByte(RDB_TYPE_LIST);
+        writeList(w,itlist->second);
+    }
+    else if(iths!=hash_Store.end()){
+        w.writeByte(RDB_TYPE_HASH);
+        writeHash(w,iths->second);
+    }
+    else return false;
+    w.finishPayload();
+    auto itExpire=expiry_map.find(key);
+    expireUnixMs=itExpire!=expiry_map.end() ? toUnixMs(itExpire->second) : 0;
+    return true;
+}
+
+//RESTORE --the payload is decoded before taking the lock; error holds the reply text on failure
+bool RedisDatabase::restoreKey(const std::string& key,const std::string& payload,uint64_t expireUnixMs,bool replace,std::string& error){
+    if(!rdbVerifyPayload(payload)){
+        error="ERR DUMP payload version or checksum are wrong";
+        return false;
+    }
+    RdbReader r(payload.data(),payload.size()-10);
+    uint8_t op;
+    std::string value;
+    std::vector<std::string> list;
+    HashValue hash;
+    bool ok=r.readByte(op);
+    if(ok && op==RDB_TYPE_STRING) ok=r.readString(value);
+    else if(ok && op==RDB_TYPE_LIST) ok=readList(r,list);
+    else if(ok && op==RDB_TYPE_HASH) ok=readHash(r,hash);
+    else ok=false;
+    if(!ok || !r.atEnd()){
+        error="ERR Bad data format";
+        return false;
+    }
+
+    std::lock_guard<ProfiledMutex> lock(db_mutex);
+    purgeExpired();
+    bool exist=kv_Store.count(key)||list_store.count(key)||hash_Store.count(key);
+    if(exist && !replace){
+        error="BUSYKEY Target key name already exists.";
+        return false;
+    }
+    removeKey(key,ServerConfig::getInstance().lazyfreeLazyServerDel);
+    if(op==RDB_TYPE_STRING) kv_Store[key]=move(value);
+    else if(op==RDB_TYPE_LIST) list_store[key]=move(list);
+    else hash_Store[key]=move(hash);
+    if(expireUnixMs) expiry_map[key]=fromUnixMs(expireUnixMs);
+    accountKey(key,1);
+    accountExpire(key,1);
+    touch(key);
+    return true;
+}
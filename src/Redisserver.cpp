@@ -1,15 +1,28 @@
 #include "../include/RedisServer.h"
 #include "../include/RedisCommandHandler.h"
 #include "../include/RedisDatabase.h"
+#include "../include/AppendOnlyFile.h"
+#include "../include/ServerConfig.h"
+#include "../include/Replication.h"
+#include "../include/Cluster.h"
+#include "../include/Tracking.h"
+#include "../include/ServerStats.h"
+#include "../include/CommandStats.h"
+#include "../include/SlowLog.h"
+#include "../include/MetricsServer.h"
+#include "../include/LazyFree.h"
 #include <iostream>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include<cstring>
 #include<thread>
 #include<signal.h>
 #include<vector>
+#include<algorithm>
+#include<strings.h>
 
 
 using namespace std; 
@@ -20,7 +33,19 @@ void signalHandler(int signum){
         cout<<"Caught signal "<<signum <<", shutting down...\n";
         globalServer->shutdown();
     }
-    exit(signum);
+    //the client and cron threads are still running: exit() would destroy the singletons
+    //(ServerStats, the database) under them, everything worth keeping is on disk by now
+    cout.flush();
+    _exit(signum);
+}
+//"ip:port" of the other end of a connection, for SLOWLOG
+static string peerAddress(int fd){
+    sockaddr_in addr{};
+    socklen_t len=sizeof(addr);
+    if(getpeername(fd,(sockaddr*)&addr,&len)<0) return "";
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET,&addr.sin_addr,ip,sizeof(ip));
+    return string(ip)+":"+to_string(ntohs(addr.sin_port));
 }
 void RedisServer::setupSignalHandler(){
     signal(SIGINT,signalHandler); //ctrl+c
@@ -34,14 +59,20 @@ void RedisServer ::shutdown(){
     running=false;
     if(server_socket !=-1){
         //Before shut down persist the database
-        if(RedisDatabase::getInstance().dump("dump.my_rdb")){
-            cout<<"Database dumped to dump.my_rdb\n";
+        if(RedisDatabase::getInstance().save()){
+            cout<<"Database dumped to "<<ServerConfig::getInstance().dbFilename<<"\n";
         }
         else{
             cerr<<"Error dumping database\n";
         }
         close(server_socket);
     }
+    AppendOnlyFile::getInstance().close();
+    Replication::getInstance().shutdown();
+    Cluster::getInstance().shutdown();
+    Tracking::getInstance().shutdown();
+    MetricsServer::getInstance().shutdown();
+    LazyFree::getInstance().shutdown();
     cout <<"Server Shutdown complete! \n";
 
 }
@@ -79,16 +110,63 @@ void RedisServer::run() {
             if (running) cerr << "Couldnt accept client connection\n";
         break;
         }
+        //replies to a pipeline go out in several writes; without this the second one
+        //waits for the ACK of the first, which the client delays by up to 40ms
+        setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
         threads.emplace_back([client_socket, &cmdHandler](){
-            char buffer[1024];
-            while (true){
-                memset(buffer,0,sizeof(buffer));
-                int bytes = recv(client_socket, buffer, sizeof(buffer) -1, 0); 
+            //commands can arrive several per recv (pipelining) or split over several recvs,
+            //so complete ones are cut off the front of a per-connection buffer
+            string buffer;
+            char chunk[16*1024];
+            vector<string> tokens;
+            int replicaPort=0; //REPLCONF listening-port, if this connection turns into a replica
+            bool open=true;
+            //replies and CLIENT TRACKING invalidations share the socket, Tracking orders them
+            Tracking& tracking=Tracking::getInstance();
+            shared_ptr<TrackingClient> client=tracking.attach(client_socket);
+            ServerStats::getInstance().clientConnected();
+            SlowLog::setClient(peerAddress(client_socket));
+            while (open){
+                int bytes = recv(client_socket, chunk, sizeof(chunk), 0); 
                 if (bytes<=0) break;
-                string request(buffer,bytes);
-                string response = cmdHandler.processCommand(request);
-                send(client_socket,response.c_str(),response.size(),0);
+                ServerStats::add(STAT_NET_INPUT,bytes);
+                buffer.append(chunk,bytes);
+                tracking.beginReplies(*client);
+                string response;
+                size_t pos=0;
+                CommandBatch batch; //the commands of this read share their clock reads
+                while(pos<buffer.size()){
+                    size_t used=parseRespFrame(buffer.data()+pos,buffer.size()-pos,tokens);
+                    if(used==0) break;
+                    if(used==string::npos){
+                        response+="-Error Protocol error\r\n";
+                        open=false;
+                        break;
+                    }
+                    pos+=used;
+                    if(tokens.empty()) continue;
+                    string cmd=tokens[0];
+                    transform(cmd.begin(),cmd.end(),cmd.begin(),::toupper);
+                    if(cmd=="PSYNC" || cmd=="SYNC"){
+                        //from here on the connection carries the replication stream
+                        tracking.sendReplies(*client,response);
+                        tracking.detach(client);
+                        response.clear();
+                        Replication::getInstance().serveReplica(client_socket,tokens,replicaPort,buffer.substr(pos));
+                        open=false;
+                        break;
+                    }
+                    if(cmd=="REPLCONF" && tokens.size()>=3 && strcasecmp(tokens[1].c_str(),"listening-port")==0)
+                        replicaPort=atoi(tokens[2].c_str());
+                    response+=cmdHandler.executeCommand(tokens);
+                    tracking.flushInvalidations();
+                }
+                buffer.erase(0,pos);
+                if(!tracking.sendReplies(*client,response)) break;
+                ServerStats::add(STAT_NET_OUTPUT,response.size());
             }
+            tracking.detach(client);
+            ServerStats::getInstance().clientDisconnected();
             close(client_socket);
         });
     }
@@ -98,8 +176,8 @@ void RedisServer::run() {
 
 
     }
-    if(RedisDatabase::getInstance().dump("dump.my_rdb")){
-        cout<<"Database dumped to dump.my_rdb\n";
+    if(RedisDatabase::getInstance().save()){
+        cout<<"Database dumped to "<<ServerConfig::getInstance().dbFilename<<"\n";
     }
     else{
         cerr<<"Error dumping database\n";
@@ -0,0 +1,631 @@
+#include "../include/Replication.h"
+#include "../include/AppendOnlyFile.h"
+#include "../include/RedisDatabase.h"
+#include "../include/RedisCommandHandler.h"
+#include "../include/ServerConfig.h"
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <random>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+using namespace std;
+
+struct ReplicaLink {
+    int fd = -1;
+    string ip;
+    int port = 0;
+    string state = "wait_bgsave"; // wait_bgsave -> send_bulk -> online
+    string out;                   // stream bytes not sent yet
+    bool closed = false;
+    bool snapshotDone = false;
+    bool snapshotOk = false;
+    uint64_t ackOffset = 0;
+    chrono::steady_clock::time_point lastAck = chrono::steady_clock::now();
+};
+
+static thread_local bool masterLinkThread = false;
+
+Replication& Replication::getInstance() {
+    static Replication instance;
+    return instance;
+}
+
+static string newReplid() {
+    static const char* hex = "0123456789abcdef";
+    random_device rd;
+    string id;
+    for (int i = 0; i < 40; i++) id += hex[rd() % 16];
+    return id;
+}
+
+Replication::Replication() : replid(newReplid()) {}
+
+static void appendResp(string& out, const vector<string>& tokens) {
+    out += "*" + to_string(tokens.size()) + "\r\n";
+    for (const auto& token : tokens) {
+        out += "$" + to_string(token.size()) + "\r\n";
+        out += token;
+        out += "\r\n";
+    }
+}
+
+static bool sendAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool sendAll(int fd, const string& data) {
+    return sendAll(fd, data.data(), data.size());
+}
+
+static long long secondsSince(chrono::steady_clock::time_point tp) {
+    return chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now() - tp).count();
+}
+
+void Replication::createBacklog() {
+    backlog.assign(ServerConfig::getInstance().replBacklogSize, '\0');
+    backlogIdx = 0;
+    histlen = 0;
+    backlogActive = true;
+}
+
+void Replication::appendStream(const char* data, size_t len) {
+    if (backlogActive) {
+        size_t size = backlog.size();
+        const char* p = data;
+        size_t n = len;
+        if (n > size) {
+            p += n - size;
+            n = size;
+        }
+        while (n > 0) {
+            size_t chunk = min(n, size - backlogIdx);
+            memcpy(&backlog[backlogIdx], p, chunk);
+            backlogIdx = (backlogIdx + chunk) % size;
+            p += chunk;
+            n -= chunk;
+        }
+        histlen = min<uint64_t>(histlen + len, size);
+    }
+    offset += len;
+    for (auto& link : replicas) {
+        if (link->closed) continue;
+        link->out.append(data, len);
+        if (link->out.size() > REPL_OUTPUT_LIMIT) {
+            cerr << "Replica " << link->ip << ":" << link->port << " fell too far behind, dropping it\n";
+            link->closed = true;
+            link->out.clear();
+            ::shutdown(link->fd, SHUT_RDWR);
+        }
+    }
+    out_cv.notify_all();
+}
+
+// stream positions are 1-based like Redis: the backlog holds [offset-histlen+1, offset]
+string Replication::backlogFrom(uint64_t start) {
+    uint64_t first = offset - histlen + 1;
+    uint64_t skip = start - first;
+    size_t size = backlog.size();
+    size_t idx = (backlogIdx + size - histlen + skip) % size;
+    size_t n = histlen - skip;
+    string out;
+    out.reserve(n);
+    while (n > 0) {
+        size_t chunk = min(n, size - idx);
+        out.append(&backlog[idx], chunk);
+        idx = (idx + chunk) % size;
+        n -= chunk;
+    }
+    return out;
+}
+
+void Replication::disconnectReplicas() {
+    for (auto& link : replicas) {
+        link->closed = true;
+        ::shutdown(link->fd, SHUT_RDWR);
+    }
+    out_cv.notify_all();
+}
+
+void Replication::feed(const vector<string>& tokens) {
+    //a replica only passes its master's stream on (see masterLoop), never its own writes
+    if (replica || !backlogActive) return;
+    string encoded;
+    appendResp(encoded, tokens);
+    lock_guard<mutex> lock(repl_mutex);
+    appendStream(encoded.data(), encoded.size());
+}
+
+bool Replication::rejectsWrites() const {
+    return replica && ServerConfig::getInstance().replicaReadOnly && !masterLinkThread;
+}
+
+bool Replication::fromMaster() {
+    return masterLinkThread;
+}
+
+/*
+Master side of one replica, on the thread of the connection that sent PSYNC.
+Decides between a partial and a full resync while holding the order lock (no write
+can run in between), then loops: send whatever the stream queued for this replica,
+read its REPLCONF ACKs.
+*/
+void Replication::serveReplica(int fd, const vector<string>& psync, int replicaPort, const string& pending) {
+    auto link = make_shared<ReplicaLink>();
+    link->fd = fd;
+    link->port = replicaPort;
+    sockaddr_in addr{};
+    socklen_t addrLen = sizeof(addr);
+    if (getpeername(fd, (sockaddr*)&addr, &addrLen) == 0) {
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+        link->ip = ip;
+    }
+    string cmd = psync[0];
+    transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+    bool legacy = cmd == "SYNC"; // old protocol: snapshot without the +FULLRESYNC line
+    string wantedId = psync.size() > 1 ? psync[1] : "?";
+    long long wantedOffset = psync.size() > 2 ? strtoll(psync[2].c_str(), nullptr, 10) : -1;
+
+    RedisDatabase& db = RedisDatabase::getInstance();
+    string snapshot = ServerConfig::getInstance().dbFilename + ".repl-" + to_string(fd);
+    string reply;
+    bool full = false;
+    while (true) {
+        {
+            lock_guard<mutex> order(AppendOnlyFile::getInstance().orderLock());
+            lock_guard<mutex> lock(repl_mutex);
+            if (!backlogActive) createBacklog();
+            uint64_t first = offset - histlen + 1;
+            bool sameHistory = wantedId == replid ||
+                (!replid2.empty() && wantedId == replid2 && wantedOffset >= 0 &&
+                 static_cast<uint64_t>(wantedOffset) <= secondOffset);
+            if (!legacy && sameHistory && wantedOffset >= static_cast<long long>(first) &&
+                static_cast<uint64_t>(wantedOffset) <= offset + 1) {
+                link->out = backlogFrom(wantedOffset);
+                link->state = "online";
+                reply = "+CONTINUE " + replid + "\r\n";
+                replicas.push_back(link);
+                break;
+            }
+            //the child's snapshot is the keyspace at exactly `offset`, the stream picks up from there
+            bool started = db.bgsave(snapshot, [this, link](bool ok) {
+                lock_guard<mutex> lock(repl_mutex);
+                link->snapshotDone = true;
+                link->snapshotOk = ok;
+                out_cv.notify_all();
+            });
+            if (started) {
+                full = true;
+                if (!legacy) reply = "+FULLRESYNC " + replid + " " + to_string(offset) + "\r\n";
+                replicas.push_back(link);
+                break;
+            }
+        }
+        //another fork (BGSAVE, AOF rewrite) is running
+        this_thread::sleep_for(chrono::milliseconds(100));
+    }
+    cout << "Replica " << link->ip << ":" << link->port << " asked for "
+         << (full ? "a full resync" : "a partial resync") << "\n";
+
+    bool ok = sendAll(fd, reply);
+    if (ok && full) {
+        //newlines keep the replica's read timeout from firing while the child works
+        unique_lock<mutex> lock(repl_mutex);
+        auto lastNewline = chrono::steady_clock::now();
+        while (!link->snapshotDone && !link->closed) {
+            out_cv.wait_for(lock, chrono::seconds(1));
+            if (!link->snapshotDone && secondsSince(lastNewline) >= 1) {
+                lock.unlock();
+                ok = sendAll(fd, "\n", 1);
+                lock.lock();
+                lastNewline = chrono::steady_clock::now();
+                if (!ok) break;
+            }
+        }
+        ok = ok && link->snapshotOk && !link->closed;
+        if (ok) link->state = "send_bulk";
+    }
+    if (ok && full) {
+        int in = open(snapshot.c_str(), O_RDONLY);
+        struct stat st;
+        ok = in >= 0 && fstat(in, &st) == 0 && sendAll(fd, "$" + to_string(st.st_size) + "\r\n");
+        off_t sent = 0;
+        while (ok && sent < st.st_size) {
+            ssize_t n = sendfile(fd, in, &sent, st.st_size - sent);
+            if (n <= 0) ok = false;
+        }
+        if (in >= 0) close(in);
+        lock_guard<mutex> lock(repl_mutex);
+        link->state = "online";
+        link->lastAck = chrono::steady_clock::now();
+    }
+    unlink(snapshot.c_str());
+
+    string acks = pending;
+    char chunk[4096];
+    vector<string> tokens;
+    while (ok) {
+        string data;
+        {
+            unique_lock<mutex> lock(repl_mutex);
+            out_cv.wait_for(lock, chrono::milliseconds(100), [&] { return !link->out.empty() || link->closed; });
+            if (link->closed) break;
+            data.swap(link->out);
+        }
+        if (!data.empty() && !sendAll(fd, data)) break;
+
+        //REPLCONF ACK <offset>, the replica's only traffic on this connection
+        ssize_t n;
+        while ((n = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT)) > 0)
+            acks.append(chunk, n);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) break;
+        size_t used;
+        while ((used = parseRespFrame(acks.data(), acks.size(), tokens)) != 0 && used != string::npos) {
+            acks.erase(0, used);
+            if (tokens.size() < 3) continue;
+            transform(tokens[0].begin(), tokens[0].end(), tokens[0].begin(), ::toupper);
+            transform(tokens[1].begin(), tokens[1].end(), tokens[1].begin(), ::tolower);
+            if (tokens[0] == "REPLCONF" && tokens[1] == "ack") {
+                lock_guard<mutex> lock(repl_mutex);
+                link->ackOffset = strtoull(tokens[2].c_str(), nullptr, 10);
+                link->lastAck = chrono::steady_clock::now();
+            }
+        }
+        if (used == string::npos) break;
+    }
+
+    lock_guard<mutex> lock(repl_mutex);
+    link->closed = true;
+    replicas.erase(remove(replicas.begin(), replicas.end(), link), replicas.end());
+    cout << "Replica " << link->ip << ":" << link->port << " disconnected\n";
+}
+
+void Replication::replicaOf(const string& host, int port) {
+    stopLink();
+    {
+        lock_guard<mutex> lock(repl_mutex);
+        //our own replicas resync against whatever history the new master gives us
+        disconnectReplicas();
+        masterHost = host;
+        masterPort = port;
+        replica = true;
+        linkUp = false;
+        linkDownSince = chrono::steady_clock::now();
+    }
+    linkStop = false;
+    link = thread(&Replication::masterLoop, this);
+}
+
+void Replication::promote() {
+    stopLink();
+    lock_guard<mutex> lock(repl_mutex);
+    if (!replica) return;
+    replica = false;
+    linkUp = false;
+    //replicas that followed the old master up to here can still PSYNC with the old id
+    replid2 = replid;
+    secondOffset = offset + 1;
+    replid = newReplid();
+}
+
+void Replication::stopLink() {
+    if (!link.joinable()) return;
+    linkStop = true;
+    int fd = linkFd;
+    if (fd >= 0) ::shutdown(fd, SHUT_RDWR);
+    link.join();
+}
+
+void Replication::shutdown() {
+    stopLink();
+    lock_guard<mutex> lock(repl_mutex);
+    disconnectReplicas();
+}
+
+static int connectTo(const string& host, int port) {
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    if (getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &res) != 0) return -1;
+    int fd = -1;
+    for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd >= 0) {
+        //reads wake up every second so the link can send ACKs and notice a stop
+        timeval tv{1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+    return fd;
+}
+
+// replica side: keeps a link to the master up, reconnecting (with PSYNC) when it drops
+void Replication::masterLoop() {
+    masterLinkThread = true;
+    while (!linkStop) {
+        string host;
+        int port;
+        {
+            lock_guard<mutex> lock(repl_mutex);
+            host = masterHost;
+            port = masterPort;
+        }
+        int fd = connectTo(host, port);
+        if (fd >= 0) {
+            linkFd = fd;
+            if (!linkStop) syncWithMaster(fd);
+            linkFd = -1;
+            close(fd);
+        }
+        {
+            lock_guard<mutex> lock(repl_mutex);
+            if (linkUp) {
+                linkUp = false;
+                linkDownSince = chrono::steady_clock::now();
+                cout << "Connection with master " << host << ":" << port << " lost\n";
+            }
+            syncInProgress = false;
+        }
+        for (int i = 0; i < 10 && !linkStop; i++)
+            this_thread::sleep_for(chrono::milliseconds(100));
+    }
+}
+
+/*
+Handshake, then either load the master's snapshot (full resync) or keep our data
+(partial), then apply the stream until the connection breaks. Every command is
+executed and appended to our own backlog under the order lock, so a replica of this
+replica gets a snapshot and a stream that meet at the same offset.
+*/
+bool Replication::syncWithMaster(int fd) {
+    ServerConfig& config = ServerConfig::getInstance();
+    AppendOnlyFile& aof = AppendOnlyFile::getInstance();
+    string buf;
+    char chunk[64 * 1024];
+    lastIo = chrono::steady_clock::now();
+    //false once the link is dead, true after new data or a one second read timeout
+    auto fill = [&]() {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n > 0) {
+            buf.append(chunk, n);
+            lastIo = chrono::steady_clock::now();
+            return true;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return !linkStop && secondsSince(lastIo) < static_cast<long long>(config.replTimeout);
+        return false;
+    };
+    auto readLine = [&](string& line) {
+        while (true) {
+            size_t eol = buf.find("\r\n");
+            if (eol != string::npos) {
+                line = buf.substr(0, eol);
+                buf.erase(0, eol + 2);
+                return true;
+            }
+            if (!fill()) return false;
+        }
+    };
+    auto command = [&](const vector<string>& tokens, string& reply) {
+        string request;
+        appendResp(request, tokens);
+        return sendAll(fd, request) && readLine(reply);
+    };
+
+    string reply;
+    if (!command({"PING"}, reply)) return false;
+    if (reply.empty() || reply[0] != '+') {
+        cerr << "Master replied to PING with " << reply << "\n";
+        return false;
+    }
+    command({"REPLCONF", "listening-port", to_string(listeningPort)}, reply);
+    string id;
+    uint64_t next;
+    {
+        lock_guard<mutex> lock(repl_mutex);
+        id = replid;
+        next = offset + 1;
+    }
+    if (!command({"PSYNC", id, to_string(next)}, reply)) return false;
+
+    if (reply.compare(0, 11, "+FULLRESYNC") == 0) {
+        istringstream iss(reply.substr(11));
+        string newId;
+        uint64_t newOffset = 0;
+        iss >> newId >> newOffset;
+        {
+            lock_guard<mutex> lock(repl_mutex);
+            syncInProgress = true;
+        }
+        //the master sends bare newlines while its child is still writing
+        string header;
+        if (!readLine(header)) return false;
+        header.erase(0, header.find_first_not_of('\n'));
+        if (header.empty() || header[0] != '$') return false;
+        uint64_t remaining = strtoull(header.c_str() + 1, nullptr, 10);
+        uint64_t total = remaining;
+        string tmpName = config.dbFilename + ".sync-" + to_string(getpid());
+        int out = open(tmpName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0) return false;
+        bool ok = true;
+        while (ok && remaining > 0) {
+            if (buf.empty() && !fill()) {
+                ok = false;
+                break;
+            }
+            size_t n = min<uint64_t>(remaining, buf.size());
+            if (n > 0 && write(out, buf.data(), n) != static_cast<ssize_t>(n)) ok = false;
+            buf.erase(0, n);
+            remaining -= n;
+        }
+        close(out);
+        if (!ok) {
+            unlink(tmpName.c_str());
+            return false;
+        }
+        {
+            //nothing is applied or streamed to our own replicas while the keyspace is swapped
+            lock_guard<mutex> order(aof.orderLock());
+            bool loaded = RedisDatabase::getInstance().load(tmpName);
+            unlink(tmpName.c_str());
+            if (!loaded) {
+                cerr << "Can't load the snapshot sent by the master\n";
+                return false;
+            }
+            lock_guard<mutex> lock(repl_mutex);
+            replid = newId;
+            replid2.clear();
+            offset = newOffset;
+            //kept even without replicas of our own, so after a promotion peers can PSYNC here
+            createBacklog();
+            disconnectReplicas();
+            syncInProgress = false;
+            syncBytes = total;
+        }
+        //the append-only file describes the old keyspace, start it over from the new one
+        if (aof.isOpen()) aof.scheduleRewrite();
+        cout << "MASTER <-> REPLICA sync: loaded " << total << " bytes from the master\n";
+    }
+    else if (reply.compare(0, 9, "+CONTINUE") == 0) {
+        istringstream iss(reply.substr(9));
+        string newId;
+        iss >> newId;
+        lock_guard<mutex> lock(repl_mutex);
+        if (!backlogActive) createBacklog();
+        if (!newId.empty() && newId != replid) {
+            //the master was promoted; our history continues under its new id
+            replid2 = replid;
+            secondOffset = offset + 1;
+            replid = newId;
+        }
+        cout << "MASTER <-> REPLICA sync: partial resync accepted\n";
+    }
+    else {
+        cerr << "Master refused PSYNC: " << reply << "\n";
+        return false;
+    }
+    {
+        lock_guard<mutex> lock(repl_mutex);
+        linkUp = true;
+    }
+
+    RedisCommandHandler handler;
+    vector<string> tokens;
+    auto lastAck = chrono::steady_clock::time_point();
+    while (true) {
+        size_t pos = 0;
+        while (pos < buf.size()) {
+            size_t used = parseRespFrame(buf.data() + pos, buf.size() - pos, tokens);
+            if (used == 0) break;
+            if (used == string::npos) return false;
+            lock_guard<mutex> order(aof.orderLock());
+            if (!tokens.empty()) handler.executeCommand(tokens);
+            lock_guard<mutex> lock(repl_mutex);
+            appendStream(buf.data() + pos, used);
+            pos += used;
+        }
+        buf.erase(0, pos);
+        if (chrono::steady_clock::now() - lastAck >= chrono::seconds(1)) {
+            string ack;
+            {
+                lock_guard<mutex> lock(repl_mutex);
+                appendResp(ack, {"REPLCONF", "ACK", to_string(offset)});
+            }
+            if (!sendAll(fd, ack)) return false;
+            lastAck = chrono::steady_clock::now();
+        }
+        if (!fill()) return false;
+    }
+}
+
+void Replication::cron() {
+    ServerConfig& config = ServerConfig::getInstance();
+    {
+        lock_guard<mutex> lock(repl_mutex);
+        //CONFIG SET repl-backlog-size keeps the newest history that still fits
+        uint64_t size = config.replBacklogSize;
+        if (backlogActive && backlog.size() != size) {
+            string keep = backlogFrom(offset - histlen + 1);
+            if (keep.size() > size) keep.erase(0, keep.size() - size);
+            backlog.assign(size, '\0');
+            memcpy(&backlog[0], keep.data(), keep.size());
+            backlogIdx = keep.size() % size;
+            histlen = keep.size();
+        }
+        for (auto& link : replicas) {
+            if (link->state == "online" && !link->closed &&
+                secondsSince(link->lastAck) > static_cast<long long>(config.replTimeout)) {
+                cerr << "Replica " << link->ip << ":" << link->port << " timed out\n";
+                link->closed = true;
+                ::shutdown(link->fd, SHUT_RDWR);
+            }
+        }
+        if (replica || replicas.empty() || ++pingTicks < REPL_PING_PERIOD) return;
+        pingTicks = 0;
+    }
+    //PINGs go through the stream like any command, so they count in the offsets
+    lock_guard<mutex> order(AppendOnlyFile::getInstance().orderLock());
+    feed({"PING"});
+}
+
+string Replication::info() {
+    ServerConfig& config = ServerConfig::getInstance();
+    lock_guard<mutex> lock(repl_mutex);
+    ostringstream oss;
+    oss << "# Replication\r\n";
+    if (replica) {
+        oss << "role:slave\r\n"
+            << "master_host:" << masterHost << "\r\n"
+            << "master_port:" << masterPort << "\r\n"
+            << "master_link_status:" << (linkUp ? "up" : "down") << "\r\n"
+            << "master_last_io_seconds_ago:" << (linkUp ? secondsSince(lastIo) : -1) << "\r\n"
+            << "master_sync_in_progress:" << (syncInProgress ? 1 : 0) << "\r\n"
+            << "master_sync_total_bytes:" << syncBytes << "\r\n";
+        if (!linkUp)
+            oss << "master_link_down_since_seconds:" << secondsSince(linkDownSince) << "\r\n";
+        oss << "slave_repl_offset:" << offset << "\r\n"
+            << "slave_read_only:" << (config.replicaReadOnly ? 1 : 0) << "\r\n";
+    }
+    else {
+        oss << "role:master\r\n";
+    }
+    oss << "connected_slaves:" << replicas.size() << "\r\n";
+    for (size_t i = 0; i < replicas.size(); i++) {
+        const auto& link = replicas[i];
+        oss << "slave" << i << ":ip=" << link->ip << ",port=" << link->port
+            << ",state=" << link->state << ",offset=" << link->ackOffset
+            << ",lag=" << secondsSince(link->lastAck)
+            << ",lag_bytes=" << (offset > link->ackOffset ? offset - link->ackOffset : 0) << "\r\n";
+    }
+    oss << "master_replid:" << replid << "\r\n"
+        << "master_replid2:" << (replid2.empty() ? string(40, '0') : replid2) << "\r\n"
+        << "master_repl_offset:" << offset << "\r\n"
+        << "second_repl_offset:" << (replid2.empty() ? -1 : static_cast<long long>(secondOffset)) << "\r\n"
+        << "repl_backlog_active:" << (backlogActive ? 1 : 0) << "\r\n"
+        << "repl_backlog_size:" << backlog.size() << "\r\n"
+        << "repl_backlog_first_byte_offset:" << (histlen ? offset - histlen + 1 : 0) << "\r\n"
+        << "repl_backlog_histlen:" << histlen << "\r\n";
+    return oss.str();
+}
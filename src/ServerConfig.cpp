@@ -0,0 +1,388 @@
+#include "../include/ServerConfig.h"
+#include "../include/SlowLog.h"
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <fnmatch.h>
+#include <sstream>
+#include <iterator>
+
+using namespace std;
+
+ServerConfig& ServerConfig::getInstance() {
+    static ServerConfig instance;
+    return instance;
+}
+
+/*
+One row per setting: how to print it, how to parse it, and whether CONFIG SET may
+change it while the server runs. New settings only need a row here.
+*/
+struct ConfigOption {
+    const char* name;
+    bool runtime;
+    function<string(ServerConfig&)> get;
+    function<bool(ServerConfig&, const string&)> set;
+};
+
+static bool parseYesNo(const string& value, bool& out) {
+    if (value == "yes") { out = true; return true; }
+    if (value == "no") { out = false; return true; }
+    return false;
+}
+
+// plain bytes or with a k/kb/m/mb/g/gb suffix, like redis.conf
+static bool parseMemory(const string& value, uint64_t& out) {
+    size_t pos = 0;
+    unsigned long long n;
+    try {
+        n = stoull(value, &pos);
+    } catch (const exception&) {
+        return false;
+    }
+    string unit = value.substr(pos);
+    transform(unit.begin(), unit.end(), unit.begin(), ::tolower);
+    if (unit == "" || unit == "b") out = n;
+    else if (unit == "k" || unit == "kb") out = n * 1024;
+    else if (unit == "m" || unit == "mb") out = n * 1024 * 1024;
+    else if (unit == "g" || unit == "gb") out = n * 1024 * 1024 * 1024;
+    else return false;
+    return true;
+}
+
+static bool parseUnsigned(const string& value, uint64_t& out) {
+    if (value.empty() || value.find_first_not_of("0123456789") != string::npos) return false;
+    try {
+        out = stoull(value);
+    } catch (const exception&) {
+        return false;
+    }
+    return true;
+}
+
+// "900 1 300 10" --pairs of seconds and changes, "" turns checkpoints off
+static bool parseSavePoints(const string& value, vector<SavePoint>& out) {
+    istringstream in(value);
+    vector<string> words{istream_iterator<string>(in), istream_iterator<string>()};
+    if (words.size() % 2 != 0) return false;
+    vector<SavePoint> points;
+    for (size_t i = 0; i < words.size(); i += 2) {
+        SavePoint point;
+        if (!parseUnsigned(words[i], point.seconds) || !parseUnsigned(words[i + 1], point.changes))
+            return false;
+        points.push_back(point);
+    }
+    out = points;
+    return true;
+}
+
+// a yes/no setting that can change at runtime
+static ConfigOption yesNoOption(const char* name, atomic<bool> ServerConfig::*field) {
+    return {name, true,
+        [field](ServerConfig& c) { return string((c.*field) ? "yes" : "no"); },
+        [field](ServerConfig& c, const string& v) {
+            bool b;
+            if (!parseYesNo(v, b)) return false;
+            c.*field = b;
+            return true;
+        }};
+}
+
+static const char* maxMemoryPolicies[] = {
+    "noeviction", "allkeys-lru", "allkeys-lfu", "allkeys-random",
+    "volatile-lru", "volatile-lfu", "volatile-random", "volatile-ttl"};
+
+static const vector<ConfigOption>& configOptions() {
+    static const vector<ConfigOption> options = {
+        {"dbfilename", false,
+            [](ServerConfig& c) { return c.dbFilename; },
+            [](ServerConfig& c, const string& v) {
+                if (v.empty() || v.find('/') != string::npos) return false;
+                c.dbFilename = v;
+                return true;
+            }},
+        {"save", true,
+            [](ServerConfig& c) {
+                string text;
+                for (const auto& point : c.save)
+                    text += (text.empty() ? "" : " ") + to_string(point.seconds) + " " + to_string(point.changes);
+                return text;
+            },
+            [](ServerConfig& c, const string& v) { return parseSavePoints(v, c.save); }},
+        {"checkpoint-max-deltas", true,
+            [](ServerConfig& c) { return to_string(c.checkpointMaxDeltas); },
+            [](ServerConfig& c, const string& v) {
+                uint64_t n;
+                if (!parseUnsigned(v, n)) return false;
+                c.checkpointMaxDeltas = n;
+                return true;
+            }},
+        {"appendonly", false,
+            [](ServerConfig& c) { return string(c.appendOnly ? "yes" : "no"); },
+            [](ServerConfig& c, const string& v) {
+                bool b;
+                if (!parseYesNo(v, b)) return false;
+                c.appendOnly = b;
+                return true;
+            }},
+        {"appendfsync", true,
+            [](ServerConfig& c) {
+                switch (c.appendFsync.load()) {
+                    case AppendFsync::Always: return string("always");
+                    case AppendFsync::No: return string("no");
+                    default: return string("everysec");
+                }
+            },
+            [](ServerConfig& c, const string& v) {
+                if (v == "always") c.appendFsync = AppendFsync::Always;
+                else if (v == "everysec") c.appendFsync = AppendFsync::EverySec;
+                else if (v == "no") c.appendFsync = AppendFsync::No;
+                else return false;
+                return true;
+            }},
+        {"appendfilename", false,
+            [](ServerConfig& c) { return c.appendFilename; },
+            [](ServerConfig& c, const string& v) {
+                if (v.empty()) return false;
+                c.appendFilename = v;
+                return true;
+            }},
+        {"appenddirname", false,
+            [](ServerConfig& c) { return c.appendDirname; },
+            [](ServerConfig& c, const string& v) {
+                if (v.empty()) return false;
+                c.appendDirname = v;
+                return true;
+            }},
+        {"auto-aof-rewrite-percentage", true,
+            [](ServerConfig& c) { return to_string(c.autoAofRewritePercentage); },
+            [](ServerConfig& c, const string& v) {
+                uint64_t n;
+                if (!parseUnsigned(v, n)) return false;
+                c.autoAofRewritePercentage = n;
+                return true;
+            }},
+        {"auto-aof-rewrite-min-size", true,
+            [](ServerConfig& c) { return to_string(c.autoAofRewriteMinSize); },
+            [](ServerConfig& c, const string& v) {
+                uint64_t n;
+                if (!parseMemory(v, n)) return false;
+                c.autoAofRewriteMinSize = n;
+                return true;
+            }},
+        {"repl-backlog-size", true,
+            [](ServerConfig& c) { return to_string(c.replBacklogSize); },
+            [](ServerConfig& c, const string& v) {
+                uint64_t n;
+                if (!parseMemory(v, n) || n < 16 * 1024) return false;
+                c.replBacklogSize = n;
+                return true;
+            }},
+        {"replica-read-only", true,
+            [](ServerConfig& c) { return string(c.replicaReadOnly ? "yes" : "no"); },
+            [](ServerConfig& c, const string& v) {
+                bool b;
+                if (!parseYesNo(v, b)) return false;
+                c.replicaReadOnly = b;
+                return true;
+            }},
+        {"repl-timeout", true,
+            [](ServerConfig& c) { return to_string(c.replTimeout); },
+            [](ServerConfig& c, const string& v) {
+                uint64_t n;
+                if (!parseUnsigned(v, n) || n == 0) return false;
+                c.replTimeout = n;
+                return true;
+            }},
+        {"cluster-enabled", false,
+            [](ServerConfig& c) { return string(c.clusterEnabled ? "yes" : "no"); },
+            [](ServerConfig& c, const string& v) { return parseYesNo(v, c.clusterEnabled); }},
+        {"cluster-config-file", false,
+            [](ServerConfig& c) { return c.clusterConfigFile; },
+            [](ServerConfig& c, const string& v) {
+                if (v.empty()) return false;
+                c.clusterConfigFile = v;
+                return true;
+            }},
+        {"cluster-announce-ip", false,
+            [](ServerConfig& c) { return c.clusterAnnounceIp; },
+            [](ServerConfig& c, const string& v) {
+                if (v.empty() || v.find_first_of(" :") != string::npos) return false;
+                c.clusterAnnounceIp = v;
+                return true;
+            }},
+        {"cluster-node-timeout", true,
+            [](ServerConfig& c) { return to_string(c.clusterNodeTimeout); },
+            [](ServerConfig& c, const string& v) {
+                uint64_t n;
+                if (!parseUnsigned(v, n) || n == 0) return false;
+                c.clusterNodeTimeout = n;
+                return true;
+            }},
+        {"tracking-table-max-keys", true,
+            [](ServerConfig& c) { return to_string(c.trackingTableMaxKeys); },
+            [](ServerConfig& c, const string& v) {
+                uint64_t n;
+                if (!parseUnsigned(v, n)) return false;
+                c.trackingTableMaxKeys = n;
+                return true;
+            }},
+        {"latency-tracking", true,
+            [](ServerConfig& c) { return string(c.latencyTracking ? "yes" : "no"); },
+            [](ServerConfig& c, const string& v) {
+                bool b;
+                if (!parseYesNo(v, b)) return false;
+                c.latencyTracking = b;
+                return true;
+            }},
+        {"latency-tracking-clock", true,
+            [](ServerConfig& c) { return string(c.latencyClock == LatencyClock::Tsc ? "tsc" : "coarse"); },
+            [](ServerConfig& c, const string& v) {
+                if (v == "tsc") c.latencyClock = LatencyClock::Tsc;
+                else if (v == "coarse") c.latencyClock = LatencyClock::Coarse;
+                else return false;
+                return true;
+            }},
+        {"slowlog-log-slower-than", true,
+            [](ServerConfig& c) { return to_string(c.slowlogLogSlowerThan); },
+            [](ServerConfig& c, const string& v) {
+                size_t pos = 0;
+                long long n;
+                try {
+                    n = stoll(v, &pos);
+                } catch (const exception&) {
+                    return false;
+                }
+                if (pos != v.size()) return false;
+                c.slowlogLogSlowerThan = n;
+                return true;
+            }},
+        {"slowlog-max-len", true,
+            [](ServerConfig& c) { return to_string(c.slowlogMaxLen); },
+            [](ServerConfig& c, const string& v) {
+                uint64_t n;
+                if (!parseUnsigned(v, n) || n > SLOWLOG_RING) return false;
+                c.slowlogMaxLen = n;
+                return true;
+            }},
+        {"metrics-port", false,
+            [](ServerConfig& c) { return to_string(c.metricsPort); },
+            [](ServerConfig& c, const string& v) {
+                uint64_t n;
+                if (!parseUnsigned(v, n) || n > 65535) return false;
+                c.metricsPort = n;
+                return true;
+            }},
+        {"latency-monitor-threshold", true,
+            [](ServerConfig& c) { return to_string(c.latencyMonitorThreshold); },
+            [](ServerConfig& c, const string& v) {
+                uint64_t n;
+                if (!parseUnsigned(v, n)) return false;
+                c.latencyMonitorThreshold = n;
+                return true;
+            }},
+        {"maxmemory", true,
+            [](ServerConfig& c) { return to_string(c.maxMemory); },
+            [](ServerConfig& c, const string& v) {
+                uint64_t n;
+                if (!parseMemory(v, n)) return false;
+                c.maxMemory = n;
+                return true;
+            }},
+        {"maxmemory-policy", true,
+            [](ServerConfig& c) { return string(maxMemoryPolicies[static_cast<int>(c.maxMemoryPolicy.load())]); },
+            [](ServerConfig& c, const string& v) {
+                for (int i = 0; i < 8; i++) {
+                    if (v != maxMemoryPolicies[i]) continue;
+                    c.maxMemoryPolicy = static_cast<MaxMemoryPolicy>(i);
+                    return true;
+                }
+                return false;
+            }},
+        {"maxmemory-samples", true,
+            [](ServerConfig& c) { return to_string(c.maxMemorySamples); },
+            [](ServerConfig& c, const string& v) {
+                uint64_t n;
+                if (!parseUnsigned(v, n) || n == 0 || n > 64) return false;
+                c.maxMemorySamples = n;
+                return true;
+            }},
+        {"lfu-log-factor", true,
+            [](ServerConfig& c) { return to_string(c.lfuLogFactor); },
+            [](ServerConfig& c, const string& v) {
+                uint64_t n;
+                if (!parseUnsigned(v, n)) return false;
+                c.lfuLogFactor = n;
+                return true;
+            }},
+        {"lfu-decay-time", true,
+            [](ServerConfig& c) { return to_string(c.lfuDecayTime); },
+            [](ServerConfig& c, const string& v) {
+                uint64_t n;
+                if (!parseUnsigned(v, n)) return false;
+                c.lfuDecayTime = n;
+                return true;
+            }},
+        yesNoOption("lazyfree-lazy-user-del", &ServerConfig::lazyfreeLazyUserDel),
+        yesNoOption("lazyfree-lazy-user-flush", &ServerConfig::lazyfreeLazyUserFlush),
+        yesNoOption("lazyfree-lazy-server-del", &ServerConfig::lazyfreeLazyServerDel),
+        yesNoOption("lazyfree-lazy-expire", &ServerConfig::lazyfreeLazyExpire),
+        yesNoOption("lazyfree-lazy-eviction", &ServerConfig::lazyfreeLazyEviction),
+    };
+    return options;
+}
+
+bool ServerConfig::parseArgs(int argc, char* argv[], int first) {
+    for (int i = first; i < argc; i += 2) {
+        string name = argv[i];
+        if (name.compare(0, 2, "--") != 0 || i + 1 >= argc) {
+            cerr << "Bad option '" << name << "', expected --name value\n";
+            return false;
+        }
+        string error;
+        if (!set(name.substr(2), argv[i + 1], error)) {
+            cerr << error << "\n";
+            return false;
+        }
+    }
+    lock_guard<mutex> lock(config_mutex);
+    started = true;
+    return true;
+}
+
+bool ServerConfig::set(const string& name, const string& value, string& error) {
+    string lname = name;
+    transform(lname.begin(), lname.end(), lname.begin(), ::tolower);
+    lock_guard<mutex> lock(config_mutex);
+    for (const auto& option : configOptions()) {
+        if (lname != option.name) continue;
+        if (started && !option.runtime) {
+            error = "Error: " + lname + " can only be set at startup";
+            return false;
+        }
+        if (!option.set(*this, value)) {
+            error = "Error: Invalid value '" + value + "' for " + lname;
+            return false;
+        }
+        return true;
+    }
+    error = "Error: Unknown option " + lname;
+    return false;
+}
+
+vector<pair<string, string>> ServerConfig::get(const string& pattern) {
+    string lpattern = pattern;
+    transform(lpattern.begin(), lpattern.end(), lpattern.begin(), ::tolower);
+    lock_guard<mutex> lock(config_mutex);
+    vector<pair<string, string>> result;
+    for (const auto& option : configOptions()) {
+        if (fnmatch(lpattern.c_str(), option.name, 0) == 0)
+            result.emplace_back(option.name, option.get(*this));
+    }
+    return result;
+}
+
+vector<SavePoint> ServerConfig::savePoints() {
+    lock_guard<mutex> lock(config_mutex);
+    return save;
+}
@@ -0,0 +1,219 @@
+#include "../include/ServerStats.h"
+#include "../include/ServerConfig.h"
+#include "../include/LazyFree.h"
+#include "../include/SlabAllocator.h"
+#include <sstream>
+#include <iomanip>
+#include <fstream>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+using namespace std;
+
+ServerStats& ServerStats::getInstance() {
+    static ServerStats instance;
+    return instance;
+}
+
+ServerStats::ServerStats() : startedSteady(chrono::steady_clock::now()), startedAt(time(nullptr)) {}
+
+ServerStats::SlotHandle::SlotHandle() : slot(ServerStats::getInstance().acquireSlot()) {}
+
+ServerStats::SlotHandle::~SlotHandle() {
+    ServerStats::getInstance().releaseSlot(slot);
+}
+
+StatSlot* ServerStats::acquireSlot() {
+    lock_guard<mutex> lock(slots_mutex);
+    if (!freeSlots.empty()) {
+        StatSlot* slot = freeSlots.back();
+        freeSlots.pop_back();
+        return slot;
+    }
+    slots.push_back(make_unique<StatSlot>());
+    return slots.back().get();
+}
+
+void ServerStats::releaseSlot(StatSlot* slot) {
+    lock_guard<mutex> lock(slots_mutex);
+    freeSlots.push_back(slot);
+}
+
+uint64_t ServerStats::total(Stat stat) {
+    lock_guard<mutex> lock(slots_mutex);
+    uint64_t sum = 0;
+    for (const auto& slot : slots) sum += slot->values[stat].load(memory_order_relaxed);
+    return sum;
+}
+
+void ServerStats::totals(uint64_t values[STAT_COUNT]) {
+    lock_guard<mutex> lock(slots_mutex);
+    for (int i = 0; i < STAT_COUNT; i++) values[i] = 0;
+    for (const auto& slot : slots) {
+        for (int i = 0; i < STAT_COUNT; i++) values[i] += slot->values[i].load(memory_order_relaxed);
+    }
+}
+
+uint64_t ServerStats::uptimeSeconds() const {
+    return chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now() - startedSteady).count();
+}
+
+void ServerStats::clientConnected() {
+    connected++;
+    add(STAT_CONNECTIONS);
+}
+
+void ServerStats::clientDisconnected() {
+    connected--;
+}
+
+void ServerStats::sample() {
+    Sample s;
+    s.at = chrono::steady_clock::now();
+    totals(s.values);
+    bool checkMemory;
+    {
+        lock_guard<mutex> lock(sample_mutex);
+        ring[samples % SAMPLES] = s;
+        samples++;
+        checkMemory = samples % 10 == 1;
+    }
+    //mallinfo2 visits every arena, once a second is enough for the peak
+    if (checkMemory) usedMemory();
+}
+
+double ServerStats::rate(Stat stat) {
+    lock_guard<mutex> lock(sample_mutex);
+    if (samples < 2) return 0;
+    const Sample& newest = ring[(samples - 1) % SAMPLES];
+    const Sample& oldest = ring[samples >= SAMPLES ? samples % SAMPLES : 0];
+    double seconds = chrono::duration<double>(newest.at - oldest.at).count();
+    return seconds > 0 ? (newest.values[stat] - oldest.values[stat]) / seconds : 0;
+}
+
+size_t ServerStats::usedMemory() {
+    struct mallinfo2 info = mallinfo2();
+    size_t used = info.uordblks + info.hblkhd; //in use from the heap arenas + mmapped chunks
+    lock_guard<mutex> lock(sample_mutex);
+    if (used > peakMemory) peakMemory = used;
+    return used;
+}
+
+size_t ServerStats::rssMemory() {
+    ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static string humanBytes(size_t bytes) {
+    const char* units[] = {"B", "K", "M", "G", "T"};
+    double value = bytes;
+    int unit = 0;
+    while (value >= 1024 && unit < 4) {
+        value /= 1024;
+        unit++;
+    }
+    ostringstream oss;
+    oss << fixed << setprecision(unit ? 2 : 0) << value << units[unit];
+    return oss.str();
+}
+
+string ServerStats::serverInfo() {
+    struct utsname name;
+    uname(&name);
+    auto now = chrono::system_clock::now().time_since_epoch();
+    uint64_t uptime = uptimeSeconds();
+    ostringstream oss;
+    oss << "# Server\r\n"
+        << "redis_version:1.0.0\r\n"
+        << "redis_mode:" << (ServerConfig::getInstance().clusterEnabled ? "cluster" : "standalone") << "\r\n"
+        << "os:" << name.sysname << " " << name.release << " " << name.machine << "\r\n"
+        << "arch_bits:" << sizeof(void*) * 8 << "\r\n"
+        << "multiplexing_api:threads\r\n"
+        << "gcc_version:" << __GNUC__ << "." << __GNUC_MINOR__ << "." << __GNUC_PATCHLEVEL__ << "\r\n"
+        << "process_id:" << getpid() << "\r\n"
+        << "tcp_port:" << port << "\r\n"
+        << "server_time_usec:" << chrono::duration_cast<chrono::microseconds>(now).count() << "\r\n"
+        << "start_time:" << startedAt << "\r\n"
+        << "uptime_in_seconds:" << uptime << "\r\n"
+        << "uptime_in_days:" << uptime / 86400 << "\r\n";
+    return oss.str();
+}
+
+string ServerStats::clientsInfo() {
+    return "# Clients\r\n"
+           "connected_clients:" + to_string(connected.load()) + "\r\n"
+           "blocked_clients:0\r\n"; //no blocking commands
+}
+
+string ServerStats::memoryInfo() {
+    size_t used = usedMemory();
+    size_t rss = rssMemory();
+    size_t peak;
+    {
+        lock_guard<mutex> lock(sample_mutex);
+        peak = peakMemory;
+    }
+    ostringstream oss;
+    oss << "# Memory\r\n"
+        << "used_memory:" << used << "\r\n"
+        << "used_memory_human:" << humanBytes(used) << "\r\n"
+        << "used_memory_rss:" << rss << "\r\n"
+        << "used_memory_rss_human:" << humanBytes(rss) << "\r\n"
+        << "used_memory_peak:" << peak << "\r\n"
+        << "used_memory_peak_human:" << humanBytes(peak) << "\r\n"
+        << "mem_fragmentation_ratio:" << fixed << setprecision(2) << (used ? (double)rss / used : 0) << "\r\n"
+        << "mem_allocator:libc\r\n";
+    ServerConfig& config = ServerConfig::getInstance();
+    uint64_t maxMemory = config.maxMemory;
+    oss << "maxmemory:" << maxMemory << "\r\n"
+        << "maxmemory_human:" << humanBytes(maxMemory) << "\r\n"
+        << "maxmemory_policy:" << config.get("maxmemory-policy")[0].second << "\r\n"
+        << "lazyfree_pending_objects:" << LazyFree::getInstance().pending() << "\r\n";
+    //the keyspace's slabs: taken from malloc, and in use
+    SlabStats slabs = SlabArena::stats();
+    oss << "slab_active:" << slabs.active << "\r\n"
+        << "slab_active_human:" << humanBytes(slabs.active) << "\r\n"
+        << "slab_allocated:" << slabs.allocated << "\r\n"
+        << "slab_frag_ratio:" << (slabs.allocated ? (double)slabs.active / slabs.allocated : 0) << "\r\n";
+    return oss.str();
+}
+
+string ServerStats::statsInfo() {
+    uint64_t sums[STAT_COUNT];
+    totals(sums);
+    ostringstream oss;
+    oss << "# Stats\r\n"
+        << "total_connections_received:" << sums[STAT_CONNECTIONS] << "\r\n"
+        << "total_commands_processed:" << sums[STAT_COMMANDS] << "\r\n"
+        << "instantaneous_ops_per_sec:" << static_cast<uint64_t>(rate(STAT_COMMANDS)) << "\r\n"
+        << "total_net_input_bytes:" << sums[STAT_NET_INPUT] << "\r\n"
+        << "total_net_output_bytes:" << sums[STAT_NET_OUTPUT] << "\r\n"
+        << fixed << setprecision(2)
+        << "instantaneous_input_kbps:" << rate(STAT_NET_INPUT) / 1024 << "\r\n"
+        << "instantaneous_output_kbps:" << rate(STAT_NET_OUTPUT) / 1024 << "\r\n"
+        << "expired_keys:" << sums[STAT_EXPIRED] << "\r\n"
+        << "evicted_keys:" << sums[STAT_EVICTED] << "\r\n"
+        << "keyspace_hits:" << sums[STAT_KEYSPACE_HITS] << "\r\n"
+        << "keyspace_misses:" << sums[STAT_KEYSPACE_MISSES] << "\r\n"
+        << "lazyfreed_objects:" << LazyFree::getInstance().freed() << "\r\n";
+    return oss.str();
+}
+
+string ServerStats::cpuInfo() {
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    auto seconds = [](const struct timeval& tv) { return tv.tv_sec + tv.tv_usec / 1e6; };
+    ostringstream oss;
+    oss << "# CPU\r\n" << fixed << setprecision(6)
+        << "used_cpu_sys:" << seconds(self.ru_stime) << "\r\n"
+        << "used_cpu_user:" << seconds(self.ru_utime) << "\r\n"
+        << "used_cpu_sys_children:" << seconds(children.ru_stime) << "\r\n"
+        << "used_cpu_user_children:" << seconds(children.ru_utime) << "\r\n";
+    return oss.str();
+}
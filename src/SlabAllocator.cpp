@@ -0,0 +1,108 @@
+#include "../include/SlabAllocator.h"
+#include <cstdlib>
+
+using namespace std;
+
+SlabArena::CentralList SlabArena::central[SLAB_CLASSES];
+thread_local SlabArena::ThreadCache SlabArena::cache;
+
+static size_t classOf(size_t bytes) {
+    return (bytes + SLAB_CLASS_STEP - 1) / SLAB_CLASS_STEP - 1;
+}
+
+void* SlabArena::allocate(size_t bytes) {
+    if (bytes == 0 || bytes > SLAB_MAX_OBJECT) return ::operator new(bytes);
+    size_t c = classOf(bytes);
+    if (!cache.head[c]) refill(c);
+    FreeObject* object = cache.head[c];
+    cache.head[c] = object->next;
+    cache.count[c]--;
+    //a thread past its cleanup (a static destructor) keeps nothing cached
+    if (cache.exited && cache.count[c]) giveBack(c, cache.count[c]);
+    return object;
+}
+
+void SlabArena::deallocate(void* p, size_t bytes) {
+    if (bytes == 0 || bytes > SLAB_MAX_OBJECT) {
+        ::operator delete(p);
+        return;
+    }
+    if (!cache.flusherSet) setFlusher();
+    size_t c = classOf(bytes);
+    FreeObject* object = static_cast<FreeObject*>(p);
+    object->next = cache.head[c];
+    cache.head[c] = object;
+    cache.count[c]++;
+    if (cache.exited) giveBack(c, cache.count[c]);
+    else if (cache.count[c] > 2 * SLAB_CACHE_OBJECTS) giveBack(c, SLAB_CACHE_OBJECTS);
+}
+
+//the thread's cache goes back to the central lists when it exits; on its first
+//allocation or free, as a thread that only frees (DEL, the lazy free thread) caches too
+void SlabArena::setFlusher() {
+    static thread_local CacheFlusher flusher;
+    (void)flusher;
+    cache.flusherSet = true;
+}
+
+void SlabArena::refill(size_t c) {
+    if (!cache.flusherSet) setFlusher();
+    CentralList& list = central[c];
+    size_t size = (c + 1) * SLAB_CLASS_STEP;
+    lock_guard<mutex> lock(list.lock);
+    if (!list.head) {
+        char* slab = static_cast<char*>(malloc(SLAB_BYTES));
+        if (!slab) throw bad_alloc();
+        for (size_t offset = 0; offset + size <= SLAB_BYTES; offset += size) {
+            FreeObject* object = reinterpret_cast<FreeObject*>(slab + offset);
+            object->next = list.head;
+            list.head = object;
+            list.count++;
+        }
+        list.slabs++;
+    }
+    for (size_t i = 0; i < SLAB_CACHE_OBJECTS / 2 && list.head; i++) {
+        FreeObject* object = list.head;
+        list.head = object->next;
+        list.count--;
+        object->next = cache.head[c];
+        cache.head[c] = object;
+        cache.count[c]++;
+    }
+}
+
+// the first `objects` of the thread's cache of class c onto the central list
+void SlabArena::giveBack(size_t c, uint32_t objects) {
+    if (!objects) return;
+    FreeObject* first = cache.head[c];
+    FreeObject* last = first;
+    for (uint32_t i = 1; i < objects; i++) last = last->next;
+    cache.head[c] = last->next;
+    cache.count[c] -= objects;
+    CentralList& list = central[c];
+    lock_guard<mutex> lock(list.lock);
+    last->next = list.head;
+    list.head = first;
+    list.count += objects;
+}
+
+void SlabArena::flushCache() {
+    for (size_t c = 0; c < SLAB_CLASSES; c++) giveBack(c, cache.count[c]);
+    cache.exited = true;
+}
+
+SlabArena::CacheFlusher::~CacheFlusher() {
+    flushCache();
+}
+
+SlabStats SlabArena::stats() {
+    SlabStats stats;
+    for (size_t c = 0; c < SLAB_CLASSES; c++) {
+        CentralList& list = central[c];
+        lock_guard<mutex> lock(list.lock);
+        size_t size = (c + 1) * SLAB_CLASS_STEP;
+        stats.active += list.slabs * SLAB_BYTES;
+        stats.allocated += (list.slabs * (SLAB_BYTES / size) - list.count) * size;
+    }
+    return stats;
+}
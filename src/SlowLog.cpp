@@ -0,0 +1,144 @@
+#include "../include/SlowLog.h"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+
+using namespace std;
+
+static thread_local string clientAddress;
+
+SlowLog& SlowLog::getInstance() {
+    static SlowLog instance;
+    return instance;
+}
+
+SlowLog::SlowLog() : ring(new SlowLogSlot[SLOWLOG_RING]) {}
+
+void SlowLog::setClient(const string& address) {
+    clientAddress = address;
+}
+
+void SlowLog::add(const vector<string>& tokens, uint64_t usec) {
+    uint64_t id = nextId.fetch_add(1, memory_order_relaxed);
+    SlowLogSlot& slot = ring[id % SLOWLOG_RING];
+    //claim the slot: not being written, and not already holding a newer entry
+    uint64_t seq = slot.seq.load(memory_order_relaxed);
+    if ((seq & 1) || seq >= 2 * (id + 1)) return;
+    if (!slot.seq.compare_exchange_strong(seq, seq + 1, memory_order_relaxed)) return;
+    atomic_thread_fence(memory_order_release); //the odd number is seen before any of the new bytes
+
+    slot.id = id;
+    slot.time = time(nullptr);
+    slot.usec = usec;
+    slot.argc = tokens.size();
+    size_t room = SLOWLOG_ARG_BYTES, used = 0;
+    uint32_t kept = 0;
+    //with too many arguments the last kept place goes to "... (N more arguments)"
+    size_t keep = tokens.size() > SLOWLOG_MAX_ARGC ? SLOWLOG_MAX_ARGC - 1 : tokens.size();
+    while (kept < keep && room > 0) {
+        const string& arg = tokens[kept];
+        size_t n = min({arg.size(), (size_t)SLOWLOG_MAX_ARG_LEN, room});
+        memcpy(slot.args + used, arg.data(), n);
+        slot.argLens[kept] = arg.size();
+        used += n;
+        room -= n;
+        kept++;
+    }
+    slot.kept = kept;
+    size_t clientLen = min(clientAddress.size(), (size_t)SLOWLOG_CLIENT_LEN - 1);
+    memcpy(slot.client, clientAddress.data(), clientLen);
+    slot.client[clientLen] = '\0';
+
+    slot.seq.store(2 * (id + 1), memory_order_release);
+}
+
+bool SlowLog::read(uint64_t id, SlowLogSlot& out) {
+    const SlowLogSlot& slot = ring[id % SLOWLOG_RING];
+    uint64_t before = slot.seq.load(memory_order_acquire);
+    if (before != 2 * (id + 1)) return false;
+    out.id = slot.id;
+    out.time = slot.time;
+    out.usec = slot.usec;
+    out.argc = slot.argc;
+    out.kept = min<uint32_t>(slot.kept, SLOWLOG_MAX_ARGC);
+    memcpy(out.argLens, slot.argLens, sizeof(out.argLens));
+    memcpy(out.args, slot.args, sizeof(out.args));
+    memcpy(out.client, slot.client, sizeof(out.client));
+    atomic_thread_fence(memory_order_acquire); //the copy is done before seq is looked at again
+    return slot.seq.load(memory_order_relaxed) == before;
+}
+
+vector<uint64_t> SlowLog::visibleIds(uint64_t limit) {
+    uint64_t next = nextId.load(memory_order_acquire);
+    uint64_t maxLen = min<uint64_t>(ServerConfig::getInstance().slowlogMaxLen, SLOWLOG_RING);
+    uint64_t lowest = max(resetBelow.load(), next > maxLen ? next - maxLen : 0);
+    vector<uint64_t> ids;
+    for (uint64_t id = next; id > lowest && ids.size() < limit; id--) ids.push_back(id - 1);
+    return ids;
+}
+
+static string bulk(const string& s) {
+    return "$" + to_string(s.size()) + "\r\n" + s + "\r\n";
+}
+
+// *6 id time usec [args] client-address client-name
+static string entryReply(const SlowLogSlot& entry) {
+    vector<string> args;
+    size_t offset = 0, room = SLOWLOG_ARG_BYTES;
+    for (uint32_t i = 0; i < entry.kept; i++) {
+        size_t n = min({(size_t)entry.argLens[i], (size_t)SLOWLOG_MAX_ARG_LEN, room});
+        string arg(entry.args + offset, n);
+        if (entry.argLens[i] > n) arg += "... (" + to_string(entry.argLens[i] - n) + " more bytes)";
+        args.push_back(arg);
+        offset += n;
+        room -= n;
+    }
+    if (entry.argc > entry.kept) args.push_back("... (" + to_string(entry.argc - entry.kept) + " more arguments)");
+
+    ostringstream oss;
+    oss << "*6\r\n:" << entry.id << "\r\n:" << entry.time << "\r\n:" << entry.usec << "\r\n*" << args.size() << "\r\n";
+    for (const auto& arg : args) oss << bulk(arg);
+    oss << bulk(entry.client) << bulk("");
+    return oss.str();
+}
+
+// SLOWLOG GET [count] | LEN | RESET
+string SlowLog::command(const vector<string>& tokens) {
+    if (tokens.size() < 2) return "-Error: SLOWLOG requires a subcommand\r\n";
+    string sub = tokens[1];
+    transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if (sub == "RESET") {
+        resetBelow = nextId.load();
+        return "+OK\r\n";
+    }
+    SlowLogSlot entry;
+    if (sub == "LEN") {
+        uint64_t len = 0;
+        for (uint64_t id : visibleIds(SLOWLOG_RING)) {
+            if (read(id, entry)) len++;
+        }
+        return ":" + to_string(len) + "\r\n";
+    }
+    if (sub != "GET") return "-Error: Unknown SLOWLOG subcommand '" + tokens[1] + "'\r\n";
+
+    uint64_t limit = 10;
+    if (tokens.size() > 2) {
+        long long count;
+        try {
+            count = stoll(tokens[2]);
+        } catch (const exception&) {
+            return "-Error: count must be a number\r\n";
+        }
+        if (count < -1) return "-Error: count should be greater than or equal to -1\r\n";
+        limit = count == -1 ? SLOWLOG_RING : count;
+    }
+    string body;
+    size_t entries = 0;
+    for (uint64_t id : visibleIds(limit)) {
+        if (!read(id, entry)) continue; //overwritten or still being written
+        body += entryReply(entry);
+        entries++;
+    }
+    return "*" + to_string(entries) + "\r\n" + body;
+}
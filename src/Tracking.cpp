@@ -0,0 +1,292 @@
+#include "../include/Tracking.h"
+#include "../include/ServerConfig.h"
+#include "../include/CommandStats.h"
+#include <sys/socket.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <strings.h>
+
+using namespace std;
+
+//the connection this thread serves (one thread per connection)
+static thread_local TrackingClient* current = nullptr;
+
+Tracking& Tracking::getInstance() {
+    static Tracking instance;
+    return instance;
+}
+
+shared_ptr<TrackingClient> Tracking::attach(int fd) {
+    auto client = make_shared<TrackingClient>();
+    client->fd = fd;
+    lock_guard<mutex> lock(tracking_mutex);
+    client->id = nextId++;
+    clients[client->id] = client;
+    current = client.get();
+    if (!pusher.joinable() && !stopping) pusher = thread(&Tracking::pushLoop, this);
+    return client;
+}
+
+void Tracking::detach(const shared_ptr<TrackingClient>& client) {
+    lock_guard<mutex> lock(tracking_mutex);
+    if (client->on) {
+        client->on = false;
+        bcastClients.erase(client->id);
+        trackingClients--;
+    }
+    clients.erase(client->id);
+    //its ids in the table are dropped lazily, when those keys change
+    outbox.erase(client->id);
+    flushOutbox.erase(client->id);
+    if (current == client.get()) current = nullptr;
+}
+
+void Tracking::beginReplies(TrackingClient& client) {
+    lock_guard<mutex> lock(client.io_mutex);
+    client.busy = true;
+}
+
+bool Tracking::sendReplies(TrackingClient& client, const string& response) {
+    lock_guard<mutex> lock(client.io_mutex);
+    client.busy = false;
+    const string* out = &response;
+    string joined;
+    if (!client.pending.empty() || !client.held.empty()) {
+        joined = client.pending + response + client.held;
+        client.pending.clear();
+        client.held.clear();
+        out = &joined;
+    }
+    size_t sent = 0;
+    while (sent < out->size()) {
+        ssize_t n = send(client.fd, out->data() + sent, out->size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+static bool parseOnOff(const string& s, bool& on) {
+    if (strcasecmp(s.c_str(), "on") == 0) on = true;
+    else if (strcasecmp(s.c_str(), "off") == 0) on = false;
+    else return false;
+    return true;
+}
+
+// CLIENT ID | CLIENT TRACKING on|off [BCAST] [PREFIX p ...] [NOLOOP]
+string Tracking::command(const vector<string>& tokens) {
+    if (tokens.size() < 2) return "-Error: CLIENT requires a subcommand\r\n";
+    string sub = tokens[1];
+    transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if (!current) return "-Error: CLIENT is only valid on a client connection\r\n";
+    if (sub == "ID") return ":" + to_string(current->id) + "\r\n";
+    if (sub != "TRACKING") return "-Error: Unknown CLIENT subcommand '" + tokens[1] + "'\r\n";
+
+    bool on;
+    if (tokens.size() < 3 || !parseOnOff(tokens[2], on))
+        return "-Error: CLIENT TRACKING requires on or off\r\n";
+    bool bcast = false, noloop = false;
+    vector<string> prefixes;
+    for (size_t i = 3; i < tokens.size(); i++) {
+        string opt = tokens[i];
+        transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+        if (opt == "BCAST") bcast = true;
+        else if (opt == "NOLOOP") noloop = true;
+        else if (opt == "PREFIX" && i + 1 < tokens.size()) prefixes.push_back(tokens[++i]);
+        else if (opt == "REDIRECT" || opt == "OPTIN" || opt == "OPTOUT")
+            return "-Error: CLIENT TRACKING " + opt + " is not supported, invalidations are pushed on the same connection\r\n";
+        else return "-Error: syntax error\r\n";
+    }
+    if (!prefixes.empty() && !bcast)
+        return "-ERR PREFIX option requires BCAST mode to be enabled\r\n";
+
+    lock_guard<mutex> lock(tracking_mutex);
+    if (on && current->on && current->bcast != bcast)
+        return "-ERR You can't switch BCAST mode on/off before disabling tracking for this client, and then re-enabling it with a different mode.\r\n";
+    if (on) {
+        if (!current->on) trackingClients++;
+        current->on = true;
+        current->bcast = bcast;
+        if (bcast) bcastClients.insert(current->id);
+        current->noloop = noloop;
+        for (auto& prefix : prefixes) {
+            if (find(current->prefixes.begin(), current->prefixes.end(), prefix) == current->prefixes.end())
+                current->prefixes.push_back(prefix);
+        }
+    }
+    else if (current->on) {
+        current->on = false;
+        current->bcast = false;
+        current->noloop = false;
+        current->prefixes.clear();
+        bcastClients.erase(current->id);
+        trackingClients--;
+    }
+    return "+OK\r\n";
+}
+
+void Tracking::keysRead(const vector<string>& keys) {
+    if (!current || !current->on || current->bcast || keys.empty()) return;
+    lock_guard<mutex> lock(tracking_mutex);
+    for (const auto& key : keys) table[key].insert(current->id);
+    evictKeys();
+}
+
+//caller holds tracking_mutex
+bool Tracking::invalidate(uint64_t id, const string& key) {
+    auto it = clients.find(id);
+    if (it == clients.end() || !it->second->on) return false; //gone, or tracking turned off since
+    if (it->second->noloop && current && current->id == id) return false;
+    outbox[id].push_back(key);
+    queued = true;
+    return true;
+}
+
+void Tracking::keyModified(const string& key) {
+    if (!active()) return;
+    lock_guard<mutex> lock(tracking_mutex);
+    bool wake = false;
+    auto it = table.find(key);
+    if (it != table.end()) {
+        for (uint64_t id : it->second) wake = invalidate(id, key) || wake;
+        table.erase(it);
+    }
+    for (uint64_t id : bcastClients) {
+        const auto& prefixes = clients[id]->prefixes;
+        bool match = prefixes.empty();
+        for (size_t i = 0; i < prefixes.size() && !match; i++)
+            match = key.compare(0, prefixes[i].size(), prefixes[i]) == 0;
+        if (match) wake = invalidate(id, key) || wake;
+    }
+    if (wake) outbox_cv.notify_one();
+}
+
+void Tracking::keyspaceReplaced() {
+    if (!active()) return;
+    lock_guard<mutex> lock(tracking_mutex);
+    table.clear();
+    for (const auto& client : clients) {
+        if (!client.second->on) continue;
+        outbox.erase(client.first);
+        flushOutbox.insert(client.first);
+    }
+    queued = true;
+    outbox_cv.notify_one();
+}
+
+//past tracking-table-max-keys keys are forgotten, their readers told to drop them
+void Tracking::evictKeys() {
+    uint64_t limit = ServerConfig::getInstance().trackingTableMaxKeys;
+    if (!limit || table.size() <= limit) return;
+    while (table.size() > limit) {
+        auto it = table.begin();
+        for (uint64_t id : it->second) invalidate(id, it->first);
+        table.erase(it);
+    }
+    outbox_cv.notify_one();
+}
+
+//caller holds client.io_mutex; false while the socket does not take everything
+bool Tracking::writePending(TrackingClient& client) {
+    while (!client.pending.empty()) {
+        ssize_t n = send(client.fd, client.pending.data(), client.pending.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return errno != EAGAIN && errno != EWOULDBLOCK; //a dead socket is its reader's business
+        client.pending.erase(0, n);
+    }
+    return true;
+}
+
+static void appendBulk(string& out, const string& s) {
+    out += "$" + to_string(s.size()) + "\r\n";
+    out += s;
+    out += "\r\n";
+}
+
+/*
+Pushes go out without blocking: what a socket does not take now stays in pending and
+is retried every 100ms by the push thread, or written ahead of the next replies of that
+connection.
+*/
+void Tracking::deliver(unique_lock<mutex>& lock) {
+    vector<pair<shared_ptr<TrackingClient>, string>> pushes;
+    for (auto& entry : outbox) {
+        auto it = clients.find(entry.first);
+        if (it == clients.end()) continue;
+        string frame = ">2\r\n$10\r\ninvalidate\r\n*" + to_string(entry.second.size()) + "\r\n";
+        for (const auto& key : entry.second) appendBulk(frame, key);
+        pushes.push_back({it->second, move(frame)});
+    }
+    for (uint64_t id : flushOutbox) {
+        auto it = clients.find(id);
+        if (it != clients.end()) pushes.push_back({it->second, ">2\r\n$10\r\ninvalidate\r\n_\r\n"});
+    }
+    outbox.clear();
+    flushOutbox.clear();
+    queued = false;
+    lock.unlock();
+
+    bool stuck = false;
+    for (auto& push : pushes) {
+        lock_guard<mutex> io(push.first->io_mutex);
+        if (push.first->busy) {
+            push.first->held += push.second;
+            continue;
+        }
+        push.first->pending += push.second;
+        if (!writePending(*push.first)) stuck = true;
+    }
+    lock.lock();
+    if (stuck && !backlog) {
+        backlog = true;
+        outbox_cv.notify_one();
+    }
+}
+
+void Tracking::flushInvalidations() {
+    if (!queued) return;
+    CommandBatch::interrupt();
+    unique_lock<mutex> lock(tracking_mutex);
+    deliver(lock);
+}
+
+void Tracking::pushLoop() {
+    unique_lock<mutex> lock(tracking_mutex);
+    while (!stopping) {
+        if (outbox.empty() && flushOutbox.empty()) {
+            if (backlog) outbox_cv.wait_for(lock, chrono::milliseconds(100));
+            else outbox_cv.wait(lock);
+        }
+        if (stopping) break;
+        if (backlog) {
+            vector<shared_ptr<TrackingClient>> retry;
+            for (const auto& client : clients) retry.push_back(client.second);
+            backlog = false;
+            lock.unlock();
+            bool stuck = false;
+            for (auto& client : retry) {
+                lock_guard<mutex> io(client->io_mutex);
+                if (!client->busy && !writePending(*client)) stuck = true;
+            }
+            lock.lock();
+            backlog = backlog || stuck;
+        }
+        deliver(lock);
+    }
+}
+
+string Tracking::info() {
+    lock_guard<mutex> lock(tracking_mutex);
+    return "tracking_clients:" + to_string(trackingClients.load()) + "\r\n"
+         + "tracking_total_keys:" + to_string(table.size()) + "\r\n";
+}
+
+void Tracking::shutdown() {
+    {
+        lock_guard<mutex> lock(tracking_mutex);
+        stopping = true;
+    }
+    outbox_cv.notify_one();
+    if (pusher.joinable()) pusher.join();
+}
@@ -1,30 +1,86 @@
 #include "../include/RedisServer.h"
 #include "../include/RedisDatabase.h"
+#include "../include/AppendOnlyFile.h"
+#include "../include/ServerConfig.h"
+#include "../include/Replication.h"
+#include "../include/Cluster.h"
+#include "../include/ServerStats.h"
+#include "../include/LockStats.h"
+#include "../include/MetricsServer.h"
 #include <iostream>
 #include <thread>
+#include <algorithm>
+#include <sys/resource.h>
 using namespace std;
 int main(int argc,char* argv[]){
     int port = 6379;
-    if(argc>=2 )port =stoi(argv[1]); 
+    int firstOption = 1;
+    if(argc>=2 && string(argv[1]).compare(0,2,"--")!=0){
+        port =stoi(argv[1]); 
+        firstOption = 2;
+    }
+    //remaining arguments are settings: ./redis-lite 6379 --appendonly yes --appendfsync always
+    ServerConfig& config = ServerConfig::getInstance();
+    if(!config.parseArgs(argc,argv,firstOption)) return 1;
 
+    //with appendonly the log is the source of truth, the dump only seeds a new log
+    uint64_t replayed = 0;
+    AppendOnlyFile& aof = AppendOnlyFile::getInstance();
+    if(config.appendOnly && aof.exists()){
+        auto start = chrono::steady_clock::now();
+        if(!aof.load(RedisDatabase::getInstance(),replayed)){
+            cerr<<"Error loading the append-only file from "<<config.appendDirname<<"\n";
+            return 1;
+        }
+        cout<<"Append-only file loaded: "<<replayed<<" commands replayed in "
+            <<chrono::duration<double>(chrono::steady_clock::now()-start).count()<<"s\n";
+    }
     //just for testing..whether database is loaded or not
-    if(RedisDatabase::getInstance().load("dump.my_rdb"))
-        cout<<"Database loaded dump.my_rdb\n";
+    else if(RedisDatabase::getInstance().loadCheckpoint()){
+        PersistenceStats st=RedisDatabase::getInstance().persistenceStats();
+        struct rusage usage;
+        getrusage(RUSAGE_SELF,&usage);
+        cout<<"Database loaded "<<config.dbFilename<<" + "<<st.loadDeltas<<" deltas: "<<st.loadKeys<<" keys in "<<st.loadSeconds<<"s ("
+            <<static_cast<uint64_t>(st.loadKeys/max(st.loadSeconds,1e-6))<<" keys/s, "
+            <<st.loadThreads<<" threads), peak RSS "<<usage.ru_maxrss/1024<<" MB\n";
+    }
     else 
         cout<<"No dump found or load failed ..starting with empty database\n";
 
+    if(config.appendOnly && !aof.open()) return 1;
+
+    //cluster mode: this node's id and slots come from cluster-config-file
+    if(config.clusterEnabled){
+        if(!Cluster::getInstance().init(port)) return 1;
+        RedisDatabase::getInstance().enableSlotIndex();
+    }
+
+    //Prometheus scrapes http://host:metrics-port/metrics
+    if(config.metricsPort && !MetricsServer::getInstance().start(config.metricsPort)) return 1;
+
+    Replication::getInstance().setListeningPort(port);
+    ServerStats::getInstance().setPort(port);
     RedisServer server(port);
     thread persistanceThread([](){
-        while(true){
-            this_thread::sleep_for(chrono::seconds(300));
-            
-            if(!RedisDatabase::getInstance().dump("dump.my_rdb")){
-                cerr<<"Error dumping database to disk\n";
+        //ticks every 100ms for the INFO rate samples, the rest runs once a second
+        for(int tick=1;;tick++){
+            this_thread::sleep_for(chrono::milliseconds(100));
+            ServerStats::getInstance().sample();
+            if(tick%10!=0) continue;
+            {
+                LockHolder holder("aofRewriteCron");
+                AppendOnlyFile::getInstance().rewriteIfNeeded();
+            }
+            {
+                LockHolder holder("replicationCron");
+                Replication::getInstance().cron();
             }
-            else{
-                cout<<"Database dumped to dump.my_rdb successfully\n";
-            }    
+            //save points: a delta of the keys written since the last checkpoint, or a new base
+            LockHolder holder("checkpointCron");
+            RedisDatabase::getInstance().checkpointCron();
         }
     });
     persistanceThread.detach();
+    server.run();
+    return 0;
 }
\ No newline at end of file
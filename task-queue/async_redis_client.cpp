@@ -0,0 +1,225 @@
+#include "async_redis_client.h"
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <cerrno>
+
+AsyncRedisClient::AsyncRedisClient(const std::string& host, int port)
+    : host(host), port(port), sockfd(-1), epfd(-1), watchingWrites(false), outPos(0) {}
+
+AsyncRedisClient::~AsyncRedisClient() {
+    disconnect();
+}
+
+bool AsyncRedisClient::connect() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        std::cerr << "Failed to create socket\n";
+        return false;
+    }
+
+    struct sockaddr_in server_addr;
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+
+    if (inet_pton(AF_INET, host.c_str(), &server_addr.sin_addr) <= 0) {
+        std::cerr << "Invalid address\n";
+        close(fd);
+        return false;
+    }
+
+    // the connect itself blocks, everything after it does not
+    if (::connect(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        std::cerr << "Connection failed to " << host << ":" << port << "\n";
+        close(fd);
+        return false;
+    }
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    epfd = epoll_create1(0);
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        std::cerr << "epoll setup failed\n";
+        if (epfd >= 0) close(epfd);
+        epfd = -1;
+        close(fd);
+        return false;
+    }
+    sockfd = fd;
+    watchingWrites = false;
+    reader = RespReader(sockfd);
+    return true;
+}
+
+void AsyncRedisClient::disconnect() {
+    if (sockfd >= 0) {
+        close(sockfd);
+        sockfd = -1;
+    }
+    if (epfd >= 0) {
+        close(epfd);
+        epfd = -1;
+    }
+    out.clear();
+    outPos = 0;
+    failPending();
+}
+
+void AsyncRedisClient::failPending() {
+    std::deque<Callback> failed;
+    failed.swap(callbacks);
+    for (auto& callback : failed) {
+        if (callback) {
+            RedisReply reply;
+            reply.type = RedisReply::ERROR;
+            reply.str = "ERR connection lost";
+            callback(reply);
+        }
+    }
+}
+
+void AsyncRedisClient::command(const std::vector<std::string>& args, Callback callback) {
+    if (sockfd < 0) {
+        if (callback) {
+            RedisReply reply;
+            reply.type = RedisReply::ERROR;
+            reply.str = "ERR not connected";
+            callback(reply);
+        }
+        return;
+    }
+    out += "*" + std::to_string(args.size()) + "\r\n";
+    for (const auto& arg : args) {
+        out += "$" + std::to_string(arg.size()) + "\r\n";
+        out += arg;
+        out += "\r\n";
+    }
+    callbacks.push_back(std::move(callback));
+}
+
+bool AsyncRedisClient::flush() {
+    while (outPos < out.size()) {
+        ssize_t n = send(sockfd, out.data() + outPos, out.size() - outPos, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            return false;
+        }
+        outPos += n;
+    }
+    if (outPos == out.size()) {
+        out.clear();
+        outPos = 0;
+    }
+    return true;
+}
+
+bool AsyncRedisClient::receive() {
+    char chunk[64 * 1024];
+    while (sockfd >= 0) {
+        ssize_t n = recv(sockfd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        if (n <= 0) return false;
+        reader.feed(chunk, n);
+        RedisReply reply;
+        int result;
+        while ((result = reader.next(reply)) == 1) {
+            // pushes (CLIENT TRACKING) answer no command
+            if (reply.type == RedisReply::PUSH || callbacks.empty()) continue;
+            // popped first: the callback may queue more commands
+            Callback callback = std::move(callbacks.front());
+            callbacks.pop_front();
+            if (callback) callback(reply);
+        }
+        if (result < 0) return false;
+    }
+    return false;
+}
+
+// EPOLLOUT only while there is something left to write, or every wait returns at once
+void AsyncRedisClient::watchWrites(bool enable) {
+    if (enable == watchingWrites) return;
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | (enable ? EPOLLOUT : 0);
+    ev.data.fd = sockfd;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, sockfd, &ev);
+    watchingWrites = enable;
+}
+
+bool AsyncRedisClient::poll(int timeoutMs) {
+    if (sockfd < 0) return false;
+    if (!flush()) {
+        disconnect();
+        return false;
+    }
+    watchWrites(!out.empty());
+
+    struct epoll_event events[4];
+    int n = epoll_wait(epfd, events, 4, timeoutMs);
+    if (n < 0 && errno != EINTR) {
+        disconnect();
+        return false;
+    }
+    for (int i = 0; i < n; i++) {
+        if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !receive()) {
+            disconnect();
+            return false;
+        }
+        if ((events[i].events & EPOLLOUT) && sockfd >= 0 && !flush()) {
+            disconnect();
+            return false;
+        }
+    }
+    return sockfd >= 0;
+}
+
+bool AsyncRedisClient::run() {
+    while (!callbacks.empty()) {
+        if (!poll(-1)) return false;
+    }
+    return true;
+}
+
+void AsyncRedisClient::get(const std::string& key, Callback callback) {
+    command({"GET", key}, std::move(callback));
+}
+
+void AsyncRedisClient::set(const std::string& key, const std::string& value, Callback callback) {
+    command({"SET", key, value}, std::move(callback));
+}
+
+void AsyncRedisClient::hset(const std::string& key, const std::string& field, const std::string& value, Callback callback) {
+    command({"HSET", key, field, value}, std::move(callback));
+}
+
+static std::vector<std::string> hmsetArgs(const std::string& key, const std::vector<std::pair<std::string, std::string>>& fields) {
+    std::vector<std::string> args = {"HMSET", key};
+    for (const auto& field : fields) {
+        args.push_back(field.first);
+        args.push_back(field.second);
+    }
+    return args;
+}
+
+void AsyncRedisClient::hmset(const std::string& key, const std::vector<std::pair<std::string, std::string>>& fields, Callback callback) {
+    command(hmsetArgs(key, fields), std::move(callback));
+}
+
+void AsyncRedisClient::lpush(const std::string& key, const std::string& value, Callback callback) {
+    command({"LPUSH", key, value}, std::move(callback));
+}
+
+void AsyncRedisClient::rpush(const std::string& key, const std::string& value, Callback callback) {
+    command({"RPUSH", key, value}, std::move(callback));
+}
+
+#ifdef ASYNC_REDIS_COROUTINES
+AsyncRedisClient::Awaitable AsyncRedisClient::hmset(const std::string& key,
+                                                    const std::vector<std::pair<std::string, std::string>>& fields) {
+    return call(hmsetArgs(key, fields));
+}
+#endif
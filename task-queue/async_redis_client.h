@@ -0,0 +1,125 @@
+#ifndef ASYNC_REDIS_CLIENT_H
+#define ASYNC_REDIS_CLIENT_H
+
+#include "redis_client.h"
+#include <deque>
+#include <functional>
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#include <exception>
+#define ASYNC_REDIS_COROUTINES 1
+#endif
+
+/*
+Many requests in flight on one connection, driven by one thread. Commands are queued
+with a callback (or co_await-ed from a coroutine) and written to a non-blocking socket;
+the server answers in order, so replies are matched to the callbacks first in, first out.
+Nothing happens until poll() or run() is called:
+
+    AsyncRedisClient client;
+    client.connect();
+    client.command({"SET", "a", "1"}, [](RedisReply& reply) { ... });
+    client.get("a", [](RedisReply& reply) { ... });
+    client.run(); // until both callbacks ran
+
+    RedisTask fetch(AsyncRedisClient& client) {    // C++20
+        RedisReply value = co_await client.get("a");
+        ...
+    }
+
+Callbacks and coroutines run inside poll() and may queue more commands. The client is
+not thread-safe and talks to one node: in a cluster, MOVED/ASK come back as replies.
+If the connection drops, every pending callback gets an "ERR connection lost" reply.
+*/
+class AsyncRedisClient {
+public:
+    using Callback = std::function<void(RedisReply&)>;
+
+    AsyncRedisClient(const std::string& host = "127.0.0.1", int port = 6379);
+    ~AsyncRedisClient();
+
+    bool connect();
+    void disconnect();
+    bool isConnected() const { return sockfd >= 0; }
+
+    void command(const std::vector<std::string>& args, Callback callback = nullptr);
+    size_t pending() const { return callbacks.size(); }
+    // waits up to timeoutMs (-1: no limit) for the socket, writes what is queued and
+    // runs the callbacks of the replies that arrived; false once disconnected
+    bool poll(int timeoutMs);
+    // polls until every queued command got its reply
+    bool run();
+
+    void get(const std::string& key, Callback callback);
+    void set(const std::string& key, const std::string& value, Callback callback);
+    void hset(const std::string& key, const std::string& field, const std::string& value, Callback callback);
+    void hmset(const std::string& key, const std::vector<std::pair<std::string, std::string>>& fields, Callback callback);
+    void lpush(const std::string& key, const std::string& value, Callback callback);
+    void rpush(const std::string& key, const std::string& value, Callback callback);
+
+#ifdef ASYNC_REDIS_COROUTINES
+    // co_await-able command: suspends the coroutine until the reply arrives
+    class Awaitable {
+    private:
+        AsyncRedisClient& client;
+        std::vector<std::string> args;
+        RedisReply reply;
+
+    public:
+        Awaitable(AsyncRedisClient& client, std::vector<std::string> args) : client(client), args(std::move(args)) {}
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> waiting) {
+            client.command(args, [this, waiting](RedisReply& result) {
+                reply = std::move(result);
+                waiting.resume();
+            });
+        }
+        RedisReply await_resume() { return std::move(reply); }
+    };
+
+    Awaitable call(const std::vector<std::string>& args) { return Awaitable(*this, args); }
+    Awaitable get(const std::string& key) { return call({"GET", key}); }
+    Awaitable set(const std::string& key, const std::string& value) { return call({"SET", key, value}); }
+    Awaitable hset(const std::string& key, const std::string& field, const std::string& value) {
+        return call({"HSET", key, field, value});
+    }
+    Awaitable hmset(const std::string& key, const std::vector<std::pair<std::string, std::string>>& fields);
+    Awaitable lpush(const std::string& key, const std::string& value) { return call({"LPUSH", key, value}); }
+    Awaitable rpush(const std::string& key, const std::string& value) { return call({"RPUSH", key, value}); }
+#endif
+
+private:
+    AsyncRedisClient(const AsyncRedisClient&) = delete;
+    AsyncRedisClient& operator=(const AsyncRedisClient&) = delete;
+
+    bool flush();   // writes as much of out as the socket takes
+    bool receive(); // reads until the socket is drained, dispatching complete replies
+    void watchWrites(bool enable);
+    void failPending();
+
+    std::string host;
+    int port;
+    int sockfd;
+    int epfd;
+    bool watchingWrites;
+    std::string out;   // encoded commands not written yet...
+    size_t outPos;     // ...from here on
+    std::deque<Callback> callbacks; // one per command sent or queued, in order
+    RespReader reader;
+};
+
+#ifdef ASYNC_REDIS_COROUTINES
+// Return type of a fire-and-forget coroutine: it starts running when called, continues
+// from poll() whenever a reply it awaits arrives, and frees itself when it finishes.
+struct RedisTask {
+    struct promise_type {
+        RedisTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+#endif
+
+#endif
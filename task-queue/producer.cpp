@@ -1,4 +1,5 @@
 #include "redis_client.h"
+#include "async_redis_client.h"
 #include <iostream>
 #include <thread>
 #include <chrono>
@@ -152,13 +153,18 @@ void viewTaskStatus(RedisClient& client) {
     int processingCount = 0;
     int pendingCount = 0;
     
+    // Get current status of every task from Redis in one round trip
+    RedisPipeline pipe(client);
+    for (const auto& pair : createdTasks) {
+        pipe.add({"HGET", pair.first, "status"});
+    }
+    std::vector<RedisReply> statuses = pipe.execute();
+    size_t index = 0;
+    
     for (const auto& pair : createdTasks) {
         std::string taskId = pair.first;
         std::string taskType = pair.second;
-        
-        // Get current status from Redis
-        std::string statusResp = client.hget(taskId, "status");
-        std::string status = parseStringResponse(statusResp);
+        std::string status = statuses[index++].str;
         
         // Count statuses
         if (status == "completed") completedCount++;
@@ -300,7 +306,73 @@ void viewQueueStats(RedisClient& client) {
     std::cin.get();
 }
 
+// Same mix as the interactive menu users pick: 10% critical, 20% high, 40% normal, 30% low
+std::string randomPriority() {
+    int roll = rand() % 100;
+    if (roll < 10) return "critical";
+    if (roll < 30) return "high";
+    if (roll < 70) return "normal";
+    return "low";
+}
+
+// One task: the hash, then the queue push. Thousands of these run at once on one
+// connection, each suspended while its reply is on the way.
+RedisTask submitTask(AsyncRedisClient& client, int& queued, int& failed) {
+    std::string taskId = generateTaskId();
+    std::string taskType = TASK_TYPES[rand() % TASK_TYPES.size()];
+    std::string priority = randomPriority();
+    
+    std::vector<std::pair<std::string, std::string>> fields = {
+        {"type", taskType},
+        {"priority", priority},
+        {"status", "pending"},
+        {"created_at", std::to_string(time(nullptr))}
+    };
+    RedisReply stored = co_await client.hmset(taskId, fields);
+    if (stored.isError()) {
+        failed++;
+        co_return;
+    }
+    
+    std::string queueName = "queue:" + priority;
+    RedisReply pushed;
+    if (priority == "critical" || priority == "high") {
+        pushed = co_await client.lpush(queueName, taskId);
+    } else {
+        pushed = co_await client.rpush(queueName, taskId);
+    }
+    if (pushed.isError()) failed++;
+    else queued++;
+}
+
+// ./producer --bulk N: creates N random tasks from this one thread and exits
+int bulkCreate(int count) {
+    AsyncRedisClient client;
+    if (!client.connect()) {
+        std::cerr << "\nFailed to connect to Redis server!\n";
+        return 1;
+    }
+    
+    int queued = 0, failed = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+        submitTask(client, queued, failed);
+    }
+    client.run();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    
+    std::cout << "Queued " << queued << " tasks in " << ms << "ms";
+    if (failed) std::cout << ", " << failed << " failed";
+    std::cout << "\n";
+    return failed ? 1 : 0;
+}
+
 int main(int argc, char* argv[]) {
+    if (argc > 2 && std::string(argv[1]) == "--bulk") {
+        srand(time(nullptr));
+        return bulkCreate(std::stoi(argv[2]));
+    }
+    
     clearScreen();
     printHeader();
     
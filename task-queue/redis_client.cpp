@@ -1,7 +1,10 @@
 #include "redis_client.h"
+#include <algorithm>
+#include <cerrno>
 
 RedisClient::RedisClient(const std::string& host, int port) 
-    : host(host), port(port), sockfd(-1) {}
+    : host(host), port(port), sockfd(-1), broken(false), clusterMode(false),
+      cacheCapacity(0), cacheHits(0), cacheMisses(0) {}
 
 RedisClient::~RedisClient() {
     disconnect();
@@ -16,21 +19,157 @@ std::string RedisClient::buildRESPCommand(const std::vector<std::string>& args)
     return oss.str();
 }
 
-std::string RedisClient::readResponse() {
-    char buffer[4096];
-    ssize_t bytes = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
-    if (bytes <= 0) {
-        return "";
+// drops the replies already consumed before the buffer grows
+void RespReader::compact() {
+    if (start == buf.size()) {
+        buf.clear();
+        pos = start = 0;
+    }
+    else if (start >= 64 * 1024) {
+        buf.erase(0, start);
+        pos -= start;
+        start = 0;
     }
-    buffer[bytes] = '\0';
-    return std::string(buffer);
 }
 
-bool RedisClient::connect() {
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
+bool RespReader::fill() {
+    compact();
+    size_t old = buf.size();
+    buf.resize(old + 64 * 1024);
+    ssize_t bytes = recv(fd, &buf[old], 64 * 1024, 0);
+    buf.resize(old + (bytes > 0 ? bytes : 0));
+    return bytes > 0;
+}
+
+void RespReader::feed(const char* data, size_t len) {
+    compact();
+    buf.append(data, len);
+}
+
+bool RespReader::read(RedisReply& reply, std::string* raw) {
+    while (true) {
+        int result = next(reply, raw);
+        if (result != 0) return result > 0;
+        if (!fill()) return false;
+    }
+}
+
+/*
+Resumable: when a reply is split across reads, the elements parsed so far are kept
+(partial, open) and parsing carries on where it stopped, so a large HGETALL is scanned
+once.
+*/
+int RespReader::next(RedisReply& reply, std::string* raw) {
+    auto place = [&](RedisReply&& element) {
+        if (open.empty()) {
+            partial = std::move(element);
+            return &partial;
+        }
+        RedisReply* parent = open.back().first;
+        open.back().second--;
+        parent->elements.push_back(std::move(element));
+        return &parent->elements.back(); // stable: elements were reserved up front
+    };
+    while (true) {
+        size_t eol = buf.find("\r\n", pos);
+        if (eol == std::string::npos) {
+            return 0;
+        }
+        char type = buf[pos];
+        RedisReply element;
+        size_t next = eol + 2;
+        if (type == '+' || type == '-') {
+            element.type = type == '+' ? RedisReply::STATUS : RedisReply::ERROR;
+            element.str.assign(buf, pos + 1, eol - pos - 1);
+        }
+        else if (type == ':') {
+            element.type = RedisReply::INTEGER;
+            element.integer = atoll(buf.c_str() + pos + 1);
+        }
+        else if (type == '$') {
+            long long len = atoll(buf.c_str() + pos + 1);
+            if (len >= 0) {
+                if (buf.size() - next < static_cast<size_t>(len) + 2) {
+                    return 0;
+                }
+                element.type = RedisReply::STRING;
+                element.str.assign(buf, next, len);
+                next += len + 2;
+            }
+        }
+        else if (type == '_') {
+            // RESP3 null, in invalidation pushes
+        }
+        else if (type == '*' || type == '>') {
+            long long count = atoll(buf.c_str() + pos + 1);
+            if (count >= 0) {
+                element.type = type == '>' ? RedisReply::PUSH : RedisReply::ARRAY;
+            }
+            if (count > 0) {
+                RedisReply* array = place(std::move(element));
+                array->elements.reserve(count);
+                open.push_back({array, count});
+                pos = next;
+                continue;
+            }
+        }
+        else {
+            return -1;
+        }
+        pos = next;
+        place(std::move(element));
+        while (!open.empty() && open.back().second == 0) {
+            open.pop_back();
+        }
+        if (open.empty()) break;
+    }
+    reply = std::move(partial);
+    partial = RedisReply();
+    if (raw) {
+        raw->assign(buf, start, pos - start);
+    }
+    start = pos;
+    return 1;
+}
+
+bool RedisClient::sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            broken = true;
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+// The reply to the next command; pushes in between are handled on the way
+bool RedisClient::readReply(int fd, RedisReply& reply, std::string* raw) {
+    auto it = readers.find(fd);
+    while (true) {
+        if (it == readers.end() || !it->second.read(reply, raw)) {
+            broken = true;
+            cacheClear(); // invalidations may have been lost with the connection
+            return false;
+        }
+        if (reply.type != RedisReply::PUSH) {
+            return true;
+        }
+        handlePush(reply);
+    }
+}
+
+bool RedisClient::roundTrip(int fd, const std::string& request, RedisReply& reply, std::string* raw) {
+    return sendAll(fd, request) && readReply(fd, reply, raw);
+}
+
+int RedisClient::connectTo(const std::string& host, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
         std::cerr << "Failed to create socket\n";
-        return false;
+        return -1;
     }
 
     struct sockaddr_in server_addr;
@@ -39,30 +178,381 @@ bool RedisClient::connect() {
     
     if (inet_pton(AF_INET, host.c_str(), &server_addr.sin_addr) <= 0) {
         std::cerr << "Invalid address\n";
-        return false;
+        close(fd);
+        return -1;
     }
 
-    if (::connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+    if (::connect(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         std::cerr << "Connection failed to " << host << ":" << port << "\n";
-        return false;
+        close(fd);
+        return -1;
     }
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    readers[fd] = RespReader(fd);
+    return fd;
+}
 
+void RedisClient::closeSocket(int fd) {
+    readers.erase(fd);
+    close(fd);
+}
+
+bool RedisClient::connect() {
+    sockfd = connectTo(host, port);
+    if (sockfd < 0) {
+        return false;
+    }
+    broken = false;
+    // a cluster node answers CLUSTER SLOTS, a standalone server an error
+    clusterMode = refreshSlots();
     return true;
 }
 
 void RedisClient::disconnect() {
     if (sockfd >= 0) {
-        close(sockfd);
+        closeSocket(sockfd);
         sockfd = -1;
     }
+    for (auto& node : nodeSockets) {
+        closeSocket(node.second);
+    }
+    nodeSockets.clear();
+    cacheClear();
+    cacheCapacity = 0;
 }
 
-std::string RedisClient::command(const std::vector<std::string>& args) {
+// CRC16-CCITT (XMODEM) of the key, or of its {hashtag}, modulo 16384
+int RedisClient::keySlot(const std::string& key) {
+    size_t start = 0, len = key.size();
+    size_t open = key.find('{');
+    if (open != std::string::npos) {
+        size_t close = key.find('}', open + 1);
+        if (close != std::string::npos && close > open + 1) {
+            start = open + 1;
+            len = close - open - 1;
+        }
+    }
+    uint16_t crc = 0;
+    for (size_t i = start; i < start + len; i++) {
+        crc ^= static_cast<uint16_t>(static_cast<uint8_t>(key[i]) << 8);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+        }
+    }
+    return crc & 16383;
+}
+
+int RedisClient::nodeSocket(const std::string& addr) {
+    if (addr == host + ":" + std::to_string(port)) {
+        return sockfd;
+    }
+    auto it = nodeSockets.find(addr);
+    if (it != nodeSockets.end()) {
+        return it->second;
+    }
+    size_t colon = addr.rfind(':');
+    int fd = connectTo(addr.substr(0, colon), std::stoi(addr.substr(colon + 1)));
+    if (fd >= 0) {
+        nodeSockets[addr] = fd;
+    }
+    return fd;
+}
+
+// CLUSTER SLOTS: *N of [first, last, [host, port, id], ...]
+bool RedisClient::refreshSlots() {
+    RedisReply reply;
+    if (!roundTrip(sockfd, buildRESPCommand({"CLUSTER", "SLOTS"}), reply, nullptr) ||
+        reply.type != RedisReply::ARRAY) {
+        return false;
+    }
+    std::vector<std::string> owners(16384);
+    for (const auto& range : reply.elements) {
+        if (range.elements.size() < 3 || range.elements[2].elements.size() < 2) {
+            continue;
+        }
+        const auto& master = range.elements[2].elements;
+        std::string owner = master[0].str + ":" + std::to_string(master[1].integer);
+        for (long long slot = range.elements[0].integer; slot <= range.elements[1].integer && slot < 16384; slot++) {
+            owners[slot] = owner;
+        }
+    }
+    slotOwners.swap(owners);
+    return true;
+}
+
+// Reads whose reply only depends on their key
+static bool isCacheable(const std::vector<std::string>& args) {
+    static const std::vector<std::string> reads = {
+        "GET", "HGET", "HGETALL", "HEXISTS", "HKEYS", "HVALS", "HLEN", "LLEN", "LGET", "LINDEX", "TYPE"
+    };
+    if (args.size() < 2) {
+        return false;
+    }
+    std::string name = args[0];
+    for (auto& c : name) c = toupper(c);
+    return std::find(reads.begin(), reads.end(), name) != reads.end();
+}
+
+// Node a command goes to in cluster mode: the owner of its key (args[1])
+std::string RedisClient::nodeFor(const std::vector<std::string>& args) {
+    static const std::vector<std::string> keyless = {"PING", "ECHO", "INFO", "CONFIG", "CLUSTER", "KEYS", "FLUSHALL"};
+    if (!clusterMode || args.size() < 2) {
+        return "";
+    }
+    std::string name = args[0];
+    for (auto& c : name) c = toupper(c);
+    if (std::find(keyless.begin(), keyless.end(), name) != keyless.end()) {
+        return "";
+    }
+    return slotOwners[keySlot(args[1])];
+}
+
+/*
+In cluster mode the command goes to the node owning its key. MOVED means the slot map
+is stale: it is fetched again and the command retried there. ASK is a slot in the
+middle of a migration: the command is sent once to the node named, after ASKING, and
+the map is left alone.
+*/
+bool RedisClient::execute(const std::vector<std::string>& args, RedisReply& reply, std::string* raw) {
     std::string cmd = buildRESPCommand(args);
-    if (send(sockfd, cmd.c_str(), cmd.size(), 0) < 0) {
+    if (cacheCapacity && isCacheable(args)) {
+        // invalidations that arrived since the last command come first
+        if (!drainPushes()) {
+            return false;
+        }
+        auto hit = cacheIndex.find(cmd);
+        if (hit != cacheIndex.end()) {
+            cache.splice(cache.begin(), cache, hit->second);
+            reply = hit->second->reply;
+            if (raw) *raw = hit->second->raw;
+            cacheHits++;
+            return true;
+        }
+        cacheMisses++;
+        std::string rawReply;
+        if (!roundTrip(sockfd, cmd, reply, &rawReply)) {
+            return false;
+        }
+        if (!reply.isError()) {
+            cacheStore(cmd, args[1], reply, rawReply);
+        }
+        if (raw) raw->swap(rawReply);
+        return true;
+    }
+    std::string addr = nodeFor(args);
+    if (!clusterMode || addr.empty()) {
+        return roundTrip(sockfd, cmd, reply, raw);
+    }
+
+    int slot = keySlot(args[1]);
+    bool asking = false;
+    bool ok = false;
+    for (int attempt = 0; attempt < 5; attempt++) {
+        int fd = addr.empty() ? sockfd : nodeSocket(addr);
+        if (fd < 0) {
+            // node gone: ask the seed node for the current map
+            refreshSlots();
+            addr = slotOwners[slot];
+            continue;
+        }
+        if (asking) {
+            RedisReply ignored;
+            roundTrip(fd, buildRESPCommand({"ASKING"}), ignored, nullptr);
+            asking = false;
+        }
+        ok = roundTrip(fd, cmd, reply, raw);
+        bool moved = reply.isError() && reply.str.compare(0, 6, "MOVED ") == 0;
+        bool ask = reply.isError() && reply.str.compare(0, 4, "ASK ") == 0;
+        if (!ok || (!moved && !ask)) {
+            return ok;
+        }
+        // MOVED <slot> <host>:<port>
+        addr = reply.str.substr(reply.str.rfind(' ') + 1);
+        if (moved) {
+            refreshSlots();
+            slotOwners[slot] = addr;
+        }
+        else {
+            asking = true;
+        }
+    }
+    return ok;
+}
+
+bool RedisClient::enableCache(size_t maxEntries) {
+    if (clusterMode || sockfd < 0 || maxEntries == 0) {
+        return false;
+    }
+    RedisReply reply;
+    if (!roundTrip(sockfd, buildRESPCommand({"CLIENT", "TRACKING", "ON"}), reply, nullptr) ||
+        reply.type != RedisReply::STATUS) {
+        return false;
+    }
+    cacheCapacity = maxEntries;
+    return true;
+}
+
+// >2 invalidate [keys] | >2 invalidate _ (everything)
+void RedisClient::handlePush(const RedisReply& push) {
+    if (push.elements.size() < 2 || push.elements[0].str != "invalidate") {
+        return;
+    }
+    if (push.elements[1].isNil()) {
+        cacheClear();
+        return;
+    }
+    for (const auto& key : push.elements[1].elements) {
+        cacheDrop(key.str);
+    }
+}
+
+// Reads the pushes already waiting on the socket, without blocking
+bool RedisClient::drainPushes() {
+    auto reader = readers.find(sockfd);
+    if (reader == readers.end()) {
+        return false;
+    }
+    char chunk[16 * 1024];
+    while (true) {
+        ssize_t bytes = recv(sockfd, chunk, sizeof(chunk), MSG_DONTWAIT);
+        if (bytes > 0) {
+            reader->second.feed(chunk, bytes);
+            continue;
+        }
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        broken = true;
+        cacheClear();
+        return false;
+    }
+    RedisReply push;
+    while (reader->second.next(push) == 1) {
+        handlePush(push); // nothing else can be waiting: no command is in flight
+    }
+    return true;
+}
+
+void RedisClient::cacheStore(const std::string& request, const std::string& key, const RedisReply& reply, const std::string& raw) {
+    if (cacheIndex.count(request)) {
+        return;
+    }
+    while (cache.size() >= cacheCapacity) {
+        auto oldest = std::prev(cache.end());
+        auto& byKey = cacheByKey[oldest->key];
+        byKey.erase(std::find(byKey.begin(), byKey.end(), oldest));
+        if (byKey.empty()) {
+            cacheByKey.erase(oldest->key);
+        }
+        cacheIndex.erase(oldest->request);
+        cache.pop_back();
+    }
+    cache.push_front({request, key, reply, raw});
+    cacheIndex[request] = cache.begin();
+    cacheByKey[key].push_back(cache.begin());
+}
+
+void RedisClient::cacheDrop(const std::string& key) {
+    auto it = cacheByKey.find(key);
+    if (it == cacheByKey.end()) {
+        return;
+    }
+    for (auto entry : it->second) {
+        cacheIndex.erase(entry->request);
+        cache.erase(entry);
+    }
+    cacheByKey.erase(it);
+}
+
+void RedisClient::cacheClear() {
+    cache.clear();
+    cacheIndex.clear();
+    cacheByKey.clear();
+}
+
+std::string RedisClient::command(const std::vector<std::string>& args) {
+    RedisReply reply;
+    std::string raw;
+    if (!execute(args, reply, &raw)) {
         return "";
     }
-    return readResponse();
+    return raw;
+}
+
+RedisReply RedisClient::call(const std::vector<std::string>& args) {
+    RedisReply reply;
+    if (!execute(args, reply, nullptr)) {
+        reply = RedisReply();
+        reply.type = RedisReply::ERROR;
+        reply.str = "ERR connection lost";
+    }
+    return reply;
+}
+
+/*
+Commands are sent in windows of PIPELINE_WINDOW: within a window every node gets its
+commands in one write, then the replies are read node by node. The window bounds what
+sits unread in the socket buffers, so neither side blocks writing while the other is
+not reading. A reply that is a MOVED/ASK redirect is retried on its own through call().
+*/
+static const size_t PIPELINE_WINDOW = 1024;
+
+std::vector<RedisReply> RedisClient::pipeline(const std::vector<std::vector<std::string>>& commands) {
+    std::vector<RedisReply> replies(commands.size());
+    for (size_t first = 0; first < commands.size(); first += PIPELINE_WINDOW) {
+        size_t last = std::min(commands.size(), first + PIPELINE_WINDOW);
+        std::vector<std::pair<int, std::vector<size_t>>> batches; // socket, commands for it
+        for (size_t i = first; i < last; i++) {
+            std::string addr = nodeFor(commands[i]);
+            int fd = addr.empty() ? sockfd : nodeSocket(addr);
+            auto batch = std::find_if(batches.begin(), batches.end(),
+                                      [fd](const std::pair<int, std::vector<size_t>>& b) { return b.first == fd; });
+            if (batch == batches.end()) {
+                batches.push_back({fd, {}});
+                batch = batches.end() - 1;
+            }
+            batch->second.push_back(i);
+        }
+
+        std::vector<bool> sent(batches.size());
+        for (size_t b = 0; b < batches.size(); b++) {
+            std::string request;
+            for (size_t i : batches[b].second) {
+                request += buildRESPCommand(commands[i]);
+            }
+            sent[b] = batches[b].first >= 0 && sendAll(batches[b].first, request);
+        }
+        for (size_t b = 0; b < batches.size(); b++) {
+            for (size_t i : batches[b].second) {
+                RedisReply& reply = replies[i];
+                if (!sent[b] || !readReply(batches[b].first, reply, nullptr)) {
+                    // the connection is out of step now: the rest of this batch fails
+                    sent[b] = false;
+                    reply = RedisReply();
+                    reply.type = RedisReply::ERROR;
+                    reply.str = "ERR connection lost";
+                }
+            }
+        }
+
+        for (size_t i = first; i < last; i++) {
+            const std::string& err = replies[i].str;
+            if (replies[i].isError() && (err.compare(0, 6, "MOVED ") == 0 || err.compare(0, 4, "ASK ") == 0)) {
+                replies[i] = call(commands[i]);
+            }
+        }
+    }
+    return replies;
+}
+
+std::vector<RedisReply> RedisPipeline::execute() {
+    std::vector<RedisReply> replies = client.pipeline(commands);
+    commands.clear();
+    return replies;
 }
 
 std::string RedisClient::hset(const std::string& key, const std::string& field, const std::string& value) {
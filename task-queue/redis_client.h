@@ -7,27 +7,128 @@
 #include <iostream>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <cstring>
+#include <unordered_map>
+#include <list>
 
+// One server reply, parsed
+struct RedisReply {
+    enum Type { STATUS, ERROR, INTEGER, STRING, NIL, ARRAY, PUSH }; // PUSH: sent unasked (CLIENT TRACKING)
+    Type type = NIL;
+    std::string str;                  // STATUS, ERROR and STRING
+    long long integer = 0;            // INTEGER
+    std::vector<RedisReply> elements; // ARRAY, PUSH
+
+    bool isError() const { return type == ERROR; }
+    bool isNil() const { return type == NIL; }
+};
+
+// Buffered reader over one connection. Replies to pipelined commands arrive back to
+// back, so bytes past the current reply are kept for the next read() instead of lost.
+// The parse state lives in the reader, so a reply can also be fed in as it arrives on a
+// non-blocking socket (feed() + next()).
+class RespReader {
+private:
+    int fd;
+    std::string buf;
+    size_t pos;    // next byte to parse
+    size_t start;  // start of the reply being parsed, everything before was consumed
+    RedisReply partial;
+    std::vector<std::pair<RedisReply*, long long>> open; // arrays still being filled, elements missing
+
+    void compact();
+    bool fill();
+
+public:
+    explicit RespReader(int fd = -1) : fd(fd), pos(0), start(0) {}
+
+    // next complete reply (raw gets its bytes); false if the connection closed or sent
+    // something that is not RESP
+    bool read(RedisReply& reply, std::string* raw = nullptr);
+
+    void feed(const char* data, size_t len);
+    // 1: reply is complete, 0: more bytes are needed, -1: not RESP
+    int next(RedisReply& reply, std::string* raw = nullptr);
+};
+
+// Talks to one redis-lite server, or to a cluster (--cluster-enabled yes) through any of
+// its nodes: the client then keeps the slot map from CLUSTER SLOTS, sends every command
+// straight to the node owning its key and follows MOVED/ASK redirects.
+//
+// enableCache() keeps the replies of reads (GET, HGET, HGETALL, ...) in a local LRU
+// cache. The server pushes an invalidation for every cached key that changes (CLIENT
+// TRACKING); they are read before any cache hit is served, so a hit costs no round
+// trip and never returns a value the server already replaced.
 class RedisClient {
 private:
     std::string host;
     int port;
     int sockfd;
+    bool broken; // a command failed on the connection, its replies are out of step
+
+    // cluster mode
+    bool clusterMode;
+    std::vector<std::string> slotOwners;               // "host:port" per hash slot
+    std::unordered_map<std::string, int> nodeSockets;  // connections to the other nodes
+    std::unordered_map<int, RespReader> readers;       // by socket
+
+    // client side cache (standalone servers only)
+    struct CacheEntry {
+        std::string request; // the encoded command
+        std::string key;
+        RedisReply reply;
+        std::string raw;
+    };
+    size_t cacheCapacity;
+    std::list<CacheEntry> cache;  // most recently used first
+    std::unordered_map<std::string, std::list<CacheEntry>::iterator> cacheIndex;          // by request
+    std::unordered_map<std::string, std::vector<std::list<CacheEntry>::iterator>> cacheByKey;
+    uint64_t cacheHits;
+    uint64_t cacheMisses;
 
     std::string buildRESPCommand(const std::vector<std::string>& args);
-    std::string readResponse();
-    
+    bool sendAll(int fd, const std::string& data);
+    bool readReply(int fd, RedisReply& reply, std::string* raw);
+    bool roundTrip(int fd, const std::string& request, RedisReply& reply, std::string* raw);
+    int connectTo(const std::string& host, int port);
+    void closeSocket(int fd);
+    int nodeSocket(const std::string& addr);
+    std::string nodeFor(const std::vector<std::string>& args); // "" for the seed node
+    bool execute(const std::vector<std::string>& args, RedisReply& reply, std::string* raw);
+    bool refreshSlots();
+    void handlePush(const RedisReply& push);
+    bool drainPushes();
+    void cacheStore(const std::string& request, const std::string& key, const RedisReply& reply, const std::string& raw);
+    void cacheDrop(const std::string& key);
+    void cacheClear();
+
 public:
     RedisClient(const std::string& host = "127.0.0.1", int port = 6379);
     ~RedisClient();
     
     bool connect();
     void disconnect();
+    bool isCluster() const { return clusterMode; }
+    bool isBroken() const { return broken; }
+    // hash slot of a key, as the server computes it (CRC16, {hashtag} aware)
+    static int keySlot(const std::string& key);
+
+    // turns on CLIENT TRACKING and caches up to maxEntries read replies; false in cluster
+    // mode or if the server refused
+    bool enableCache(size_t maxEntries);
+    uint64_t getCacheHits() const { return cacheHits; }
+    uint64_t getCacheMisses() const { return cacheMisses; }
+    size_t cacheSize() const { return cache.size(); }
     
-    // Command methods
+    // Command methods. command() returns the raw RESP reply ("" if the connection
+    // failed), call() the parsed one.
     std::string command(const std::vector<std::string>& args);
+    RedisReply call(const std::vector<std::string>& args);
+    // sends all the commands before reading any reply (one write per node) and returns
+    // the replies in the same order
+    std::vector<RedisReply> pipeline(const std::vector<std::vector<std::string>>& commands);
     std::string hset(const std::string& key, const std::string& field, const std::string& value);
     std::string hmset(const std::string& key, const std::vector<std::pair<std::string, std::string>>& fields);
     std::string hget(const std::string& key, const std::string& field);
@@ -41,4 +142,25 @@ public:
     std::string set(const std::string& key, const std::string& value);
 };
 
+// Queues commands and sends them in one go:
+//   RedisPipeline pipe(client);
+//   pipe.add({"HSET", key, "status", "done"}).add({"LPUSH", "done", key});
+//   std::vector<RedisReply> replies = pipe.execute();
+class RedisPipeline {
+private:
+    RedisClient& client;
+    std::vector<std::vector<std::string>> commands;
+
+public:
+    explicit RedisPipeline(RedisClient& client) : client(client) {}
+
+    RedisPipeline& add(const std::vector<std::string>& args) {
+        commands.push_back(args);
+        return *this;
+    }
+    size_t size() const { return commands.size(); }
+    // replies in the order the commands were added; the queue is emptied
+    std::vector<RedisReply> execute();
+};
+
 #endif
@@ -0,0 +1,130 @@
+#include "redis_pool.h"
+#include <algorithm>
+
+using Clock = std::chrono::steady_clock;
+
+RedisPool::Handle& RedisPool::Handle::operator=(Handle&& other) {
+    if (this != &other) {
+        release();
+        pool = other.pool;
+        client = std::move(other.client);
+    }
+    return *this;
+}
+
+void RedisPool::Handle::release() {
+    if (client) {
+        pool->giveBack(std::move(client));
+    }
+}
+
+RedisPool::RedisPool(const RedisPoolOptions& options)
+    : options(options), nextConnect(Clock::now()) {}
+
+RedisPool::~RedisPool() {
+    // every handle must be gone by now; the idle clients close their sockets
+    idle.clear();
+}
+
+RedisPool::Handle RedisPool::acquire() {
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + std::chrono::milliseconds(options.checkoutTimeoutMs);
+    std::unique_lock<std::mutex> lock(mtx);
+    bool waited = false;
+    auto account = [&](bool timedOut) {
+        uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+        counters.totalWaitUs += us;
+        counters.maxWaitUs = std::max(counters.maxWaitUs, us);
+        if (waited) counters.waits++;
+        if (timedOut) counters.exhausted++;
+        else counters.checkouts++;
+    };
+
+    while (true) {
+        closeExpired();
+        if (!idle.empty()) {
+            Idle conn = std::move(idle.back());
+            idle.pop_back();
+            if (Clock::now() - conn.since < std::chrono::milliseconds(options.healthCheckIdleMs)) {
+                account(false);
+                return Handle(this, std::move(conn.client));
+            }
+            // long idle: the server may have dropped it, check before handing it out
+            lock.unlock();
+            RedisReply pong = conn.client->call({"PING"});
+            lock.lock();
+            if (!conn.client->isBroken() && pong.type == RedisReply::STATUS) {
+                account(false);
+                return Handle(this, std::move(conn.client));
+            }
+            counters.healthCheckFailures++;
+            open--;
+            continue;
+        }
+
+        Clock::time_point now = Clock::now();
+        if (open < options.maxSize && now >= nextConnect) {
+            open++;
+            lock.unlock();
+            std::unique_ptr<RedisClient> client(new RedisClient(options.host, options.port));
+            bool connected = client->connect();
+            lock.lock();
+            if (connected) {
+                counters.connects++;
+                backoffMs = 0;
+                account(false);
+                return Handle(this, std::move(client));
+            }
+            open--;
+            counters.connectFailures++;
+            backoffMs = backoffMs ? std::min(backoffMs * 2, options.backoffMaxMs) : options.backoffInitialMs;
+            nextConnect = Clock::now() + std::chrono::milliseconds(backoffMs);
+            available.notify_all(); // the slot it held is free again
+            continue;
+        }
+
+        if (now >= deadline) {
+            account(true);
+            return Handle();
+        }
+        // woken by a returned connection, or when the backoff is over and a connect may be tried
+        waited = true;
+        Clock::time_point wake = deadline;
+        if (open < options.maxSize) wake = std::min(wake, nextConnect);
+        available.wait_until(lock, wake);
+    }
+}
+
+void RedisPool::giveBack(std::unique_ptr<RedisClient> client) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (client->isBroken()) {
+        counters.discarded++;
+        open--;
+        client.reset();
+    }
+    else {
+        idle.push_back({std::move(client), Clock::now()});
+    }
+    available.notify_one();
+}
+
+// Idle connections above minSize that nobody needed for idleTimeoutMs; the oldest are first
+void RedisPool::closeExpired() {
+    Clock::time_point cutoff = Clock::now() - std::chrono::milliseconds(options.idleTimeoutMs);
+    size_t expired = 0;
+    while (expired < idle.size() && idle.size() - expired > options.minSize && idle[expired].since < cutoff) {
+        expired++;
+    }
+    if (expired) {
+        idle.erase(idle.begin(), idle.begin() + expired);
+        open -= expired;
+    }
+}
+
+RedisPoolStats RedisPool::stats() {
+    std::lock_guard<std::mutex> lock(mtx);
+    RedisPoolStats result = counters;
+    result.open = open;
+    result.idle = idle.size();
+    return result;
+}
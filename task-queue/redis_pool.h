@@ -0,0 +1,102 @@
+#ifndef REDIS_POOL_H
+#define REDIS_POOL_H
+
+#include "redis_client.h"
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+
+struct RedisPoolOptions {
+    std::string host = "127.0.0.1";
+    int port = 6379;
+    size_t minSize = 1;             // idle connections kept open however long they sit unused
+    size_t maxSize = 8;             // connections open at once, idle or checked out
+    int checkoutTimeoutMs = 5000;   // acquire() gives up after this long
+    int idleTimeoutMs = 60000;      // idle connections above minSize are closed after this long
+    int healthCheckIdleMs = 10000;  // a connection idle this long is PINGed before it is handed out
+    int backoffInitialMs = 100;     // wait after a failed connect, doubled on every failure...
+    int backoffMaxMs = 5000;        // ...up to this
+};
+
+struct RedisPoolStats {
+    size_t open = 0;                // connections, idle or checked out
+    size_t idle = 0;
+    uint64_t checkouts = 0;
+    uint64_t waits = 0;             // checkouts that found no connection ready
+    uint64_t exhausted = 0;         // checkouts that timed out
+    uint64_t totalWaitUs = 0;       // time spent in acquire()
+    uint64_t maxWaitUs = 0;
+    uint64_t connects = 0;
+    uint64_t connectFailures = 0;
+    uint64_t healthCheckFailures = 0;
+    uint64_t discarded = 0;         // returned with a broken connection
+};
+
+/*
+Connections shared by many threads. Nothing is opened up front: acquire() hands out an
+idle connection (the most recently used one) or opens a new one while fewer than
+maxSize are open, and otherwise waits for one to come back. The handle gives the
+connection back when it goes out of scope, so hold it only around the commands:
+
+    {
+        RedisPool::Handle redis = pool.acquire();
+        if (!redis) return;           // timed out: the pool is exhausted or the server down
+        redis->hset(key, "status", "done");
+    }
+
+A connection that failed a command is closed instead of going back to the pool. After a
+failed connect no new connection is attempted until the backoff has passed, so a server
+that is down is not hammered by every waiting thread.
+*/
+class RedisPool {
+public:
+    class Handle {
+    private:
+        RedisPool* pool;
+        std::unique_ptr<RedisClient> client;
+
+    public:
+        Handle() : pool(nullptr) {}
+        Handle(RedisPool* pool, std::unique_ptr<RedisClient> client) : pool(pool), client(std::move(client)) {}
+        Handle(Handle&& other) = default;
+        Handle& operator=(Handle&& other);
+        ~Handle() { release(); }
+
+        explicit operator bool() const { return client != nullptr; }
+        RedisClient* operator->() const { return client.get(); }
+        RedisClient& operator*() const { return *client; }
+        void release(); // gives the connection back early
+    };
+
+    explicit RedisPool(const RedisPoolOptions& options = RedisPoolOptions());
+    ~RedisPool();
+
+    Handle acquire(); // empty handle after checkoutTimeoutMs
+    RedisPoolStats stats();
+
+private:
+    struct Idle {
+        std::unique_ptr<RedisClient> client;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    RedisPool(const RedisPool&) = delete;
+    RedisPool& operator=(const RedisPool&) = delete;
+
+    void giveBack(std::unique_ptr<RedisClient> client);
+    void closeExpired(); // caller holds mtx
+
+    RedisPoolOptions options;
+    std::mutex mtx;
+    std::condition_variable available;
+    std::vector<Idle> idle;  // most recently returned last
+    size_t open = 0;         // includes connections being opened
+    std::chrono::steady_clock::time_point nextConnect;
+    int backoffMs = 0;
+    RedisPoolStats counters;
+};
+
+#endif
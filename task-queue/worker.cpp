@@ -1,10 +1,11 @@
-#include "redis_client.h"
+#include "redis_pool.h"
 #include <iostream>
 #include <thread>
 #include <chrono>
 #include <sstream>
 #include <atomic>
 #include <csignal>
+#include <functional>
 
 std::atomic<bool> running(true);
 
@@ -29,7 +30,7 @@ std::string parseTaskId(const std::string& resp) {
     return data.substr(0, pos);
 }
 
-std::string getNextTask(RedisClient& client) {
+std::string getNextTask(RedisPool& pool) {
     // Check queues in priority order
     std::vector<std::string> queues = {
         "queue:critical",
@@ -38,8 +39,12 @@ std::string getNextTask(RedisClient& client) {
         "queue:low"
     };
     
+    RedisPool::Handle client = pool.acquire();
+    if (!client) {
+        return "";
+    }
     for (const auto& queue : queues) {
-        std::string resp = client.lpop(queue);
+        std::string resp = client->lpop(queue);
         std::string taskId = parseTaskId(resp);
         if (!taskId.empty()) {
             return taskId;
@@ -49,25 +54,35 @@ std::string getNextTask(RedisClient& client) {
     return "";  // No tasks available
 }
 
-void processTask(RedisClient& client, const std::string& taskId, int workerId) {
+// A connection is only held around the two batches, not through the simulated work
+void processTask(RedisPool& pool, const std::string& taskId, int workerId) {
     std::cout << "[WORKER-" << workerId << "] Assigned: " << taskId << std::endl;
     
     // Delay 1: When task is assigned (make it visible on frontend that task was assigned)
     std::this_thread::sleep_for(std::chrono::milliseconds(1000));
     
-    // Update task status to processing
+    // Update task status to processing, worker status (for dashboard tracking) and get
+    // the task details: one round trip
     std::cout << "[WORKER-" << workerId << "] Processing: " << taskId << std::endl;
-    client.hset(taskId, "status", "processing");
-    client.hset(taskId, "worker_id", std::to_string(workerId));
-    
-    // Update worker status (for dashboard tracking)
     std::string workerKey = "worker:" + std::to_string(workerId);
-    client.hset(workerKey, "status", "processing");
-    client.hset(workerKey, "current_task", taskId);
-    client.hset(workerKey, "last_seen", std::to_string(time(nullptr)));
-    
-    // Get task details
-    std::string details = client.hgetall(taskId);
+    RedisPool::Handle client = pool.acquire();
+    if (!client) {
+        std::cerr << "[WORKER-" << workerId << "] No connection for " << taskId << std::endl;
+        return;
+    }
+    RedisPipeline pipe(*client);
+    pipe.add({"HSET", taskId, "status", "processing"})
+        .add({"HSET", taskId, "worker_id", std::to_string(workerId)})
+        .add({"HSET", workerKey, "status", "processing"})
+        .add({"HSET", workerKey, "current_task", taskId})
+        .add({"HSET", workerKey, "last_seen", std::to_string(time(nullptr))})
+        .add({"HGETALL", taskId});
+    std::vector<RedisReply> replies = pipe.execute();
+    const RedisReply& details = replies.back();
+    if (details.isError()) {
+        std::cerr << "[WORKER-" << workerId << "] " << details.str << std::endl;
+    }
+    client.release();
     
     // Delay 2: Simulate work with longer, more visible delay (3-6 seconds)
     int processingTime = 3000 + rand() % 3000;
@@ -77,52 +92,63 @@ void processTask(RedisClient& client, const std::string& taskId, int workerId) {
     // Delay 3: Small delay before completing to give frontend time to update
     std::this_thread::sleep_for(std::chrono::milliseconds(500));
     
-    // Mark task as completed
-    client.hset(taskId, "status", "completed");
-    client.hset(taskId, "completed_at", std::to_string(time(nullptr)));
-    
-    // Update worker status to idle
-    client.hset(workerKey, "status", "idle");
-    client.hset(workerKey, "current_task", "");
-    client.hset(workerKey, "last_seen", std::to_string(time(nullptr)));
-    
-    // Add to completed list
-    client.lpush("tasks:completed", taskId);
+    // Mark task as completed, set the worker idle and add the task to the completed
+    // list: one round trip
+    client = pool.acquire();
+    if (!client) {
+        std::cerr << "[WORKER-" << workerId << "] No connection to complete " << taskId << std::endl;
+        return;
+    }
+    RedisPipeline(*client).add({"HSET", taskId, "status", "completed"})
+        .add({"HSET", taskId, "completed_at", std::to_string(time(nullptr))})
+        .add({"HSET", workerKey, "status", "idle"})
+        .add({"HSET", workerKey, "current_task", ""})
+        .add({"HSET", workerKey, "last_seen", std::to_string(time(nullptr))})
+        .add({"LPUSH", "tasks:completed", taskId})
+        .execute();
     
     std::cout << "[WORKER-" << workerId << "] Completed: " << taskId << std::endl;
 }
 
-void workerLoop(int workerId) {
-    RedisClient client;
-    
+void workerLoop(RedisPool& pool, int workerId) {
     std::cout << "[WORKER-" << workerId << "] Starting...\n";
     
-    if (!client.connect()) {
-        std::cerr << "[WORKER-" << workerId << "] Failed to connect!\n";
-        return;
+    // Register worker on startup
+    std::string workerKey = "worker:" + std::to_string(workerId);
+    {
+        RedisPool::Handle client = pool.acquire();
+        if (!client) {
+            std::cerr << "[WORKER-" << workerId << "] Failed to connect!\n";
+            return;
+        }
+        RedisPipeline(*client)
+            .add({"HSET", workerKey, "status", "idle"})
+            .add({"HSET", workerKey, "current_task", ""})
+            .add({"HSET", workerKey, "started_at", std::to_string(time(nullptr))})
+            .add({"HSET", workerKey, "last_seen", std::to_string(time(nullptr))})
+            .execute();
     }
     
     std::cout << "[WORKER-" << workerId << "] Connected to Redis-Lite\n";
     
-    // Register worker on startup
-    std::string workerKey = "worker:" + std::to_string(workerId);
-    client.hset(workerKey, "status", "idle");
-    client.hset(workerKey, "current_task", "");
-    client.hset(workerKey, "started_at", std::to_string(time(nullptr)));
-    client.hset(workerKey, "last_seen", std::to_string(time(nullptr)));
-    
     int tasksProcessed = 0;
     
     while (running) {
-        std::string taskId = getNextTask(client);
+        std::string taskId = getNextTask(pool);
         
         if (!taskId.empty()) {
-            processTask(client, taskId, workerId);
+            processTask(pool, taskId, workerId);
             tasksProcessed++;
         } else {
             // No tasks, update heartbeat
-            client.hset(workerKey, "status", "idle");
-            client.hset(workerKey, "last_seen", std::to_string(time(nullptr)));
+            RedisPool::Handle client = pool.acquire();
+            if (client) {
+                RedisPipeline(*client)
+                    .add({"HSET", workerKey, "status", "idle"})
+                    .add({"HSET", workerKey, "last_seen", std::to_string(time(nullptr))})
+                    .execute();
+                client.release();
+            }
             
             // Wait a bit
             std::this_thread::sleep_for(std::chrono::milliseconds(500));
@@ -130,7 +156,10 @@ void workerLoop(int workerId) {
     }
     
     // Cleanup: remove worker from registry on shutdown
-    client.command({"DEL", workerKey});
+    RedisPool::Handle client = pool.acquire();
+    if (client) {
+        client->command({"DEL", workerKey});
+    }
     
     std::cout << "[WORKER-" << workerId << "] Stopped. Tasks processed: " << tasksProcessed << "\n";
 }
@@ -138,21 +167,28 @@ void workerLoop(int workerId) {
 int main(int argc, char* argv[]) {
     int numWorkers = 3;
     
+    // the workers share a pool of connections, opened as they are needed
+    RedisPoolOptions options;
+    
     if (argc > 1) {
         numWorkers = std::stoi(argv[1]);
     }
+    if (argc > 2) {
+        options.maxSize = std::stoi(argv[2]);
+    }
+    RedisPool pool(options);
     
     signal(SIGINT, signalHandler);
     
     std::cout << "TASK WORKERS\n";
-    std::cout << "Starting " << numWorkers << " workers...\n";
+    std::cout << "Starting " << numWorkers << " workers, up to " << options.maxSize << " connections...\n";
     std::cout << "Press Ctrl+C to stop\n\n";
     
     std::vector<std::thread> workers;
     
     // Start worker threads
     for (int i = 1; i <= numWorkers; i++) {
-        workers.emplace_back(workerLoop, i);
+        workers.emplace_back(workerLoop, std::ref(pool), i);
     }
     
     // Wait for all workers to finish
@@ -162,5 +198,11 @@ int main(int argc, char* argv[]) {
     
     std::cout << "\nAll workers stopped\n";
     
+    RedisPoolStats stats = pool.stats();
+    std::cout << "Connections: " << stats.connects << " opened, " << stats.connectFailures << " failed, "
+              << stats.discarded + stats.healthCheckFailures << " dropped\n";
+    std::cout << "Checkouts:   " << stats.checkouts << ", " << stats.waits << " waited (max "
+              << stats.maxWaitUs / 1000 << "ms), " << stats.exhausted << " timed out\n";
+    
     return 0;
 }
@@ -0,0 +1,491 @@
+#!/bin/bash
+# End-to-end checks against a real server: every case starts redis-lite in a scratch
+# directory, drives it with redis-cli and looks at the replies, INFO and MEMORY STATS
+# and the files it leaves behind.
+#
+#   make test
+#   tests/integration.sh [--filter name] [server] [cli]
+#
+# Exits non-zero when any case fails; the failing case's server log is printed.
+
+FILTER=""
+if [ "${1:-}" = "--filter" ]; then
+    FILTER=$2
+    shift 2
+fi
+SERVER=$(realpath "${1:-./redis-lite}")
+CLI=$(realpath "${2:-./redis-cli}")
+PORT=7500            # each case gets the next one, its restarts reuse it
+TIMEOUT=10           # seconds a single command or shutdown may take
+FAILED=0
+PASSED=0
+
+# --- helpers -----------------------------------------------------------------------
+
+# start_server [options...]: in the case's directory, on its port
+start_server() {
+    "$SERVER" "$PORT" "$@" >>log 2>&1 &
+    SERVER_PID=$!
+    for _ in $(seq 50); do
+        [ "$(cli PING 2>/dev/null)" = "PONG" ] && return 0
+        sleep 0.1
+    done
+    fail "server did not start on port $PORT"
+    return 1
+}
+
+# stop_server: SIGINT, which saves dbfilename on the way out and exits with status 2
+stop_server() {
+    kill -INT "$SERVER_PID" 2>/dev/null
+    for _ in $(seq $((TIMEOUT * 10))); do
+        if ! kill -0 "$SERVER_PID" 2>/dev/null; then
+            wait "$SERVER_PID" 2>/dev/null
+            local status=$?
+            [ "$status" = 2 ] || { fail "server exited with status $status on SIGINT"; return 1; }
+            return 0
+        fi
+        sleep 0.1
+    done
+    fail "server did not shut down within ${TIMEOUT}s"
+    kill -9 "$SERVER_PID" 2>/dev/null
+    wait "$SERVER_PID" 2>/dev/null
+    return 1
+}
+
+# cli command args...: the reply (errors as "(Error) ..."), without redis-cli's prompts
+cli() {
+    echo "$*" | timeout "$TIMEOUT" "$CLI" -p "$PORT" 2>&1 | sed "s/127\.0\.0\.1:$PORT> //g" | tr -d '\r' | grep -v '^$'
+}
+
+# info field: its value in INFO
+info() {
+    cli INFO | sed -n "s/^$1://p"
+}
+
+# memstat field: its value in MEMORY STATS (a name line, then its value)
+memstat() {
+    cli MEMORY STATS | sed -n "/^$1\$/{n;p}"
+}
+
+# wait_for description condition: polls until the shell condition holds
+wait_for() {
+    for _ in $(seq $((TIMEOUT * 10))); do
+        eval "$2" && return 0
+        sleep 0.1
+    done
+    fail "timed out waiting for $1"
+    return 1
+}
+
+fail() {
+    echo "    FAIL: $*"
+    CASE_FAILED=1
+}
+
+# expect description actual expected
+expect() {
+    [ "$2" = "$3" ] || fail "$1: got '$2', expected '$3'"
+}
+
+run_case() {
+    local name=$1
+    [ -n "$FILTER" ] && [[ "$name" != *"$FILTER"* ]] && return
+    echo "$name"
+    PORT=$((PORT + 1))
+    local dir
+    dir=$(mktemp -d)
+    CASE_FAILED=0
+    SERVER_PID=""
+    (cd "$dir" && "$name")
+    CASE_FAILED=$?
+    if [ "$CASE_FAILED" != 0 ]; then
+        FAILED=$((FAILED + 1))
+        sed 's/^/    | /' "$dir/log" 2>/dev/null | tail -40
+    else
+        PASSED=$((PASSED + 1))
+    fi
+    rm -rf "$dir"
+}
+
+# --- cases: each runs in a subshell inside its directory, returns CASE_FAILED --------
+
+# SAVE, BGSAVE and shutdown with delta checkpoints on disk: the base replaces them
+case_save_after_delta_checkpoint() {
+    start_server --save "1 1" || return 1
+    cli SET a 1 >/dev/null
+    wait_for "the first base" '[ -f dump.my_rdb ]'
+    wait_for "its child" '[ "$(info rdb_bgsave_in_progress)" = 0 ]'
+    cli SET b 2 >/dev/null
+    wait_for "a delta checkpoint" '[ -f dump.my_rdb.delta.1 ]'
+    expect "SAVE" "$(cli SAVE)" "OK"
+    expect "deltas after SAVE" "$(ls dump.my_rdb.delta.* 2>/dev/null)" ""
+    cli SET c 3 >/dev/null
+    wait_for "a delta checkpoint" '[ -f dump.my_rdb.delta.2 ]'
+    stop_server || return 1
+    expect "deltas after shutdown" "$(ls dump.my_rdb.delta.* 2>/dev/null)" ""
+    start_server || return 1
+    expect "GET a" "$(cli GET a)" "1"
+    expect "GET b" "$(cli GET b)" "2"
+    expect "GET c" "$(cli GET c)" "3"
+    stop_server
+    return $CASE_FAILED
+}
+
+# UNLINK of a big hash: freed by the lazy free thread, the memory counts go back to
+# nothing but the bucket arrays (tables do not shrink); shutdown with the thread idle
+case_unlink_lazy_free_accounting() {
+    start_server || return 1
+    for i in $(seq 1000); do echo "HSET big f$i v$i"; done | "$CLI" -p "$PORT" --pipe >/dev/null 2>&1
+    expect "HLEN" "$(cli HLEN big)" "1000"
+    cli SET small x >/dev/null
+    expect "UNLINK" "$(cli UNLINK big)" "1"
+    expect "DEL" "$(cli DEL small)" "1"
+    expect "DEL again" "$(cli DEL small)" "0"
+    wait_for "the lazy free thread" '[ "$(info lazyfree_pending_objects)" = 0 ]'
+    expect "lazyfreed_objects" "$(info lazyfreed_objects)" "1"
+    expect "keys.count" "$(memstat keys.count)" "0"
+    expect "hash.hashtable.bytes" "$(memstat hash.hashtable.bytes)" "0"
+    expect "dataset.bytes" "$(memstat dataset.bytes)" \
+        "$(($(memstat overhead.hashtable.buckets) + $(memstat overhead.key-access)))"
+    stop_server
+    return $CASE_FAILED
+}
+
+# a dump that fails its checks is reported and the server starts empty, never reading
+# outside the file: a forged index count, a flipped byte, a truncated file
+case_corrupt_dump_load() {
+    start_server || return 1
+    for i in $(seq 200); do echo "SET key$i value$i"; done | "$CLI" -p "$PORT" --pipe >/dev/null 2>&1
+    expect "SAVE" "$(cli SAVE)" "OK"
+    stop_server || return 1
+    cp dump.my_rdb good.my_rdb
+    local size
+    size=$(stat -c %s good.my_rdb)
+
+    # header, 16 bytes, then an index count of 1 that would put the index before the file
+    { printf 'MYRDB0002'; head -c 16 /dev/zero; printf '\x01\0\0\0\0\0\0\0'; head -c 8 /dev/zero; } >forged.my_rdb
+    cp good.my_rdb flipped.my_rdb
+    printf '\xAA' | dd of=flipped.my_rdb bs=1 seek=$((size / 2)) conv=notrunc status=none
+    head -c $((size - 5)) good.my_rdb >truncated.my_rdb
+
+    local bad
+    for bad in forged flipped truncated; do
+        cp $bad.my_rdb dump.my_rdb
+        : >log
+        start_server || return 1
+        expect "$bad: keys" "$(memstat keys.count)" "0"
+        grep -q "corrupt" log || fail "$bad: no corruption reported"
+        stop_server || return 1
+    done
+
+    cp good.my_rdb dump.my_rdb
+    start_server || return 1
+    expect "intact: keys" "$(memstat keys.count)" "200"
+    expect "intact: GET" "$(cli GET key200)" "value200"
+    stop_server
+    return $CASE_FAILED
+}
+
+# a crash while a merge-base child is still writing: the deltas written meanwhile extend
+# the old base, so nothing checkpointed is lost (the child is stopped to hold the window
+# open, it takes ~100ms on 300k keys and is caught by polling)
+case_crash_during_base_merge() {
+    start_server --save "1 1" --checkpoint-max-deltas 1 || return 1
+    seq 300000 | awk '{print "SET key" $1 " value" $1}' | "$CLI" -p "$PORT" --pipe >/dev/null 2>&1
+    wait_for "a base of every key" '[ -f dump.my_rdb ] && [ -z "$(pgrep -P $SERVER_PID)" ] && [ "$(info rdb_changes_since_last_save)" = 0 ]'
+    cli SET a 1 >/dev/null
+    wait_for "a delta checkpoint" '[ -f dump.my_rdb.delta.1 ]'
+    cli SET b 2 >/dev/null          # one delta is the limit: this checkpoint forks a base
+    local child=""
+    for _ in $(seq 2000); do
+        child=$(pgrep -P "$SERVER_PID") && break
+    done
+    [ -n "$child" ] || { fail "missed the base child"; stop_server; return 1; }
+    kill -STOP "$child"
+    cli SET c 3 >/dev/null
+    wait_for "a delta while the child runs" '[ -f dump.my_rdb.delta.2 ]'
+    kill -9 "$SERVER_PID" "$child"
+    wait "$SERVER_PID" 2>/dev/null
+    start_server --save "1 1" --checkpoint-max-deltas 1 || return 1
+    expect "rdb_last_load_keys_loaded" "$(info rdb_last_load_keys_loaded)" "300000"
+    expect "GET a" "$(cli GET a)" "1"
+    expect "GET b" "$(cli GET b)" "2"
+    expect "GET c" "$(cli GET c)" "3"
+    expect "GET key300000" "$(cli GET key300000)" "value300000"
+
+    # two deltas again: the next checkpoint merges them, and the deltas after it apply
+    cli SET d 4 >/dev/null
+    wait_for "the merged base" '[ ! -f dump.my_rdb.delta.1 ] && [ ! -f dump.my_rdb.delta.2 ]'
+    cli SET e 5 >/dev/null
+    wait_for "a delta of the merged base" '[ -f dump.my_rdb.delta.3 ]'
+    kill -9 "$SERVER_PID"
+    wait "$SERVER_PID" 2>/dev/null
+    start_server --save "1 1" --checkpoint-max-deltas 1 || return 1
+    expect "GET c" "$(cli GET c)" "3"
+    expect "GET d" "$(cli GET d)" "4"
+    expect "GET e" "$(cli GET e)" "5"
+    stop_server
+    return $CASE_FAILED
+}
+
+# RESTORE payloads whose element count is larger than the payload: a valid CRC, but
+# rejected as bad data instead of sizing a list or hash after the count
+case_restore_oversized_count() {
+    start_server || return 1
+    local replies
+    replies=$(python3 - "$PORT" <<'PY'
+import socket, struct, sys
+
+def crc64(data):  # reflected Jones, as in RdbFormat.cpp
+    crc = 0
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0x95ac9329ac4bc9b5 if crc & 1 else crc >> 1
+    return crc
+
+def varint(n):
+    out = b""
+    while n >= 0x80:
+        out += bytes([n & 0x7f | 0x80])
+        n >>= 7
+    return out + bytes([n])
+
+def payload(body):
+    body += struct.pack("<H", 2)
+    return body + struct.pack("<Q", crc64(body))
+
+def command(sock, *args):
+    out = b"*%d\r\n" % len(args)
+    for a in args:
+        out += b"$%d\r\n%s\r\n" % (len(a), a)
+    sock.sendall(out)
+    return sock.recv(4096).split(b"\r\n")[0].decode()
+
+sock = socket.create_connection(("127.0.0.1", int(sys.argv[1])))
+huge = varint(1 << 62)
+print(command(sock, b"RESTORE", b"list", b"0", payload(b"\x01" + huge + b"\x01a")))
+print(command(sock, b"RESTORE", b"hash", b"0", payload(b"\x04" + huge + b"\x01f\x01v")))
+print(command(sock, b"RESTORE", b"list", b"0", payload(b"\x01" + varint(2) + b"\x01a\x01b")))
+print(command(sock, b"LLEN", b"list"))
+PY
+)
+    expect "RESTORE replies" "$(echo "$replies" | tr '\n' ' ')" "-ERR Bad data format -ERR Bad data format +OK :2 "
+    expect "PING" "$(cli PING)" "PONG"
+    stop_server
+    return $CASE_FAILED
+}
+
+# RENAME onto itself and onto another key keeps MEMORY STATS exact; with maxmemory the
+# counts are what eviction goes by, so a drift would evict the whole keyspace
+case_rename_memory_accounting() {
+    start_server --maxmemory 1mb --maxmemory-policy allkeys-lru || return 1
+    cli SET k v >/dev/null
+    cli EXPIRE k 100 >/dev/null
+    cli RPUSH other a b c >/dev/null
+    local keys bytes
+    keys=$(memstat keys.count)
+    bytes=$(memstat dataset.bytes)
+    expect "RENAME k k" "$(cli RENAME k k)" "OK"
+    expect "GET k" "$(cli GET k)" "v"
+    expect "keys.count" "$(memstat keys.count)" "$keys"
+    expect "dataset.bytes" "$(memstat dataset.bytes)" "$bytes"
+    expect "expires.keys" "$(memstat expires.keys)" "1"
+    cli SET x y >/dev/null
+    expect "evicted_keys" "$(info evicted_keys)" "0"
+    expect "RENAME k other" "$(cli RENAME k other)" "OK"
+    expect "GET other" "$(cli GET other)" "v"
+    expect "keys.count after RENAME" "$(memstat keys.count)" "2"
+    expect "list.vector.keys" "$(memstat list.vector.keys)" "0"
+    stop_server
+    return $CASE_FAILED
+}
+
+# past maxmemory, writes evict down to the limit; noeviction refuses them instead
+case_maxmemory_eviction() {
+    start_server --maxmemory 200kb --maxmemory-policy allkeys-lru || return 1
+    seq 5000 | awk '{print "SET key" $1 " value" $1}' | "$CLI" -p "$PORT" --pipe >/dev/null 2>&1
+    local evicted bytes
+    evicted=$(info evicted_keys)
+    bytes=$(memstat dataset.bytes)
+    [ "$evicted" -gt 0 ] || fail "evicted_keys: $evicted, expected some"
+    # eviction runs before each write, so the last one may overshoot by its own size
+    [ "$bytes" -le $((200 * 1024 + 1024)) ] || fail "dataset.bytes $bytes over maxmemory"
+    expect "keys.count" "$(memstat keys.count)" "$((5000 - evicted))"
+    # every key's LRU clock is part of what the limit is held to
+    [ "$(memstat overhead.key-access)" -ge $(((5000 - evicted) * 24)) ] ||
+        fail "overhead.key-access $(memstat overhead.key-access) below a clock per key"
+    expect "GET key5000" "$(cli GET key5000)" "value5000"
+    expect "CONFIG SET" "$(cli CONFIG SET maxmemory-policy noeviction)" "OK"
+    cli SET filler "$(head -c 100000 /dev/zero | tr '\0' x)" >/dev/null
+    expect "SET over the limit" "$(cli SET one more)" "(Error) OOM command not allowed when used memory > 'maxmemory'."
+    stop_server
+    return $CASE_FAILED
+}
+
+# keys, values and hash fields on both sides of the stored string encodings (7 bytes
+# in the word, a one byte length up to 254, a nine byte one past it) come back intact
+# from the keyspace and a restart; MEMORY USAGE prices a small key as one
+# 32 byte node and its bucket, a longer one with a 16 byte block per string
+case_stored_string_lengths() {
+    start_server || return 1
+    local len value
+    for len in 1 7 8 254 255 256 70000; do
+        value=$(head -c "$len" /dev/zero | tr '\0' v)
+        cli SET "k$len" "$value" >/dev/null
+        cli HSET hash "$(head -c "$len" /dev/zero | tr '\0' f)" "$value" >/dev/null
+    done
+    cli SET "$(head -c 300 /dev/zero | tr '\0' k)" long >/dev/null
+    expect "MEMORY USAGE k1" "$(cli MEMORY USAGE k1)" "40"
+    expect "MEMORY USAGE key:1234567" "$(cli SET key:1234567 val:1234567; cli MEMORY USAGE key:1234567)" "OK
+72"
+    expect "SAVE" "$(cli SAVE)" "OK"
+    stop_server || return 1
+    start_server || return 1
+    for len in 1 7 8 254 255 256 70000; do
+        value=$(head -c "$len" /dev/zero | tr '\0' v)
+        expect "GET k$len" "$(cli GET "k$len")" "$value"
+        expect "HGET, a field of $len" "$(cli HGET hash "$(head -c "$len" /dev/zero | tr '\0' f)")" "$value"
+    done
+    expect "GET of a 300 byte key" "$(cli GET "$(head -c 300 /dev/zero | tr '\0' k)")" "long"
+    expect "HLEN" "$(cli HLEN hash)" "7"
+    expect "SCAN MATCH" "$(cli SCAN 0 MATCH 'k25*' COUNT 1000 | sort)" "0
+k254
+k255
+k256"
+    stop_server
+    return $CASE_FAILED
+}
+
+# connections that only free (DEL) give their slab cache back when they close: once the
+# keys are gone nothing is left allocated
+case_slab_free_only_threads() {
+    start_server || return 1
+    local before
+    before=$(info slab_allocated)
+    seq 5000 | awk '{print "SET key" $1 " value" $1}' | "$CLI" -p "$PORT" --pipe >/dev/null 2>&1
+    [ "$(info slab_allocated)" -gt "$before" ] || fail "keys took nothing from the slabs"
+    for batch in $(seq 0 49); do
+        seq $((batch * 100 + 1)) $((batch * 100 + 100)) | awk '{print "DEL key" $1}' |
+            "$CLI" -p "$PORT" --pipe >/dev/null 2>&1
+    done
+    expect "keys.count" "$(memstat keys.count)" "0"
+    wait_for "the closed connections' caches" '[ "$(info slab_allocated)" = "$before" ]'
+    stop_server
+    return $CASE_FAILED
+}
+
+# appendfsync always, then a crash: everything acknowledged replays from the manifest's
+# base and incremental files, before and after a BGREWRITEAOF
+case_aof_manifest_replay() {
+    local opts=(--appendonly yes --appendfsync always --save "")
+    start_server "${opts[@]}" || return 1
+    cli SET a 1 >/dev/null
+    cli RPUSH list x y z >/dev/null
+    cli HSET hash f v >/dev/null
+    cli SET gone 1 >/dev/null
+    cli DEL gone >/dev/null
+    expect "BGREWRITEAOF" "$(cli BGREWRITEAOF)" "Background append only file rewriting started"
+    wait_for "the rewrite" '[ "$(info aof_rewrite_in_progress)" = 0 ]'
+    cli SET b 2 >/dev/null
+    cli LPOP list >/dev/null
+    kill -9 "$SERVER_PID"
+    wait "$SERVER_PID" 2>/dev/null
+    grep -q "type b" appendonlydir/appendonly.aof.manifest || fail "no base in the manifest"
+    grep -q "type i" appendonlydir/appendonly.aof.manifest || fail "no incremental file in the manifest"
+    start_server "${opts[@]}" || return 1
+    expect "GET a" "$(cli GET a)" "1"
+    expect "GET b" "$(cli GET b)" "2"
+    expect "GET gone" "$(cli GET gone)" "(nil)"
+    expect "LLEN" "$(cli LLEN list)" "2"
+    expect "HGET" "$(cli HGET hash f)" "v"
+    cli SET c 3 >/dev/null
+    kill -9 "$SERVER_PID"
+    wait "$SERVER_PID" 2>/dev/null
+    start_server "${opts[@]}" || return 1
+    expect "GET c after a second crash" "$(cli GET c)" "3"
+    expect "keys.count" "$(memstat keys.count)" "5"
+    stop_server
+    return $CASE_FAILED
+}
+
+# appendfsync always while BGREWRITEAOF switches incr files under writing clients: every
+# write is acknowledged, also a last one that is fsynced only as part of the retired tail
+case_aof_rewrite_concurrent_writes() {
+    local opts=(--appendonly yes --appendfsync always --save "")
+    start_server "${opts[@]}" || return 1
+    local round client clients
+    for round in $(seq 30); do
+        clients=()
+        for client in 1 2 3; do
+            cli SET r$round:$client $round >"reply$client" &
+            clients+=($!)
+        done
+        cli BGREWRITEAOF >/dev/null &
+        wait "${clients[@]}" $!
+        for client in 1 2 3; do
+            expect "round $round, SET $client" "$(cat "reply$client")" "OK"
+        done
+        wait_for "the rewrite" '[ "$(info aof_rewrite_in_progress)" = 0 ]'
+    done
+    [ "$(info aof_rewrites)" -gt 0 ] || fail "no rewrite ran"
+    kill -9 "$SERVER_PID"
+    wait "$SERVER_PID" 2>/dev/null
+    start_server "${opts[@]}" || return 1
+    expect "keys.count after replay" "$(memstat keys.count)" "90"
+    expect "GET r30:3" "$(cli GET r30:3)" "30"
+    stop_server
+    return $CASE_FAILED
+}
+
+# pipelined SET/GET under appendfsync always: a GET's time in INFO commandstats is its
+# own, not the fsync the SET before it waited for (a few us, not the fsync's 100s)
+case_command_stats_pipelined_fsync() {
+    start_server --appendonly yes --appendfsync always --save "" || return 1
+    seq 2000 | awk '{print "SET key" $1 " v"; print "GET key" $1}' | "$CLI" -p "$PORT" --pipe >/dev/null 2>&1
+    local get
+    get=$(cli INFO commandstats | sed -n 's/^cmdstat_get:.*usec_per_call=\([0-9]*\).*/\1/p')
+    expect "GET calls" "$(cli INFO commandstats | grep -o 'cmdstat_get:calls=[0-9]*')" "cmdstat_get:calls=2000"
+    [ -n "$get" ] && [ "$get" -lt 20 ] || fail "GET usec_per_call $get, the SETs' fsync counted with it"
+    stop_server
+    return $CASE_FAILED
+}
+
+# a replica takes a full resync, then one that lost its link for a few seconds (stopped
+# past the master's repl-timeout) catches up from the backlog with a partial resync
+case_replica_partial_resync() {
+    start_server --repl-timeout 1 --save "" || return 1
+    local master=$PORT masterPid=$SERVER_PID
+    cli SET before 1 >/dev/null
+    mkdir replica && cd replica || return 1
+    PORT=$((master + 100))
+    start_server --save "" || return 1
+    expect "REPLICAOF" "$(cli REPLICAOF 127.0.0.1 $master)" "OK"
+    wait_for "the link" '[ "$(info master_link_status)" = up ]'
+    expect "GET before" "$(cli GET before)" "1"
+
+    kill -STOP "$SERVER_PID"
+    PORT=$master
+    wait_for "the master to drop the replica" 'grep -q "timed out" ../log'
+    cli SET during 2 >/dev/null
+    cli RPUSH list a b >/dev/null
+    kill -CONT "$SERVER_PID"
+    PORT=$((master + 100))
+    wait_for "the replica to catch up" '[ "$(cli GET during)" = 2 ]'
+    expect "LLEN" "$(cli LLEN list)" "2"
+    expect "SET on the replica" "$(cli SET x 1)" "(Error) READONLY You can't write against a read only replica."
+    stop_server || return 1
+    cd ..
+    PORT=$master
+    SERVER_PID=$masterPid
+    stop_server || return 1
+    expect "full resyncs" "$(grep -c "a full resync" log)" "1"
+    expect "partial resyncs" "$(grep -c "a partial resync" log)" "1"
+    return $CASE_FAILED
+}
+
+for name in $(declare -F | awk '{print $3}' | grep '^case_'); do
+    run_case "$name"
+done
+echo "$PASSED passed, $FAILED failed"
+[ "$FAILED" = 0 ]